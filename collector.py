@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""
+Collector application for multi-sensor deployments.
+Receives flow records from sensors started with main.py --collector, merges
+the records of flows seen by several sensors and exports the result.
+"""
+
+import argparse
+import json
+import logging
+import signal
+import sys
+import time
+
+from src.collector.merge import MERGE_MODES
+from src.collector.sender import parse_address
+from src.collector.server import CollectorServer
+from src.kafka.producer import KafkaProducer
+from src.metrics.exporter import MetricsExporter
+from src.pipeline.placement import parse_cpu_list
+
+class CollectorApp:
+    def __init__(self, listen, shards=1, shard_cpus=None, tolerance=5.0, mode='sum', max_flows=1000000,
+                 kafka_enabled=True, kafka_topic='network-flows', output=None, metrics_port=None,
+                 verbose=False):
+        self.server = CollectorServer(listen, shards=shards, tolerance=tolerance, mode=mode,
+                                      max_flows=max_flows, cpus=shard_cpus)
+        self.kafka_enabled = kafka_enabled
+        self.kafka_producer = KafkaProducer() if kafka_enabled else None
+        self.kafka_topic = kafka_topic
+        self.output_path = output
+        self.output = None
+        self.metrics = MetricsExporter(port=metrics_port, prefix='flow_collector')
+        self.running = True
+        
+        level = logging.DEBUG if verbose else logging.INFO
+        logging.basicConfig(level=level, format='%(asctime)s - %(levelname)s - %(message)s')
+        self.logger = logging.getLogger(__name__)
+        
+    def signal_handler(self, signum, frame):
+        """Handle shutdown signals gracefully."""
+        self.logger.info("Received shutdown signal, stopping collector...")
+        self.running = False
+        
+    def initialize(self):
+        """Initialize all components."""
+        try:
+            signal.signal(signal.SIGINT, self.signal_handler)
+            signal.signal(signal.SIGTERM, self.signal_handler)
+            
+            if self.kafka_enabled:
+                self.logger.info("Initializing Kafka producer...")
+                if not self.kafka_producer.initialize():
+                    raise RuntimeError("Failed to initialize Kafka producer")
+                self.kafka_producer.topic = self.kafka_topic
+                self.metrics.register('kafka', self.kafka_producer.get_statistics)
+                
+            if self.output_path:
+                self.output = open(self.output_path, 'a')
+                
+            if not self.server.start():
+                raise RuntimeError("Failed to start collector")
+            self.metrics.register('collector', self.server.collect_metrics)
+            if not self.metrics.start():
+                raise RuntimeError("Failed to start metrics exporter")
+            return True
+            
+        except Exception as e:
+            self.logger.error(f"Initialization failed: {e}")
+            return False
+            
+    def export(self, records):
+        """Send merged records to Kafka and/or the output file."""
+        if not records:
+            return
+        if self.kafka_producer:
+            self.kafka_producer.send_batch(records, flush=False)
+        if self.output:
+            self.output.write(''.join(json.dumps(record) + '\n' for record in records))
+        self.logger.debug(f"Exported {len(records)} merged flow records")
+        
+    def run(self):
+        """Main collector loop."""
+        if not self.initialize():
+            self.cleanup()
+            return 1
+            
+        last_report = time.time()
+        try:
+            while self.running:
+                self.server.poll()
+                self.export(self.server.collect())
+                
+                if time.time() - last_report >= 10.0:
+                    stats = self.server.collect_metrics()
+                    self.logger.info(f"Received {stats['records']} records from {stats['sensors']} sensors, "
+                                     f"exported {stats['exported_records']} flows "
+                                     f"({self.server.total('merged_flows')} merged)")
+                    last_report = time.time()
+                    
+        except Exception as e:
+            self.logger.error(f"Runtime error: {e}")
+            return 1
+            
+        finally:
+            self.cleanup()
+        return 0
+        
+    def cleanup(self):
+        """Emit pending flows and release resources."""
+        try:
+            self.export(self.server.stop())
+            self.logger.info(f"Collector stopped: {self.server.stats['records']} records received, "
+                             f"{self.server.stats['exported_records']} flows exported")
+            if self.kafka_producer:
+                self.kafka_producer.cleanup()
+            if self.output:
+                self.output.close()
+                self.output = None
+            self.metrics.stop()
+        except Exception as e:
+            self.logger.error(f"Cleanup error: {e}")
+
+def main():
+    parser = argparse.ArgumentParser(description='Multi-sensor flow record collector')
+    parser.add_argument('--listen', type=str, default=':9555', help='Address to accept sensors on (default: :9555)')
+    parser.add_argument('--shards', type=int, default=1, help='Merge processes, records are sharded by flow hash (default: 1)')
+    parser.add_argument('--shard-cpus', type=str, default=None, help='CPUs for the merge processes, e.g. 2-5')
+    parser.add_argument('--tolerance', type=float, default=5.0,
+                        help='Seconds a flow waits for updates from other sensors before it is merged (default: 5)')
+    parser.add_argument('--merge', choices=MERGE_MODES, default='sum',
+                        help='sum: sensors see different packets of a flow; max: they see the same packets (default: sum)')
+    parser.add_argument('--max-flows', type=int, default=1000000, help='Flows pending merge before the oldest are emitted early')
+    parser.add_argument('--no-kafka', action='store_true', help='Disable Kafka output')
+    parser.add_argument('--kafka-topic', type=str, default='network-flows', help='Kafka topic (default: network-flows)')
+    parser.add_argument('--output', type=str, default=None, help='Also append merged records to this file as NDJSON')
+    parser.add_argument('--metrics-port', type=int, default=None, help='Serve Prometheus metrics on this port')
+    parser.add_argument('--verbose', action='store_true', help='Enable verbose output')
+    
+    args = parser.parse_args()
+    
+    app = CollectorApp(
+        listen=parse_address(args.listen),
+        shards=args.shards,
+        shard_cpus=parse_cpu_list(args.shard_cpus) if args.shard_cpus else None,
+        tolerance=args.tolerance,
+        mode=args.merge,
+        max_flows=args.max_flows,
+        kafka_enabled=not args.no_kafka,
+        kafka_topic=args.kafka_topic,
+        output=args.output,
+        metrics_port=args.metrics_port,
+        verbose=args.verbose
+    )
+    return app.run()
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,343 @@
+#!/usr/bin/env python3
+"""
+Golden-output harness for flow feature correctness and throughput.
+Replays pcap corpora through the reference Python FeatureExtractor, the
+NumPy implementation and the native flow engine, diffs the per-packet flow
+records and the final records flushed at the end against the reference and
+reports the speed of each implementation.
+"""
+
+import argparse
+import glob
+import json
+import logging
+import math
+import os
+import random
+import struct
+import sys
+import time
+
+from src.dpdk.burst import PacketBurst
+from src.dpdk.pcap_file import PcapReader, PcapWriter
+from src.features.extractor import FeatureExtractor
+from src.features.native import NativeFeatureExtractor
+from src.features.vectorized import VECTOR_BURST, VectorFeatureExtractor
+
+DEFAULT_CORPUS = 'corpus'
+
+# Integer fields that may differ by rounding of the float reference clock
+FIELD_TOLERANCE = {
+    'timestamp': 1
+}
+
+def flow_order(record):
+    """Sort key of flushed records, which each implementation emits in table order."""
+    return (record['src_ip'], record['dst_ip'], record['src_port'], record['dst_port'], record['protocol'])
+
+def load_corpus(path):
+    """Load all packets of a pcap file into memory as (timestamp_ns, data).
+    
+    Timestamps are rebased to start at one second: the reference clock is a
+    float in seconds, which cannot resolve microseconds at epoch magnitudes.
+    """
+    with PcapReader(path) as reader:
+        packets = [(ts, data) for ts, data, _ in reader]
+    if not packets:
+        return packets
+    base = packets[0][0] - 1000000000
+    return [(ts - base, data) for ts, data in packets]
+
+def generate_corpus(path, flows=1000, packets=100000, seed=1):
+    """Write a deterministic synthetic corpus with TCP, UDP, ICMP and non-IP packets."""
+    rng = random.Random(seed)
+    endpoints = []
+    for _ in range(flows):
+        endpoints.append((
+            struct.pack('!I', rng.randrange(0x0a000000, 0x0affffff)),
+            struct.pack('!I', rng.randrange(0xc0a80000, 0xc0a8ffff)),
+            rng.randrange(1024, 65535),
+            rng.choice((53, 80, 443, 8080)),
+            rng.choice((6, 6, 6, 17, 17, 1))
+        ))
+        
+    ts = 1700000000 * 1000000000
+    with PcapWriter(path) as writer:
+        for _ in range(packets):
+            ts += rng.randrange(1000, 2000000)
+            src, dst, sport, dport, proto = rng.choice(endpoints)
+            if rng.random() < 0.5:
+                src, dst, sport, dport = dst, src, dport, sport
+                
+            if rng.random() < 0.01:
+                # ARP, skipped by both implementations
+                writer.write(ts, b'\xff' * 6 + b'\x02' * 6 + b'\x08\x06' + bytes(28))
+                continue
+                
+            payload = bytes(rng.randrange(0, 1400))
+            if proto == 6:
+                flags = rng.choice((0x02, 0x12, 0x10, 0x18, 0x11, 0x04))
+                l4 = struct.pack('!HHLLBBHHH', sport, dport, rng.getrandbits(32), 0, 0x50, flags, 65535, 0, 0)
+            elif proto == 17:
+                l4 = struct.pack('!HHHH', sport, dport, 8 + len(payload), 0)
+            else:
+                l4 = struct.pack('!BBHHH', 8, 0, 0, 0, 0)
+                
+            ip = struct.pack('!BBHHHBBH4s4s', 0x45, 0, 20 + len(l4) + len(payload), 0, 0, 64, proto, 0, src, dst)
+            writer.write(ts, b'\x02' * 6 + b'\x04' * 6 + b'\x08\x00' + ip + l4 + payload)
+
+class GoldenHarness:
+    def __init__(self, rel_tol=1e-6, abs_tol=1e-9, max_mismatches=10, perf_only=False, vector_burst=VECTOR_BURST,
+                 flow_timeout=600.0):
+        self.logger = logging.getLogger(__name__)
+        logging.basicConfig(level=logging.INFO, format='%(asctime)s - %(levelname)s - %(message)s')
+        self.rel_tol = rel_tol
+        self.abs_tol = abs_tol
+        self.max_mismatches = max_mismatches
+        self.perf_only = perf_only
+        self.vector_burst = vector_burst
+        self.flow_timeout = flow_timeout
+        self.results = {}
+        
+    def run_reference(self, packets):
+        """Run packets through the Python FeatureExtractor, driven by capture time."""
+        now = [0.0]
+        extractor = FeatureExtractor(clock=lambda: now[0])
+        extractor.flow_timeout = self.flow_timeout
+        records = []
+        
+        start = time.perf_counter()
+        for ts, data in packets:
+            now[0] = ts / 1e9
+            records.append(extractor.extract_features({'data': data, 'length': len(data)}))
+        elapsed = time.perf_counter() - start
+        
+        return records, elapsed, sorted(extractor.flush_flows(), key=flow_order)
+        
+    def encode_bursts(self, packets):
+        """Packets as worker ring messages of vector_burst packets each."""
+        messages = []
+        for offset in range(0, len(packets), self.vector_burst):
+            burst = [{'data': data, 'length': len(data), 'timestamp_ns': ts}
+                     for ts, data in packets[offset:offset + self.vector_burst]]
+            messages.append(PacketBurst.from_packets(burst).encode())
+        return messages
+        
+    def run_native(self, packets):
+        """Run packets through the native flow engine as the pipeline does, a burst per call.
+        
+        Decoding the ring messages and extracting their FlowRecords is timed.
+        The records returned come from a second, untimed run that also
+        encodes them with the native JSON encoder, to diff against json.dumps().
+        """
+        messages = self.encode_bursts(packets)
+        extractor = NativeFeatureExtractor(flow_timeout=self.flow_timeout)
+        if not extractor.initialize():
+            raise RuntimeError("Native flow engine unavailable")
+            
+        start = time.perf_counter()
+        for payload in messages:
+            extractor.extract_burst(PacketBurst.decode(payload))
+        elapsed = time.perf_counter() - start
+        
+        stats = extractor.get_stats()
+        extractor.cleanup()
+        
+        extractor = NativeFeatureExtractor(flow_timeout=self.flow_timeout, encode_json=True)
+        if not extractor.initialize():
+            raise RuntimeError("Native flow engine unavailable")
+        records = []
+        for payload in messages:
+            records.extend(extractor.extract_burst(PacketBurst.decode(payload)))
+        flushed = sorted(extractor.flush_flows(), key=flow_order)
+        extractor.cleanup()
+        
+        return records, elapsed, stats, flushed
+        
+    def run_vectorized(self, packets):
+        """Run packets through the NumPy implementation as the pipeline does, driven by capture time.
+        
+        Bursts are encoded as worker ring messages beforehand; decoding them
+        and extracting their FlowRecords is timed. Returns the records, the
+        time taken and the final flushed records.
+        """
+        messages = self.encode_bursts(packets)
+        extractor = VectorFeatureExtractor()
+        extractor.flow_timeout = self.flow_timeout
+        batches = []
+        
+        start = time.perf_counter()
+        for payload in messages:
+            batches.append(extractor.extract_burst(PacketBurst.decode(payload)))
+        elapsed = time.perf_counter() - start
+        
+        records = [record for batch in batches for record in batch]
+        return records, elapsed, sorted(extractor.flush_flows(), key=flow_order)
+        
+    def values_match(self, field, expected, actual):
+        """Compare one feature value with float tolerances."""
+        if isinstance(expected, str) or isinstance(actual, str):
+            return expected == actual
+        if isinstance(expected, float) or isinstance(actual, float):
+            return math.isclose(expected, actual, rel_tol=self.rel_tol, abs_tol=self.abs_tol)
+        return abs(expected - actual) <= FIELD_TOLERANCE.get(field, 0)
+        
+    def diff_records(self, expected, actual, name='native'):
+        """Diff two record lists, returning a list of mismatch descriptions."""
+        mismatches = []
+        for index, (ref, nat) in enumerate(zip(expected, actual)):
+            if ref is None or nat is None:
+                if ref is not nat:
+                    mismatches.append(f"packet {index}: reference={'none' if ref is None else 'record'} "
+                                      f"{name}={'none' if nat is None else 'record'}")
+                continue
+                
+            for field in sorted(set(ref) | set(nat)):
+                if field not in ref or field not in nat:
+                    mismatches.append(f"packet {index}: field {field} missing from "
+                                      f"{name if field in ref else 'reference'}")
+                elif not self.values_match(field, ref[field], nat[field]):
+                    mismatches.append(f"packet {index}: {field} reference={ref[field]!r} {name}={nat[field]!r}")
+                    
+        if len(expected) != len(actual):
+            mismatches.append(f"record count reference={len(expected)} {name}={len(actual)}")
+        return mismatches
+        
+    def diff_json(self, records):
+        """Diff the native JSON encoding of records with json.dumps()."""
+        mismatches = []
+        for index, record in enumerate(records):
+            if record is not None and record.json != json.dumps(record, default=str).encode():
+                mismatches.append(f"packet {index}: native JSON {record.json!r}")
+        return mismatches
+        
+    def run_corpus(self, path):
+        """Run one corpus file through all implementations."""
+        self.logger.info(f"Running corpus {path}...")
+        packets = load_corpus(path)
+        total_bytes = sum(len(data) for _, data in packets)
+        result = {'packets': len(packets), 'bytes': total_bytes}
+        
+        native_records, native_time, native_stats, native_flushed = self.run_native(packets)
+        result['native'] = self.throughput(len(packets), total_bytes, native_time)
+        result['native']['flows'] = native_stats.get('flows_created', 0)
+        
+        ref_records, ref_time, ref_flushed = self.run_reference(packets)
+        result['reference'] = self.throughput(len(packets), total_bytes, ref_time)
+        result['speedup'] = ref_time / native_time if native_time > 0 else 0
+        
+        vector_records, vector_time, vector_flushed = self.run_vectorized(packets)
+        result['vectorized'] = self.throughput(len(packets), total_bytes, vector_time)
+        result['vectorized_speedup'] = ref_time / vector_time if vector_time > 0 else 0
+        
+        if self.perf_only:
+            result['status'] = 'PERF'
+        else:
+            expected = [record for record in ref_records if record is not None]
+            mismatches = (self.diff_records(expected, native_records) +
+                          self.diff_records(expected, vector_records, 'vectorized') +
+                          self.diff_json(native_records) +
+                          self.diff_records(ref_flushed, native_flushed, 'native flush') +
+                          self.diff_records(ref_flushed, vector_flushed, 'vectorized flush') +
+                          self.diff_json(native_flushed))
+            result['mismatches'] = len(mismatches)
+            result['status'] = 'PASS' if not mismatches else 'FAIL'
+            for mismatch in mismatches[:self.max_mismatches]:
+                self.logger.error(f"✗ {mismatch}")
+            if len(mismatches) > self.max_mismatches:
+                self.logger.error(f"✗ ... {len(mismatches) - self.max_mismatches} more mismatches")
+                
+        self.logger.info(f"  reference: {result['reference']['pps']:,.0f} pps, "
+                         f"{result['reference']['mbps']:,.1f} Mbps")
+        self.logger.info(f"  native:    {result['native']['pps']:,.0f} pps, "
+                         f"{result['native']['mbps']:,.1f} Mbps ({result['speedup']:.1f}x)")
+        self.logger.info(f"  numpy:     {result['vectorized']['pps']:,.0f} pps, "
+                         f"{result['vectorized']['mbps']:,.1f} Mbps ({result['vectorized_speedup']:.1f}x)")
+        self.results[path] = result
+        return result
+        
+    def throughput(self, packets, total_bytes, elapsed):
+        """Build a throughput summary."""
+        elapsed = max(elapsed, 1e-9)
+        return {
+            'seconds': elapsed,
+            'pps': packets / elapsed,
+            'mbps': total_bytes * 8 / elapsed / 1e6
+        }
+        
+    def print_summary(self):
+        """Print the results summary and return True if all corpora matched."""
+        self.logger.info("=" * 60)
+        self.logger.info("GOLDEN OUTPUT SUMMARY")
+        self.logger.info("=" * 60)
+        
+        failed = 0
+        for path, result in self.results.items():
+            if result['status'] == 'FAIL':
+                failed += 1
+            symbol = "✗" if result['status'] == 'FAIL' else "✓"
+            self.logger.info(f"{symbol} {os.path.basename(path)}: {result['status']} "
+                             f"({result['packets']} packets, {result['speedup']:.1f}x)")
+            
+        self.logger.info("-" * 60)
+        self.logger.info(f"Results: {len(self.results) - failed} passed, {failed} failed")
+        return failed == 0
+
+def main():
+    parser = argparse.ArgumentParser(description='Flow feature golden-output and throughput harness')
+    parser.add_argument('pcaps', nargs='*', help=f'Pcap files or directories (default: {DEFAULT_CORPUS}/)')
+    parser.add_argument('--rel-tol', type=float, default=1e-6, help='Relative float tolerance (default: 1e-6)')
+    parser.add_argument('--abs-tol', type=float, default=1e-9, help='Absolute float tolerance (default: 1e-9)')
+    parser.add_argument('--max-mismatches', type=int, default=10, help='Mismatches to print per corpus (default: 10)')
+    parser.add_argument('--perf-only', action='store_true', help='Only measure throughput, skip the diff')
+    parser.add_argument('--vector-burst', type=int, default=VECTOR_BURST,
+                        help=f'Burst size for the NumPy implementation (default: {VECTOR_BURST})')
+    parser.add_argument('--flow-timeout', type=float, default=600.0,
+                        help='Flow timeout of all implementations in seconds; corpora longer than it with '
+                             'over 1000 active flows exercise expiry (default: 600)')
+    parser.add_argument('--json', type=str, default=None, help='Write results to a JSON file')
+    parser.add_argument('--generate', type=str, default=None, help='Write a synthetic corpus to this path and exit')
+    parser.add_argument('--flows', type=int, default=1000, help='Flows in the synthetic corpus (default: 1000)')
+    parser.add_argument('--packets', type=int, default=100000, help='Packets in the synthetic corpus (default: 100000)')
+    parser.add_argument('--seed', type=int, default=1, help='Seed of the synthetic corpus (default: 1)')
+    
+    args = parser.parse_args()
+    
+    if args.generate:
+        generate_corpus(args.generate, args.flows, args.packets, args.seed)
+        print(f"Wrote {args.packets} packets to {args.generate}")
+        return 0
+        
+    paths = []
+    for path in args.pcaps or [DEFAULT_CORPUS]:
+        if os.path.isdir(path):
+            paths.extend(sorted(glob.glob(os.path.join(path, '*.pcap'))))
+        else:
+            paths.append(path)
+            
+    if not paths:
+        print(f"No pcap files found. Generate one with: python3 golden_harness.py --generate {DEFAULT_CORPUS}/synthetic.pcap")
+        return 1
+        
+    if args.flow_timeout <= 0:
+        parser.error("--flow-timeout must be positive")
+        
+    harness = GoldenHarness(args.rel_tol, args.abs_tol, args.max_mismatches, args.perf_only,
+                            args.vector_burst, args.flow_timeout)
+    for path in paths:
+        try:
+            harness.run_corpus(path)
+        except Exception as e:
+            harness.logger.error(f"✗ {path}: {e}")
+            harness.results[path] = {'status': 'FAIL', 'packets': 0, 'speedup': 0, 'error': str(e)}
+            
+    success = harness.print_summary()
+    
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(harness.results, f, indent=2)
+            
+    return 0 if success else 1
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,27 +5,105 @@ Coordinates DPDK packet capture, feature extraction, and Kafka streaming.
 """
 
 import argparse
+import asyncio
+import os
 import sys
 import time
 import signal
+import socket
 import logging
-from src.dpdk.packet_capture import DPDKPacketCapture
-from src.features.extractor import FeatureExtractor
+import threading
+
+from src.dpdk.packet_capture import PacketCapture, BACKENDS, CLOCKS, DPDK_BACKENDS
+from src.features.plugins import PluginChain
+from src.features.tenants import TenantMap, parse_tenant
+from src.features.vectorized import VECTOR_BURST
 from src.kafka.producer import KafkaProducer
+from src.metrics.exporter import MetricsExporter
+from src.metrics.drops import DropAccountant, DropCounters, PARSE_FAILED, WORKER_RING_FULL
+from src.metrics.memory import MemoryAccountant
+from src.pipeline.autotune import AutoTuner
+from src.pipeline.placement import ThreadPlacement, parse_cpu_list, parse_placement
+from src.pipeline.ratelimit import RecordLimiter, RELEASE_INTERVAL
+from src.pipeline.control import ControlServer
+from src.pipeline.runtime_config import ConfigStore, RuntimeConfig, FlowFilter, select_features
+from src.pipeline.workers import WorkerPool, create_extractor, export_sample_rate
+from src.pipeline.aio import AsyncCapturePipeline
+from src.pipeline.health import LinkMonitor
+from src.collector.sender import CollectorSender, parse_address
+from src.storage.flow_archive import FlowArchive
+from src.storage.packet_store import PacketStore
+
+# Packets drained from the capture at shutdown at most, per RX queue: the
+# default mbuf pool, more than the rings of any backend hold
+DRAIN_MAX_PACKETS = 8192
 
 class NetworkCaptureApp:
-    def __init__(self, port=0, cores="0", batch_size=32, kafka_enabled=True, verbose=False):
+    def __init__(self, port=0, cores="0", batch_size=32, kafka_enabled=True, verbose=False,
+                 num_mbufs=0, metrics_port=None, stats_interval=60.0, auto_tune=False,
+                 min_batch_size=4, max_backoff_us=1000, max_export_batch=256,
+                 placement=None, housekeeping_cores=None, engine='python',
+                 control_socket=None, runtime_config=None, backend='pci', iface=None, queues=1,
+                 source=None, worker_pool=False, plugins=None, packet_store=None,
+                 packet_store_segment_bytes=1 << 30, flow_archive=None, flow_archive_retention=7,
+                 collector=None, sensor_id=None, clock='realtime', stall_timeout=10.0,
+                 drain_timeout=10.0, state_dir=None, tenants=None, export_rate=0.0, export_burst=None,
+                 flow_export_rate=0.0, flow_export_burst=None):
         self.port = port
+        self.backend = backend
+        self.iface = iface
+        self.queues = queues
+        self.source = source
+        self.clock = clock
+        self.stall_timeout = stall_timeout
+        self.drain_timeout = drain_timeout
+        self.state_dir = state_dir
         self.cores = cores
         self.batch_size = batch_size
         self.kafka_enabled = kafka_enabled
         self.verbose = verbose
+        self.num_mbufs = num_mbufs
+        self.stats_interval = stats_interval
+        self.engine = engine
+        self.use_worker_pool = worker_pool
+        self.tenants = tenants or []
+        self.plugin_specs = plugins or []
+        self.plugins = PluginChain()
         self.running = True
         
+        # Runtime configuration, swapped atomically by the control socket
+        self.config_store = ConfigStore(runtime_config)
+        self.active_config = None
+        
         # Initialize components
         self.packet_capture = None
-        self.feature_extractor = FeatureExtractor()
-        self.kafka_producer = KafkaProducer() if kafka_enabled else None
+        self.link_monitor = None
+        self.worker_pool = None
+        self.packet_store = PacketStore(packet_store, segment_bytes=packet_store_segment_bytes) if packet_store else None
+        self.flow_archive = FlowArchive(flow_archive, retention_days=flow_archive_retention) if flow_archive else None
+        self.collector = CollectorSender(collector, sensor_id) if collector else None
+        # Records bound for Kafka are also JSON-encoded natively; tenants get
+        # an extractor each
+        self.feature_extractor = create_extractor(engine, self.config_store.current.flow_timeout,
+                                                  encode_json=kafka_enabled, tenants=self.tenants)
+        self.limiter = RecordLimiter(flow_rate=flow_export_rate, flow_burst=flow_export_burst,
+                                     rate=export_rate, burst=export_burst,
+                                     tenants=self.feature_extractor.tenants if self.tenants else None)
+        spool_file = os.path.join(state_dir, 'kafka-spool.jsonl') if state_dir else None
+        self.kafka_producer = KafkaProducer(spool_file=spool_file) if kafka_enabled else None
+        self.metrics = MetricsExporter(port=metrics_port)
+        self.memory = MemoryAccountant()
+        self.drops = DropAccountant()
+        self.rx_drops = DropCounters()  # Counted by the RX thread
+        self.tuner = AutoTuner(max_burst=batch_size, min_burst=min_batch_size,
+                               max_backoff_us=max_backoff_us, max_export_batch=max_export_batch,
+                               enabled=auto_tune)
+        self.pending_exports = []
+        self.placement = ThreadPlacement(rx_cores=cores, placement=placement,
+                                         housekeeping=housekeeping_cores)
+        self.control = ControlServer(control_socket, self.config_store, self.metrics,
+                                     thread_init=lambda: self.placement.pin_current_thread('control')
+                                     ) if control_socket else None
         
         # Setup logging
         level = logging.DEBUG if verbose else logging.INFO
@@ -44,23 +122,86 @@ class NetworkCaptureApp:
             signal.signal(signal.SIGINT, self.signal_handler)
             signal.signal(signal.SIGTERM, self.signal_handler)
             
-            # Initialize DPDK
-            self.logger.info("Initializing DPDK packet capture...")
-            self.packet_capture = DPDKPacketCapture(
+            # Record usable CPUs before DPDK pins this thread to the main lcore
+            self.placement.snapshot()
+            
+            # Load flow record plugins
+            if self.plugin_specs:
+                self.plugins = PluginChain.from_specs(self.plugin_specs)
+                self.logger.info(f"Loaded plugins: {', '.join(p.name for p in self.plugins.plugins)}")
+                
+            # Open the capture backend
+            self.logger.info(f"Initializing {self.backend} packet capture...")
+            self.packet_capture = PacketCapture(
+                backend=self.backend,
                 port=self.port,
                 cores=self.cores,
-                batch_size=self.batch_size
+                batch_size=self.batch_size,
+                num_mbufs=self.num_mbufs,
+                iface=self.iface,
+                queues=self.queues,
+                source=self.source,
+                clock=self.clock
             )
             
             if not self.packet_capture.initialize():
-                raise RuntimeError("Failed to initialize DPDK")
+                raise RuntimeError(f"Failed to initialize {self.backend} capture")
+            self.link_monitor = LinkMonitor(self.packet_capture, stall_timeout=self.stall_timeout)
+            
+            # Initialize the native flow engine if selected; pool workers run their own
+            if self.engine == 'native' and not self.use_worker_pool:
+                if not self.feature_extractor.initialize():
+                    raise RuntimeError("Failed to initialize native flow engine")
+                # The engine swaps its own configuration safely mid-burst
+                self.config_store.add_listener(
+                    lambda config: self.feature_extractor.set_config(config.flow_timeout, config.sample_rate))
+                self.feature_extractor.set_config(self.config_store.current.flow_timeout,
+                                                  self.config_store.current.sample_rate)
                 
-            # Initialize Kafka if enabled
+            # This thread polls RX on the main lcore, where EAL pinned it
+            self.placement.register_current_thread('rx')
+            self.placement.set_numa_node(self.packet_capture.get_numa_node())
+            
+            # One worker process per RX queue; RSS keeps each flow on one worker
+            if self.use_worker_pool:
+                self.worker_pool = WorkerPool(self.packet_capture.get_queue_count(), engine=self.engine,
+                                              cpus=self.placement.cpus_for('worker'),
+                                              encode_json=self.kafka_enabled, tenants=self.tenants)
+                if not self.worker_pool.start(self.config_store.current):
+                    raise RuntimeError("Failed to start worker pool")
+                self.config_store.add_listener(self.worker_pool.update_config)
+                
+            if self.state_dir:
+                os.makedirs(self.state_dir, exist_ok=True)
+                
+            # Initialize Kafka if enabled; records spooled at the last shutdown are sent first
             if self.kafka_enabled:
                 self.logger.info("Initializing Kafka producer...")
-                if not self.kafka_producer.initialize():
+                if not self.kafka_producer.initialize(
+                        thread_init=lambda: self.placement.pin_current_thread('kafka')):
                     raise RuntimeError("Failed to initialize Kafka producer")
+                if self.tenants:
+                    self.kafka_producer.tenant_topics = self.feature_extractor.topics()
                     
+            # Packets are written from the writer thread, off the RX path
+            if self.packet_store and not self.packet_store.open(
+                    thread_init=lambda: self.placement.pin_current_thread('writer')):
+                raise RuntimeError("Failed to open packet store")
+            if self.flow_archive and not self.flow_archive.open(
+                    thread_init=lambda: self.placement.pin_current_thread('writer')):
+                raise RuntimeError("Failed to open flow archive")
+            if self.collector:
+                self.collector.start(thread_init=lambda: self.placement.pin_current_thread('kafka'))
+                
+            self.setup_metrics()
+            
+            if self.control and not self.control.start():
+                raise RuntimeError("Failed to start control socket")
+                
+            # Move library threads off the RX cores
+            self.placement.apply()
+            self.placement.check()
+            
             self.logger.info("Application initialized successfully")
             return True
             
@@ -68,34 +209,162 @@ class NetworkCaptureApp:
             self.logger.error(f"Initialization failed: {e}")
             return False
             
+    def setup_metrics(self):
+        """Register memory providers and start the metrics exporter."""
+        self.memory.register('mempools', self.backend,
+                             lambda: self.packet_capture.get_memory_stats().get('buffer_bytes', 0))
+        if self.worker_pool:
+            self.memory.register('mempools', 'worker_rings', self.worker_pool.memory_usage)
+            self.memory.register('flow_table', 'workers', self.worker_pool.flow_bytes)
+            self.memory.register_flow_counter('workers', self.worker_pool.flow_count)
+        else:
+            self.memory.register('flow_table', 'feature_extractor', self.feature_extractor.memory_usage)
+            self.memory.register_flow_counter('feature_extractor', self.feature_extractor.flow_count)
+        if self.packet_store:
+            self.memory.register('spool', 'packet_store', self.packet_store.memory_usage)
+        if self.flow_archive:
+            self.memory.register('spool', 'flow_archive', self.flow_archive.memory_usage)
+        if self.kafka_producer:
+            self.memory.register('export_queues', 'kafka', self.kafka_producer.memory_usage)
+        if self.limiter.enabled:
+            self.memory.register('export_queues', 'export_limit', self.limiter.memory_usage)
+            
+        self.drops.register('nic', self.packet_capture.get_drop_stats)
+        self.drops.register('rx', self.rx_drops)
+        if self.worker_pool:
+            self.drops.register('workers', self.worker_pool.drop_stats)
+        elif self.engine != 'python' or self.tenants:
+            self.drops.register('flow_engine', self.feature_extractor.drop_stats)
+        if self.kafka_producer and self.kafka_enabled:
+            self.drops.register('kafka', self.kafka_producer.drop_stats)
+        if self.packet_store:
+            self.drops.register('packet_store', self.packet_store.drop_stats)
+        if self.flow_archive:
+            self.drops.register('flow_archive', self.flow_archive.drop_stats)
+        if self.collector:
+            self.drops.register('collector', self.collector.drop_stats)
+            
+        self.metrics.register('memory', self.memory.collect)
+        self.metrics.register('drops', self.drops.collect)
+        self.metrics.register('rx', self.packet_capture.get_stats)
+        self.metrics.register('link', self.link_monitor.collect)
+        self.metrics.register('autotune', self.tuner.collect)
+        self.metrics.register('placement', self.placement.collect)
+        if self.plugins.plugins:
+            self.metrics.register('plugins', self.plugins.collect)
+        self.metrics.register('config', lambda: {'version': self.config_store.current.version})
+        if self.limiter.enabled:
+            self.metrics.register('export_limit', self.limiter.collect)
+        if self.kafka_producer and self.kafka_enabled:
+            self.metrics.register('kafka', self.kafka_producer.get_statistics)
+        if self.packet_store:
+            self.metrics.register('packet_store', self.packet_store.collect)
+        if self.flow_archive:
+            self.metrics.register('flow_archive', self.flow_archive.collect)
+        if self.collector:
+            self.metrics.register('collector', self.collector.collect)
+        if self.worker_pool:
+            self.metrics.register('workers', self.worker_pool.collect_metrics)
+        else:
+            if self.engine == 'native':
+                self.metrics.register('flow_engine', self.feature_extractor.get_stats)
+            if self.tenants:
+                self.metrics.register('tenants', self.feature_extractor.collect)
+        if not self.metrics.start(thread_init=lambda: self.placement.pin_current_thread('metrics')):
+            raise RuntimeError("Failed to start metrics exporter")
+            
+    def apply_config(self, config):
+        """Apply a new runtime configuration at a burst boundary."""
+        self.feature_extractor.flow_timeout = config.flow_timeout
+        if self.kafka_producer:
+            self.kafka_producer.topic = config.kafka_topic
+        self.active_config = config
+        
     def process_packets(self, packets):
         """Process captured packets and extract features."""
+        self.queue_features(self.select_records(packets))
+        
+    def select_records(self, packets):
+        """Extract features from a burst and return the records selected for export."""
         if not packets:
+            return []
+            
+        if self.packet_store:
+            self.packet_store.submit(packets)
+            
+        # Read the configuration once per burst
+        config = self.config_store.current
+        if config is not self.active_config:
+            self.apply_config(config)
+            
+        # The native engine samples flows itself
+        sample_rate = export_sample_rate(self.engine, self.feature_extractor, config)
+        
+        try:
+            records = self.feature_extractor.extract_burst(packets)
+            if self.engine == 'python' and not self.tenants:
+                # The other engines and tenant extractors count the packets they skip themselves
+                self.rx_drops.counts[PARSE_FAILED] += records.count(None)
+            return self.limiter.limit(self.plugins.apply(select_features(records, config, sample_rate)))
+        except Exception as e:
+            self.logger.error(f"Error processing packet: {e}")
+            return []
+            
+    def queue_features(self, records):
+        """Queue selected feature records for export."""
+        if not records:
             return
             
-        processed_count = 0
-        for packet in packets:
-            try:
-                # Extract features from packet
-                features = self.feature_extractor.extract_features(packet)
-                
-                if features:
-                    # Send to Kafka if enabled
-                    if self.kafka_enabled and self.kafka_producer:
-                        self.kafka_producer.send_features(features)
-                    
-                    # Print features if verbose mode
-                    if self.verbose:
-                        self.logger.debug(f"Features: {features}")
-                        
-                    processed_count += 1
-                    
-            except Exception as e:
-                self.logger.error(f"Error processing packet: {e}")
+        # The sinks take record dictionaries; build them once per batch
+        records = list(records)
+        if self.flow_archive:
+            self.flow_archive.submit(records)
+        if self.collector:
+            self.collector.submit(records)
+            
+        # Queue for Kafka if enabled
+        if self.kafka_enabled and self.kafka_producer:
+            self.pending_exports.extend(records)
+            
+        # Print features if verbose mode
+        if self.verbose:
+            for features in records:
+                self.logger.debug(f"Features: {features}")
                 
-        if processed_count > 0:
-            self.logger.info(f"Processed {processed_count} packets")
+        self.logger.info(f"Processed {len(records)} packets")
+        
+    def poll_worker_pool(self, burst_size):
+        """Hand one burst per RX queue to its worker and merge finished records."""
+        captured = 0
+        for queue in range(self.worker_pool.workers):
+            packets = self.packet_capture.capture_packets(burst_size, queue=queue)
+            if packets and self.packet_store:
+                self.packet_store.submit(packets)
+            if packets and not self.worker_pool.submit(queue, packets):
+                self.rx_drops.counts[WORKER_RING_FULL] += len(packets)
+                self.logger.debug(f"Worker {queue} ring full, dropped {len(packets)} packets")
+            captured += len(packets)
+            
+        # Workers apply configuration changes themselves
+        config = self.config_store.current
+        if config is not self.active_config:
+            self.apply_config(config)
+        self.queue_features(self.limiter.limit(self.plugins.apply(self.worker_pool.collect())))
+        return captured
+        
+    def export_pending(self, force=False):
+        """Send queued features to Kafka once the export batch is full."""
+        if not self.pending_exports:
+            return
+        if not force and len(self.pending_exports) < self.tuner.export_batch:
+            return
             
+        start = time.perf_counter()
+        self.kafka_producer.send_batch(self.pending_exports, flush=False)
+        self.pending_exports = []
+        self.tuner.record_stage('export', time.perf_counter() - start)
+        self.tuner.record_export_occupancy(self.kafka_producer.queue_occupancy())
+        
     def run(self):
         """Main application loop."""
         if not self.initialize():
@@ -103,22 +372,56 @@ class NetworkCaptureApp:
             
         self.logger.info("Starting packet capture loop...")
         packets_captured = 0
+        last_stats_time = time.time()
         
         try:
             while self.running:
-                # Capture packets
-                packets = self.packet_capture.capture_packets()
+                # Periodically report memory usage and drops
+                if self.stats_interval > 0 and time.time() - last_stats_time >= self.stats_interval:
+                    self.logger.info(self.memory.format_summary())
+                    self.logger.info(self.drops.format_summary())
+                    self.placement.apply()
+                    last_stats_time = time.time()
+                    
+                # Restart the port or a queue that stopped receiving
+                self.link_monitor.check()
                 
-                if packets:
-                    packets_captured += len(packets)
-                    self.process_packets(packets)
+                # Capture packets
+                burst_size = self.tuner.burst_size
+                start = time.perf_counter()
+                if self.worker_pool:
+                    captured = self.poll_worker_pool(burst_size)
+                    self.tuner.record_poll(captured, burst_size, time.perf_counter() - start)
+                    if not self.worker_pool.alive():
+                        raise RuntimeError("A worker process exited")
+                else:
+                    packets = self.packet_capture.capture_packets(burst_size)
+                    captured = len(packets)
+                    self.tuner.record_poll(captured, burst_size, time.perf_counter() - start)
+                    
+                if captured:
+                    self.tuner.reset_backoff()
+                    packets_captured += captured
+                    if not self.worker_pool:
+                        start = time.perf_counter()
+                        self.process_packets(packets)
+                        self.tuner.record_stage('process', time.perf_counter() - start)
+                    self.export_pending()
                     
                     if self.verbose:
                         self.logger.debug(f"Total packets captured: {packets_captured}")
                 else:
-                    # Short sleep to prevent CPU spinning
-                    time.sleep(0.001)
+                    # Don't hold records back while the link is idle
+                    self.queue_features(self.limiter.release())
+                    self.export_pending(force=True)
                     
+                    # Back off to prevent CPU spinning
+                    backoff = self.tuner.idle_backoff()
+                    if backoff > 0:
+                        time.sleep(backoff)
+                        
+                self.tuner.maybe_adjust()
+                
         except Exception as e:
             self.logger.error(f"Runtime error: {e}")
             return 1
@@ -129,15 +432,179 @@ class NetworkCaptureApp:
         self.logger.info(f"Application stopped. Total packets captured: {packets_captured}")
         return 0
         
-    def cleanup(self):
-        """Cleanup resources."""
+    async def run_async(self):
+        """Asyncio loop: capture on descriptor readiness and export with async delivery reports."""
+        if not self.initialize():
+            return 1
+            
+        loop = asyncio.get_running_loop()
+        pipeline = AsyncCapturePipeline(self.packet_capture, self.select_records,
+                                        burst_size=self.batch_size,
+                                        max_backoff=self.tuner.max_backoff)
+        self.metrics.register('asyncio', pipeline.collect)
+        
+        # Queues are restarted through the pipeline, which owns their descriptors
+        self.link_monitor.restart = pipeline.restart_capture
+        
+        async def monitor_link():
+            while self.running:
+                self.link_monitor.check()
+                await asyncio.sleep(self.link_monitor.interval)
+                
+        async def release_limited():
+            # Records held by the rate limiter go out as tokens refill, even without traffic
+            while self.running:
+                await asyncio.sleep(RELEASE_INTERVAL)
+                records = self.limiter.release()
+                if records:
+                    pipeline.publish(records)
+                    
+        def stop():
+            self.logger.info("Received shutdown signal, stopping application...")
+            self.running = False
+            pipeline.stop()
+            
+        for signum in (signal.SIGINT, signal.SIGTERM):
+            loop.add_signal_handler(signum, stop)
+            
+        self.logger.info("Starting asyncio capture loop...")
+        exports = set()
+        last_stats_time = time.time()
+        pipeline.start()
+        monitor = loop.create_task(monitor_link())
+        releaser = loop.create_task(release_limited()) if self.limiter.enabled else None
+        
         try:
+            while self.running:
+                timeout = self.stats_interval if self.stats_interval > 0 else None
+                records = await pipeline.get_batch(self.tuner.export_batch, timeout=timeout)
+                
+                if self.stats_interval > 0 and time.time() - last_stats_time >= self.stats_interval:
+                    self.logger.info(self.memory.format_summary())
+                    self.logger.info(self.drops.format_summary())
+                    self.placement.apply()
+                    last_stats_time = time.time()
+                    
+                if not records:
+                    continue
+                if self.flow_archive:
+                    self.flow_archive.submit(records)
+                if self.collector:
+                    self.collector.submit(records)
+                if self.verbose:
+                    for features in records:
+                        self.logger.debug(f"Features: {features}")
+                self.logger.info(f"Processed {len(records)} packets")
+                
+                # Delivery reports complete in the background; keep capturing meanwhile
+                if self.kafka_enabled and self.kafka_producer:
+                    task = loop.create_task(self.kafka_producer.send_batch_async(records))
+                    exports.add(task)
+                    task.add_done_callback(exports.discard)
+                    
+        except Exception as e:
+            self.logger.error(f"Runtime error: {e}")
+            return 1
+            
+        finally:
+            deadline = time.monotonic() + self.drain_timeout
+            monitor.cancel()
+            if releaser:
+                releaser.cancel()
+            pipeline.stop()
+            self.queue_features(pipeline.get_batch_nowait(len(pipeline.records)))
+            if exports:
+                # Started exports have produced their records, which the
+                # producer flush below delivers; stop waiting for their reports
+                await asyncio.sleep(0)
+                for task in exports:
+                    task.cancel()
+            pipeline.close()
+            self.cleanup(deadline)
+            
+        self.logger.info(f"Application stopped. Total packets captured: {pipeline.packets}")
+        return 0
+        
+    def drain_capture(self, deadline):
+        """Process the packets already received, until the rings are empty or the deadline passes."""
+        limit = DRAIN_MAX_PACKETS * self.packet_capture.get_queue_count()
+        drained = 0
+        while drained < limit and time.monotonic() < deadline:
+            if self.worker_pool:
+                captured = self.poll_worker_pool(self.batch_size)
+            else:
+                packets = self.packet_capture.capture_packets(self.batch_size)
+                captured = len(packets)
+                self.process_packets(packets)
+            if not captured:
+                break
+            drained += captured
+        self.logger.info(f"Drained {drained} packets from the capture rings")
+        
+    def flush_flows(self, deadline):
+        """Export final records of all active flows, marked with the shutdown end reason."""
+        if self.worker_pool:
+            # Workers finish their rings, then flush their flows
+            records = self.worker_pool.stop(timeout=max(deadline - time.monotonic(), 0.0))
+        else:
+            config = self.config_store.current
+            records = select_features(self.feature_extractor.flush_flows(), config,
+                                      export_sample_rate(self.engine, self.feature_extractor, config))
+        # Final records pass the rate limiter; what it still holds goes with them
+        records = list(self.limiter.limit(self.plugins.apply(records))) + self.limiter.flush()
+        self.logger.info(f"Flushed {len(records)} active flow records")
+        self.queue_features(records)
+        
+    def flush_exports(self, deadline):
+        """Deliver everything queued to all sinks in parallel, each bounded by the deadline."""
+        sinks = []
+        if self.kafka_producer:
+            if self.kafka_producer.producer is not None:
+                self.export_pending(force=True)
+            sinks.append(('kafka', lambda: self.kafka_producer.cleanup(timeout=deadline - time.monotonic())))
+        if self.packet_store:
+            sinks.append(('packet_store', self.packet_store.close))
+        if self.flow_archive:
+            sinks.append(('flow_archive', self.flow_archive.close))
+        if self.collector:
+            sinks.append(('collector', lambda: self.collector.stop(timeout=deadline - time.monotonic())))
+            
+        threads = {name: threading.Thread(target=flush, name=f'flush-{name}', daemon=True) for name, flush in sinks}
+        for thread in threads.values():
+            thread.start()
+        for name, thread in threads.items():
+            thread.join(max(deadline - time.monotonic(), 0.0))
+            if thread.is_alive():
+                self.logger.error(f"Flushing {name} did not finish within the drain timeout, abandoning it")
+                
+    def cleanup(self, deadline=None):
+        """Drain capture, export all active flows and flush every sink within the drain timeout, then clean up."""
+        if deadline is None:
+            deadline = time.monotonic() + self.drain_timeout
+        try:
+            # Stop receiving once the packets already in the rings are processed
+            if self.packet_capture and self.packet_capture.initialized:
+                self.drain_capture(deadline)
             if self.packet_capture:
                 self.packet_capture.cleanup()
                 
-            if self.kafka_producer:
-                self.kafka_producer.cleanup()
+            if self.worker_pool or self.packet_capture:
+                self.flush_flows(deadline)
+                
+            if self.control:
+                self.control.stop()
+                
+            self.flush_exports(deadline)
+            
+            # NIC counters went with the capture context; the rest are final
+            self.logger.info(self.drops.format_summary())
+            self.plugins.close()
+            
+            if self.engine == 'native' and not self.use_worker_pool:
+                self.feature_extractor.cleanup()
                 
+            self.metrics.stop()
+            
             self.logger.info("Cleanup completed")
             
         except Exception as e:
@@ -147,26 +614,151 @@ def main():
     parser = argparse.ArgumentParser(description='DPDK Network Packet Capture Application')
     parser.add_argument('--port', type=int, default=0, help='DPDK port number (default: 0)')
     parser.add_argument('--cores', type=str, default='0', help='CPU cores for DPDK (default: 0)')
-    parser.add_argument('--batch-size', type=int, default=32, help='Packet batch size (default: 32)')
+    parser.add_argument('--backend', choices=list(BACKENDS), default='pci',
+                        help='Capture backend: pci for DPDK-bound NICs, af_xdp for kernel interfaces, '
+                             'vdev for DPDK virtual devices, pcap to replay a file, '
+                             'af_packet for hosts without DPDK (default: pci)')
+    parser.add_argument('--iface', type=str, default=None, help='Kernel interface for the af_xdp and af_packet backends')
+    parser.add_argument('--source', type=str, default=None,
+                        help="Pcap file for the pcap backend, or devargs such as 'net_pcap0,iface=eth0' for vdev")
+    parser.add_argument('--queues', type=int, default=1,
+                        help='Number of RX queues (af_packet: fanout rings) to poll (default: 1)')
+    parser.add_argument('--clock', choices=list(CLOCKS), default='realtime',
+                        help='Reference clock of packet timestamps; use tai where sensors are PTP-synchronised '
+                             '(default: realtime)')
+    parser.add_argument('--batch-size', type=int, default=None,
+                        help=f'Packet batch size (default: 32, {VECTOR_BURST} with --engine numpy or native)')
     parser.add_argument('--no-kafka', action='store_true', help='Disable Kafka output')
     parser.add_argument('--verbose', action='store_true', help='Enable verbose output')
+    parser.add_argument('--num-mbufs', type=int, default=0, help='Number of mbufs in the DPDK pool (default: 8192)')
+    parser.add_argument('--metrics-port', type=int, default=None, help='Serve Prometheus metrics on this port')
+    parser.add_argument('--auto-tune', action='store_true', help='Adapt burst size, poll backoff and export batch to load')
+    parser.add_argument('--min-batch-size', type=int, default=4, help='Smallest burst size when auto-tuning (default: 4)')
+    parser.add_argument('--max-backoff-us', type=int, default=1000, help='Longest idle poll backoff when auto-tuning (default: 1000)')
+    parser.add_argument('--max-export-batch', type=int, default=256, help='Largest Kafka export batch when auto-tuning (default: 256)')
+    parser.add_argument('--placement', type=str, default=None,
+                        help="CPUs per thread role, e.g. 'kafka=2-3;metrics=3' "
+                             "(roles: kafka, eal, metrics, control, writer, worker, housekeeping)")
+    parser.add_argument('--housekeeping-cores', type=str, default=None,
+                        help='CPUs for threads without an explicit placement (default: all CPUs except --cores)')
+    parser.add_argument('--engine', choices=['python', 'native', 'numpy'], default='python',
+                        help='Feature extraction engine (default: python)')
+    parser.add_argument('--worker-pool', action='store_true',
+                        help='Process each RX queue in its own worker process, pinned to the worker placement')
+    parser.add_argument('--asyncio', action='store_true',
+                        help='Run capture and export on an asyncio event loop, woken by descriptor readiness')
+    parser.add_argument('--plugin', action='append', default=[], metavar='MODULE:CLASS',
+                        help='Flow record plugin receiving batches as NumPy structured arrays (repeatable)')
+    parser.add_argument('--control-socket', type=str, default=None,
+                        help='Unix socket for runtime statistics and configuration changes')
+    parser.add_argument('--flow-timeout', type=float, default=600.0, help='Flow inactivity timeout in seconds (default: 600)')
+    parser.add_argument('--sample-rate', type=int, default=1, help='Export 1 in N flows (default: 1)')
+    parser.add_argument('--filter', type=str, default='', help="Flow filter, e.g. 'proto=tcp port=80,443 net=10.0.0.0/8'")
+    parser.add_argument('--kafka-topic', type=str, default='network-flows', help='Kafka topic (default: network-flows)')
+    parser.add_argument('--packet-store', type=str, default=None, metavar='DIR',
+                        help='Keep captured packets in an indexed store in DIR, searchable with query.py')
+    parser.add_argument('--packet-store-segment-size', type=int, default=1024,
+                        help='Packet store segment size in MB (default: 1024)')
+    parser.add_argument('--flow-archive', type=str, default=None, metavar='DIR',
+                        help='Keep selected flow records in a compressed columnar archive in DIR, searchable with query.py')
+    parser.add_argument('--flow-archive-retention', type=float, default=7,
+                        help='Days to keep flow archive files (default: 7)')
+    parser.add_argument('--collector', type=str, default=None, metavar='HOST:PORT',
+                        help='Also send selected flow records to a collector (collector.py) for multi-sensor merging')
+    parser.add_argument('--sensor-id', type=str, default=socket.gethostname(),
+                        help='Name of this sensor at the collector (default: host name)')
+    parser.add_argument('--stats-interval', type=float, default=60.0, help='Seconds between memory usage reports, 0 to disable (default: 60)')
+    parser.add_argument('--stall-timeout', type=float, default=10.0,
+                        help='Restart the port or an RX queue idle this many seconds with the link up, 0 to disable (default: 10)')
+    parser.add_argument('--drain-timeout', type=float, default=10.0,
+                        help='Seconds to drain capture, export active flows and flush sinks at shutdown (default: 10)')
+    parser.add_argument('--state-dir', type=str, default=None, metavar='DIR',
+                        help='Keep Kafka messages undelivered at shutdown in DIR and send them at the next start')
+    parser.add_argument('--tenant', action='append', default=[], metavar='SPEC',
+                        help="Tenant with its own flow table and export settings, e.g. "
+                             "'acme:vlan=100,200-210 vni=5001 max_flows=100000 sample_rate=10 topic=acme-flows "
+                             "export_rate=5000' (repeatable)")
+    parser.add_argument('--export-rate', type=float, default=0.0,
+                        help='Export at most this many flow records per second, 0 for no limit (default: 0)')
+    parser.add_argument('--export-burst', type=float, default=None,
+                        help='Records exported at once above --export-rate (default: one second of records)')
+    parser.add_argument('--flow-export-rate', type=float, default=0.0,
+                        help='Export at most this many records per second of each flow, 0 for no limit (default: 0)')
+    parser.add_argument('--flow-export-burst', type=float, default=None,
+                        help='Records of a flow exported at once above --flow-export-rate (default: one second of records)')
     
     args = parser.parse_args()
     
-    # Check if running as root (required for DPDK)
-    if os.geteuid() != 0:
+    try:
+        tenants = [parse_tenant(spec) for spec in args.tenant]
+        TenantMap(tenants)  # Rejects VLANs and VNIs claimed twice
+    except ValueError as e:
+        parser.error(f'--tenant: {e}')
+        
+    if args.backend in ('af_xdp', 'af_packet') and not args.iface:
+        parser.error(f'--backend {args.backend} requires --iface')
+    if args.backend in ('vdev', 'pcap') and not args.source:
+        parser.error(f'--backend {args.backend} requires --source')
+    if args.asyncio and args.worker_pool:
+        parser.error('--asyncio cannot be combined with --worker-pool')
+    if args.batch_size is None:
+        # The vectorised and native engines need large bursts to amortise their per-burst work
+        args.batch_size = VECTOR_BURST if args.engine in ('numpy', 'native') else 32
+        
+    # Check if running as root (required for DPDK; AF_PACKET only needs CAP_NET_RAW)
+    if args.backend in DPDK_BACKENDS and os.geteuid() != 0:
         print("Error: This application requires root privileges for DPDK operations.")
         print("Please run with sudo: sudo python3 main.py")
         return 1
-    
+        
     app = NetworkCaptureApp(
         port=args.port,
+        backend=args.backend,
+        iface=args.iface,
+        queues=args.queues,
+        source=args.source,
         cores=args.cores,
         batch_size=args.batch_size,
         kafka_enabled=not args.no_kafka,
-        verbose=args.verbose
+        verbose=args.verbose,
+        num_mbufs=args.num_mbufs,
+        metrics_port=args.metrics_port,
+        stats_interval=args.stats_interval,
+        auto_tune=args.auto_tune,
+        min_batch_size=args.min_batch_size,
+        max_backoff_us=args.max_backoff_us,
+        max_export_batch=args.max_export_batch,
+        placement=parse_placement(args.placement),
+        housekeeping_cores=parse_cpu_list(args.housekeeping_cores) if args.housekeeping_cores else None,
+        engine=args.engine,
+        worker_pool=args.worker_pool,
+        plugins=args.plugin,
+        packet_store=args.packet_store,
+        packet_store_segment_bytes=args.packet_store_segment_size << 20,
+        flow_archive=args.flow_archive,
+        flow_archive_retention=args.flow_archive_retention,
+        collector=parse_address(args.collector, default_host='localhost') if args.collector else None,
+        sensor_id=args.sensor_id,
+        clock=args.clock,
+        stall_timeout=args.stall_timeout,
+        drain_timeout=args.drain_timeout,
+        state_dir=args.state_dir,
+        tenants=tenants,
+        export_rate=args.export_rate,
+        export_burst=args.export_burst,
+        flow_export_rate=args.flow_export_rate,
+        flow_export_burst=args.flow_export_burst,
+        control_socket=args.control_socket,
+        runtime_config=RuntimeConfig(
+            flow_timeout=args.flow_timeout,
+            sample_rate=args.sample_rate,
+            kafka_topic=args.kafka_topic,
+            filter=FlowFilter(args.filter)
+        )
     )
     
+    if args.asyncio:
+        return asyncio.run(app.run_async())
     return app.run()
 
 if __name__ == "__main__":
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""
+Query tool for data kept by the capture application.
+Retrieves the packets of a flow from a packet store written with
+main.py --packet-store, and flow records from a flow archive written with
+main.py --flow-archive.
+"""
+
+import argparse
+import json
+import logging
+import sys
+import time
+from datetime import datetime
+
+from src.dpdk.pcap_file import PcapWriter
+from src.storage.flow_archive import FlowArchiveReader
+from src.storage.packet_store import PacketStoreReader
+
+PROTOCOLS = {'tcp': 6, 'udp': 17, 'icmp': 1}
+
+def parse_time(value):
+    """Epoch seconds or an ISO 8601 time, as nanoseconds."""
+    try:
+        return int(float(value) * 1000000000)
+    except ValueError:
+        return int(datetime.fromisoformat(value).timestamp() * 1000000000)
+
+def parse_protocol(value):
+    """Protocol name or number."""
+    if value.lower() in PROTOCOLS:
+        return PROTOCOLS[value.lower()]
+    return int(value)
+
+def query_packets(args):
+    """Write the packets of one flow to a pcap file."""
+    reader = PacketStoreReader(args.store)
+    start = time.monotonic()
+    count = 0
+    with PcapWriter(args.write) as writer:
+        for timestamp, data, orig_len in reader.query(args.src_ip, args.dst_ip, args.src_port, args.dst_port,
+                                                      args.protocol, args.start, args.end):
+            writer.write(timestamp, data, orig_len)
+            count += 1
+            
+    stats = reader.stats
+    print(f"{count} packets written to {args.write} in {time.monotonic() - start:.3f}s "
+          f"({stats['blocks_read']} of {stats['blocks']} blocks read, "
+          f"{stats['bytes_read'] / (1 << 20):.1f} MB, {stats['segments']} segments)")
+    return 0
+
+def query_flows(args):
+    """Print matching archived flow records as newline-delimited JSON."""
+    reader = FlowArchiveReader(args.archive)
+    start = time.monotonic()
+    count = 0
+    to_us = lambda ns: ns // 1000 if ns is not None else None
+    for record in reader.query(args.host, args.port, args.protocol, to_us(args.start), to_us(args.end)):
+        if args.limit and count >= args.limit:
+            break
+        if not args.count:
+            print(json.dumps(record))
+        count += 1
+        
+    stats = reader.stats
+    print(f"{count} flow records in {time.monotonic() - start:.3f}s "
+          f"({stats['blocks_read']} of {stats['blocks']} blocks read, {stats['records_scanned']} records scanned, "
+          f"{stats['bytes_read'] / (1 << 20):.1f} MB, {stats['files']} files)", file=sys.stderr)
+    return 0
+
+def main():
+    parser = argparse.ArgumentParser(description='Query captured network data')
+    commands = parser.add_subparsers(dest='command', required=True)
+    
+    packets = commands.add_parser('packets', help='Retrieve the packets of a flow from a packet store')
+    packets.add_argument('store', help='Packet store directory')
+    packets.add_argument('--src-ip', required=True, help='Address of one end of the flow')
+    packets.add_argument('--dst-ip', required=True, help='Address of the other end of the flow')
+    packets.add_argument('--src-port', type=int, default=0, help='Port at --src-ip (default: 0)')
+    packets.add_argument('--dst-port', type=int, default=0, help='Port at --dst-ip (default: 0)')
+    packets.add_argument('--protocol', type=parse_protocol, default=6, help='tcp, udp, icmp or a number (default: tcp)')
+    packets.add_argument('--start', type=parse_time, default=None, help='Earliest packet time, epoch seconds or ISO 8601')
+    packets.add_argument('--end', type=parse_time, default=None, help='Latest packet time, epoch seconds or ISO 8601')
+    packets.add_argument('-w', '--write', required=True, help='Output pcap file')
+    packets.set_defaults(handler=query_packets)
+    
+    flows = commands.add_parser('flows', help='Search a flow archive')
+    flows.add_argument('archive', help='Flow archive directory')
+    flows.add_argument('--host', default=None, help='Address at either end of the flow')
+    flows.add_argument('--port', type=int, default=None, help='Port at either end of the flow')
+    flows.add_argument('--protocol', type=parse_protocol, default=None, help='tcp, udp, icmp or a number')
+    flows.add_argument('--start', type=parse_time, default=None, help='Earliest record time, epoch seconds or ISO 8601')
+    flows.add_argument('--end', type=parse_time, default=None, help='Latest record time, epoch seconds or ISO 8601')
+    flows.add_argument('--limit', type=int, default=0, help='Stop after this many records (default: no limit)')
+    flows.add_argument('--count', action='store_true', help='Only count matching records')
+    flows.set_defaults(handler=query_flows)
+    
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO, format='%(asctime)s - %(levelname)s - %(message)s')
+    
+    try:
+        return args.handler(args)
+    except (OSError, ValueError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        return 1
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""
+Generate src/dpdk/ryu_tables.h, the 128-bit power-of-5 tables used by the
+shortest float formatting in src/dpdk/flow_json.c (Ryu, Ulf Adams 2018).
+
+Usage: python3 scripts/gen_ryu_tables.py > src/dpdk/ryu_tables.h
+"""
+
+POW5_INV_BITCOUNT = 125
+POW5_BITCOUNT = 125
+POW5_INV_TABLE_SIZE = 342
+POW5_TABLE_SIZE = 326
+
+MASK64 = (1 << 64) - 1
+
+def split(value):
+    return f"{{ {value & MASK64:#018x}ULL, {value >> 64:#018x}ULL }}"
+
+def main():
+    print("/*")
+    print(" * Ryu Power-of-5 Tables")
+    print(" * Generated by scripts/gen_ryu_tables.py, do not edit")
+    print(" */")
+    print()
+    print("#ifndef RYU_TABLES_H")
+    print("#define RYU_TABLES_H")
+    print()
+    print("#include <stdint.h>")
+    print()
+    print(f"#define RYU_POW5_INV_BITCOUNT {POW5_INV_BITCOUNT}")
+    print(f"#define RYU_POW5_BITCOUNT {POW5_BITCOUNT}")
+    print(f"#define RYU_POW5_INV_TABLE_SIZE {POW5_INV_TABLE_SIZE}")
+    print(f"#define RYU_POW5_TABLE_SIZE {POW5_TABLE_SIZE}")
+    print()
+
+    # floor(2^k / 5^i) + 1, scaled to POW5_INV_BITCOUNT significant bits
+    print("static const uint64_t RYU_POW5_INV_SPLIT[RYU_POW5_INV_TABLE_SIZE][2] = {")
+    for i in range(POW5_INV_TABLE_SIZE):
+        pow5 = 5 ** i
+        shift = pow5.bit_length() - 1 + POW5_INV_BITCOUNT
+        print(f"    {split((1 << shift) // pow5 + 1)},")
+    print("};")
+    print()
+
+    # 5^i truncated to POW5_BITCOUNT significant bits
+    print("static const uint64_t RYU_POW5_SPLIT[RYU_POW5_TABLE_SIZE][2] = {")
+    for i in range(POW5_TABLE_SIZE):
+        pow5 = 5 ** i
+        shift = pow5.bit_length() - POW5_BITCOUNT
+        print(f"    {split(pow5 >> shift if shift >= 0 else pow5 << -shift)},")
+    print("};")
+    print()
+    print("#endif /* RYU_TABLES_H */")
+
+if __name__ == '__main__':
+    main()
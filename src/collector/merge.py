@@ -0,0 +1,151 @@
+"""
+Flow record merging for the collector.
+Sensors send cumulative per-flow records. The merger keeps the latest
+record of each flow from each sensor and, once no sensor has updated the
+flow for the merge tolerance, emits one record combining them.
+"""
+
+import math
+import time
+from collections import OrderedDict
+
+from src.collector.wire import WIRE_DTYPE, int_to_address
+from src.features.flow_key import flow_keys
+
+# Merge modes: sensors saw disjoint packets of a flow (e.g. one direction
+# each), or the same packets at several taps
+MERGE_MODES = ('sum', 'max')
+
+FIELD = {name: index for index, name in enumerate(WIRE_DTYPE.names)}
+FLAG_COUNTS = ('fin_flag_count', 'syn_flag_count', 'rst_flag_count',
+               'psh_flag_count', 'ack_flag_count', 'urg_flag_count')
+
+def first_seen_us(row):
+    """Time of the first packet of a record, in microseconds."""
+    return row[FIELD['timestamp']] - int(row[FIELD['flow_duration']] * 1000000)
+
+def pooled_std(counts, means, stds, mean):
+    """Standard deviation of the union of samples given per-part counts, means and deviations."""
+    total = sum(counts)
+    if total == 0:
+        return 0.0
+    square = sum(n * (s * s + m * m) for n, m, s in zip(counts, means, stds)) / total
+    return math.sqrt(max(square - mean * mean, 0.0))
+
+def merge_rows(rows, mode='sum'):
+    """Combine the latest records of one flow from several sensors into one record."""
+    if len(rows) == 1 or mode == 'max':
+        # Overlapping views: the sensor that saw most of the flow wins
+        row = max(rows, key=lambda r: (r[FIELD['total_fwd_packets']], r[FIELD['timestamp']]))
+        return dict(zip(WIRE_DTYPE.names, row))
+        
+    # Orientation and identity from the sensor that saw the flow start
+    rows = sorted(rows, key=first_seen_us)
+    record = dict(zip(WIRE_DTYPE.names, rows[0]))
+    column = lambda name: [row[FIELD[name]] for row in rows]
+    
+    for name in ('total_fwd_packets', 'total_bwd_packets', 'total_length_fwd_packets', 'total_length_bwd_packets',
+                 'bad_checksum_packets'):
+        record[name] = sum(column(name))
+    packets = record['total_fwd_packets']
+    
+    start = min(first_seen_us(row) for row in rows)
+    record['timestamp'] = max(column('timestamp'))
+    record['end_reason'] = max(column('end_reason'))
+    duration = (record['timestamp'] - start) / 1000000
+    record['flow_duration'] = duration
+    
+    counts = column('total_fwd_packets')
+    means = column('packet_length_mean')
+    record['packet_length_max'] = max(column('packet_length_max'))
+    record['packet_length_min'] = min(column('packet_length_min'))
+    mean = sum(n * m for n, m in zip(counts, means)) / packets if packets else 0.0
+    record['packet_length_mean'] = mean
+    record['packet_length_std'] = pooled_std(counts, means, column('packet_length_std'), mean)
+    record['avg_packet_size'] = mean
+    record['packet_length_variance'] = record['packet_length_std'] ** 2
+    
+    record['flow_bytes_per_second'] = record['total_length_fwd_packets'] / duration if duration > 0 else 0
+    record['flow_packets_per_second'] = packets / duration if duration > 0 else 0
+    
+    # Inter-arrival statistics over the merged packet sequence can only be approximated
+    gaps = [max(n - 1, 0) for n in counts]
+    with_gaps = [row for row, n in zip(rows, gaps) if n]
+    if packets > 1:
+        iat_mean = duration / (packets - 1)
+        record['flow_iat_mean'] = iat_mean
+        record['flow_iat_std'] = pooled_std([n for n in gaps if n], [r[FIELD['flow_iat_mean']] for r in with_gaps],
+                                            [r[FIELD['flow_iat_std']] for r in with_gaps], iat_mean)
+        record['flow_iat_max'] = max(r[FIELD['flow_iat_max']] for r in with_gaps) if with_gaps else duration
+        record['flow_iat_min'] = min(r[FIELD['flow_iat_min']] for r in with_gaps) if with_gaps else duration
+        
+    flags = 0
+    for value in column('tcp_flags'):
+        flags |= value
+    record['tcp_flags'] = flags
+    for bit, name in enumerate(FLAG_COUNTS):
+        record[name] = (flags >> bit) & 1
+    return record
+
+class FlowMerger:
+    def __init__(self, tolerance=5.0, mode='sum', max_flows=1000000, clock=time.monotonic):
+        """Merge records of flows seen by several sensors.
+        
+        A flow is emitted once tolerance seconds pass without an update from
+        any sensor, or early when more than max_flows flows are pending.
+        """
+        if mode not in MERGE_MODES:
+            raise ValueError(f"merge mode must be one of {', '.join(MERGE_MODES)}")
+        self.tolerance = tolerance
+        self.mode = mode
+        self.max_flows = max_flows
+        self.clock = clock
+        self.flows = OrderedDict()  # key -> (last update, {sensor: latest row}), oldest update first
+        self.stats = {'records': 0, 'flows': 0, 'merged_flows': 0, 'evicted_flows': 0}
+        
+    def add(self, sensor, flows):
+        """Take a WIRE_DTYPE array of records from a sensor."""
+        if not len(flows):
+            return
+        # Tenants may reuse addresses, so their flows are kept apart
+        hi, lo = flow_keys(flows)
+        now = self.clock()
+        table = self.flows
+        for key, row in zip(zip(hi.tolist(), lo.tolist(), flows['tenant'].tolist()), flows.tolist()):
+            entry = table.get(key)
+            if entry is None:
+                table[key] = (now, {sensor: row})
+            else:
+                entry[1][sensor] = row
+                table[key] = (now, entry[1])
+                table.move_to_end(key)
+        self.stats['records'] += len(flows)
+        
+    def expire(self, force=False):
+        """Merged records of flows idle for the tolerance, or of all flows if force."""
+        cutoff = self.clock() - self.tolerance
+        table = self.flows
+        records = []
+        while table:
+            key, (updated, rows) = next(iter(table.items()))
+            if not force and updated > cutoff and len(table) <= self.max_flows:
+                break
+            if not force and updated > cutoff:
+                self.stats['evicted_flows'] += 1
+            del table[key]
+            record = merge_rows(list(rows.values()), self.mode)
+            record['src_ip'] = int_to_address(record['src_ip'])
+            record['dst_ip'] = int_to_address(record['dst_ip'])
+            record['label'] = 'BENIGN'
+            records.append(record)
+            self.stats['flows'] += 1
+            if len(rows) > 1:
+                self.stats['merged_flows'] += 1
+        return records
+        
+    def memory_usage(self):
+        """Approximate bytes held by pending flows."""
+        return len(self.flows) * (WIRE_DTYPE.itemsize * 4 + 200)
+        
+    def flow_count(self):
+        return len(self.flows)
@@ -0,0 +1,123 @@
+"""
+Sensor side of the collector transport.
+Streams selected flow records to a collector over TCP from a background
+thread, reconnecting when the connection drops.
+"""
+
+import logging
+import queue
+import socket
+import threading
+import time
+
+from src.collector.wire import encode_hello, encode_records
+
+DEFAULT_QUEUE_BATCHES = 4096
+RECONNECT_INTERVAL = 1.0
+
+def parse_address(spec, default_host='0.0.0.0'):
+    """Parse 'host:port' (or ':port') into a (host, port) tuple."""
+    host, _, port = spec.rpartition(':')
+    if not port.isdigit():
+        raise ValueError(f"'{spec}' is not host:port")
+    return host or default_host, int(port)
+
+class CollectorSender:
+    def __init__(self, address, sensor, queue_batches=DEFAULT_QUEUE_BATCHES):
+        self.logger = logging.getLogger(__name__)
+        self.address = address
+        self.sensor = sensor
+        self.queue = queue.Queue(maxsize=queue_batches)
+        self.thread = None
+        self.thread_init = None
+        self.sock = None
+        self.addresses = {}  # Dotted address -> integer, for repeated hosts
+        self.stats = {'records': 0, 'bytes': 0, 'frames': 0, 'connects': 0, 'dropped_records': 0,
+                      'send_errors': 0}
+        
+    def start(self, thread_init=None):
+        """Start the sending thread; the connection is made, and remade, from there.
+        
+        thread_init, if given, is called first in the sending thread.
+        """
+        self.thread_init = thread_init
+        self.thread = threading.Thread(target=self.run, name='collector-send', daemon=True)
+        self.thread.start()
+        self.logger.info(f"Sending flow records to collector {self.address[0]}:{self.address[1]} "
+                         f"as sensor '{self.sensor}'")
+        return True
+        
+    def submit(self, records):
+        """Queue a batch of flow records; never blocks the export path."""
+        try:
+            self.queue.put_nowait(records)
+            return True
+        except queue.Full:
+            self.stats['dropped_records'] += len(records)
+            return False
+            
+    def connect(self):
+        """Connect and introduce this sensor; returns False to retry later."""
+        try:
+            self.sock = socket.create_connection(self.address, timeout=5.0)
+            self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            self.sock.sendall(encode_hello(self.sensor))
+            self.stats['connects'] += 1
+            self.logger.info(f"Connected to collector {self.address[0]}:{self.address[1]}")
+            return True
+        except OSError as e:
+            self.logger.warning(f"Cannot connect to collector {self.address[0]}:{self.address[1]}: {e}")
+            self.sock = None
+            return False
+            
+    def run(self):
+        """Sending thread: encode queued batches and write them to the collector."""
+        if self.thread_init:
+            self.thread_init()
+        while True:
+            records = self.queue.get()
+            if records is None:
+                break
+            if len(self.addresses) > 1000000:
+                self.addresses.clear()
+            frame = encode_records(records, self.addresses)
+            
+            # Records are dropped, and counted, while the collector is unreachable
+            if self.sock is None and not self.connect():
+                self.stats['dropped_records'] += len(records)
+                time.sleep(RECONNECT_INTERVAL)
+                continue
+            try:
+                self.sock.sendall(frame)
+                self.stats['records'] += len(records)
+                self.stats['bytes'] += len(frame)
+                self.stats['frames'] += 1
+            except OSError as e:
+                self.logger.error(f"Sending to collector failed: {e}")
+                self.stats['send_errors'] += 1
+                self.stats['dropped_records'] += len(records)
+                self.sock.close()
+                self.sock = None
+                
+    def drop_stats(self):
+        """Records not delivered because the collector was unreachable or the queue to it full."""
+        return {'collector_unavailable': self.stats['dropped_records']}
+        
+    def collect(self):
+        """Sender counters for the metrics exporter."""
+        metrics = dict(self.stats)
+        metrics['connected'] = int(self.sock is not None)
+        metrics['queued_batches'] = self.queue.qsize()
+        return metrics
+        
+    def stop(self, timeout=10.0):
+        """Send everything queued for up to timeout seconds, then close the connection."""
+        if self.thread:
+            self.queue.put(None)
+            self.thread.join(timeout=max(timeout, 0.0))
+            self.thread = None
+        if self.sock:
+            self.sock.close()
+            self.sock = None
+        self.logger.info(f"Sent {self.stats['records']} flow records to the collector, "
+                         f"{self.stats['dropped_records']} dropped")
@@ -0,0 +1,290 @@
+"""
+Multi-sensor flow record collector.
+Accepts binary flow record streams from many sensors over TCP and shards
+the records by flow hash across merge processes, one per collector core,
+so every record of a flow reaches the same merger whichever sensor sent it.
+Merged records come back to this process for export.
+"""
+
+import logging
+import multiprocessing
+import os
+import pickle
+import queue
+import selectors
+import signal
+import socket
+import struct
+import time
+
+import numpy as np
+
+from src.collector.merge import FlowMerger
+from src.collector.wire import FRAME_HELLO, FRAME_RECORDS, WIRE_DTYPE, FrameDecoder
+from src.features.flow_key import flow_hashes, flow_keys
+from src.pipeline.workers import ShmRing, DEFAULT_RING_SIZE
+
+# Shard ring message: sensor index, then the records
+SHARD_HEADER = struct.Struct('H')
+
+# Seconds between expiry passes in each shard
+EXPIRE_INTERVAL = 0.1
+
+# Records per shard ring message, well below the ring size
+SHARD_BATCH = 8192
+
+SHARD_COUNTERS = ('records', 'flows', 'merged_flows', 'evicted_flows', 'pending_flows')
+
+def shard_main(index, in_name, out_name, control, counters, cpus, tolerance, mode, max_flows, log_level):
+    """Entry point of a shard process: merge the records of the flows hashed to it."""
+    logging.basicConfig(level=log_level, format=f'%(asctime)s - shard{index} - %(levelname)s - %(message)s')
+    logger = logging.getLogger(__name__)
+    signal.signal(signal.SIGINT, signal.SIG_IGN)
+    
+    if cpus:
+        try:
+            os.sched_setaffinity(0, cpus)
+        except OSError as e:
+            logger.warning(f"Cannot pin shard to CPUs {sorted(cpus)}: {e}")
+            
+    merger = FlowMerger(tolerance=tolerance, mode=mode, max_flows=max_flows)
+    in_ring = ShmRing(name=in_name)
+    out_ring = ShmRing(name=out_name)
+    base = index * len(SHARD_COUNTERS)
+    next_expiry = time.monotonic() + EXPIRE_INTERVAL
+    stopping = False
+    
+    def publish(records):
+        while records and not out_ring.put(pickle.dumps(records, protocol=pickle.HIGHEST_PROTOCOL)):
+            time.sleep(0.0005)
+            
+    try:
+        while True:
+            payload = in_ring.get()
+            if payload is not None:
+                sensor = SHARD_HEADER.unpack_from(payload, 0)[0]
+                merger.add(sensor, np.frombuffer(payload, dtype=WIRE_DTYPE, offset=SHARD_HEADER.size))
+            elif stopping:
+                break
+            else:
+                try:
+                    stopping = control.get(timeout=0.001) is None
+                except queue.Empty:
+                    pass
+                    
+            if time.monotonic() >= next_expiry:
+                publish(merger.expire())
+                next_expiry = time.monotonic() + EXPIRE_INTERVAL
+                for offset, name in enumerate(SHARD_COUNTERS[:-1]):
+                    counters[base + offset] = merger.stats[name]
+                counters[base + len(SHARD_COUNTERS) - 1] = merger.flow_count()
+                
+        # Flows still pending are emitted as they stand
+        publish(merger.expire(force=True))
+    finally:
+        in_ring.close()
+        out_ring.close()
+
+class Sensor:
+    """One sensor connection."""
+    
+    def __init__(self, sock, peer):
+        self.sock = sock
+        self.peer = peer
+        self.decoder = FrameDecoder()
+        self.name = None
+        self.index = None
+
+class CollectorServer:
+    def __init__(self, address, shards=1, tolerance=5.0, mode='sum', max_flows=1000000,
+                 ring_size=DEFAULT_RING_SIZE, cpus=None):
+        self.logger = logging.getLogger(__name__)
+        self.address = address
+        self.shards = shards
+        self.tolerance = tolerance
+        self.mode = mode
+        self.max_flows = max_flows
+        self.ring_size = ring_size
+        self.cpus = cpus
+        self.context = multiprocessing.get_context('spawn')
+        self.selector = selectors.DefaultSelector()
+        self.listener = None
+        self.sensors = {}       # Open connections by socket
+        self.sensor_ids = {}    # Sensor name -> index, stable across reconnects
+        self.in_rings = []
+        self.out_rings = []
+        self.controls = []
+        self.processes = []
+        self.counters = None
+        self.stats = {'connections': 0, 'frames': 0, 'records': 0, 'bytes': 0, 'protocol_errors': 0,
+                      'ring_dropped_records': 0, 'exported_records': 0}
+        
+    def start(self):
+        """Start the shard processes and listen for sensors."""
+        try:
+            self.counters = self.context.Array('Q', self.shards * len(SHARD_COUNTERS), lock=False)
+            log_level = logging.getLogger().getEffectiveLevel()
+            for index in range(self.shards):
+                in_ring = ShmRing(self.ring_size)
+                out_ring = ShmRing(self.ring_size)
+                control = self.context.Queue()
+                process = self.context.Process(
+                    target=shard_main, name=f"shard{index}", daemon=True,
+                    args=(index, in_ring.name, out_ring.name, control, self.counters, self.cpus,
+                          self.tolerance, self.mode, self.max_flows // self.shards, log_level))
+                process.start()
+                self.in_rings.append(in_ring)
+                self.out_rings.append(out_ring)
+                self.controls.append(control)
+                self.processes.append(process)
+                
+            self.listener = socket.create_server(self.address, reuse_port=False)
+            self.listener.setblocking(False)
+            self.selector.register(self.listener, selectors.EVENT_READ)
+            self.logger.info(f"Collector listening on {self.address[0]}:{self.address[1]} "
+                             f"with {self.shards} merge shards ({self.mode}, {self.tolerance}s tolerance)")
+            return True
+            
+        except Exception as e:
+            self.logger.error(f"Failed to start collector: {e}")
+            self.stop()
+            return False
+            
+    def poll(self, timeout=0.01):
+        """Serve sensor connections for up to timeout seconds."""
+        for key, _ in self.selector.select(timeout):
+            if key.fileobj is self.listener:
+                self.accept()
+            else:
+                self.receive(self.sensors[key.fileobj])
+                
+    def accept(self):
+        try:
+            sock, peer = self.listener.accept()
+        except BlockingIOError:
+            return
+        sock.setblocking(False)
+        self.sensors[sock] = Sensor(sock, peer)
+        self.selector.register(sock, selectors.EVENT_READ)
+        self.stats['connections'] += 1
+        self.logger.info(f"Sensor connected from {peer[0]}:{peer[1]}")
+        
+    def receive(self, sensor):
+        try:
+            data = sensor.sock.recv(1 << 20)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError as e:
+            self.logger.warning(f"Sensor {sensor.name or sensor.peer[0]} receive failed: {e}")
+            data = b''
+        if not data:
+            self.disconnect(sensor)
+            return
+            
+        self.stats['bytes'] += len(data)
+        try:
+            for kind, payload in sensor.decoder.feed(data):
+                self.stats['frames'] += 1
+                if kind == FRAME_HELLO:
+                    sensor.name = payload.decode(errors='replace')
+                    sensor.index = self.sensor_ids.setdefault(sensor.name, len(self.sensor_ids))
+                    self.logger.info(f"Sensor '{sensor.name}' identified from {sensor.peer[0]}")
+                elif kind == FRAME_RECORDS and sensor.index is not None:
+                    self.dispatch(sensor.index, np.frombuffer(payload, dtype=WIRE_DTYPE))
+                else:
+                    raise ValueError(f"unexpected frame kind {kind}")
+        except ValueError as e:
+            self.logger.error(f"Protocol error from {sensor.peer[0]}: {e}")
+            self.stats['protocol_errors'] += 1
+            self.disconnect(sensor)
+            
+    def dispatch(self, sensor, flows):
+        """Split records by flow hash and hand each part to its shard."""
+        self.stats['records'] += len(flows)
+        if self.shards == 1:
+            parts = [(0, flows)]
+        else:
+            shard = flow_hashes(*flow_keys(flows)) % np.uint64(self.shards)
+            order = np.argsort(shard, kind='stable')
+            bounds = np.searchsorted(shard[order], np.arange(self.shards + 1))
+            parts = [(index, flows[order[bounds[index]:bounds[index + 1]]]) for index in range(self.shards)]
+        header = SHARD_HEADER.pack(sensor)
+        for index, part in parts:
+            for start in range(0, len(part), SHARD_BATCH):
+                chunk = part[start:start + SHARD_BATCH]
+                if not self.in_rings[index].put(header + chunk.tobytes()):
+                    self.stats['ring_dropped_records'] += len(chunk)
+                    
+    def disconnect(self, sensor):
+        self.selector.unregister(sensor.sock)
+        sensor.sock.close()
+        del self.sensors[sensor.sock]
+        self.logger.info(f"Sensor '{sensor.name or sensor.peer[0]}' disconnected")
+        
+    def collect(self, limit=64):
+        """Merged records from all shards, at most limit messages per shard."""
+        records = []
+        for ring in self.out_rings:
+            for _ in range(limit):
+                payload = ring.get()
+                if payload is None:
+                    break
+                records.extend(pickle.loads(payload))
+        self.stats['exported_records'] += len(records)
+        return records
+        
+    def total(self, counter):
+        """Sum one shard counter over all shards."""
+        if self.counters is None:
+            return 0
+        offset = SHARD_COUNTERS.index(counter)
+        return sum(self.counters[i * len(SHARD_COUNTERS) + offset] for i in range(self.shards))
+        
+    def memory_usage(self):
+        """Shared memory held by all rings."""
+        return sum(ring.memory_usage() for ring in self.in_rings + self.out_rings)
+        
+    def collect_metrics(self):
+        """Collector counters for the metrics exporter."""
+        metrics = dict(self.stats)
+        metrics['sensors'] = len(self.sensors)
+        metrics['shards_alive'] = sum(p.is_alive() for p in self.processes)
+        for index in range(len(self.processes)):
+            for offset, name in enumerate(SHARD_COUNTERS):
+                metrics[f"{index}_{name}"] = self.counters[index * len(SHARD_COUNTERS) + offset]
+        return metrics
+        
+    def stop(self, timeout=10.0):
+        """Close sensor connections, let shards emit pending flows and stop them.
+        
+        Returns the records merged while the shards drained.
+        """
+        for sensor in list(self.sensors.values()):
+            self.disconnect(sensor)
+        if self.listener:
+            self.selector.unregister(self.listener)
+            self.listener.close()
+            self.listener = None
+            
+        records = []
+        deadline = time.time() + timeout
+        for control in self.controls:
+            control.put(None)
+        while any(p.is_alive() for p in self.processes) and time.time() < deadline:
+            records.extend(self.collect())
+            time.sleep(0.001)
+        records.extend(self.collect(limit=1 << 30))
+        
+        for process in self.processes:
+            if process.is_alive():
+                self.logger.warning(f"Shard {process.name} did not stop, terminating")
+                process.terminate()
+            process.join(1.0)
+            
+        for ring in self.in_rings + self.out_rings:
+            ring.close()
+        self.in_rings = []
+        self.out_rings = []
+        self.controls = []
+        self.processes = []
+        return records
@@ -0,0 +1,99 @@
+"""
+Binary flow record transport between sensors and the collector.
+A TCP stream of frames: one hello naming the sensor, then batches of flow
+records as packed structured arrays, so neither side touches JSON.
+"""
+
+import socket
+import struct
+
+import numpy as np
+
+from src.features.plugins import FLOW_RECORD_FIELDS
+
+WIRE_MAGIC = b'FLRW'
+WIRE_VERSION = 4
+FRAME_HEADER = struct.Struct('<4sHHI')  # magic, version, kind, payload length
+
+FRAME_HELLO = 1
+FRAME_RECORDS = 2
+
+MAX_FRAME = 64 << 20
+
+# Flow records on the wire: addresses as integers, no label
+WIRE_DTYPE = np.dtype([(name, '<u4' if name in ('src_ip', 'dst_ip') else '<' + dtype)
+                       for name, dtype in FLOW_RECORD_FIELDS if name != 'label'])
+
+def address_to_int(address):
+    return int.from_bytes(socket.inet_aton(address), 'big')
+
+def int_to_address(value):
+    return f"{value >> 24}.{(value >> 16) & 0xff}.{(value >> 8) & 0xff}.{value & 0xff}"
+
+def encode_frame(kind, payload):
+    """One frame with its header."""
+    return FRAME_HEADER.pack(WIRE_MAGIC, WIRE_VERSION, kind, len(payload)) + payload
+
+def encode_hello(sensor):
+    return encode_frame(FRAME_HELLO, sensor.encode())
+
+def records_to_array(records, addresses=None):
+    """Pack flow record dictionaries into a WIRE_DTYPE array.
+    
+    addresses, if given, is a dictionary caching address conversions.
+    """
+    flows = np.zeros(len(records), dtype=WIRE_DTYPE)
+    if addresses is None:
+        addresses = {}
+    for name in WIRE_DTYPE.names:
+        if name in ('src_ip', 'dst_ip'):
+            values = []
+            for record in records:
+                address = record[name]
+                value = addresses.get(address)
+                if value is None:
+                    value = addresses[address] = address_to_int(address)
+                values.append(value)
+            flows[name] = values
+        else:
+            flows[name] = [record[name] for record in records]
+    return flows
+
+def encode_records(records, addresses=None):
+    """One records frame holding flow record dictionaries."""
+    return encode_frame(FRAME_RECORDS, records_to_array(records, addresses).tobytes())
+
+def array_to_records(flows, label='BENIGN'):
+    """Unpack a WIRE_DTYPE array into flow record dictionaries."""
+    names = flows.dtype.names
+    records = []
+    for row in flows.tolist():
+        record = dict(zip(names, row))
+        record['src_ip'] = int_to_address(record['src_ip'])
+        record['dst_ip'] = int_to_address(record['dst_ip'])
+        record['label'] = label
+        records.append(record)
+    return records
+
+class FrameDecoder:
+    """Reassembles frames from the bytes of one TCP stream."""
+    
+    def __init__(self):
+        self.buffer = bytearray()
+        
+    def feed(self, data):
+        """Add received bytes; returns the (kind, payload) of every completed frame."""
+        self.buffer += data
+        frames = []
+        offset = 0
+        while len(self.buffer) - offset >= FRAME_HEADER.size:
+            magic, version, kind, length = FRAME_HEADER.unpack_from(self.buffer, offset)
+            if magic != WIRE_MAGIC or version != WIRE_VERSION or length > MAX_FRAME:
+                raise ValueError("invalid frame header")
+            end = offset + FRAME_HEADER.size + length
+            if end > len(self.buffer):
+                break
+            frames.append((kind, bytes(self.buffer[offset + FRAME_HEADER.size:end])))
+            offset = end
+        del self.buffer[:offset]
+        return frames
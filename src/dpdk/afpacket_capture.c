@@ -0,0 +1,513 @@
+/*
+ * AF_PACKET Capture Implementation
+ * Block-based TPACKET_V3 mmap ring with PACKET_FANOUT_HASH across sockets
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "afpacket_capture.h"
+#include "capture_backend.h"
+#include "clock_sync.h"
+
+struct afp_capture {
+    int fd;
+    int ifindex;
+    uint8_t *ring;              /* mmap'ed blocks */
+    size_t ring_size;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t current;           /* Block being read */
+    uint32_t remaining;         /* Packets left in the current block */
+    uint8_t *next;              /* Next packet header in the current block */
+    uint32_t release_head;      /* First block consumed by the previous call */
+    uint32_t nb_held;           /* Consumed blocks not yet returned to the kernel */
+    uint64_t packets;           /* Accumulated PACKET_STATISTICS */
+    uint64_t drops;
+    uint64_t freeze_q_cnt;
+};
+
+static inline struct tpacket_block_desc *block_at(struct afp_capture *cap, uint32_t index)
+{
+    return (struct tpacket_block_desc *)(cap->ring + (size_t)index * cap->block_size);
+}
+
+static inline int block_ready(struct tpacket_block_desc *desc)
+{
+    return __atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER;
+}
+
+/* Hand blocks consumed by the previous call back to the kernel */
+static void release_blocks(struct afp_capture *cap)
+{
+    while (cap->nb_held > 0) {
+        struct tpacket_block_desc *desc = block_at(cap, cap->release_head);
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        cap->release_head = (cap->release_head + 1) % cap->block_count;
+        cap->nb_held--;
+    }
+}
+
+struct afp_capture *afp_open(const struct afp_config *config)
+{
+    struct afp_capture *cap;
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    int version = TPACKET_V3;
+    int err;
+
+    if (config == NULL || config->iface == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    cap = calloc(1, sizeof(*cap));
+    if (cap == NULL)
+        return NULL;
+    cap->fd = -1;
+
+    cap->ifindex = if_nametoindex(config->iface);
+    if (cap->ifindex == 0) {
+        printf("Error: interface %s not found\n", config->iface);
+        goto fail;
+    }
+
+    cap->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (cap->fd < 0) {
+        printf("Error: cannot open AF_PACKET socket: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    if (setsockopt(cap->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        printf("Error: TPACKET_V3 not supported: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    cap->block_size = config->block_size ? config->block_size : AFP_BLOCK_SIZE;
+    cap->block_count = config->block_count ? config->block_count : AFP_BLOCK_COUNT;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = cap->block_size;
+    req.tp_block_nr = cap->block_count;
+    req.tp_frame_size = AFP_FRAME_SIZE;
+    req.tp_frame_nr = (cap->block_size / AFP_FRAME_SIZE) * cap->block_count;
+    req.tp_retire_blk_tov = config->block_timeout_ms ? config->block_timeout_ms : AFP_BLOCK_TIMEOUT_MS;
+    req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+    if (setsockopt(cap->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        printf("Error: cannot create RX ring (%u blocks of %u bytes): %s\n",
+               cap->block_count, cap->block_size, strerror(errno));
+        goto fail;
+    }
+
+    cap->ring_size = (size_t)cap->block_size * cap->block_count;
+    cap->ring = mmap(NULL, cap->ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, cap->fd, 0);
+    if (cap->ring == MAP_FAILED) {
+        cap->ring = NULL;
+        printf("Error: cannot map RX ring: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = cap->ifindex;
+    if (bind(cap->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        printf("Error: cannot bind to %s: %s\n", config->iface, strerror(errno));
+        goto fail;
+    }
+
+    if (config->promiscuous) {
+        struct packet_mreq mreq;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = cap->ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(cap->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+            printf("Warning: cannot enable promiscuous mode on %s: %s\n",
+                   config->iface, strerror(errno));
+    }
+
+    /* Join the fanout group after bind; the kernel hashes each flow to one socket */
+    if (config->fanout_group >= 0) {
+        int fanout = (config->fanout_group & 0xffff) |
+                     ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+
+        if (setsockopt(cap->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+            printf("Error: cannot join fanout group %d: %s\n",
+                   config->fanout_group, strerror(errno));
+            goto fail;
+        }
+    }
+
+    return cap;
+
+fail:
+    err = errno;
+    afp_close(cap);
+    errno = err;
+    return NULL;
+}
+
+void afp_release(struct afp_capture *cap)
+{
+    if (cap)
+        release_blocks(cap);
+}
+
+int afp_capture_packets(struct afp_capture *cap, struct packet *packets,
+                        uint64_t *timestamps, int max_packets)
+{
+    int nb_rx = 0;
+
+    if (!cap || !packets || max_packets <= 0) {
+        return -1;
+    }
+
+    /* Packets returned by the previous call are no longer referenced */
+    release_blocks(cap);
+
+    while (nb_rx < max_packets) {
+        struct tpacket3_hdr *hdr;
+
+        if (cap->remaining == 0) {
+            struct tpacket_block_desc *desc = block_at(cap, cap->current);
+
+            if (!block_ready(desc))
+                break;
+
+            cap->remaining = desc->hdr.bh1.num_pkts;
+            cap->next = (uint8_t *)desc + desc->hdr.bh1.offset_to_first_pkt;
+            if (cap->remaining == 0) {
+                /* Nothing to hand out, return the block at the next call */
+                cap->nb_held++;
+                cap->current = (cap->current + 1) % cap->block_count;
+                continue;
+            }
+        }
+
+        hdr = (struct tpacket3_hdr *)cap->next;
+        packets[nb_rx].data = cap->next + hdr->tp_mac;
+        packets[nb_rx].length = hdr->tp_snaplen > UINT16_MAX ? UINT16_MAX : hdr->tp_snaplen;
+        packets[nb_rx].port = (uint8_t)cap->ifindex;
+        packets[nb_rx].timestamp = hdr->tp_sec;
+        packets[nb_rx].rx_flags = hdr->hv1.tp_rxhash ? PACKET_RX_RSS_HASH : 0;
+        packets[nb_rx].rss_hash = hdr->hv1.tp_rxhash;
+        /* The driver validated the TCP/UDP checksum, or the packet is our own
+         * and its checksum is left to the NIC */
+        if (hdr->tp_status & (TP_STATUS_CSUM_VALID | TP_STATUS_CSUMNOTREADY))
+            packets[nb_rx].rx_flags |= PACKET_RX_L4_CKSUM_CHECKED;
+        if (timestamps)
+            timestamps[nb_rx] = (uint64_t)hdr->tp_sec * 1000000000ULL + hdr->tp_nsec;
+        nb_rx++;
+
+        cap->next += hdr->tp_next_offset;
+        if (--cap->remaining == 0) {
+            /* Keep the block until the caller is done with its packets */
+            cap->nb_held++;
+            cap->current = (cap->current + 1) % cap->block_count;
+        }
+    }
+
+    return nb_rx;
+}
+
+int afp_wait(struct afp_capture *cap, int timeout_ms)
+{
+    struct pollfd pfd;
+    int ret;
+
+    if (!cap) {
+        return -1;
+    }
+
+    if (cap->remaining > 0 || block_ready(block_at(cap, cap->current)))
+        return 1;
+
+    pfd.fd = cap->fd;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0)
+        return errno == EINTR ? 0 : -1;
+
+    return block_ready(block_at(cap, cap->current)) ? 1 : 0;
+}
+
+int afp_get_stats(struct afp_capture *cap, struct afp_stats *stats)
+{
+    struct tpacket_stats_v3 kstats;
+    socklen_t len = sizeof(kstats);
+    uint32_t i;
+
+    if (!cap || !stats) {
+        return -1;
+    }
+
+    /* The kernel resets its counters on every read */
+    memset(&kstats, 0, sizeof(kstats));
+    if (getsockopt(cap->fd, SOL_PACKET, PACKET_STATISTICS, &kstats, &len) == 0) {
+        cap->packets += kstats.tp_packets;
+        cap->drops += kstats.tp_drops;
+        cap->freeze_q_cnt += kstats.tp_freeze_q_cnt;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    stats->packets = cap->packets;
+    stats->drops = cap->drops;
+    stats->freeze_q_cnt = cap->freeze_q_cnt;
+    stats->ring_bytes = cap->ring_size;
+    stats->block_count = cap->block_count;
+    for (i = 0; i < cap->block_count; i++) {
+        if (block_ready(block_at(cap, i)))
+            stats->blocks_in_use++;
+    }
+
+    return 0;
+}
+
+int afp_get_fd(struct afp_capture *cap)
+{
+    return cap ? cap->fd : -1;
+}
+
+void afp_close(struct afp_capture *cap)
+{
+    if (!cap)
+        return;
+
+    if (cap->ring)
+        munmap(cap->ring, cap->ring_size);
+    if (cap->fd >= 0)
+        close(cap->fd);
+    free(cap);
+}
+
+/* Capture backend: one ring per queue, joined in a fanout group */
+struct afp_backend {
+    struct afp_capture *rings[MAX_RX_QUEUES];
+    struct afp_config config;               /* To reopen a ring on restart */
+    char iface[IF_NAMESIZE];
+    int64_t carrier_changes;                /* Interface's count when the context was opened */
+    uint32_t block_size;
+    uint64_t buffer_in_use_hwm;             /* Highest buffer_in_use seen by stats calls */
+    int tai;                                /* Convert the kernel's UTC timestamps to TAI */
+    int64_t tai_offset[MAX_RX_QUEUES];      /* TAI - UTC in nanoseconds, per polling thread */
+    uint32_t tai_checked[MAX_RX_QUEUES];    /* Packet second at which tai_offset was read */
+};
+
+/* Read a number from the interface's sysfs directory; fails while the
+ * interface is down for attributes such as carrier and speed */
+static int read_iface_attr(const char *iface, const char *name, int64_t *value)
+{
+    char path[64 + IF_NAMESIZE];
+    long long v;
+    FILE *f;
+    int ret;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/%s", iface, name);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    ret = fscanf(f, "%lld", &v) == 1 ? 0 : -1;
+    fclose(f);
+    if (ret == 0)
+        *value = v;
+    return ret;
+}
+
+static int afp_backend_init(struct capture_ctx *ctx, const struct capture_config *config)
+{
+    static unsigned fanout_seq = 0;
+    struct afp_backend *ab = ctx->priv;
+    struct afp_config *afp = &ab->config;
+    char path[64 + IF_NAMESIZE];
+    FILE *f;
+    int q;
+
+    if (config->iface == NULL || config->iface[0] == '\0') {
+        printf("Error: AF_PACKET backend requires an interface name\n");
+        return -1;
+    }
+    if (strlen(config->iface) >= sizeof(ab->iface)) {
+        printf("Error: interface name %s too long\n", config->iface);
+        return -1;
+    }
+    strcpy(ab->iface, config->iface);
+    afp->iface = ab->iface;
+    afp->fanout_group = -1;
+    afp->promiscuous = 1;
+
+    /* Fanout group ids are shared by the network namespace */
+    if (ctx->nb_queues > 1)
+        afp->fanout_group = (getpid() + __atomic_fetch_add(&fanout_seq, 1, __ATOMIC_RELAXED)) & 0xffff;
+
+    for (q = 0; q < ctx->nb_queues; q++) {
+        ab->rings[q] = afp_open(afp);
+        if (ab->rings[q] == NULL) {
+            while (q-- > 0)
+                afp_close(ab->rings[q]);
+            return -1;
+        }
+    }
+    ab->block_size = AFP_BLOCK_SIZE;
+    ab->tai = config->clock == CAPTURE_CLOCK_TAI;
+    if (read_iface_attr(ab->iface, "carrier_changes", &ab->carrier_changes) != 0)
+        ab->carrier_changes = -1;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", config->iface);
+    f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%d", &ctx->numa_node) != 1)
+            ctx->numa_node = -1;
+        fclose(f);
+    }
+
+    return 0;
+}
+
+static int afp_backend_rx_burst(struct capture_ctx *ctx, int queue, struct packet *packets,
+                                uint64_t *timestamps, int max_packets)
+{
+    struct afp_backend *ab = ctx->priv;
+    int nb_rx, i;
+
+    nb_rx = afp_capture_packets(ab->rings[queue], packets, timestamps, max_packets);
+    if (!ab->tai || nb_rx <= 0)
+        return nb_rx;
+
+    /* Leap seconds change the offset; read it again once per second */
+    if (packets[0].timestamp != ab->tai_checked[queue]) {
+        ab->tai_offset[queue] = clock_sync_tai_offset();
+        ab->tai_checked[queue] = packets[0].timestamp;
+    }
+    for (i = 0; i < nb_rx; i++) {
+        packets[i].timestamp += (uint32_t)(ab->tai_offset[queue] / 1000000000LL);
+        if (timestamps)
+            timestamps[i] += ab->tai_offset[queue];
+    }
+    return nb_rx;
+}
+
+static void afp_backend_release(struct capture_ctx *ctx, int queue)
+{
+    struct afp_backend *ab = ctx->priv;
+
+    afp_release(ab->rings[queue]);
+}
+
+static int afp_backend_stats(struct capture_ctx *ctx, struct capture_stats *stats)
+{
+    struct afp_backend *ab = ctx->priv;
+    struct afp_stats rs;
+    int q;
+
+    for (q = 0; q < ctx->nb_queues; q++) {
+        if (afp_get_stats(ab->rings[q], &rs) != 0)
+            continue;
+        stats->rx_packets += rs.packets;
+        stats->rx_dropped += rs.drops;
+        stats->rx_missed += rs.drops;
+        stats->buffer_bytes += rs.ring_bytes;
+        stats->buffer_in_use += (uint64_t)rs.blocks_in_use * ab->block_size;
+    }
+    if (stats->buffer_in_use > ab->buffer_in_use_hwm)
+        ab->buffer_in_use_hwm = stats->buffer_in_use;
+    stats->buffer_in_use_hwm = ab->buffer_in_use_hwm;
+
+    return 0;
+}
+
+static int afp_backend_get_fd(struct capture_ctx *ctx, int queue)
+{
+    struct afp_backend *ab = ctx->priv;
+
+    return afp_get_fd(ab->rings[queue]);
+}
+
+static int afp_backend_health(struct capture_ctx *ctx, struct capture_health *health)
+{
+    struct afp_backend *ab = ctx->priv;
+    int64_t value;
+
+    health->link_up = read_iface_attr(ab->iface, "carrier", &value) == 0 && value == 1;
+    if (health->link_up && read_iface_attr(ab->iface, "speed", &value) == 0 && value > 0)
+        health->link_speed = (uint32_t)value;
+    if (ab->carrier_changes >= 0 && read_iface_attr(ab->iface, "carrier_changes", &value) == 0 &&
+        value >= ab->carrier_changes)
+        health->link_changes = (uint64_t)(value - ab->carrier_changes);
+    return 0;
+}
+
+/* Replace a queue's ring with a new socket in the same fanout group */
+static int afp_restart_ring(struct afp_backend *ab, int queue)
+{
+    struct afp_capture *cap, *old = ab->rings[queue];
+    struct afp_stats rs;
+
+    cap = afp_open(&ab->config);
+    if (cap == NULL)
+        return -1;
+
+    /* Carry the kernel's counters over to the new socket */
+    if (old != NULL && afp_get_stats(old, &rs) == 0) {
+        cap->packets = old->packets;
+        cap->drops = old->drops;
+        cap->freeze_q_cnt = old->freeze_q_cnt;
+    }
+    afp_close(old);
+    ab->rings[queue] = cap;
+    return 0;
+}
+
+static int afp_backend_restart(struct capture_ctx *ctx, int queue)
+{
+    struct afp_backend *ab = ctx->priv;
+    int ret = 0;
+    int q;
+
+    if (queue >= 0)
+        return afp_restart_ring(ab, queue);
+
+    for (q = 0; q < ctx->nb_queues; q++) {
+        if (afp_restart_ring(ab, q) != 0)
+            ret = -1;
+    }
+    return ret;
+}
+
+static void afp_backend_close(struct capture_ctx *ctx)
+{
+    struct afp_backend *ab = ctx->priv;
+    int q;
+
+    for (q = 0; q < ctx->nb_queues; q++) {
+        afp_close(ab->rings[q]);
+        ab->rings[q] = NULL;
+    }
+}
+
+const struct capture_backend capture_backend_afpacket = {
+    .name = "af_packet",
+    .priv_size = sizeof(struct afp_backend),
+    .init = afp_backend_init,
+    .rx_burst = afp_backend_rx_burst,
+    .release = afp_backend_release,
+    .stats = afp_backend_stats,
+    .get_fd = afp_backend_get_fd,
+    .health = afp_backend_health,
+    .restart = afp_backend_restart,
+    .close = afp_backend_close,
+};
@@ -0,0 +1,105 @@
+/*
+ * AF_PACKET Capture Header
+ * TPACKET_V3 mmap ring capture, a fallback for hosts without DPDK or
+ * hugepages. Packets are returned as struct packet like dpdk_capture_packets();
+ * registered as CAPTURE_BACKEND_AF_PACKET of the capture API.
+ */
+
+#ifndef AFPACKET_CAPTURE_H
+#define AFPACKET_CAPTURE_H
+
+#include <stdint.h>
+
+#include "dpdk_capture.h"
+
+/* Default ring geometry: 64 blocks of 1 MiB, retired after 10 ms */
+#define AFP_BLOCK_SIZE (1 << 20)
+#define AFP_BLOCK_COUNT 64
+#define AFP_FRAME_SIZE 2048
+#define AFP_BLOCK_TIMEOUT_MS 10
+
+/* Opaque handle for one ring; one per capture thread */
+struct afp_capture;
+
+/* Ring configuration for afp_open() */
+struct afp_config {
+    const char *iface;         /* Interface name (e.g., "eth0", "lo") */
+    int fanout_group;          /* PACKET_FANOUT group id, negative for no fanout */
+    uint32_t block_size;       /* Ring block size, power of two multiple of the page size */
+    uint32_t block_count;      /* Number of ring blocks */
+    uint32_t block_timeout_ms; /* Retire partially filled blocks after this long */
+    int promiscuous;           /* Enable promiscuous mode on the interface */
+};
+
+/* Counters of one ring */
+struct afp_stats {
+    uint64_t packets;          /* Packets seen by the socket, including drops */
+    uint64_t drops;            /* Packets dropped because the ring was full */
+    uint64_t freeze_q_cnt;     /* Times the queue was frozen */
+    uint64_t ring_bytes;       /* Size of the mmap ring */
+    uint32_t blocks_in_use;    /* Blocks owned by user space */
+    uint32_t block_count;
+};
+
+/**
+ * Open a TPACKET_V3 ring on an interface
+ *
+ * Sockets opened with the same fanout_group share the interface's traffic,
+ * split by flow hash (PACKET_FANOUT_HASH), so each flow is seen by a single
+ * ring. Requires CAP_NET_RAW.
+ * @param config Ring configuration; zero fields select the defaults
+ * @return Capture handle, NULL on error (errno is set)
+ */
+struct afp_capture *afp_open(const struct afp_config *config);
+
+/**
+ * Capture packets from the ring
+ *
+ * Packet data points into the ring and stays valid until the next call on
+ * the same handle, which returns the consumed block to the kernel.
+ * @param cap Capture handle
+ * @param packets Array to store captured packets
+ * @param timestamps Array to store kernel receive timestamps in nanoseconds, may be NULL
+ * @param max_packets Maximum number of packets to capture
+ * @return Number of packets captured, negative on error
+ */
+int afp_capture_packets(struct afp_capture *cap, struct packet *packets,
+                        uint64_t *timestamps, int max_packets);
+
+/**
+ * Return the blocks of the last afp_capture_packets() call to the kernel
+ * @param cap Capture handle
+ */
+void afp_release(struct afp_capture *cap);
+
+/**
+ * Wait until the ring has a block ready
+ * @param cap Capture handle
+ * @param timeout_ms Longest wait in milliseconds, negative to wait forever
+ * @return 1 if packets are ready, 0 on timeout, negative on error
+ */
+int afp_wait(struct afp_capture *cap, int timeout_ms);
+
+/**
+ * Get ring counters; kernel packet and drop counts are reset by each call
+ * and accumulated in the handle
+ * @param cap Capture handle
+ * @param stats Pointer to store the counters
+ * @return 0 on success, negative on error
+ */
+int afp_get_stats(struct afp_capture *cap, struct afp_stats *stats);
+
+/**
+ * Get the socket file descriptor, for use with poll() or epoll
+ * @param cap Capture handle
+ * @return File descriptor
+ */
+int afp_get_fd(struct afp_capture *cap);
+
+/**
+ * Unmap the ring and close the socket
+ * @param cap Capture handle
+ */
+void afp_close(struct afp_capture *cap);
+
+#endif /* AFPACKET_CAPTURE_H */
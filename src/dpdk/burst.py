@@ -0,0 +1,161 @@
+"""
+Columnar packet bursts.
+A burst holds its packets back to back in one buffer, each at an aligned
+offset and zero padded, with their metadata in a NumPy structured array laid
+out as struct packed_packet. Bursts go from the capture library to the flow
+extractors, the worker rings and the packet store without a Python object
+per packet.
+"""
+
+import struct
+import time
+
+import numpy as np
+from numpy.lib.stride_tricks import as_strided
+
+# Alignment of packets in the buffer, matching PACKED_ALIGN
+PACKED_ALIGN = 8
+
+# Packet metadata matching struct packed_packet
+PACKED_PACKET = np.dtype([
+    ('timestamp_ns', '<u8'),
+    ('offset', '<u4'),
+    ('rss_hash', '<u4'),
+    ('length', '<u2'),
+    ('port', 'u1'),
+    ('rx_flags', 'u1'),
+], align=True)
+
+# Ring message: packet count and buffer size, then the metadata and the buffer
+MESSAGE_HEADER = struct.Struct('<II')
+
+class PacketBurst:
+    """Packets of one burst; packet i is buffer[offset[i]:offset[i] + length[i]].
+    
+    Offsets are at least even, so every packet and IP header starts on a
+    16-bit word, and the bytes between packets are zero.
+    """
+    
+    __slots__ = ('buffer', 'meta')
+    
+    def __init__(self, buffer=None, meta=None):
+        self.buffer = np.zeros(0, dtype=np.uint8) if buffer is None else buffer
+        self.meta = np.zeros(0, dtype=PACKED_PACKET) if meta is None else meta
+        
+    def __len__(self):
+        return len(self.meta)
+        
+    @property
+    def offsets(self):
+        return self.meta['offset']
+        
+    @property
+    def lengths(self):
+        return self.meta['length']
+        
+    @property
+    def rx_flags(self):
+        return self.meta['rx_flags']
+        
+    @classmethod
+    def from_packets(cls, packets, now=None):
+        """Pack packet dictionaries, as the reference extractor takes them, into a burst.
+        
+        Packets without a capture timestamp get now, by default the current time.
+        """
+        now = time.time_ns() if now is None else now
+        meta = np.zeros(len(packets), dtype=PACKED_PACKET)
+        chunks = []
+        offset = 0
+        for i, packet in enumerate(packets):
+            data = packet['data'][:packet['length']]
+            size = (len(data) + PACKED_ALIGN - 1) & ~(PACKED_ALIGN - 1)
+            meta[i] = (packet.get('timestamp_ns') or now, offset, packet.get('rss_hash', 0), len(data),
+                       packet.get('port', 0), packet.get('rx_flags', 0))
+            chunks.append(data)
+            chunks.append(bytes(size - len(data)))
+            offset += size
+        return cls(np.frombuffer(b''.join(chunks), dtype=np.uint8), meta)
+        
+    def encode(self):
+        """The burst as one ring message."""
+        return b''.join((MESSAGE_HEADER.pack(len(self.meta), len(self.buffer)), self.meta.tobytes(),
+                         self.buffer.tobytes()))
+        
+    @classmethod
+    def decode(cls, payload):
+        """A burst viewing a ring message, without copying it."""
+        count, size = MESSAGE_HEADER.unpack_from(payload, 0)
+        start = MESSAGE_HEADER.size
+        meta = np.frombuffer(payload, dtype=PACKED_PACKET, count=count, offset=start)
+        start += meta.nbytes
+        return cls(np.frombuffer(payload, dtype=np.uint8, count=size, offset=start), meta)
+        
+    @classmethod
+    def concat(cls, bursts):
+        """One burst of the packets of several, with their buffers copied back to back.
+        
+        Buffer sizes are multiples of PACKED_ALIGN, so offsets stay aligned.
+        """
+        bursts = [burst for burst in bursts if len(burst)]
+        if not bursts:
+            return cls()
+        if len(bursts) == 1:
+            return bursts[0]
+        meta = np.concatenate([burst.meta for burst in bursts])
+        start = 0
+        base = 0
+        for burst in bursts:
+            meta['offset'][start:start + len(burst)] += base
+            start += len(burst)
+            base += len(burst.buffer)
+        return cls(np.concatenate([burst.buffer for burst in bursts]), meta)
+        
+    def data(self, i):
+        """Bytes of packet i."""
+        offset = int(self.meta['offset'][i])
+        return self.buffer[offset:offset + int(self.meta['length'][i])].tobytes()
+        
+    def packets(self):
+        """Packet dictionaries of the burst, for the reference extractor."""
+        return [{'data': self.data(i), 'length': length, 'timestamp_ns': timestamp_ns,
+                 'rx_flags': rx_flags, 'rss_hash': rss_hash, 'port': port}
+                for i, (timestamp_ns, _, rss_hash, length, port, rx_flags) in enumerate(self.meta.tolist())]
+        
+    def headers(self, size):
+        """(n, size) uint8 array with the first size bytes of each packet, zero padded."""
+        offsets = self.meta['offset']
+        if not len(offsets):
+            return np.zeros((0, size), dtype=np.uint8)
+        buffer = self.buffer
+        end = int(offsets.max()) + size
+        if end > len(buffer):
+            buffer = np.concatenate((buffer, np.zeros(end - len(buffer), dtype=np.uint8)))
+        # Rows of a sliding window view are copied whole, without a per-byte index
+        windows = as_strided(buffer, (len(buffer) - size + 1, size), (1, 1), writeable=False)
+        headers = windows[offsets]
+        lengths = self.meta['length']
+        short = np.flatnonzero(lengths < size)
+        if len(short):
+            headers[short] *= np.arange(size) < lengths[short, None]
+        return headers
+        
+    def times(self, clock=time.time):
+        """Capture times in seconds; the clock's time for packets the backend did not stamp."""
+        times = self.meta['timestamp_ns'].astype(np.int64) / 1e9
+        if not times.all():
+            times[times == 0] = clock()
+        return times
+        
+    def select(self, rows, skip=None):
+        """A burst of the given packets sharing this one's buffer.
+        
+        skip, if given, is the number of leading bytes to drop from each
+        selected packet, an even number.
+        """
+        meta = self.meta[rows]
+        if skip is not None:
+            skip = np.asarray(skip)
+            meta['offset'] += skip.astype(np.uint32)
+            meta['length'] -= skip.astype(np.uint16)
+        return PacketBurst(self.buffer, meta)
@@ -0,0 +1,263 @@
+/*
+ * Capture Backend API Implementation
+ * Selects a backend at runtime and dispatches bursts to it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "capture_backend.h"
+
+/* Backends built into the library, by CAPTURE_BACKEND_* id */
+static const struct capture_backend *backends[CAPTURE_BACKEND_COUNT] = {
+#ifdef HAVE_DPDK
+    [CAPTURE_BACKEND_PCI] = &capture_backend_dpdk,
+    [CAPTURE_BACKEND_AF_XDP] = &capture_backend_dpdk,
+    [CAPTURE_BACKEND_VDEV] = &capture_backend_dpdk,
+#endif
+    [CAPTURE_BACKEND_PCAP] = &capture_backend_pcap,
+    [CAPTURE_BACKEND_AF_PACKET] = &capture_backend_afpacket,
+};
+
+static uint64_t monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+int capture_backend_available(int backend)
+{
+    return backend >= 0 && backend < CAPTURE_BACKEND_COUNT && backends[backend] != NULL;
+}
+
+struct capture_ctx *capture_open(const struct capture_config *config)
+{
+    struct capture_ctx *ctx;
+    uint64_t now;
+    int q;
+
+    if (config == NULL)
+        return NULL;
+
+    if (!capture_backend_available(config->backend)) {
+        printf("Error: capture backend %d is not available in this build\n", config->backend);
+        return NULL;
+    }
+
+    if (config->queues < 1 || config->queues > MAX_RX_QUEUES) {
+        printf("Error: %d RX queues requested, supported range is 1-%d\n",
+               config->queues, MAX_RX_QUEUES);
+        return NULL;
+    }
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+        return NULL;
+
+    ctx->backend = backends[config->backend];
+    ctx->backend_id = config->backend;
+    ctx->nb_queues = config->queues;
+    ctx->batch_size = config->batch_size > 0 ? config->batch_size : MAX_PKT_BURST;
+    ctx->numa_node = -1;
+
+    if (ctx->backend->priv_size > 0) {
+        ctx->priv = calloc(1, ctx->backend->priv_size);
+        if (ctx->priv == NULL) {
+            free(ctx);
+            return NULL;
+        }
+    }
+
+    if (ctx->backend->init(ctx, config) != 0) {
+        free(ctx->priv);
+        free(ctx);
+        return NULL;
+    }
+
+    now = monotonic_ms();
+    for (q = 0; q < ctx->nb_queues; q++)
+        ctx->seen_ms[q] = now;
+
+    return ctx;
+}
+
+int capture_rx_burst(struct capture_ctx *ctx, int queue, struct packet *packets,
+                     uint64_t *timestamps, int max_packets)
+{
+    int nb_rx = 0;
+    int polled;
+    int ret;
+
+    if (!ctx || !packets || max_packets <= 0 || queue >= ctx->nb_queues) {
+        return -1;
+    }
+
+    if (max_packets > ctx->batch_size)
+        max_packets = ctx->batch_size;
+
+    if (queue >= 0) {
+        ctx->backend->release(ctx, queue);
+        ret = ctx->backend->rx_burst(ctx, queue, packets, timestamps, max_packets);
+        if (ret > 0)
+            ctx->rx_packets[queue] += ret;
+        return ret;
+    }
+
+    capture_release(ctx, -1);
+
+    /* Poll each queue once, continuing where the previous call stopped */
+    for (polled = 0; polled < ctx->nb_queues && nb_rx < max_packets; polled++) {
+        ret = ctx->backend->rx_burst(ctx, ctx->next_queue, packets + nb_rx,
+                                     timestamps ? timestamps + nb_rx : NULL,
+                                     max_packets - nb_rx);
+        if (ret < 0)
+            return nb_rx > 0 ? nb_rx : ret;
+        nb_rx += ret;
+        ctx->rx_packets[ctx->next_queue] += ret;
+        ctx->next_queue = (ctx->next_queue + 1) % ctx->nb_queues;
+    }
+
+    return nb_rx;
+}
+
+void capture_release(struct capture_ctx *ctx, int queue)
+{
+    int q;
+
+    if (!ctx || queue >= ctx->nb_queues)
+        return;
+
+    if (queue >= 0) {
+        ctx->backend->release(ctx, queue);
+        return;
+    }
+
+    for (q = 0; q < ctx->nb_queues; q++)
+        ctx->backend->release(ctx, q);
+}
+
+int64_t capture_pack_burst(const struct packet *packets, const uint64_t *timestamps, int nb_packets,
+                           struct packed_packet *meta, uint8_t *buf, uint64_t buf_size)
+{
+    uint64_t used = 0;
+    int i;
+
+    if (!packets || nb_packets < 0 || (buf && !meta))
+        return -1;
+
+    for (i = 0; i < nb_packets; i++) {
+        uint64_t size = ((uint64_t)packets[i].length + PACKED_ALIGN - 1) & ~(uint64_t)(PACKED_ALIGN - 1);
+
+        if (buf) {
+            if (used + size > buf_size || used > UINT32_MAX)
+                return -2;
+            memcpy(buf + used, packets[i].data, packets[i].length);
+            memset(buf + used + packets[i].length, 0, size - packets[i].length);
+            meta[i].timestamp_ns = timestamps ? timestamps[i] : 0;
+            meta[i].offset = (uint32_t)used;
+            meta[i].rss_hash = packets[i].rss_hash;
+            meta[i].length = packets[i].length;
+            meta[i].port = packets[i].port;
+            meta[i].rx_flags = packets[i].rx_flags;
+        }
+        used += size;
+    }
+
+    return (int64_t)used;
+}
+
+int capture_get_stats(struct capture_ctx *ctx, struct capture_stats *stats)
+{
+    if (!ctx || !stats) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    return ctx->backend->stats(ctx, stats);
+}
+
+int capture_get_nb_queues(struct capture_ctx *ctx)
+{
+    return ctx ? ctx->nb_queues : 0;
+}
+
+int capture_get_numa_node(struct capture_ctx *ctx)
+{
+    return ctx ? ctx->numa_node : -1;
+}
+
+int capture_get_fd(struct capture_ctx *ctx, int queue)
+{
+    if (!ctx || queue < 0 || queue >= ctx->nb_queues || !ctx->backend->get_fd)
+        return -1;
+
+    return ctx->backend->get_fd(ctx, queue);
+}
+
+int capture_get_health(struct capture_ctx *ctx, struct capture_health *health)
+{
+    uint64_t now;
+    int q;
+
+    if (!ctx || !health) {
+        return -1;
+    }
+
+    memset(health, 0, sizeof(*health));
+    health->link_up = -1;
+    health->nb_queues = ctx->nb_queues;
+
+    now = monotonic_ms();
+    for (q = 0; q < ctx->nb_queues; q++) {
+        if (ctx->rx_packets[q] != ctx->seen_packets[q]) {
+            ctx->seen_packets[q] = ctx->rx_packets[q];
+            ctx->seen_ms[q] = now;
+        }
+        health->idle_ms[q] = now - ctx->seen_ms[q];
+    }
+
+    return ctx->backend->health ? ctx->backend->health(ctx, health) : 0;
+}
+
+int capture_restart(struct capture_ctx *ctx, int queue)
+{
+    uint64_t now;
+    int ret;
+    int q;
+
+    if (!ctx || queue >= ctx->nb_queues || !ctx->backend->restart)
+        return -1;
+
+    capture_release(ctx, -1);
+    ret = ctx->backend->restart(ctx, queue);
+
+    /* Idle time counts again from the restart */
+    now = monotonic_ms();
+    for (q = 0; q < ctx->nb_queues; q++) {
+        if (queue < 0 || q == queue)
+            ctx->seen_ms[q] = now;
+    }
+
+    return ret;
+}
+
+const char *capture_get_backend_name(struct capture_ctx *ctx)
+{
+    return ctx ? ctx->backend->name : "none";
+}
+
+void capture_close(struct capture_ctx *ctx)
+{
+    if (!ctx)
+        return;
+
+    capture_release(ctx, -1);
+    ctx->backend->close(ctx);
+    free(ctx->priv);
+    free(ctx);
+}
@@ -0,0 +1,166 @@
+/*
+ * Capture Backend API Header
+ * Context-based packet capture over pluggable backends (DPDK port, DPDK
+ * virtual device, AF_XDP, pcap file, AF_PACKET). Several contexts may be
+ * open at the same time.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+#include "dpdk_capture.h"
+
+/* Opaque capture context */
+struct capture_ctx;
+
+/* Counters and buffer usage of a capture context */
+struct capture_stats {
+    uint64_t rx_packets;        /* Packets received by the device or kernel */
+    uint64_t rx_bytes;
+    uint64_t rx_dropped;        /* Packets lost because no buffer was free */
+    uint64_t rx_errors;
+    uint64_t rx_missed;         /* Of rx_dropped: device or kernel ring full */
+    uint64_t rx_nombuf;         /* Of rx_dropped: no free mbuf */
+    uint64_t buffer_bytes;      /* Memory of packet buffers (mbuf pool, ring, file) */
+    uint64_t buffer_in_use;     /* Bytes of buffers currently in use */
+    uint64_t buffer_in_use_hwm; /* High-water mark of buffer_in_use */
+    uint64_t clock_calibrations; /* Calibrations of the TSC or NIC clock against the system clock */
+    int64_t clock_error_ns;      /* System clock minus converted time at the last calibration */
+    uint64_t clock_error_max_ns; /* Largest absolute clock_error_ns */
+};
+
+/* Link state and receive activity of a capture context */
+struct capture_health {
+    int32_t link_up;            /* 1 up, 0 down, -1 unknown (pcap replay) */
+    uint32_t link_speed;        /* Mbps, 0 if unknown */
+    uint64_t link_changes;      /* Link state changes seen since the context was opened */
+    uint64_t reset_events;      /* Resets or errors reported by the driver */
+    int32_t reset_pending;      /* The driver asked for a port reset, see capture_restart() */
+    int32_t nb_queues;
+    uint64_t idle_ms[MAX_RX_QUEUES]; /* Time since each queue last returned packets */
+};
+
+/**
+ * Check whether a backend was built into the library
+ * @param backend CAPTURE_BACKEND_*
+ * @return 1 if available, 0 otherwise
+ */
+int capture_backend_available(int backend);
+
+/**
+ * Open a capture context
+ * @param config Capture configuration
+ * @return Capture context, NULL on error
+ */
+struct capture_ctx *capture_open(const struct capture_config *config);
+
+/**
+ * Receive a burst of packets
+ *
+ * Packets returned by the previous burst on the same queue are released
+ * first; packet data stays valid until then or until capture_release().
+ * @param ctx Capture context
+ * @param queue RX queue number, negative to poll all queues in turn
+ * @param packets Array to store captured packets
+ * @param timestamps Array to store receive times in nanoseconds since the epoch of
+ *                   config->clock, may be NULL
+ * @param max_packets Maximum number of packets to capture
+ * @return Number of packets captured, negative on error
+ */
+int capture_rx_burst(struct capture_ctx *ctx, int queue, struct packet *packets,
+                     uint64_t *timestamps, int max_packets);
+
+/**
+ * Release the packets returned by the last burst on a queue
+ * @param ctx Capture context
+ * @param queue RX queue number, negative for all queues
+ */
+void capture_release(struct capture_ctx *ctx, int queue);
+
+/**
+ * Copy a burst of packets back to back into one buffer
+ *
+ * Each packet starts at a multiple of PACKED_ALIGN and is zero padded up to
+ * the next one, so consumers can sum the 16-bit words of any packet. With
+ * buf NULL only the size the buffer needs is returned.
+ * @param packets Packets returned by capture_rx_burst()
+ * @param timestamps Their receive times in nanoseconds, may be NULL
+ * @param nb_packets Number of packets
+ * @param meta Array of nb_packets entries to describe the packets, may be NULL with buf
+ * @param buf Buffer to copy the packets into, or NULL
+ * @param buf_size Size of buf
+ * @return Bytes of buf used or needed, negative on error or if buf is too small
+ */
+int64_t capture_pack_burst(const struct packet *packets, const uint64_t *timestamps, int nb_packets,
+                           struct packed_packet *meta, uint8_t *buf, uint64_t buf_size);
+
+/**
+ * Get counters of a capture context
+ * @param ctx Capture context
+ * @param stats Pointer to store the counters
+ * @return 0 on success, negative on error
+ */
+int capture_get_stats(struct capture_ctx *ctx, struct capture_stats *stats);
+
+/**
+ * Get the number of RX queues of a capture context
+ * @param ctx Capture context
+ * @return Number of RX queues
+ */
+int capture_get_nb_queues(struct capture_ctx *ctx);
+
+/**
+ * Get the NUMA node packets are received on
+ * @param ctx Capture context
+ * @return NUMA node id, negative if unknown
+ */
+int capture_get_numa_node(struct capture_ctx *ctx);
+
+/**
+ * Get a descriptor that polls readable when a queue has packets, for use
+ * with poll/epoll or an event loop
+ * @param ctx Capture context
+ * @param queue RX queue
+ * @return File descriptor, negative if the backend must be busy-polled
+ */
+int capture_get_fd(struct capture_ctx *ctx, int queue);
+
+/**
+ * Get the link state and receive activity of a capture context
+ *
+ * Idle times are measured from one call to the next, so that receiving
+ * costs nothing extra; call it periodically from the polling thread.
+ * @param ctx Capture context
+ * @param health Pointer to store the state
+ * @return 0 on success, negative on error
+ */
+int capture_get_health(struct capture_ctx *ctx, struct capture_health *health);
+
+/**
+ * Restart one RX queue, or the whole port, of a capture context
+ *
+ * Recovers a stalled queue or a port whose driver requested a reset without
+ * closing the context. A queue the driver cannot restart on its own restarts
+ * the port. Must not run concurrently with capture_rx_burst() on the context.
+ * @param ctx Capture context
+ * @param queue RX queue number, negative for the port
+ * @return 0 on success, negative on error or if the backend cannot restart
+ */
+int capture_restart(struct capture_ctx *ctx, int queue);
+
+/**
+ * Get the name of the backend of a capture context
+ * @param ctx Capture context
+ * @return Backend name
+ */
+const char *capture_get_backend_name(struct capture_ctx *ctx);
+
+/**
+ * Release all packets and close a capture context
+ * @param ctx Capture context
+ */
+void capture_close(struct capture_ctx *ctx);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,68 @@
+/*
+ * Capture Backend Interface
+ * Operations implemented by each capture backend. Calls are made once per
+ * burst, so the indirection is amortized over up to MAX_PKT_BURST packets.
+ */
+
+#ifndef CAPTURE_BACKEND_H
+#define CAPTURE_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "capture.h"
+
+/* Capture context; priv holds the backend's own state */
+struct capture_ctx {
+    const struct capture_backend *backend;
+    void *priv;
+    int backend_id;     /* CAPTURE_BACKEND_* */
+    int nb_queues;
+    int batch_size;     /* Largest burst, may be lowered by the backend's init */
+    int numa_node;      /* Set by the backend's init, -1 if unknown */
+    int next_queue;     /* Next queue polled by a burst on all queues */
+
+    /* Receive activity, for capture_get_health() */
+    uint64_t rx_packets[MAX_RX_QUEUES];   /* Packets returned per queue */
+    uint64_t seen_packets[MAX_RX_QUEUES]; /* rx_packets at the last health check */
+    uint64_t seen_ms[MAX_RX_QUEUES];      /* Monotonic time packets were last seen */
+};
+
+struct capture_backend {
+    const char *name;
+    size_t priv_size;   /* Bytes allocated for ctx->priv before init */
+
+    /* Open the device; on failure the context is freed without close() */
+    int (*init)(struct capture_ctx *ctx, const struct capture_config *config);
+
+    /* Receive up to max_packets packets from one queue */
+    int (*rx_burst)(struct capture_ctx *ctx, int queue, struct packet *packets,
+                    uint64_t *timestamps, int max_packets);
+
+    /* Return the buffers of the last burst on one queue to the device */
+    void (*release)(struct capture_ctx *ctx, int queue);
+
+    int (*stats)(struct capture_ctx *ctx, struct capture_stats *stats);
+
+    /* Descriptor that polls readable when a queue has packets; NULL if the
+     * backend can only be busy-polled */
+    int (*get_fd)(struct capture_ctx *ctx, int queue);
+
+    /* Link state; NULL if the backend has no link */
+    int (*health)(struct capture_ctx *ctx, struct capture_health *health);
+
+    /* Restart one queue, or the device if queue is negative, with the
+     * buffers of both released; NULL if the backend cannot restart */
+    int (*restart)(struct capture_ctx *ctx, int queue);
+
+    /* Release everything init() acquired */
+    void (*close)(struct capture_ctx *ctx);
+};
+
+#ifdef HAVE_DPDK
+extern const struct capture_backend capture_backend_dpdk;
+#endif
+extern const struct capture_backend capture_backend_pcap;
+extern const struct capture_backend capture_backend_afpacket;
+
+#endif /* CAPTURE_BACKEND_H */
@@ -0,0 +1,158 @@
+/*
+ * Clock Synchronisation Implementation
+ * Calibration of counter to wall-clock mappings
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "clock_sync.h"
+#include "dpdk_capture.h"
+
+/* Counter reads bracketing each clock read; the tightest bracket is kept */
+#define CALIBRATION_TRIES 3
+
+/* Largest deviation of a measured rate from the initial one, in parts per
+ * million. NTP slews by at most 500 ppm; more is a step of the clock. */
+#define MAX_RATE_DEVIATION_PPM 1000
+
+/* Read the counter and the system clock at the same instant */
+static int read_pair(struct clock_sync *cs, uint64_t *ticks, uint64_t *ns)
+{
+    uint64_t before, after, best = UINT64_MAX;
+    struct timespec ts;
+    int i;
+
+    /* A preemption between the reads widens the bracket, so keep the
+     * tightest one and take its midpoint */
+    for (i = 0; i < CALIBRATION_TRIES; i++) {
+        if (cs->read(cs->arg, &before) != 0 || clock_gettime(cs->clock_id, &ts) != 0 ||
+            cs->read(cs->arg, &after) != 0)
+            return -1;
+        if (after - before < best) {
+            best = after - before;
+            *ticks = before + best / 2;
+            *ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+/* Set mult for a rate, keeping the shift */
+static void set_mult(struct clock_sync *cs, double ns_per_tick)
+{
+    cs->mult = (uint64_t)(ns_per_tick * (double)(1ULL << cs->shift) + 0.5);
+    if (cs->mult == 0)
+        cs->mult = 1;
+    cs->max_delta = UINT64_MAX / cs->mult;
+}
+
+int clock_sync_init(struct clock_sync *cs, clock_sync_read_fn read, void *arg, uint64_t hz, int clock)
+{
+    const struct timespec pause = { .tv_sec = 0, .tv_nsec = 10000000 };
+    uint64_t ticks, ns, later_ticks, later_ns;
+    double ns_per_tick;
+
+    memset(cs, 0, sizeof(*cs));
+    cs->read = read;
+    cs->arg = arg;
+    cs->clock_id = clock == CAPTURE_CLOCK_TAI ? CLOCK_TAI : CLOCK_REALTIME;
+
+    if (read_pair(cs, &ticks, &ns) != 0)
+        return -1;
+
+    /* Unknown rate: measure it over a short pause, calibration refines it */
+    if (hz == 0) {
+        nanosleep(&pause, NULL);
+        if (read_pair(cs, &later_ticks, &later_ns) != 0 || later_ticks <= ticks || later_ns <= ns)
+            return -1;
+        hz = (uint64_t)((double)(later_ticks - ticks) * 1e9 / (double)(later_ns - ns));
+        ticks = later_ticks;
+        ns = later_ns;
+    }
+    if (hz < 1000)
+        return -1;
+
+    /* The largest shift that leaves mult below 2^31, with room for the
+     * rate to drift without mult reaching 2^32 */
+    ns_per_tick = 1e9 / (double)hz;
+    cs->shift = 32;
+    while (cs->shift > 0 && ns_per_tick * (double)(1ULL << cs->shift) >= 2147483648.0)
+        cs->shift--;
+    set_mult(cs, ns_per_tick);
+    cs->nominal_mult = cs->mult;
+    cs->period = hz / 1000 * CLOCK_SYNC_PERIOD_MS;
+
+    cs->base_ticks = cs->ref_ticks = ticks;
+    cs->base_ns = cs->ref_ns = ns;
+    cs->calibrations = 1;
+    return 0;
+}
+
+int clock_sync_calibrate(struct clock_sync *cs)
+{
+    uint64_t ticks, ns, elapsed, error_abs, now_ns;
+    double mult, deviation, slew;
+    int64_t error;
+
+    if (read_pair(cs, &ticks, &ns) != 0) {
+        /* Keep converting with the current rate and retry after another period */
+        cs->base_ns = clock_sync_ns(cs, cs->base_ticks + cs->period);
+        cs->base_ticks += cs->period;
+        cs->failures++;
+        return -1;
+    }
+
+    now_ns = clock_sync_ns(cs, ticks);
+    error = (int64_t)(ns - now_ns);
+    error_abs = error < 0 ? (uint64_t)-error : (uint64_t)error;
+    cs->last_error_ns = error;
+    if (error_abs > cs->max_error_ns)
+        cs->max_error_ns = error_abs;
+
+    /* Rate over the time since the last calibration */
+    mult = (double)cs->mult;
+    elapsed = ticks - cs->ref_ticks;
+    if (elapsed > 0 && ns > cs->ref_ns) {
+        double measured = (double)(ns - cs->ref_ns) / (double)elapsed * (double)(1ULL << cs->shift);
+
+        deviation = (measured - (double)cs->nominal_mult) / (double)cs->nominal_mult * 1e6;
+        if (deviation <= MAX_RATE_DEVIATION_PPM && deviation >= -MAX_RATE_DEVIATION_PPM)
+            mult = measured;
+    }
+    cs->ref_ticks = ticks;
+    cs->ref_ns = ns;
+
+    if (error_abs > CLOCK_SYNC_STEP_NS) {
+        /* The system clock was stepped; follow it. Going back is left to
+         * the caller, who holds the last time handed out. */
+        set_mult(cs, mult / (double)(1ULL << cs->shift));
+        cs->base_ns = ns;
+    } else {
+        /* Run the next period fast or slow by the error, within the slew bound */
+        slew = (double)error / ((double)cs->period * mult / (double)(1ULL << cs->shift));
+        if (slew > CLOCK_SYNC_SLEW_PPM * 1e-6)
+            slew = CLOCK_SYNC_SLEW_PPM * 1e-6;
+        else if (slew < -CLOCK_SYNC_SLEW_PPM * 1e-6)
+            slew = -CLOCK_SYNC_SLEW_PPM * 1e-6;
+        set_mult(cs, mult * (1.0 + slew) / (double)(1ULL << cs->shift));
+        cs->base_ns = now_ns;
+    }
+    cs->base_ticks = ticks;
+    cs->calibrations++;
+    return 0;
+}
+
+int64_t clock_sync_tai_offset(void)
+{
+    struct timespec tai, utc;
+    int64_t diff;
+
+    if (clock_gettime(CLOCK_TAI, &tai) != 0 || clock_gettime(CLOCK_REALTIME, &utc) != 0)
+        return 0;
+
+    /* The offset is whole seconds; round away the time between the reads */
+    diff = (int64_t)(tai.tv_sec - utc.tv_sec) * 1000000000LL + (tai.tv_nsec - utc.tv_nsec);
+    return (diff + 500000000LL) / 1000000000LL * 1000000000LL;
+}
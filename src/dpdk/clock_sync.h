@@ -0,0 +1,112 @@
+/*
+ * Clock Synchronisation Header
+ * Maps a free-running tick counter (the TSC, or a NIC's timestamp clock) to
+ * wall-clock nanoseconds. The mapping is recalibrated periodically against
+ * CLOCK_REALTIME or CLOCK_TAI, so it follows the NTP or PTP discipline of
+ * the system clock, and converting a tick count is a multiply and a shift.
+ * Calibration slews the rate rather than moving the offset, so correcting
+ * drift never makes converted times go backwards.
+ */
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Default time between calibrations */
+#define CLOCK_SYNC_PERIOD_MS 1000
+
+/* Largest rate correction while slewing, in parts per million */
+#define CLOCK_SYNC_SLEW_PPM 500
+
+/* Errors up to this are slewed away; larger ones are steps of the system
+ * clock, which the mapping follows at once */
+#define CLOCK_SYNC_STEP_NS 128000000LL
+
+/* Read the counter; returns 0 on success */
+typedef int (*clock_sync_read_fn)(void *arg, uint64_t *ticks);
+
+/*
+ * One counter's mapping to wall-clock time:
+ *   ns = base_ns + ((ticks - base_ticks) * mult >> shift)
+ * Used by a single thread; counters may be read by others.
+ */
+struct clock_sync {
+    uint64_t base_ticks;      /* Counter value at the last calibration */
+    uint64_t base_ns;         /* Converted time at the last calibration */
+    uint64_t mult;            /* Nanoseconds per tick, scaled by 2^shift; below 2^32 */
+    uint32_t shift;
+    uint64_t max_delta;       /* Largest tick delta the multiply cannot overflow */
+    uint64_t period;          /* Ticks between calibrations */
+    uint64_t nominal_mult;    /* mult of the initial rate, to reject outliers */
+    uint64_t ref_ticks;       /* Counter and wall-clock time read at the last */
+    uint64_t ref_ns;          /* calibration, to measure the rate */
+    clockid_t clock_id;       /* CLOCK_REALTIME or CLOCK_TAI */
+    clock_sync_read_fn read;
+    void *arg;
+
+    /* Calibration error: wall-clock time minus the converted time */
+    int64_t last_error_ns;
+    uint64_t max_error_ns;
+    uint64_t calibrations;
+    uint64_t failures;        /* Calibrations that could not read a clock */
+};
+
+/**
+ * Set up a counter mapping and calibrate it once
+ * @param cs Mapping to initialize
+ * @param read Counter read function
+ * @param arg Argument of read
+ * @param hz Counter frequency, 0 to measure it against the system clock
+ * @param clock CAPTURE_CLOCK_REALTIME or CAPTURE_CLOCK_TAI
+ * @return 0 on success, negative if the counter or clock cannot be read
+ */
+int clock_sync_init(struct clock_sync *cs, clock_sync_read_fn read, void *arg, uint64_t hz, int clock);
+
+/**
+ * Recalibrate a mapping against the system clock
+ *
+ * Measures the counter rate over the time since the last calibration and
+ * records how far the previous mapping had drifted. The mapping stays
+ * continuous: the drift is corrected by running the next period fast or
+ * slow, by at most CLOCK_SYNC_SLEW_PPM, unless it exceeds
+ * CLOCK_SYNC_STEP_NS.
+ * @param cs Mapping
+ * @return 0 on success, negative if the counter or clock cannot be read
+ */
+int clock_sync_calibrate(struct clock_sync *cs);
+
+/**
+ * Get the TAI - UTC offset the kernel applies to CLOCK_TAI
+ * @return Offset in nanoseconds, 0 if the kernel's offset is not set
+ */
+int64_t clock_sync_tai_offset(void);
+
+/* Scale a tick delta to nanoseconds */
+static inline uint64_t clock_sync_scale(const struct clock_sync *cs, uint64_t delta)
+{
+    if (delta <= cs->max_delta)
+        return (delta * cs->mult) >> cs->shift;
+
+    /* Long since calibration: split the multiply, both halves fit as mult < 2^32 */
+    return (delta >> cs->shift) * cs->mult +
+           (((delta & ((1ULL << cs->shift) - 1)) * cs->mult) >> cs->shift);
+}
+
+/* Convert a counter value to wall-clock nanoseconds; values before the
+ * last calibration (NIC timestamps of packets already queued) are allowed */
+static inline uint64_t clock_sync_ns(const struct clock_sync *cs, uint64_t ticks)
+{
+    if (ticks >= cs->base_ticks)
+        return cs->base_ns + clock_sync_scale(cs, ticks - cs->base_ticks);
+    return cs->base_ns - clock_sync_scale(cs, cs->base_ticks - ticks);
+}
+
+/* Whether the mapping is due for calibration at counter value ticks */
+static inline int clock_sync_due(const struct clock_sync *cs, uint64_t ticks)
+{
+    return ticks - cs->base_ticks >= cs->period;
+}
+
+#endif /* CLOCK_SYNC_H */
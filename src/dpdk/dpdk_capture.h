@@ -7,22 +7,90 @@
 #define DPDK_CAPTURE_H
 
 #include <stdint.h>
-#include <rte_mbuf.h>
 
 /* Maximum number of packets in a batch */
 #define MAX_PKT_BURST 32
 #define MAX_CORES 16
+#define MAX_RX_QUEUES 16
+
+/* Capture backends selectable at initialization */
+#define CAPTURE_BACKEND_PCI 0       /* NIC bound to a DPDK driver (vfio-pci, uio) */
+#define CAPTURE_BACKEND_AF_XDP 1    /* Kernel interface through the net_af_xdp PMD */
+#define CAPTURE_BACKEND_VDEV 2      /* Any DPDK virtual device, from devargs */
+#define CAPTURE_BACKEND_PCAP 3      /* Replay of a pcap file, without DPDK */
+#define CAPTURE_BACKEND_AF_PACKET 4 /* Kernel TPACKET_V3 rings, without DPDK */
+#define CAPTURE_BACKEND_COUNT 5
+
+/* Reference clocks for packet timestamps */
+#define CAPTURE_CLOCK_REALTIME 0    /* UTC, as NTP or PTP disciplines the system clock */
+#define CAPTURE_CLOCK_TAI 1         /* TAI, without leap seconds; needs the kernel's TAI offset set */
+
+/* Default mbuf pool sizing */
+#define NUM_MBUFS 8192
+#define MBUF_CACHE_SIZE 250
+
+/* Receive metadata in packet.rx_flags, filled in from NIC or kernel offloads */
+#define PACKET_RX_PTYPE             0x01 /* Packet type classified, PACKET_RX_IPV4 is meaningful */
+#define PACKET_RX_IPV4              0x02 /* Ethernet without VLAN tags, carrying IPv4 */
+#define PACKET_RX_RSS_HASH          0x04 /* rss_hash is set */
+#define PACKET_RX_IP_CKSUM_CHECKED  0x08 /* IPv4 header checksum verified */
+#define PACKET_RX_IP_CKSUM_BAD      0x10
+#define PACKET_RX_L4_CKSUM_CHECKED  0x20 /* TCP or UDP checksum verified */
+#define PACKET_RX_L4_CKSUM_BAD      0x40
 
 /* Packet structure for captured data */
 struct packet {
     uint8_t *data;      /* Packet data pointer */
     uint16_t length;    /* Packet length */
     uint8_t port;       /* Port number */
-    uint32_t timestamp; /* Capture timestamp */
+    uint8_t rx_flags;   /* PACKET_RX_*, 0 if the backend has no offloads */
+    uint32_t timestamp; /* Capture time, seconds since the epoch of the reference clock */
+    uint32_t rss_hash;  /* Receive hash of the NIC or kernel, if PACKET_RX_RSS_HASH */
+};
+
+/* Alignment of packets in a packed burst, see capture_pack_burst() */
+#define PACKED_ALIGN 8
+
+/* Packet of a packed burst: its data is at offset in the burst's buffer */
+struct packed_packet {
+    uint64_t timestamp_ns;  /* Capture time in nanoseconds */
+    uint32_t offset;        /* Start of the packet data, a multiple of PACKED_ALIGN */
+    uint32_t rss_hash;
+    uint16_t length;
+    uint8_t port;
+    uint8_t rx_flags;
+};
+
+/* Capture configuration for capture_open() and dpdk_init_config() */
+struct capture_config {
+    int backend;        /* CAPTURE_BACKEND_* */
+    int port;           /* DPDK port number (PCI backend) */
+    const char *iface;  /* Kernel interface name (AF_XDP and AF_PACKET backends) */
+    int queues;         /* Number of RX queues, 1 to MAX_RX_QUEUES */
+    const char *cores;  /* CPU cores to use (e.g., "0-1"), DPDK backends only */
+    int batch_size;     /* Maximum packets per batch */
+    const char *source; /* Pcap file (PCAP) or devargs such as "net_pcap0,iface=eth0" (VDEV) */
+    unsigned num_mbufs; /* Mbufs in the context's pool, 0 for NUM_MBUFS */
+    int clock;          /* CAPTURE_CLOCK_*, reference clock of receive timestamps */
+};
+
+/* Memory footprint of the capture library, in bytes */
+struct dpdk_mem_stats {
+    uint64_t mempool_bytes;      /* Total size of all mbuf pools */
+    uint64_t mempool_in_use;     /* Bytes held by mbufs currently in use */
+    uint64_t mempool_in_use_hwm; /* High-water mark of mempool_in_use */
+    uint32_t mbuf_count;         /* Number of mbufs in the pools */
+    uint32_t mbuf_in_use;        /* Number of mbufs currently in use */
 };
 
 /* Function prototypes */
 
+/**
+ * Set the number of mbufs allocated by the next dpdk_init() call
+ * @param num_mbufs Number of mbufs in the pool (0 restores NUM_MBUFS)
+ */
+void dpdk_set_mbuf_count(unsigned num_mbufs);
+
 /**
  * Initialize DPDK environment and configure packet capture
  * @param port DPDK port number
@@ -32,14 +100,51 @@ struct packet {
  */
 int dpdk_init(int port, const char *cores, int batch_size);
 
+/**
+ * Initialize DPDK with an explicit capture backend
+ *
+ * The AF_XDP backend creates a net_af_xdp virtual device on config->iface,
+ * bound to its first config->queues kernel RX queues; the interface stays
+ * under kernel control. Packets are delivered through the same
+ * dpdk_capture_packets() API as with the PCI backend.
+ * @param config Capture configuration
+ * @return 0 on success, negative on error
+ */
+int dpdk_init_config(const struct capture_config *config);
+
 /**
  * Capture packets from the network interface
+ *
+ * With several RX queues, queues are polled in turn until the batch is full.
  * @param packets Array to store captured packets
  * @param max_packets Maximum number of packets to capture
  * @return Number of packets captured, negative on error
  */
 int dpdk_capture_packets(struct packet *packets, int max_packets);
 
+/**
+ * Capture packets from one RX queue
+ * @param queue RX queue number
+ * @param packets Array to store captured packets
+ * @param max_packets Maximum number of packets to capture
+ * @return Number of packets captured, negative on error
+ */
+int dpdk_capture_packets_queue(int queue, struct packet *packets, int max_packets);
+
+/**
+ * Get the number of configured RX queues
+ * @return Number of RX queues, 0 if not initialized
+ */
+int dpdk_get_nb_queues(void);
+
+/**
+ * Get the DPDK port number being captured from
+ *
+ * For the AF_XDP backend this is the port of the virtual device.
+ * @return Port number
+ */
+int dpdk_get_port_id(void);
+
 /**
  * Cleanup DPDK resources and shutdown
  */
@@ -57,4 +162,18 @@ void dpdk_cleanup(void);
 int dpdk_get_stats(int port, uint64_t *rx_packets, uint64_t *tx_packets,
                    uint64_t *rx_bytes, uint64_t *tx_bytes);
 
+/**
+ * Get the NUMA node of a port
+ * @param port Port number
+ * @return NUMA node id, negative if unknown or on error
+ */
+int dpdk_get_port_socket(int port);
+
+/**
+ * Get memory usage of the capture library
+ * @param stats Pointer to store memory statistics
+ * @return 0 on success, negative on error
+ */
+int dpdk_get_mem_stats(struct dpdk_mem_stats *stats);
+
 #endif /* DPDK_CAPTURE_H */
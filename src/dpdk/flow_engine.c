@@ -0,0 +1,1046 @@
+/*
+ * Native Flow Engine Implementation
+ * Open-addressing flow table with streaming per-flow statistics
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "flow_engine.h"
+#include "flow_key.h"
+
+#define ETHER_HDR_LEN 14
+#define ETHER_TYPE_IPV4 0x0800
+#define ETHER_TYPE_VLAN 0x8100
+#define ETHER_TYPE_QINQ 0x88A8
+#define VLAN_TAG_LEN 4
+#define VXLAN_PORT 4789
+#define VXLAN_HDR_LEN 8
+#define VXLAN_FLAG_VNI 0x08
+#define IPV4_MIN_HDR_LEN 20
+#define TCP_MIN_HDR_LEN 20
+#define UDP_HDR_LEN 8
+#define PROTO_TCP 6
+#define PROTO_UDP 17
+
+#define NS_PER_SEC 1000000000ULL
+#define MIN_FLOW_DURATION 0.000001
+
+/*
+ * Python computes the variance as std ** 2 with libm pow(), which is not
+ * always the correctly rounded std * std; a constant exponent would let the
+ * compiler fold pow() back into the product
+ */
+static volatile double variance_exponent = 2.0;
+
+/* End of a flow table's list by last_ns */
+#define FLOW_NIL UINT32_MAX
+
+/* Canonical (direction-independent) flow key, see flow_key_pack() */
+struct flow_key {
+    uint8_t bytes[FLOW_KEY_V4_LEN];
+};
+
+/* Per-flow state kept in the table */
+struct flow_entry {
+    uint64_t hash;         /* flow_key_hash() of key */
+    struct flow_key key;
+    uint8_t in_use;
+    uint8_t tcp_flags;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t src_ip[4];
+    uint8_t dst_ip[4];
+    uint32_t bad_checksum;     /* Packets with a bad checksum */
+    uint64_t start_ns;
+    uint64_t last_ns;
+    uint32_t older;        /* Neighbours in the table's list by last_ns, FLOW_NIL at the ends */
+    uint32_t newer;
+    uint64_t packet_count;
+    uint64_t byte_count;
+    uint32_t len_min;
+    uint32_t len_max;
+    double len_mean;       /* Welford running mean and sum of squares */
+    double len_m2;
+    double iat_mean;
+    double iat_m2;
+    double iat_min;
+    double iat_max;
+};
+
+/* Parsed header fields of one packet */
+struct parsed_packet {
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t protocol;
+    uint8_t tcp_flags;
+    uint8_t has_tcp_flags;
+    uint8_t bad_checksum;
+    uint16_t tenant;
+    uint16_t length;       /* Of the frame parsed, without the tags or tunnel headers skipped */
+};
+
+/* Flow table of one tenant */
+struct flow_table {
+    struct flow_entry *entries;
+    uint32_t mask;             /* Table size minus one, size is a power of two */
+    uint32_t oldest;           /* Ends of the list of active flows by last_ns, FLOW_NIL if empty */
+    uint32_t newest;
+    struct flow_tenant_stats stats;
+};
+
+/* Configuration as used by the data path, with the tenant overrides applied */
+struct engine_config {
+    struct flow_engine_config user;
+    struct flow_tenant_table *tenants;  /* Copy of user.tenants, NULL if none */
+    uint8_t *vnis;                      /* Copy of user.tenants->vnis */
+    double timeout[FLOW_ENGINE_MAX_TENANTS];    /* Seconds */
+    uint32_t sample_rate[FLOW_ENGINE_MAX_TENANTS];
+};
+
+struct flow_engine {
+    struct flow_table *tables;     /* One per tenant */
+    uint16_t nb_tables;
+    struct engine_config *config;  /* Swapped atomically by flow_engine_set_config() */
+    uint32_t in_burst;             /* Set while the data path holds a config pointer */
+    uint64_t bursts;               /* Incremented when the data path lets go of it */
+    pthread_mutex_t config_lock;   /* Serializes configuration writers */
+    struct flow_engine_config user_config;  /* Writer-side copy, under config_lock */
+    struct flow_engine_stats stats;
+};
+
+static inline uint16_t read_be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t read_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void write_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* Ones' complement sum of len bytes, folded to 16 bits */
+static uint32_t cksum_add(uint32_t sum, const uint8_t *p, uint32_t len)
+{
+    while (len >= 2) {
+        sum += read_be16(p);
+        p += 2;
+        len -= 2;
+    }
+    if (len)
+        sum += (uint32_t)p[0] << 8;
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+/*
+ * Software fallback for checksums the capture backend did not verify, see
+ * checksum.packet_checksum_bad(). TCP and UDP checksums are only checked
+ * when the whole unfragmented datagram was captured.
+ */
+static int checksum_bad(uint8_t rx_flags, const uint8_t *ip, uint32_t ip_len, uint32_t hdr_len,
+                        uint8_t protocol)
+{
+    uint32_t total_len, l4_len, sum;
+    const uint8_t *l4;
+
+    if (!(rx_flags & PACKET_RX_IP_CKSUM_CHECKED)) {
+        if (hdr_len < IPV4_MIN_HDR_LEN || cksum_add(0, ip, hdr_len) != 0xFFFF)
+            return 1;
+    } else if (rx_flags & PACKET_RX_IP_CKSUM_BAD) {
+        return 1;
+    }
+
+    if (protocol != PROTO_TCP && protocol != PROTO_UDP)
+        return 0;
+    if (rx_flags & PACKET_RX_L4_CKSUM_CHECKED)
+        return (rx_flags & PACKET_RX_L4_CKSUM_BAD) != 0;
+
+    total_len = read_be16(ip + 2);
+    if (total_len > ip_len || total_len < hdr_len || (read_be16(ip + 6) & 0x3FFF) != 0)
+        return 0;
+    l4 = ip + hdr_len;
+    l4_len = total_len - hdr_len;
+    if (protocol == PROTO_TCP ? l4_len < TCP_MIN_HDR_LEN : l4_len < UDP_HDR_LEN)
+        return 0;
+    /* A zero UDP checksum means the sender did not compute one */
+    if (protocol == PROTO_UDP && read_be16(l4 + 6) == 0)
+        return 0;
+
+    sum = cksum_add(protocol + l4_len, ip + 12, 8);
+    return cksum_add(sum, l4, l4_len) != 0xFFFF;
+}
+
+static inline int is_vlan_tpid(uint16_t ethertype)
+{
+    return ethertype == ETHER_TYPE_VLAN || ethertype == ETHER_TYPE_QINQ;
+}
+
+/*
+ * Tenant of a frame by its outer VLAN ID or its VXLAN VNI, see
+ * TenantMap.classify(). Sets *offset to the start of the frame its flows
+ * are parsed from: past the VLAN tags, so the inner EtherType is where an
+ * untagged frame has it, or the inner frame of a tenant's VXLAN packet.
+ */
+static uint16_t classify_tenant(const struct flow_tenant_table *tt, const uint8_t *data,
+                                uint32_t length, uint32_t *offset)
+{
+    uint16_t tenant = 0, ethertype;
+    uint32_t ip, udp, vni;
+    uint8_t vni_tenant;
+
+    *offset = 0;
+    if (length < ETHER_HDR_LEN)
+        return 0;
+
+    ethertype = read_be16(data + 12);
+    if (is_vlan_tpid(ethertype) && length >= ETHER_HDR_LEN + VLAN_TAG_LEN) {
+        /* The outer tag identifies the tenant; a QinQ inner tag is skipped too */
+        tenant = tt->vlan[read_be16(data + 14) & (FLOW_TENANT_VLANS - 1)];
+        *offset = VLAN_TAG_LEN;
+        ethertype = read_be16(data + 16);
+        if (is_vlan_tpid(ethertype) && length >= ETHER_HDR_LEN + 2 * VLAN_TAG_LEN) {
+            *offset = 2 * VLAN_TAG_LEN;
+            ethertype = read_be16(data + 20);
+        }
+    }
+
+    if (tt->nb_vni_pages == 0 || ethertype != ETHER_TYPE_IPV4)
+        return tenant;
+
+    ip = *offset + ETHER_HDR_LEN;
+    if (length < ip + IPV4_MIN_HDR_LEN || data[ip + 9] != PROTO_UDP ||
+        (read_be16(data + ip + 6) & 0x3FFF) != 0)
+        return tenant;
+    udp = ip + (data[ip] & 0x0F) * 4;
+    if (length < udp + UDP_HDR_LEN + VXLAN_HDR_LEN + ETHER_HDR_LEN ||
+        read_be16(data + udp + 2) != VXLAN_PORT || !(data[udp + 8] & VXLAN_FLAG_VNI))
+        return tenant;
+
+    vni = ((uint32_t)data[udp + 12] << 16) | read_be16(data + udp + 13);
+    vni_tenant = tt->vnis[((uint32_t)tt->vni_page[vni >> FLOW_TENANT_VNI_PAGE_BITS] << FLOW_TENANT_VNI_PAGE_BITS) |
+                          (vni & (FLOW_TENANT_VNI_PAGE_SIZE - 1))];
+    if (vni_tenant == 0)
+        return tenant;
+    *offset = udp + UDP_HDR_LEN + VXLAN_HDR_LEN;
+    return vni_tenant;
+}
+
+/*
+ * Parse Ethernet/IPv4/TCP/UDP headers with the same acceptance rules as
+ * FeatureExtractor.extract_features(). Returns 0 if the packet is IPv4.
+ * A packet type classified by the NIC replaces the Ethernet and IP version
+ * checks. With a tenant table, the tenant is classified first and the
+ * headers parsed from the frame classify_tenant() points to.
+ */
+static int parse_packet(const struct packet *pkt, const struct flow_tenant_table *tenants,
+                        struct parsed_packet *pp)
+{
+    const uint8_t *data = pkt->data;
+    uint16_t length = pkt->length;
+    uint8_t rx_flags = pkt->rx_flags;
+    const uint8_t *ip, *l4;
+    uint32_t ip_len, l4_len, hdr_len, offset;
+
+    pp->tenant = 0;
+    if (tenants != NULL) {
+        pp->tenant = classify_tenant(tenants, data, length, &offset);
+        if (offset > 0) {
+            /*
+             * Offload results describe the outer frame; checksum verdicts
+             * only still hold for the same IP packet behind VLAN tags
+             */
+            rx_flags = offset <= 2 * VLAN_TAG_LEN ?
+                rx_flags & ~(PACKET_RX_PTYPE | PACKET_RX_IPV4) : 0;
+            data += offset;
+            length -= offset;
+        }
+    }
+
+    if (rx_flags & PACKET_RX_PTYPE) {
+        if (!(rx_flags & PACKET_RX_IPV4) || length < ETHER_HDR_LEN + IPV4_MIN_HDR_LEN)
+            return -1;
+        ip = data + ETHER_HDR_LEN;
+        ip_len = length - ETHER_HDR_LEN;
+        hdr_len = (ip[0] & 0x0F) * 4;
+        if (ip_len < hdr_len)
+            return -1;
+    } else {
+        if (length < ETHER_HDR_LEN || read_be16(data + 12) != ETHER_TYPE_IPV4)
+            return -1;
+
+        ip = data + ETHER_HDR_LEN;
+        ip_len = length - ETHER_HDR_LEN;
+        if (ip_len < IPV4_MIN_HDR_LEN)
+            return -1;
+
+        hdr_len = (ip[0] & 0x0F) * 4;
+        if ((ip[0] >> 4) != 4 || ip_len < hdr_len)
+            return -1;
+    }
+
+    pp->protocol = ip[9];
+    pp->src_ip = read_be32(ip + 12);
+    pp->dst_ip = read_be32(ip + 16);
+    pp->src_port = 0;
+    pp->dst_port = 0;
+    pp->tcp_flags = 0;
+    pp->has_tcp_flags = 0;
+
+    l4 = ip + hdr_len;
+    l4_len = ip_len - hdr_len;
+
+    if (pp->protocol == PROTO_TCP) {
+        if (l4_len >= TCP_MIN_HDR_LEN && l4_len >= (uint32_t)(l4[12] >> 4) * 4) {
+            pp->src_port = read_be16(l4);
+            pp->dst_port = read_be16(l4 + 2);
+            pp->tcp_flags = l4[13];
+            pp->has_tcp_flags = 1;
+        }
+    } else if (pp->protocol == PROTO_UDP) {
+        if (l4_len >= UDP_HDR_LEN) {
+            pp->src_port = read_be16(l4);
+            pp->dst_port = read_be16(l4 + 2);
+        }
+    }
+
+    pp->bad_checksum = checksum_bad(rx_flags, ip, ip_len, hdr_len, pp->protocol);
+    pp->length = length;
+    return 0;
+}
+
+static inline void make_key(const struct parsed_packet *pp, struct flow_key *key)
+{
+    flow_key_pack_v4(key->bytes, pp->src_ip, pp->dst_ip, pp->src_port, pp->dst_port,
+                     pp->protocol);
+}
+
+static inline int key_equal(const struct flow_key *a, const struct flow_key *b)
+{
+    return memcmp(a->bytes, b->bytes, FLOW_KEY_V4_LEN) == 0;
+}
+
+/* Find the slot holding key, or the empty slot where it would be inserted */
+static struct flow_entry *lookup_slot(struct flow_table *t, const struct flow_key *key,
+                                      uint64_t hash)
+{
+    uint32_t idx = (uint32_t)hash & t->mask;
+
+    for (;;) {
+        struct flow_entry *e = &t->entries[idx];
+        if (!e->in_use || (e->hash == hash && key_equal(&e->key, key)))
+            return e;
+        idx = (idx + 1) & t->mask;
+    }
+}
+
+/*
+ * Active flows are kept in a list ordered by last_ns, so expiry only looks
+ * at the oldest ones. Packets mostly arrive in time order: a flow seen
+ * again moves to the newest end, and a late timestamp walks back a little.
+ */
+static void list_unlink(struct flow_table *t, uint32_t idx)
+{
+    struct flow_entry *e = &t->entries[idx];
+
+    if (e->older != FLOW_NIL)
+        t->entries[e->older].newer = e->newer;
+    else
+        t->oldest = e->newer;
+    if (e->newer != FLOW_NIL)
+        t->entries[e->newer].older = e->older;
+    else
+        t->newest = e->older;
+}
+
+static void list_insert(struct flow_table *t, uint32_t idx)
+{
+    struct flow_entry *e = &t->entries[idx];
+    uint32_t pos = t->newest;
+
+    while (pos != FLOW_NIL && t->entries[pos].last_ns > e->last_ns)
+        pos = t->entries[pos].older;
+
+    e->older = pos;
+    e->newer = pos != FLOW_NIL ? t->entries[pos].newer : t->oldest;
+    if (pos != FLOW_NIL)
+        t->entries[pos].newer = idx;
+    else
+        t->oldest = idx;
+    if (e->newer != FLOW_NIL)
+        t->entries[e->newer].older = idx;
+    else
+        t->newest = idx;
+}
+
+/* Reposition a flow whose last_ns changed */
+static inline void list_touch(struct flow_table *t, uint32_t idx)
+{
+    const struct flow_entry *e = &t->entries[idx];
+
+    if (e->newer == FLOW_NIL && (e->older == FLOW_NIL || t->entries[e->older].last_ns <= e->last_ns))
+        return;
+    list_unlink(t, idx);
+    list_insert(t, idx);
+}
+
+/* Point the list neighbours of an entry moved to idx at its new slot */
+static void list_moved(struct flow_table *t, uint32_t idx)
+{
+    const struct flow_entry *e = &t->entries[idx];
+
+    if (e->older != FLOW_NIL)
+        t->entries[e->older].newer = idx;
+    else
+        t->oldest = idx;
+    if (e->newer != FLOW_NIL)
+        t->entries[e->newer].older = idx;
+    else
+        t->newest = idx;
+}
+
+/* Remove an entry using backward-shift deletion to keep probe chains intact */
+static void remove_slot(struct flow_engine *fe, struct flow_table *t, uint32_t idx)
+{
+    uint32_t next = (idx + 1) & t->mask;
+
+    list_unlink(t, idx);
+    while (t->entries[next].in_use) {
+        uint32_t home = (uint32_t)t->entries[next].hash & t->mask;
+
+        /* Move the entry back if its home slot is not between idx and next */
+        if (((next - home) & t->mask) >= ((next - idx) & t->mask)) {
+            t->entries[idx] = t->entries[next];
+            list_moved(t, idx);
+            idx = next;
+        }
+        next = (next + 1) & t->mask;
+    }
+
+    t->entries[idx].in_use = 0;
+    t->stats.active_flows--;
+    fe->stats.active_flows--;
+}
+
+static void init_flow(struct flow_entry *e, const struct flow_key *key, uint64_t hash,
+                      const struct parsed_packet *pp, uint64_t ts_ns)
+{
+    memset(e, 0, sizeof(*e));
+    e->key = *key;
+    e->hash = hash;
+    e->in_use = 1;
+    write_be32(e->src_ip, pp->src_ip);
+    write_be32(e->dst_ip, pp->dst_ip);
+    e->src_port = pp->src_port;
+    e->dst_port = pp->dst_port;
+    e->start_ns = ts_ns;
+    e->last_ns = ts_ns;
+    e->len_min = UINT32_MAX;
+}
+
+static void update_flow(struct flow_entry *e, const struct parsed_packet *pp,
+                        uint16_t length, uint64_t ts_ns)
+{
+    double delta;
+
+    e->packet_count++;
+    e->byte_count += length;
+
+    if (length < e->len_min)
+        e->len_min = length;
+    if (length > e->len_max)
+        e->len_max = length;
+
+    delta = length - e->len_mean;
+    e->len_mean += delta / e->packet_count;
+    e->len_m2 += delta * (length - e->len_mean);
+
+    /* Calculate inter-arrival time */
+    if (e->packet_count > 1) {
+        double iat = ((double)ts_ns - (double)e->last_ns) / NS_PER_SEC;
+        uint64_t n = e->packet_count - 1;
+
+        if (n == 1 || iat < e->iat_min)
+            e->iat_min = iat;
+        if (n == 1 || iat > e->iat_max)
+            e->iat_max = iat;
+
+        delta = iat - e->iat_mean;
+        e->iat_mean += delta / n;
+        e->iat_m2 += delta * (iat - e->iat_mean);
+    }
+
+    e->last_ns = ts_ns;
+
+    if (pp->protocol == PROTO_TCP && pp->has_tcp_flags)
+        e->tcp_flags |= pp->tcp_flags;
+
+    e->bad_checksum += pp->bad_checksum;
+}
+
+static void fill_record(const struct flow_entry *e, uint64_t now_ns, uint16_t tenant,
+                        struct flow_record *rec)
+{
+    uint64_t iat_count = e->packet_count - 1;
+    double duration = ((double)e->last_ns - (double)e->start_ns) / NS_PER_SEC;
+
+    memcpy(rec->src_ip, e->src_ip, 4);
+    memcpy(rec->dst_ip, e->dst_ip, 4);
+    rec->src_port = e->src_port;
+    rec->dst_port = e->dst_port;
+    rec->protocol = e->key.bytes[FLOW_KEY_V4_LEN - 1];
+    rec->tcp_flags = rec->protocol == PROTO_TCP ? e->tcp_flags : 0;
+    rec->valid = 1;
+    rec->end_reason = FLOW_END_NONE;
+
+    if (duration < MIN_FLOW_DURATION)
+        duration = MIN_FLOW_DURATION;
+    rec->flow_duration = duration;
+
+    rec->total_fwd_packets = e->packet_count;
+    rec->total_length_fwd_packets = e->byte_count;
+    rec->packet_length_max = e->len_max;
+    rec->packet_length_min = e->len_min;
+    rec->packet_length_mean = e->len_mean;
+    rec->packet_length_std = e->packet_count > 1 ?
+        sqrt(e->len_m2 / (e->packet_count - 1)) : 0.0;
+    rec->packet_length_variance = pow(rec->packet_length_std, variance_exponent);
+
+    rec->flow_bytes_per_second = e->byte_count / duration;
+    rec->flow_packets_per_second = e->packet_count / duration;
+
+    if (iat_count > 0) {
+        rec->flow_iat_mean = e->iat_mean;
+        rec->flow_iat_std = iat_count > 1 ? sqrt(e->iat_m2 / (iat_count - 1)) : 0.0;
+        rec->flow_iat_max = e->iat_max;
+        rec->flow_iat_min = e->iat_min;
+    } else {
+        rec->flow_iat_mean = 0.0;
+        rec->flow_iat_std = 0.0;
+        rec->flow_iat_max = 0.0;
+        rec->flow_iat_min = 0.0;
+    }
+
+    rec->timestamp = now_ns / 1000;
+    rec->bad_checksum_packets = e->bad_checksum;
+    rec->tenant = tenant;
+}
+
+/* Whether all tenant indexes of a table are flow tables of the engine */
+static int tenant_table_valid(const struct flow_tenant_table *tt, uint16_t nb_tables)
+{
+    uint32_t i;
+
+    if (tt->nb_vni_pages > FLOW_TENANT_VNI_PAGES + 1 || (tt->nb_vni_pages > 0 && tt->vnis == NULL))
+        return 0;
+    for (i = 0; i < FLOW_TENANT_VLANS; i++)
+        if (tt->vlan[i] >= nb_tables)
+            return 0;
+    if (tt->nb_vni_pages == 0)
+        return 1;
+    for (i = 0; i < FLOW_TENANT_VNI_PAGES; i++)
+        if (tt->vni_page[i] >= tt->nb_vni_pages)
+            return 0;
+    for (i = 0; i < tt->nb_vni_pages * FLOW_TENANT_VNI_PAGE_SIZE; i++)
+        if (tt->vnis[i] >= nb_tables)
+            return 0;
+    return 1;
+}
+
+static void free_config(struct engine_config *cfg)
+{
+    if (cfg == NULL)
+        return;
+
+    free(cfg->vnis);
+    free(cfg->tenants);
+    free(cfg);
+}
+
+static struct engine_config *make_config(const struct flow_engine *fe,
+                                         const struct flow_engine_config *config)
+{
+    const struct flow_tenant_table *tt = config->tenants;
+    struct engine_config *cfg = calloc(1, sizeof(*cfg));
+    uint32_t i;
+
+    if (cfg == NULL)
+        return NULL;
+
+    cfg->user = *config;
+    if (cfg->user.flow_timeout <= 0)
+        cfg->user.flow_timeout = FLOW_ENGINE_TIMEOUT;
+    if (cfg->user.sample_rate == 0)
+        cfg->user.sample_rate = 1;
+
+    if (tt != NULL) {
+        size_t vnis_size = (size_t)tt->nb_vni_pages * FLOW_TENANT_VNI_PAGE_SIZE;
+
+        cfg->tenants = malloc(sizeof(*cfg->tenants));
+        cfg->vnis = vnis_size ? malloc(vnis_size) : NULL;
+        if (cfg->tenants == NULL || (vnis_size && cfg->vnis == NULL)) {
+            free_config(cfg);
+            return NULL;
+        }
+        *cfg->tenants = *tt;
+        if (vnis_size)
+            memcpy(cfg->vnis, tt->vnis, vnis_size);
+        cfg->tenants->vnis = cfg->vnis;
+        cfg->user.tenants = cfg->tenants;
+    }
+
+    for (i = 0; i < fe->nb_tables; i++) {
+        double timeout = tt && tt->flow_timeout[i] > 0 ? tt->flow_timeout[i] : cfg->user.flow_timeout;
+
+        cfg->timeout[i] = timeout;
+        cfg->sample_rate[i] = tt && tt->sample_rate[i] ? tt->sample_rate[i] : cfg->user.sample_rate;
+    }
+    return cfg;
+}
+
+/*
+ * RCU-style read side: the data path announces itself before loading the
+ * configuration pointer and keeps it until the end of the burst
+ */
+static inline const struct engine_config *reader_enter(struct flow_engine *fe)
+{
+    __atomic_store_n(&fe->in_burst, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&fe->config, __ATOMIC_SEQ_CST);
+}
+
+static inline void reader_exit(struct flow_engine *fe)
+{
+    __atomic_add_fetch(&fe->bursts, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&fe->in_burst, 0, __ATOMIC_RELEASE);
+}
+
+/* Wait until a burst that may hold the old configuration has finished */
+static void wait_for_reader(struct flow_engine *fe)
+{
+    uint64_t bursts = __atomic_load_n(&fe->bursts, __ATOMIC_ACQUIRE);
+
+    while (__atomic_load_n(&fe->in_burst, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&fe->bursts, __ATOMIC_ACQUIRE) == bursts)
+        sched_yield();
+}
+
+struct flow_engine *flow_engine_create(uint32_t max_flows, double flow_timeout)
+{
+    return flow_engine_create_tenants(1, &max_flows, flow_timeout);
+}
+
+struct flow_engine *flow_engine_create_tenants(uint16_t nb_tenants, const uint32_t *max_flows,
+                                               double flow_timeout)
+{
+    struct flow_engine_config config = { .flow_timeout = flow_timeout, .sample_rate = 1 };
+    struct flow_engine *fe;
+    uint16_t i;
+
+    if (nb_tenants == 0 || nb_tenants > FLOW_ENGINE_MAX_TENANTS || max_flows == NULL) {
+        printf("Error: invalid number of tenants %u\n", nb_tenants);
+        return NULL;
+    }
+
+    fe = calloc(1, sizeof(*fe));
+    if (fe == NULL)
+        return NULL;
+
+    fe->tables = calloc(nb_tenants, sizeof(struct flow_table));
+    if (fe->tables == NULL) {
+        free(fe);
+        return NULL;
+    }
+    fe->nb_tables = nb_tenants;
+    fe->stats.memory_bytes = sizeof(*fe) + nb_tenants * sizeof(struct flow_table);
+
+    for (i = 0; i < nb_tenants; i++) {
+        struct flow_table *t = &fe->tables[i];
+        uint32_t limit = max_flows[i] ? max_flows[i] : FLOW_ENGINE_MAX_FLOWS;
+        uint32_t size = 1;
+
+        if (limit > (1U << 30)) {
+            printf("Error: flow table size %u too large\n", limit);
+            flow_engine_destroy(fe);
+            return NULL;
+        }
+
+        /* Keep the load factor at or below 50% */
+        while (size < limit * 2)
+            size <<= 1;
+
+        t->entries = calloc(size, sizeof(struct flow_entry));
+        if (t->entries == NULL) {
+            printf("Error: cannot allocate flow table of %u entries\n", size);
+            flow_engine_destroy(fe);
+            return NULL;
+        }
+        t->mask = size - 1;
+        t->oldest = t->newest = FLOW_NIL;
+        t->stats.max_flows = limit;
+        fe->stats.max_flows += limit;
+        fe->stats.memory_bytes += (uint64_t)size * sizeof(struct flow_entry);
+    }
+
+    fe->config = make_config(fe, &config);
+    if (fe->config == NULL) {
+        flow_engine_destroy(fe);
+        return NULL;
+    }
+    fe->user_config = fe->config->user;
+    pthread_mutex_init(&fe->config_lock, NULL);
+
+    return fe;
+}
+
+void flow_engine_destroy(struct flow_engine *fe)
+{
+    uint16_t i;
+
+    if (fe == NULL)
+        return;
+
+    if (fe->config != NULL)
+        pthread_mutex_destroy(&fe->config_lock);
+    free_config(fe->config);
+    for (i = 0; i < fe->nb_tables; i++)
+        free(fe->tables[i].entries);
+    free(fe->tables);
+    free(fe);
+}
+
+int flow_engine_set_config(struct flow_engine *fe, const struct flow_engine_config *config)
+{
+    struct engine_config *cfg, *old;
+
+    if (fe == NULL || config == NULL)
+        return -1;
+    if (config->tenants != NULL && !tenant_table_valid(config->tenants, fe->nb_tables))
+        return -1;
+
+    cfg = make_config(fe, config);
+    if (cfg == NULL)
+        return -2;
+
+    /*
+     * One writer at a time: wait_for_reader() only tells the data path's
+     * bursts apart, so the control thread must never enter the read side
+     */
+    pthread_mutex_lock(&fe->config_lock);
+    old = __atomic_exchange_n(&fe->config, cfg, __ATOMIC_SEQ_CST);
+    wait_for_reader(fe);
+    free_config(old);
+    fe->user_config = cfg->user;
+    pthread_mutex_unlock(&fe->config_lock);
+
+    __atomic_add_fetch(&fe->stats.config_version, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int flow_engine_get_config(struct flow_engine *fe, struct flow_engine_config *config)
+{
+    if (fe == NULL || config == NULL)
+        return -1;
+
+    pthread_mutex_lock(&fe->config_lock);
+    *config = fe->user_config;
+    pthread_mutex_unlock(&fe->config_lock);
+    return 0;
+}
+
+/*
+ * Whether a flow last seen at last_ns is idle at now_ns. Compared in
+ * seconds as doubles, as FeatureExtractor compares its float clock, so
+ * flows expire at the same packet.
+ */
+static inline int flow_idle(uint64_t now_ns, uint64_t last_ns, double timeout)
+{
+    return (double)now_ns / NS_PER_SEC - (double)last_ns / NS_PER_SEC > timeout;
+}
+
+/* Whether the oldest flow of a table is idle */
+static inline int table_idle(const struct flow_table *t, uint64_t now_ns, double timeout)
+{
+    return t->oldest != FLOW_NIL && flow_idle(now_ns, t->entries[t->oldest].last_ns, timeout);
+}
+
+static int expire_flows(struct flow_engine *fe, struct flow_table *t, uint64_t now_ns,
+                        double timeout)
+{
+    int removed = 0;
+
+    while (table_idle(t, now_ns, timeout)) {
+        remove_slot(fe, t, t->oldest);
+        removed++;
+    }
+
+    fe->stats.flows_expired += removed;
+    return removed;
+}
+
+int flow_engine_expire(struct flow_engine *fe, uint64_t now_ns)
+{
+    const struct engine_config *cfg;
+    uint16_t i;
+    int removed = 0;
+
+    if (fe == NULL)
+        return -1;
+
+    cfg = reader_enter(fe);
+    for (i = 0; i < fe->nb_tables; i++)
+        removed += expire_flows(fe, &fe->tables[i], now_ns, cfg->timeout[i]);
+    reader_exit(fe);
+    return removed;
+}
+
+int flow_engine_process_burst(struct flow_engine *fe, const struct packet *pkts,
+                              const uint64_t *ts_ns, int nb_pkts,
+                              struct flow_record *records)
+{
+    const struct engine_config *cfg;
+    struct parsed_packet pp = { 0 };
+    struct flow_key key, prev_key;
+    struct flow_entry *prev = NULL;
+    uint64_t prev_hash = 0;
+    uint32_t prev_rss = 0;
+    uint16_t prev_tenant = 0;
+    uint8_t prev_flags = 0;
+    int i, nb_records = 0;
+
+    if (fe == NULL || pkts == NULL || ts_ns == NULL || records == NULL || nb_pkts < 0)
+        return -1;
+
+    if (nb_pkts == 0)
+        return 0;
+
+    /* Pick up the current configuration once per burst */
+    cfg = reader_enter(fe);
+
+    for (i = 0; i < nb_pkts; i++) {
+        struct flow_table *t;
+        struct flow_entry *e;
+        uint32_t sample_rate;
+        uint64_t hash;
+        int parsed;
+
+        records[i].valid = 0;
+        fe->stats.packets++;
+
+        if (pkts[i].rx_flags & PACKET_RX_PTYPE)
+            fe->stats.rx_classified++;
+        if ((pkts[i].rx_flags & (PACKET_RX_IP_CKSUM_CHECKED | PACKET_RX_L4_CKSUM_CHECKED)) ==
+            (PACKET_RX_IP_CKSUM_CHECKED | PACKET_RX_L4_CKSUM_CHECKED))
+            fe->stats.cksum_offloaded++;
+
+        parsed = parse_packet(&pkts[i], cfg->tenants, &pp);
+        t = &fe->tables[pp.tenant];
+        t->stats.packets++;
+
+        /*
+         * Like FeatureExtractor, expire idle flows before each packet of a
+         * table holding more than FLOW_ENGINE_EXPIRE_THRESHOLD flows.
+         * Removal moves entries, so the previous lookup is dropped.
+         */
+        if (t->stats.active_flows > FLOW_ENGINE_EXPIRE_THRESHOLD &&
+            table_idle(t, ts_ns[i], cfg->timeout[pp.tenant])) {
+            expire_flows(fe, t, ts_ns[i], cfg->timeout[pp.tenant]);
+            prev = NULL;
+        }
+        if (parsed != 0) {
+            fe->stats.parse_skipped++;
+            t->stats.parse_skipped++;
+            continue;
+        }
+        fe->stats.bad_checksum += pp.bad_checksum;
+
+        /*
+         * Consecutive packets of one flow reuse the previous lookup. The RSS
+         * hash is per direction and keyed per device, so it cannot replace
+         * the flow hash, but where both packets carry one a mismatch skips
+         * the key comparison. Tenants' flows live in separate tables.
+         */
+        make_key(&pp, &key);
+        if (prev != NULL && pp.tenant == prev_tenant &&
+            (!(pkts[i].rx_flags & prev_flags & PACKET_RX_RSS_HASH) || pkts[i].rss_hash == prev_rss) &&
+            key_equal(&key, &prev_key)) {
+            e = prev;
+            hash = prev_hash;
+            fe->stats.lookups_reused++;
+        } else {
+            hash = flow_key_hash(key.bytes, FLOW_KEY_V4_LEN);
+            e = lookup_slot(t, &key, hash);
+        }
+
+        if (!e->in_use) {
+            if (t->stats.active_flows >= t->stats.max_flows) {
+                fe->stats.table_full++;
+                t->stats.table_full++;
+                continue;
+            }
+            init_flow(e, &key, hash, &pp, ts_ns[i]);
+            list_insert(t, (uint32_t)(e - t->entries));
+            fe->stats.active_flows++;
+            fe->stats.flows_created++;
+            t->stats.active_flows++;
+            t->stats.flows_created++;
+        }
+
+        update_flow(e, &pp, pp.length, ts_ns[i]);
+        list_touch(t, (uint32_t)(e - t->entries));
+        prev = e;
+        prev_key = key;
+        prev_hash = hash;
+        prev_rss = pkts[i].rss_hash;
+        prev_flags = pkts[i].rx_flags;
+        prev_tenant = pp.tenant;
+
+        /* Flow sampling keeps or drops all records of a flow */
+        sample_rate = cfg->sample_rate[pp.tenant];
+        if (sample_rate > 1 && hash % sample_rate != 0) {
+            fe->stats.sampled_out++;
+            continue;
+        }
+
+        fill_record(e, ts_ns[i], pp.tenant ? pp.tenant : cfg->user.tenant, &records[i]);
+        t->stats.records++;
+        nb_records++;
+    }
+
+    reader_exit(fe);
+    return nb_records;
+}
+
+int flow_engine_process_packed(struct flow_engine *fe, const uint8_t *buf,
+                               const struct packed_packet *meta, int nb_pkts, uint64_t now_ns,
+                               struct flow_record *records)
+{
+    struct packet pkts[MAX_PKT_BURST];
+    uint64_t ts_ns[MAX_PKT_BURST];
+    int start, i, n, result, nb_records = 0;
+
+    if (buf == NULL || meta == NULL || nb_pkts < 0)
+        return -1;
+
+    for (start = 0; start < nb_pkts; start += n) {
+        n = nb_pkts - start < MAX_PKT_BURST ? nb_pkts - start : MAX_PKT_BURST;
+        for (i = 0; i < n; i++) {
+            const struct packed_packet *m = &meta[start + i];
+
+            pkts[i].data = (uint8_t *)buf + m->offset;
+            pkts[i].length = m->length;
+            pkts[i].port = m->port;
+            pkts[i].rx_flags = m->rx_flags;
+            pkts[i].timestamp = 0;
+            pkts[i].rss_hash = m->rss_hash;
+            ts_ns[i] = m->timestamp_ns ? m->timestamp_ns : now_ns;
+        }
+
+        result = flow_engine_process_burst(fe, pkts, ts_ns, n, records + start);
+        if (result < 0)
+            return result;
+        nb_records += result;
+    }
+
+    return nb_records;
+}
+
+int flow_engine_flush(struct flow_engine *fe, uint8_t end_reason, struct flow_record *records,
+                      int max_records)
+{
+    const struct engine_config *cfg;
+    uint32_t start, idx, n;
+    uint16_t tenant;
+    int nb_records = 0;
+
+    if (fe == NULL || records == NULL || max_records <= 0)
+        return -1;
+
+    if (fe->stats.active_flows == 0)
+        return 0;
+
+    cfg = reader_enter(fe);
+
+    for (tenant = 0; tenant < fe->nb_tables && nb_records < max_records; tenant++) {
+        struct flow_table *t = &fe->tables[tenant];
+        uint32_t sample_rate = cfg->sample_rate[tenant];
+
+        if (t->stats.active_flows == 0)
+            continue;
+
+        /*
+         * Start after an empty slot, which the load factor guarantees: no
+         * probe chain crosses it, so removals never shift an entry into a
+         * slot the scan has already passed
+         */
+        for (start = 0; t->entries[start].in_use; start++)
+            ;
+
+        idx = (start + 1) & t->mask;
+        for (n = 0; n <= t->mask && nb_records < max_records; ) {
+            struct flow_entry *e = &t->entries[idx];
+
+            if (!e->in_use) {
+                idx = (idx + 1) & t->mask;
+                n++;
+                continue;
+            }
+
+            if (sample_rate <= 1 || e->hash % sample_rate == 0) {
+                fill_record(e, e->last_ns, tenant ? tenant : cfg->user.tenant, &records[nb_records]);
+                records[nb_records].end_reason = end_reason;
+                t->stats.records++;
+                nb_records++;
+            }
+            remove_slot(fe, t, idx);
+            fe->stats.flows_flushed++;
+        }
+    }
+
+    reader_exit(fe);
+    return nb_records;
+}
+
+uint64_t flow_engine_hash_tuple(uint32_t src_ip, uint32_t dst_ip, uint16_t src_port,
+                                uint16_t dst_port, uint8_t protocol)
+{
+    struct flow_key key;
+
+    flow_key_pack_v4(key.bytes, src_ip, dst_ip, src_port, dst_port, protocol);
+    return flow_key_hash(key.bytes, FLOW_KEY_V4_LEN);
+}
+
+int flow_engine_get_stats(struct flow_engine *fe, struct flow_engine_stats *stats)
+{
+    if (fe == NULL || stats == NULL)
+        return -1;
+
+    *stats = fe->stats;
+    return 0;
+}
+
+int flow_engine_get_tenant_stats(struct flow_engine *fe, uint16_t tenant,
+                                 struct flow_tenant_stats *stats)
+{
+    if (fe == NULL || stats == NULL || tenant >= fe->nb_tables)
+        return -1;
+
+    *stats = fe->tables[tenant].stats;
+    return 0;
+}
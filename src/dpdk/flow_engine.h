@@ -0,0 +1,263 @@
+/*
+ * Native Flow Engine Header
+ * Parses packets and maintains per-flow statistics matching the Python
+ * FeatureExtractor, without any dependency on DPDK
+ */
+
+#ifndef FLOW_ENGINE_H
+#define FLOW_ENGINE_H
+
+#include <stdint.h>
+
+#include "dpdk_capture.h"
+
+/* Default flow table limits */
+#define FLOW_ENGINE_MAX_FLOWS 65536
+#define FLOW_ENGINE_TIMEOUT 600.0
+#define FLOW_ENGINE_EXPIRE_THRESHOLD 1000
+
+/* Most flow tables, one per tenant, an engine holds; tenant 0 is the default */
+#define FLOW_ENGINE_MAX_TENANTS 256
+
+/* Tenant lookup: a flat table of VLAN IDs, and VNIs in pages allocated on use */
+#define FLOW_TENANT_VLANS 4096
+#define FLOW_TENANT_VNI_PAGE_BITS 12
+#define FLOW_TENANT_VNI_PAGE_SIZE (1 << FLOW_TENANT_VNI_PAGE_BITS)
+#define FLOW_TENANT_VNI_PAGES (1 << (24 - FLOW_TENANT_VNI_PAGE_BITS))
+
+/* Why a record is the last of its flow, see flow_record.end_reason */
+#define FLOW_END_NONE 0       /* Record of a packet; the flow continues */
+#define FLOW_END_SHUTDOWN 1   /* Exported with the rest of the table when capture stopped */
+
+/* Features of a flow after the latest packet, see calculate_flow_features() */
+struct flow_record {
+    uint8_t src_ip[4];                 /* Source IP of the first packet */
+    uint8_t dst_ip[4];                 /* Destination IP of the first packet */
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t protocol;
+    uint8_t tcp_flags;                 /* OR of all TCP flags seen */
+    uint8_t valid;                     /* 1 if the packet produced a record */
+    uint8_t end_reason;                /* FLOW_END_* */
+    uint64_t total_fwd_packets;
+    uint64_t total_length_fwd_packets;
+    uint32_t packet_length_max;
+    uint32_t packet_length_min;
+    double flow_duration;              /* Seconds, at least 1us */
+    double packet_length_mean;
+    double packet_length_std;
+    double packet_length_variance;     /* packet_length_std ** 2, rounded as Python does */
+    double flow_bytes_per_second;
+    double flow_packets_per_second;
+    double flow_iat_mean;
+    double flow_iat_std;
+    double flow_iat_max;
+    double flow_iat_min;
+    uint64_t timestamp;                /* Microseconds */
+    uint64_t bad_checksum_packets;     /* Packets with a bad IPv4, TCP or UDP checksum */
+    uint16_t tenant;                   /* Tenant of the flow, see flow_engine_config.tenant */
+};
+
+/*
+ * Tenant classification at parse time. The outer VLAN ID (802.1Q or QinQ)
+ * or the VNI of a VXLAN packet selects the tenant, whose flows are parsed
+ * from past the tags or from the inner frame and kept in its own flow
+ * table. Tenant indexes are flow tables of the engine; 0, the default, takes
+ * the packets no tenant claims.
+ */
+struct flow_tenant_table {
+    uint8_t vlan[FLOW_TENANT_VLANS];                /* Tenant of each VLAN ID */
+    uint16_t vni_page[FLOW_TENANT_VNI_PAGES];       /* Page of vnis for each VNI >> FLOW_TENANT_VNI_PAGE_BITS */
+    uint32_t nb_vni_pages;                          /* Pages in vnis, 0 if no tenant has a VNI */
+    const uint8_t *vnis;                            /* Tenant of each VNI, by page; page 0 is all 0 */
+    double flow_timeout[FLOW_ENGINE_MAX_TENANTS];   /* Per tenant, 0 for flow_engine_config.flow_timeout */
+    uint32_t sample_rate[FLOW_ENGINE_MAX_TENANTS];  /* Per tenant, 0 for flow_engine_config.sample_rate */
+};
+
+/* Runtime configuration, replaceable while packets are being processed */
+struct flow_engine_config {
+    double flow_timeout;      /* Seconds of inactivity before a flow expires */
+    uint32_t sample_rate;     /* Emit records for 1 in sample_rate flows, 0 or 1 for all */
+    uint16_t tenant;          /* Stamped in records of tenant 0; others carry their index */
+    const struct flow_tenant_table *tenants;  /* NULL to put all packets in tenant 0 */
+};
+
+/* Flow engine counters */
+struct flow_engine_stats {
+    uint64_t packets;         /* Packets processed */
+    uint64_t parse_skipped;   /* Packets that were not IPv4 */
+    uint64_t flows_created;
+    uint64_t flows_expired;
+    uint64_t table_full;      /* Packets dropped because the table was full */
+    uint32_t active_flows;
+    uint32_t max_flows;
+    uint64_t memory_bytes;    /* Bytes allocated for the flow table */
+    uint64_t sampled_out;     /* Records suppressed by flow sampling */
+    uint64_t config_version;  /* Number of configuration changes applied */
+    uint64_t bad_checksum;    /* Packets with a bad IPv4, TCP or UDP checksum */
+    uint64_t rx_classified;   /* Packets whose type the NIC had already classified */
+    uint64_t cksum_offloaded; /* Packets whose checksums the NIC had already verified */
+    uint64_t lookups_reused;  /* Packets that reused the flow lookup of the packet before */
+    uint64_t flows_flushed;   /* Flows removed by flow_engine_flush() */
+};
+
+/* Counters of one tenant's flow table */
+struct flow_tenant_stats {
+    uint64_t packets;         /* Packets classified to the tenant */
+    uint64_t parse_skipped;   /* Of those, packets that were not IPv4 */
+    uint64_t records;         /* Records emitted, after flow sampling */
+    uint64_t flows_created;
+    uint64_t table_full;      /* Packets dropped because the tenant's table was full */
+    uint32_t active_flows;
+    uint32_t max_flows;
+};
+
+struct flow_engine;
+
+/**
+ * Create a flow engine
+ * @param max_flows Maximum number of concurrent flows (0 for default)
+ * @param flow_timeout Seconds of inactivity before a flow expires
+ * @return Engine handle, NULL on error
+ */
+struct flow_engine *flow_engine_create(uint32_t max_flows, double flow_timeout);
+
+/**
+ * Create a flow engine with a flow table per tenant
+ *
+ * Tenants are classified with flow_engine_config.tenants; a tenant whose
+ * table is full drops its own new flows and never another tenant's.
+ * @param nb_tenants Number of flow tables, at most FLOW_ENGINE_MAX_TENANTS
+ * @param max_flows Maximum number of concurrent flows of each tenant (0 for default)
+ * @param flow_timeout Seconds of inactivity before a flow expires
+ * @return Engine handle, NULL on error
+ */
+struct flow_engine *flow_engine_create_tenants(uint16_t nb_tenants, const uint32_t *max_flows,
+                                               double flow_timeout);
+
+/**
+ * Destroy a flow engine and free its flow table
+ * @param fe Engine handle
+ */
+void flow_engine_destroy(struct flow_engine *fe);
+
+/**
+ * Process a burst of packets and compute the features of their flows
+ *
+ * The packet type, checksum status and RSS hash in pkts[i].rx_flags are used
+ * where the capture backend provides them; checksums it did not verify are
+ * checked in software.
+ * @param fe Engine handle
+ * @param pkts Packets to process
+ * @param ts_ns Capture timestamp of each packet in nanoseconds
+ * @param nb_pkts Number of packets
+ * @param records Array of nb_pkts records; records[i].valid is set when
+ *                packet i belongs to a flow
+ * @return Number of valid records, negative on error
+ */
+int flow_engine_process_burst(struct flow_engine *fe, const struct packet *pkts,
+                              const uint64_t *ts_ns, int nb_pkts,
+                              struct flow_record *records);
+
+/**
+ * Process a packed burst, as capture_pack_burst() lays it out
+ *
+ * Equivalent to flow_engine_process_burst() on each run of up to
+ * MAX_PKT_BURST packets, so a burst of any size is processed in one call.
+ * @param fe Engine handle
+ * @param buf Buffer holding the packets
+ * @param meta Array of nb_pkts entries describing the packets
+ * @param nb_pkts Number of packets
+ * @param now_ns Timestamp in nanoseconds for packets whose timestamp_ns is 0
+ * @param records Array of nb_pkts records; records[i].valid is set when
+ *                packet i belongs to a flow
+ * @return Number of valid records, negative on error
+ */
+int flow_engine_process_packed(struct flow_engine *fe, const uint8_t *buf,
+                               const struct packed_packet *meta, int nb_pkts, uint64_t now_ns,
+                               struct flow_record *records);
+
+/**
+ * Remove flows idle for longer than the flow timeout
+ *
+ * Like flow_engine_process_burst(), only to be called from the data path.
+ * @param fe Engine handle
+ * @param now_ns Current time in nanoseconds
+ * @return Number of flows removed
+ */
+int flow_engine_expire(struct flow_engine *fe, uint64_t now_ns);
+
+/**
+ * Export and remove active flows, for an orderly shutdown
+ *
+ * Fills records with the features of up to max_records flows as of their
+ * last packet, with end_reason set, and removes them from the table. Flows
+ * sampled out are removed without a record. Call until it returns 0, from
+ * the data path or once it has stopped.
+ * @param fe Engine handle
+ * @param end_reason FLOW_END_* stored in the records
+ * @param records Array of max_records records
+ * @param max_records Size of records
+ * @return Number of records filled, negative on error
+ */
+int flow_engine_flush(struct flow_engine *fe, uint8_t end_reason, struct flow_record *records,
+                      int max_records);
+
+/**
+ * Replace the runtime configuration
+ *
+ * Safe to call from another thread while bursts are being processed: the
+ * data path reads the configuration once per burst, and the old copy is
+ * freed only after the burst in progress (if any) has finished. Calls are
+ * serialized; the data path itself must not call it. The tenant table is
+ * copied, and its tenant indexes must be below the engine's nb_tenants.
+ * @param fe Engine handle
+ * @param config New configuration
+ * @return 0 on success, negative on error
+ */
+int flow_engine_set_config(struct flow_engine *fe, const struct flow_engine_config *config);
+
+/**
+ * Get the current runtime configuration
+ *
+ * Reads the copy kept by flow_engine_set_config() and never the data path's,
+ * so it may be called from any thread. config->tenants points to the
+ * engine's copy of the tenant table, valid until the next
+ * flow_engine_set_config().
+ * @param fe Engine handle
+ * @param config Pointer to store the configuration
+ * @return 0 on success, negative on error
+ */
+int flow_engine_get_config(struct flow_engine *fe, struct flow_engine_config *config);
+
+/**
+ * Hash an IPv4 5-tuple the way the engine does for flow lookup and sampling
+ * @param src_ip Source address, host byte order
+ * @param dst_ip Destination address, host byte order
+ * @param src_port Source port
+ * @param dst_port Destination port
+ * @param protocol IP protocol
+ * @return flow_key_hash() of the canonical key, the same for both directions
+ */
+uint64_t flow_engine_hash_tuple(uint32_t src_ip, uint32_t dst_ip, uint16_t src_port,
+                                uint16_t dst_port, uint8_t protocol);
+
+/**
+ * Get flow engine counters
+ * @param fe Engine handle
+ * @param stats Pointer to store statistics
+ * @return 0 on success, negative on error
+ */
+int flow_engine_get_stats(struct flow_engine *fe, struct flow_engine_stats *stats);
+
+/**
+ * Get the counters of one tenant's flow table
+ * @param fe Engine handle
+ * @param tenant Tenant index
+ * @param stats Pointer to store statistics
+ * @return 0 on success, negative on error
+ */
+int flow_engine_get_tenant_stats(struct flow_engine *fe, uint16_t tenant,
+                                 struct flow_tenant_stats *stats);
+
+#endif /* FLOW_ENGINE_H */
@@ -0,0 +1,398 @@
+/*
+ * Flow Record JSON Encoder Implementation
+ * Schema-specific encoder writing straight into caller buffers; doubles use
+ * Ryu shortest round-trip digits, laid out the way Python's repr() does
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "flow_json.h"
+#include "ryu_tables.h"
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BITS 11
+#define DOUBLE_BIAS 1023
+
+/* repr() switches to exponent notation outside 1e-4 <= |x| < 1e16 */
+#define REPR_MIN_DECPT -4
+#define REPR_MAX_DECPT 16
+
+typedef unsigned __int128 uint128_t;
+
+/* Append a string literal, without its terminator */
+#define APPEND(p, lit) do { memcpy((p), (lit), sizeof(lit) - 1); (p) += sizeof(lit) - 1; } while (0)
+
+/* ceil(log2(5^e)) for 0 <= e <= 3528 */
+static inline int32_t pow5bits(int32_t e)
+{
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)) for 0 <= e <= 1650 */
+static inline uint32_t log10_pow2(int32_t e)
+{
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+/* floor(log10(5^e)) for 0 <= e <= 2620 */
+static inline uint32_t log10_pow5(int32_t e)
+{
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline uint32_t pow5_factor(uint64_t value)
+{
+    uint32_t count = 0;
+
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static inline int multiple_of_pow5(uint64_t value, uint32_t p)
+{
+    return pow5_factor(value) >= p;
+}
+
+static inline int multiple_of_pow2(uint64_t value, uint32_t p)
+{
+    return (value & ((1ULL << p) - 1)) == 0;
+}
+
+static inline uint64_t mul_shift64(uint64_t m, const uint64_t *mul, int32_t j)
+{
+    uint128_t b0 = (uint128_t)m * mul[0];
+    uint128_t b2 = (uint128_t)m * mul[1];
+
+    return (uint64_t)(((b0 >> 64) + b2) >> (j - 64));
+}
+
+/*
+ * Shortest decimal digits of a positive finite double: value is
+ * *digits * 10^*exponent and no shorter digit string rounds to it (Ryu)
+ */
+static void shortest_digits(uint64_t ieee_mantissa, uint32_t ieee_exponent,
+                            uint64_t *digits, int32_t *exponent)
+{
+    int32_t e2, e10;
+    uint64_t m2, mv, vr, vp, vm, output;
+    uint32_t mm_shift;
+    int accept_bounds, vm_trailing_zeros = 0, vr_trailing_zeros = 0;
+    int32_t removed = 0;
+    uint8_t last_removed_digit = 0;
+
+    if (ieee_exponent == 0) {
+        e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t)ieee_exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = (1ULL << DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+    }
+    accept_bounds = (m2 & 1) == 0;
+
+    /* Step 2: the interval of values that round to this double, times 4 */
+    mv = 4 * m2;
+    mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    /* Step 3: convert the interval to a decimal power base */
+    if (e2 >= 0) {
+        uint32_t q = log10_pow2(e2) - (e2 > 3);
+        int32_t k = RYU_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+
+        e10 = (int32_t)q;
+        vr = mul_shift64(4 * m2, RYU_POW5_INV_SPLIT[q], i);
+        vp = mul_shift64(4 * m2 + 2, RYU_POW5_INV_SPLIT[q], i);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, RYU_POW5_INV_SPLIT[q], i);
+        if (q <= 21) {
+            /* Only one of mp, mv and mm can be a multiple of 5, if any */
+            if (mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            else
+                vp -= multiple_of_pow5(mv + 2, q);
+        }
+    } else {
+        uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = pow5bits(i) - RYU_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+
+        e10 = (int32_t)q + e2;
+        vr = mul_shift64(4 * m2, RYU_POW5_SPLIT[i], j);
+        vp = mul_shift64(4 * m2 + 2, RYU_POW5_SPLIT[i], j);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, RYU_POW5_SPLIT[i], j);
+        if (q <= 1) {
+            /* mv has at least q trailing zero bits since e2 < 0 */
+            vr_trailing_zeros = 1;
+            if (accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                vp--;
+        } else if (q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* Step 4: find the shortest representation in the interval */
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        for (;;) {
+            uint64_t vp_div10 = vp / 10, vm_div10 = vm / 10;
+            if (vp_div10 <= vm_div10)
+                break;
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed_digit == 0;
+            last_removed_digit = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp = vp_div10;
+            vm = vm_div10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed_digit == 0;
+                last_removed_digit = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        /* Round half to even on an exact tie */
+        if (vr_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0)
+            last_removed_digit = 4;
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                       last_removed_digit >= 5);
+    } else {
+        /* Common case: no trailing zeros to track */
+        int round_up = 0;
+
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        for (;;) {
+            uint64_t vp_div10 = vp / 10, vm_div10 = vm / 10;
+            if (vp_div10 <= vm_div10)
+                break;
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp = vp_div10;
+            vm = vm_div10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    *digits = output;
+    *exponent = e10 + removed;
+}
+
+/* Write the decimal digits of value, returning their count */
+static inline int write_uint(uint64_t value, char *out)
+{
+    char tmp[20];
+    int n = 0, i;
+
+    do {
+        tmp[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    for (i = 0; i < n; i++)
+        out[i] = tmp[n - 1 - i];
+    return n;
+}
+
+int flow_json_format_double(double value, char *out)
+{
+    uint64_t bits, mantissa, digits;
+    uint32_t exponent;
+    int32_t exp10, decpt;
+    char buf[20];
+    char *p = out;
+    int ndigits, i;
+
+    memcpy(&bits, &value, sizeof(bits));
+    mantissa = bits & ((1ULL << DOUBLE_MANTISSA_BITS) - 1);
+    exponent = (uint32_t)((bits >> DOUBLE_MANTISSA_BITS) & ((1U << DOUBLE_EXPONENT_BITS) - 1));
+
+    if (exponent == (1U << DOUBLE_EXPONENT_BITS) - 1) {
+        if (mantissa) {
+            APPEND(p, "NaN");
+        } else if (bits >> 63) {
+            APPEND(p, "-Infinity");
+        } else {
+            APPEND(p, "Infinity");
+        }
+        return (int)(p - out);
+    }
+
+    if (bits >> 63)
+        *p++ = '-';
+
+    if (exponent == 0 && mantissa == 0) {
+        APPEND(p, "0.0");
+        return (int)(p - out);
+    }
+
+    shortest_digits(mantissa, exponent, &digits, &exp10);
+    ndigits = write_uint(digits, buf);
+    decpt = exp10 + ndigits;
+
+    if (decpt <= REPR_MIN_DECPT || decpt > REPR_MAX_DECPT) {
+        /* d[.ddd]e+XX */
+        int32_t e = decpt - 1;
+
+        *p++ = buf[0];
+        if (ndigits > 1) {
+            *p++ = '.';
+            memcpy(p, buf + 1, ndigits - 1);
+            p += ndigits - 1;
+        }
+        *p++ = 'e';
+        *p++ = e < 0 ? '-' : '+';
+        if (e < 0)
+            e = -e;
+        if (e < 10)
+            *p++ = '0';
+        p += write_uint((uint64_t)e, p);
+    } else if (decpt <= 0) {
+        /* 0.000ddd */
+        *p++ = '0';
+        *p++ = '.';
+        for (i = 0; i < -decpt; i++)
+            *p++ = '0';
+        memcpy(p, buf, ndigits);
+        p += ndigits;
+    } else if (decpt >= ndigits) {
+        /* ddd000.0 */
+        memcpy(p, buf, ndigits);
+        p += ndigits;
+        for (i = ndigits; i < decpt; i++)
+            *p++ = '0';
+        APPEND(p, ".0");
+    } else {
+        /* ddd.ddd */
+        memcpy(p, buf, decpt);
+        p += decpt;
+        *p++ = '.';
+        memcpy(p, buf + decpt, ndigits - decpt);
+        p += ndigits - decpt;
+    }
+
+    return (int)(p - out);
+}
+
+static inline char *write_ip(const uint8_t *ip, char *p)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (i)
+            *p++ = '.';
+        p += write_uint(ip[i], p);
+    }
+    return p;
+}
+
+int flow_json_encode_record(const struct flow_record *rec, char *out)
+{
+    uint8_t flags = rec->tcp_flags;
+    char *p = out;
+
+    /* Keys in the order of calculate_flow_features(), with json.dumps() separators */
+    APPEND(p, "{\"src_ip\": \"");
+    p = write_ip(rec->src_ip, p);
+    APPEND(p, "\", \"dst_ip\": \"");
+    p = write_ip(rec->dst_ip, p);
+    APPEND(p, "\", \"src_port\": ");
+    p += write_uint(rec->src_port, p);
+    APPEND(p, ", \"dst_port\": ");
+    p += write_uint(rec->dst_port, p);
+    APPEND(p, ", \"protocol\": ");
+    p += write_uint(rec->protocol, p);
+    APPEND(p, ", \"flow_duration\": ");
+    p += flow_json_format_double(rec->flow_duration, p);
+    APPEND(p, ", \"total_fwd_packets\": ");
+    p += write_uint(rec->total_fwd_packets, p);
+    APPEND(p, ", \"total_bwd_packets\": 0, \"total_length_fwd_packets\": ");
+    p += write_uint(rec->total_length_fwd_packets, p);
+    APPEND(p, ", \"total_length_bwd_packets\": 0, \"packet_length_max\": ");
+    p += write_uint(rec->packet_length_max, p);
+    APPEND(p, ", \"packet_length_min\": ");
+    p += write_uint(rec->packet_length_min, p);
+    APPEND(p, ", \"packet_length_mean\": ");
+    p += flow_json_format_double(rec->packet_length_mean, p);
+    APPEND(p, ", \"packet_length_std\": ");
+    p += flow_json_format_double(rec->packet_length_std, p);
+    APPEND(p, ", \"flow_bytes_per_second\": ");
+    p += flow_json_format_double(rec->flow_bytes_per_second, p);
+    APPEND(p, ", \"flow_packets_per_second\": ");
+    p += flow_json_format_double(rec->flow_packets_per_second, p);
+    APPEND(p, ", \"flow_iat_mean\": ");
+    p += flow_json_format_double(rec->flow_iat_mean, p);
+    APPEND(p, ", \"flow_iat_std\": ");
+    p += flow_json_format_double(rec->flow_iat_std, p);
+    APPEND(p, ", \"flow_iat_max\": ");
+    p += flow_json_format_double(rec->flow_iat_max, p);
+    APPEND(p, ", \"flow_iat_min\": ");
+    p += flow_json_format_double(rec->flow_iat_min, p);
+    APPEND(p, ", \"tcp_flags\": ");
+    p += write_uint(flags, p);
+    APPEND(p, ", \"fin_flag_count\": ");
+    *p++ = flags & 0x01 ? '1' : '0';
+    APPEND(p, ", \"syn_flag_count\": ");
+    *p++ = flags & 0x02 ? '1' : '0';
+    APPEND(p, ", \"rst_flag_count\": ");
+    *p++ = flags & 0x04 ? '1' : '0';
+    APPEND(p, ", \"psh_flag_count\": ");
+    *p++ = flags & 0x08 ? '1' : '0';
+    APPEND(p, ", \"ack_flag_count\": ");
+    *p++ = flags & 0x10 ? '1' : '0';
+    APPEND(p, ", \"urg_flag_count\": ");
+    *p++ = flags & 0x20 ? '1' : '0';
+    APPEND(p, ", \"avg_packet_size\": ");
+    p += flow_json_format_double(rec->packet_length_mean, p);
+    APPEND(p, ", \"packet_length_variance\": ");
+    p += flow_json_format_double(rec->packet_length_variance, p);
+    APPEND(p, ", \"bad_checksum_packets\": ");
+    p += write_uint(rec->bad_checksum_packets, p);
+    APPEND(p, ", \"end_reason\": ");
+    p += write_uint(rec->end_reason, p);
+    APPEND(p, ", \"tenant\": ");
+    p += write_uint(rec->tenant, p);
+    APPEND(p, ", \"timestamp\": ");
+    p += write_uint(rec->timestamp, p);
+    APPEND(p, ", \"label\": \"BENIGN\"}\n");
+
+    return (int)(p - out);
+}
+
+int flow_json_encode_burst(const struct flow_record *records, int nb_records,
+                           char *buf, size_t size, uint32_t *ends)
+{
+    size_t used = 0;
+    int i;
+
+    if (records == NULL || buf == NULL || ends == NULL || nb_records < 0)
+        return -1;
+
+    for (i = 0; i < nb_records; i++) {
+        if (records[i].valid) {
+            if (size - used < FLOW_JSON_MAX_RECORD)
+                return -1;
+            used += flow_json_encode_record(&records[i], buf + used);
+        }
+        ends[i] = (uint32_t)used;
+    }
+
+    return (int)used;
+}
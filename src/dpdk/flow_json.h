@@ -0,0 +1,51 @@
+/*
+ * Flow Record JSON Encoder Header
+ * Encodes flow records as newline-delimited JSON, byte for byte as
+ * json.dumps() encodes the dictionaries built by calculate_flow_features()
+ */
+
+#ifndef FLOW_JSON_H
+#define FLOW_JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flow_engine.h"
+
+/* Upper bound on the length of one encoded record, newline included */
+#define FLOW_JSON_MAX_RECORD 2048
+
+/* Upper bound on the length of one formatted double */
+#define FLOW_JSON_MAX_DOUBLE 32
+
+/**
+ * Format a double as Python's repr() does, with the shortest digits that
+ * round-trip; non-finite values as json.dumps() writes them
+ * @param value Value to format
+ * @param out Buffer of at least FLOW_JSON_MAX_DOUBLE bytes, not terminated
+ * @return Number of characters written
+ */
+int flow_json_format_double(double value, char *out);
+
+/**
+ * Encode one flow record as a JSON object followed by a newline
+ * @param rec Record to encode
+ * @param out Buffer of at least FLOW_JSON_MAX_RECORD bytes, not terminated
+ * @return Number of characters written
+ */
+int flow_json_encode_record(const struct flow_record *rec, char *out);
+
+/**
+ * Encode the valid records of a burst as newline-delimited JSON
+ * @param records Records from flow_engine_process_burst()
+ * @param nb_records Number of records
+ * @param buf Output buffer
+ * @param size Size of buf; nb_records * FLOW_JSON_MAX_RECORD always suffices
+ * @param ends Array of nb_records offsets; ends[i] is the end of record i's
+ *             line, or of the previous line if record i is not valid
+ * @return Number of bytes written, negative if buf is too small
+ */
+int flow_json_encode_burst(const struct flow_record *records, int nb_records,
+                           char *buf, size_t size, uint32_t *ends);
+
+#endif /* FLOW_JSON_H */
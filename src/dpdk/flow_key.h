@@ -0,0 +1,181 @@
+/*
+ * Canonical Flow Key
+ * Packed, direction-independent 5-tuple keys and their 64-bit hash, shared
+ * by the flow engine and the Python side (src/features/flow_key.py) so a
+ * flow samples and partitions the same way everywhere
+ */
+
+#ifndef FLOW_KEY_H
+#define FLOW_KEY_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* Packed key lengths: two addresses, two ports and the protocol */
+#define FLOW_KEY_V4_LEN 13
+#define FLOW_KEY_V6_LEN 37
+#define FLOW_KEY_MAX_LEN FLOW_KEY_V6_LEN
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+/**
+ * Pack a 5-tuple into a canonical key
+ *
+ * The (address, port) endpoint that sorts lower comes first, so both
+ * directions of a flow give the same key. Addresses are in network byte
+ * order, ports and the protocol are written big-endian after them.
+ * @param key Buffer of at least 2 * addr_len + 5 bytes
+ * @param src_ip Source address, addr_len bytes in network byte order
+ * @param dst_ip Destination address, addr_len bytes in network byte order
+ * @param addr_len 4 for IPv4, 16 for IPv6
+ * @param src_port Source port
+ * @param dst_port Destination port
+ * @param protocol IP protocol
+ * @return Key length
+ */
+static inline int flow_key_pack(uint8_t *key, const uint8_t *src_ip, const uint8_t *dst_ip,
+                                int addr_len, uint16_t src_port, uint16_t dst_port,
+                                uint8_t protocol)
+{
+    int cmp = memcmp(src_ip, dst_ip, addr_len);
+    const uint8_t *ip_lo = src_ip, *ip_hi = dst_ip;
+    uint16_t port_lo = src_port, port_hi = dst_port;
+    uint8_t *p = key;
+
+    if (cmp > 0 || (cmp == 0 && src_port >= dst_port)) {
+        ip_lo = dst_ip;
+        ip_hi = src_ip;
+        port_lo = dst_port;
+        port_hi = src_port;
+    }
+
+    memcpy(p, ip_lo, addr_len);
+    p += addr_len;
+    memcpy(p, ip_hi, addr_len);
+    p += addr_len;
+    *p++ = port_lo >> 8;
+    *p++ = port_lo & 0xff;
+    *p++ = port_hi >> 8;
+    *p++ = port_hi & 0xff;
+    *p++ = protocol;
+    return (int)(p - key);
+}
+
+/**
+ * Pack an IPv4 5-tuple with addresses given as host-order integers
+ * @param key Buffer of at least FLOW_KEY_V4_LEN bytes
+ * @return FLOW_KEY_V4_LEN
+ */
+static inline int flow_key_pack_v4(uint8_t *key, uint32_t src_ip, uint32_t dst_ip,
+                                   uint16_t src_port, uint16_t dst_port, uint8_t protocol)
+{
+    uint8_t src[4] = { src_ip >> 24, src_ip >> 16, src_ip >> 8, src_ip };
+    uint8_t dst[4] = { dst_ip >> 24, dst_ip >> 16, dst_ip >> 8, dst_ip };
+
+    return flow_key_pack(key, src, dst, 4, src_port, dst_port, protocol);
+}
+
+static inline uint64_t xxh_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/**
+ * 64-bit hash of a packed flow key (XXH64 with seed 0)
+ * @param key Packed key from flow_key_pack()
+ * @param len Key length
+ * @return Hash value, identical to flow_hash() in Python
+ */
+static inline uint64_t flow_key_hash(const uint8_t *key, int len)
+{
+    const uint8_t *p = key;
+    const uint8_t *end = key + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = XXH_PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = -XXH_PRIME64_1;
+
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+        h = xxh_merge_round(h, v1);
+        h = xxh_merge_round(h, v2);
+        h = xxh_merge_round(h, v3);
+        h = xxh_merge_round(h, v4);
+    } else {
+        h = XXH_PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+        h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (uint64_t)*p * XXH_PRIME64_5;
+        h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+#endif /* FLOW_KEY_H */
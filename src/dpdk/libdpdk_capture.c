@@ -1,6 +1,8 @@
 /*
  * DPDK Packet Capture Library Implementation
- * High-performance packet capture using DPDK kernel-bypass technology
+ * High-performance packet capture using DPDK kernel-bypass technology.
+ * Implements the ethdev capture backend (PCI ports, virtual devices, AF_XDP)
+ * and the single-port dpdk_* API on top of a default capture context.
  */
 
 #include <stdio.h>
@@ -8,23 +10,55 @@
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
-#include <signal.h>
 #include <time.h>
+#include <errno.h>
 
 #include <rte_common.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
+#include <rte_bus_vdev.h>
 #include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
 #include <rte_mempool.h>
 #include <rte_cycles.h>
 
 #include "dpdk_capture.h"
+#include "capture_backend.h"
+#include "clock_sync.h"
+
+/* Per-context state of the ethdev backend */
+struct dpdk_ctx {
+    uint16_t port_id;
+    struct rte_mempool *mbuf_pool;
+    uint64_t mempool_in_use_hwm;
+    char vdev_name[RTE_DEV_NAME_MAX_LEN]; /* Empty unless the context created a vdev */
+    uint8_t rx_offloads;                  /* PACKET_RX_* metadata the port delivers */
+    int ts_offset;                        /* Mbuf field of NIC receive timestamps, negative if unused */
+    uint64_t ts_flag;                     /* ol_flags bit of mbufs with a NIC timestamp */
+    struct clock_sync tsc_clock[MAX_RX_QUEUES]; /* Per queue, so each polling thread owns its own */
+    struct clock_sync nic_clock[MAX_RX_QUEUES];
+    uint64_t last_ns[MAX_RX_QUEUES];      /* Latest timestamp of each queue, which the next may not precede */
+    struct rte_mbuf *held[MAX_RX_QUEUES][MAX_PKT_BURST]; /* Mbufs of the last burst */
+    uint16_t nb_held[MAX_RX_QUEUES];
+    int clock;                            /* CAPTURE_CLOCK_*, to recalibrate after a restart */
+
+    /* Link state; the counters are updated from the EAL interrupt thread */
+    int lsc_intr;                         /* The port reports link changes by interrupt */
+    int callbacks;                        /* Event callbacks are registered */
+    uint64_t link_changes;
+    uint64_t reset_events;
+    int reset_pending;
+    int link_last;                        /* Link status at the last poll, -1 before the first */
+};
+
+/* The EAL is process-wide: initialized by the first context, cleaned up by the last */
+static int g_eal_refs = 0;
+static int g_eal_done = 0;
+static unsigned g_vdev_seq = 0;
 
-/* Global variables */
-static struct rte_mempool *mbuf_pool = NULL;
-static int g_port_id = 0;
-static int g_batch_size = MAX_PKT_BURST;
-static volatile sig_atomic_t force_quit = 0;
+/* Legacy single-port API state */
+static struct capture_ctx *g_default_ctx = NULL;
+static unsigned g_num_mbufs = NUM_MBUFS;
 
 /* Port configuration */
 static const struct rte_eth_conf port_conf_default = {
@@ -33,18 +67,107 @@ static const struct rte_eth_conf port_conf_default = {
     },
 };
 
-static void signal_handler(int signum)
+/* Check that the port classifies untagged Ethernet and IPv4 packets, and
+ * tell it that only the L2 to L4 types are used */
+static int port_ptypes_init(uint16_t port)
+{
+    const uint32_t mask = RTE_PTYPE_L2_MASK | RTE_PTYPE_L3_MASK | RTE_PTYPE_L4_MASK;
+    uint32_t ptypes[64];
+    int has_ether = 0, has_ipv4 = 0;
+    int n, i;
+
+    n = rte_eth_dev_get_supported_ptypes(port, mask, ptypes, RTE_DIM(ptypes));
+    for (i = 0; i < n && i < (int)RTE_DIM(ptypes); i++) {
+        if ((ptypes[i] & RTE_PTYPE_L2_MASK) == RTE_PTYPE_L2_ETHER)
+            has_ether = 1;
+        if (RTE_ETH_IS_IPV4_HDR(ptypes[i]))
+            has_ipv4 = 1;
+    }
+    if (!has_ether || !has_ipv4)
+        return 0;
+
+    /* Not fatal: the PMD then keeps classifying every type it knows */
+    rte_eth_dev_set_ptypes(port, mask, NULL, 0);
+    return 1;
+}
+
+static int read_tsc(void *arg, uint64_t *ticks)
+{
+    (void)arg;
+    *ticks = rte_rdtsc();
+    return 0;
+}
+
+static int read_nic_clock(void *arg, uint64_t *ticks)
+{
+    return rte_eth_read_clock((uint16_t)(uintptr_t)arg, ticks);
+}
+
+/* Map the TSC, and the NIC's timestamp clock if it stamps packets, to the
+ * reference clock; the mapping is copied to every queue */
+static int clocks_init(struct dpdk_ctx *dc, int nb_queues, int clock)
 {
-    if (signum == SIGINT || signum == SIGTERM) {
-        printf("\nSignal %d received, preparing to exit...\n", signum);
-        force_quit = 1;
+    int q;
+
+    if (clock_sync_init(&dc->tsc_clock[0], read_tsc, NULL, rte_get_tsc_hz(), clock) != 0) {
+        printf("Error: cannot read the %s clock\n", clock == CAPTURE_CLOCK_TAI ? "TAI" : "system");
+        return -1;
+    }
+
+    /* The NIC clock's rate is not reported, so it is measured */
+    if (dc->ts_offset >= 0 &&
+        clock_sync_init(&dc->nic_clock[0], read_nic_clock, (void *)(uintptr_t)dc->port_id, 0, clock) != 0) {
+        printf("WARNING: cannot read the clock of port %u, timestamping packets with the TSC\n",
+               dc->port_id);
+        dc->ts_offset = -1;
+    }
+
+    for (q = 1; q < nb_queues; q++) {
+        dc->tsc_clock[q] = dc->tsc_clock[0];
+        dc->nic_clock[q] = dc->nic_clock[0];
     }
+    return 0;
+}
+
+/* Runs on the EAL interrupt thread: only counts, the polling thread acts on it */
+static int port_event_cb(uint16_t port, enum rte_eth_event_type event, void *arg, void *ret_param)
+{
+    struct dpdk_ctx *dc = arg;
+
+    (void)port;
+    (void)ret_param;
+    if (event == RTE_ETH_EVENT_INTR_LSC) {
+        __atomic_add_fetch(&dc->link_changes, 1, __ATOMIC_RELAXED);
+    } else if (event == RTE_ETH_EVENT_INTR_RESET) {
+        __atomic_add_fetch(&dc->reset_events, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&dc->reset_pending, 1, __ATOMIC_RELEASE);
+    }
+    return 0;
 }
 
-static int port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+static void port_events_register(struct dpdk_ctx *dc)
+{
+    if (dc->callbacks)
+        return;
+    rte_eth_dev_callback_register(dc->port_id, RTE_ETH_EVENT_INTR_LSC, port_event_cb, dc);
+    rte_eth_dev_callback_register(dc->port_id, RTE_ETH_EVENT_INTR_RESET, port_event_cb, dc);
+    dc->callbacks = 1;
+}
+
+static void port_events_unregister(struct dpdk_ctx *dc)
+{
+    if (!dc->callbacks)
+        return;
+    rte_eth_dev_callback_unregister(dc->port_id, RTE_ETH_EVENT_INTR_LSC, port_event_cb, dc);
+    rte_eth_dev_callback_unregister(dc->port_id, RTE_ETH_EVENT_INTR_RESET, port_event_cb, dc);
+    dc->callbacks = 0;
+}
+
+static int port_init(uint16_t port, struct rte_mempool *mbuf_pool, uint16_t rx_rings,
+                     uint8_t *rx_offloads, int *ts_offset, uint64_t *ts_flag, int *lsc_intr)
 {
     struct rte_eth_conf port_conf = port_conf_default;
-    const uint16_t rx_rings = 1, tx_rings = 1;
+    const uint16_t tx_rings = 1;
     uint16_t nb_rxd = 1024;
     uint16_t nb_txd = 1024;
     int retval;
@@ -65,6 +188,47 @@ static int port_init(uint16_t port, struct rte_mempool *mbuf_pool)
     if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE)
         port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE;
 
+    /* Link changes by interrupt where the PMD supports it, else they are polled */
+    *lsc_intr = dev_info.dev_flags != NULL && (*dev_info.dev_flags & RTE_ETH_DEV_INTR_LSC);
+    port_conf.intr_conf.lsc = *lsc_intr;
+
+    /* Have the NIC verify checksums; the flow engine checks in software
+     * whatever it leaves unverified */
+    *rx_offloads = 0;
+    port_conf.rxmode.offloads |= dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_CHECKSUM;
+    if (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_IPV4_CKSUM)
+        *rx_offloads |= PACKET_RX_IP_CKSUM_CHECKED;
+    if ((dev_info.rx_offload_capa & (RTE_ETH_RX_OFFLOAD_TCP_CKSUM | RTE_ETH_RX_OFFLOAD_UDP_CKSUM)) ==
+        (RTE_ETH_RX_OFFLOAD_TCP_CKSUM | RTE_ETH_RX_OFFLOAD_UDP_CKSUM))
+        *rx_offloads |= PACKET_RX_L4_CKSUM_CHECKED;
+
+    if (rx_rings > dev_info.max_rx_queues) {
+        printf("Error: port %u supports only %u RX queues\n", port, dev_info.max_rx_queues);
+        return -EINVAL;
+    }
+
+    /* Spread flows over the RX queues with RSS where the device supports it;
+     * for AF_XDP the kernel driver has already done so */
+    if (rx_rings > 1) {
+        port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+        port_conf.rx_adv_conf.rss_conf.rss_hf =
+            (RTE_ETH_RSS_IP | RTE_ETH_RSS_TCP | RTE_ETH_RSS_UDP) & dev_info.flow_type_rss_offloads;
+        if (port_conf.rx_adv_conf.rss_conf.rss_hf != 0)
+            port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+    }
+
+    /* Deliver the RSS hash in the mbuf where it is computed anyway */
+    if (port_conf.rxmode.mq_mode == RTE_ETH_MQ_RX_RSS &&
+        (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_RSS_HASH)) {
+        port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_RSS_HASH;
+        *rx_offloads |= PACKET_RX_RSS_HASH;
+    }
+
+    /* Have the NIC stamp each packet on arrival rather than the TSC at poll time */
+    *ts_offset = -1;
+    if (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_TIMESTAMP)
+        port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_TIMESTAMP;
+
     /* Configure the Ethernet device. */
     retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
     if (retval != 0)
@@ -74,7 +238,7 @@ static int port_init(uint16_t port, struct rte_mempool *mbuf_pool)
     if (retval != 0)
         return retval;
 
-    /* Allocate and set up 1 RX queue per Ethernet port. */
+    /* Allocate and set up the RX queues. */
     for (q = 0; q < rx_rings; q++) {
         retval = rte_eth_rx_queue_setup(port, q, nb_rxd,
                 rte_eth_dev_socket_id(port), NULL, mbuf_pool);
@@ -92,16 +256,24 @@ static int port_init(uint16_t port, struct rte_mempool *mbuf_pool)
             return retval;
     }
 
+    if (port_ptypes_init(port))
+        *rx_offloads |= PACKET_RX_PTYPE;
+
     /* Start the Ethernet port. */
     retval = rte_eth_dev_start(port);
     if (retval < 0)
         return retval;
 
+    /* The PMD registered the timestamp field when it started; look it up */
+    if ((port_conf.rxmode.offloads & RTE_ETH_RX_OFFLOAD_TIMESTAMP) &&
+        rte_mbuf_dyn_rx_timestamp_register(ts_offset, ts_flag) != 0)
+        *ts_offset = -1;
+
     /* Display the port MAC address. */
     struct rte_ether_addr addr;
     retval = rte_eth_macaddr_get(port, &addr);
     if (retval != 0)
-        return retval;
+        goto fail_stop;
 
     printf("Port %u MAC: %02x:%02x:%02x:%02x:%02x:%02x\n",
             port, RTE_ETHER_ADDR_BYTES(&addr));
@@ -109,25 +281,41 @@ static int port_init(uint16_t port, struct rte_mempool *mbuf_pool)
     /* Enable RX in promiscuous mode for the Ethernet device. */
     retval = rte_eth_promiscuous_enable(port);
     if (retval != 0)
-        return retval;
+        goto fail_stop;
 
     return 0;
+
+fail_stop:
+    /* The started RX rings hold mbufs of the pool, which the caller frees */
+    rte_eth_dev_stop(port);
+    return retval;
 }
 
-int dpdk_init(int port, const char *cores, int batch_size)
+static int eal_acquire(const char *cores)
 {
     int argc = 0;
-    char *argv[10];
+    char *argv[8];
     char core_arg[64];
     char app_name[] = "dpdk_capture";
-    
+
+    if (g_eal_refs > 0) {
+        g_eal_refs++;
+        return 0;
+    }
+
+    /* rte_eal_init() succeeds only once per process */
+    if (g_eal_done) {
+        printf("Error: DPDK EAL was already shut down in this process\n");
+        return -1;
+    }
+
     /* Setup arguments for DPDK EAL */
     argv[argc++] = app_name;
     argv[argc++] = "-l";
-    
-    snprintf(core_arg, sizeof(core_arg), "%s", cores);
+
+    snprintf(core_arg, sizeof(core_arg), "%s", cores ? cores : "0");
     argv[argc++] = core_arg;
-    
+
     argv[argc++] = "--";
     argv[argc] = NULL;
 
@@ -138,89 +326,458 @@ int dpdk_init(int port, const char *cores, int batch_size)
         return -1;
     }
 
-    /* Check that there is at least one port available */
-    unsigned nb_ports = rte_eth_dev_count_avail();
-    if (nb_ports == 0) {
-        printf("Error: no Ethernet ports available\n");
+    g_eal_refs = 1;
+    g_eal_done = 1;
+    return 0;
+}
+
+static void eal_release(void)
+{
+    if (g_eal_refs > 0 && --g_eal_refs == 0)
         rte_eal_cleanup();
-        return -2;
+}
+
+/* Create a virtual device from "name,args" devargs and look up its port */
+static int vdev_create(struct dpdk_ctx *dc, const char *devargs)
+{
+    char name[RTE_DEV_NAME_MAX_LEN];
+    const char *args = strchr(devargs, ',');
+    size_t len = args ? (size_t)(args - devargs) : strlen(devargs);
+
+    if (len == 0 || len >= sizeof(name)) {
+        printf("Error: invalid device arguments '%s'\n", devargs);
+        return -1;
     }
+    memcpy(name, devargs, len);
+    name[len] = '\0';
 
-    /* Validate port number */
-    if (port >= nb_ports) {
-        printf("Error: port %d not available (only %u ports)\n", port, nb_ports);
-        rte_eal_cleanup();
-        return -3;
+    if (rte_vdev_init(name, args ? args + 1 : "") != 0) {
+        printf("Error: cannot create virtual device %s\n", name);
+        return -1;
     }
+    snprintf(dc->vdev_name, sizeof(dc->vdev_name), "%s", name);
 
-    g_port_id = port;
-    g_batch_size = (batch_size > 0 && batch_size <= MAX_PKT_BURST) ? batch_size : MAX_PKT_BURST;
+    if (rte_eth_dev_get_port_by_name(name, &dc->port_id) != 0) {
+        printf("Error: virtual device %s has no Ethernet port\n", name);
+        return -1;
+    }
 
-    /* Create packet buffer pool */
-    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", 8192,
-        250, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    return 0;
+}
 
-    if (mbuf_pool == NULL) {
+static void dpdk_ctx_free(struct dpdk_ctx *dc)
+{
+    if (dc->vdev_name[0] != '\0') {
+        rte_vdev_uninit(dc->vdev_name);
+        dc->vdev_name[0] = '\0';
+    }
+    if (dc->mbuf_pool) {
+        rte_mempool_free(dc->mbuf_pool);
+        dc->mbuf_pool = NULL;
+    }
+}
+
+static int dpdk_backend_init(struct capture_ctx *ctx, const struct capture_config *config)
+{
+    struct dpdk_ctx *dc = ctx->priv;
+    char devargs[256];
+    char pool_name[RTE_MEMPOOL_NAMESIZE];
+    unsigned seq;
+    int ret;
+
+    if (eal_acquire(config->cores) != 0)
+        return -1;
+
+    seq = g_vdev_seq++;
+    switch (config->backend) {
+    case CAPTURE_BACKEND_AF_XDP:
+        if (config->iface == NULL || config->iface[0] == '\0') {
+            printf("Error: AF_XDP backend requires an interface name\n");
+            goto fail;
+        }
+        /* The interface stays with the kernel */
+        snprintf(devargs, sizeof(devargs),
+                 "net_af_xdp%u,iface=%s,start_queue=0,queue_count=%d",
+                 seq, config->iface, ctx->nb_queues);
+        if (vdev_create(dc, devargs) != 0)
+            goto fail;
+        break;
+
+    case CAPTURE_BACKEND_VDEV:
+        if (config->source == NULL || config->source[0] == '\0') {
+            printf("Error: vdev backend requires device arguments\n");
+            goto fail;
+        }
+        if (vdev_create(dc, config->source) != 0)
+            goto fail;
+        break;
+
+    default:
+        /* Validate port number */
+        if (config->port < 0 || !rte_eth_dev_is_valid_port(config->port)) {
+            printf("Error: port %d not available (only %u ports)\n",
+                   config->port, rte_eth_dev_count_avail());
+            goto fail;
+        }
+        dc->port_id = config->port;
+        break;
+    }
+
+    /* Mbufs of a burst are held per queue until released */
+    if (ctx->batch_size > MAX_PKT_BURST)
+        ctx->batch_size = MAX_PKT_BURST;
+
+    /* Warn if the polling lcore is on a different NUMA node than the port */
+    int port_socket = rte_eth_dev_socket_id(dc->port_id);
+    if (port_socket >= 0 && (unsigned)port_socket != rte_socket_id()) {
+        printf("WARNING: port %u is on remote NUMA node %d to lcore %u (node %u), "
+               "performance will not be optimal\n",
+               dc->port_id, port_socket, rte_lcore_id(), rte_socket_id());
+    }
+    ctx->numa_node = port_socket;
+
+    /* Create packet buffer pool on the port's NUMA node */
+    snprintf(pool_name, sizeof(pool_name), "MBUF_POOL_%u", seq);
+    dc->mbuf_pool = rte_pktmbuf_pool_create(pool_name,
+        config->num_mbufs > 0 ? config->num_mbufs : NUM_MBUFS,
+        MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
+        port_socket >= 0 ? port_socket : (int)rte_socket_id());
+
+    if (dc->mbuf_pool == NULL) {
         printf("Error: cannot create mbuf pool\n");
-        rte_eal_cleanup();
-        return -4;
+        goto fail;
     }
 
     /* Initialize port */
-    if (port_init(g_port_id, mbuf_pool) != 0) {
-        printf("Error: cannot init port %d\n", g_port_id);
-        rte_eal_cleanup();
-        return -5;
+    dc->link_last = -1;
+    ret = port_init(dc->port_id, dc->mbuf_pool, ctx->nb_queues, &dc->rx_offloads,
+                    &dc->ts_offset, &dc->ts_flag, &dc->lsc_intr);
+    if (ret != 0) {
+        printf("Error: cannot init port %u: %s\n", dc->port_id, strerror(ret < 0 ? -ret : ret));
+        goto fail;
     }
+    port_events_register(dc);
+
+    dc->clock = config->clock;
+    if (clocks_init(dc, ctx->nb_queues, config->clock) != 0)
+        goto fail_port;
+
+    printf("DPDK initialized successfully on port %u (%s, %d RX queues, offloads:%s%s%s%s, "
+           "timestamps: %s)\n",
+           dc->port_id, dc->vdev_name[0] ? dc->vdev_name : "PCI", ctx->nb_queues,
+           dc->rx_offloads & PACKET_RX_PTYPE ? " ptype" : "",
+           dc->rx_offloads & (PACKET_RX_IP_CKSUM_CHECKED | PACKET_RX_L4_CKSUM_CHECKED) ? " checksum" : "",
+           dc->rx_offloads & PACKET_RX_RSS_HASH ? " rss-hash" : "",
+           dc->rx_offloads ? "" : " none",
+           dc->ts_offset >= 0 ? "NIC clock" : "TSC");
+    return 0;
 
-    /* Install signal handlers */
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+fail_port:
+    /* The started port's RX rings hold mbufs of the pool */
+    port_events_unregister(dc);
+    rte_eth_dev_stop(dc->port_id);
+    rte_eth_dev_close(dc->port_id);
+fail:
+    port_events_unregister(dc);
+    dpdk_ctx_free(dc);
+    eal_release();
+    return -1;
+}
 
-    printf("DPDK initialized successfully on port %d\n", g_port_id);
-    return 0;
+/* Translate the offload results of an mbuf to PACKET_RX_* flags */
+static inline uint8_t mbuf_rx_flags(const struct rte_mbuf *mbuf, uint8_t offloads)
+{
+    uint32_t ptype = mbuf->packet_type;
+    uint64_t ip_cksum = mbuf->ol_flags & RTE_MBUF_F_RX_IP_CKSUM_MASK;
+    uint64_t l4_cksum = mbuf->ol_flags & RTE_MBUF_F_RX_L4_CKSUM_MASK;
+    uint8_t flags = 0;
+
+    /* Packets the NIC could not classify are left to the parser */
+    if ((offloads & PACKET_RX_PTYPE) && ptype != RTE_PTYPE_UNKNOWN) {
+        flags |= PACKET_RX_PTYPE;
+        if ((ptype & RTE_PTYPE_L2_MASK) == RTE_PTYPE_L2_ETHER && RTE_ETH_IS_IPV4_HDR(ptype))
+            flags |= PACKET_RX_IPV4;
+    }
+    if (ip_cksum == RTE_MBUF_F_RX_IP_CKSUM_GOOD)
+        flags |= PACKET_RX_IP_CKSUM_CHECKED;
+    else if (ip_cksum == RTE_MBUF_F_RX_IP_CKSUM_BAD)
+        flags |= PACKET_RX_IP_CKSUM_CHECKED | PACKET_RX_IP_CKSUM_BAD;
+    if (l4_cksum == RTE_MBUF_F_RX_L4_CKSUM_GOOD)
+        flags |= PACKET_RX_L4_CKSUM_CHECKED;
+    else if (l4_cksum == RTE_MBUF_F_RX_L4_CKSUM_BAD)
+        flags |= PACKET_RX_L4_CKSUM_CHECKED | PACKET_RX_L4_CKSUM_BAD;
+    if (mbuf->ol_flags & RTE_MBUF_F_RX_RSS_HASH)
+        flags |= PACKET_RX_RSS_HASH;
+    return flags;
 }
 
-int dpdk_capture_packets(struct packet *packets, int max_packets)
+static int dpdk_backend_rx_burst(struct capture_ctx *ctx, int queue, struct packet *packets,
+                                 uint64_t *timestamps, int max_packets)
 {
-    struct rte_mbuf *bufs[MAX_PKT_BURST];
+    struct dpdk_ctx *dc = ctx->priv;
+    struct rte_mbuf **bufs = dc->held[queue];
+    struct clock_sync *tsc_clock = &dc->tsc_clock[queue];
+    struct clock_sync *nic_clock = &dc->nic_clock[queue];
+    uint64_t tsc, burst_ns, last_ns;
     uint16_t nb_rx;
     int i;
-    uint32_t timestamp;
-
-    if (!packets || max_packets <= 0) {
-        return -1;
-    }
-
-    /* Limit to our batch size */
-    int capture_count = (max_packets < g_batch_size) ? max_packets : g_batch_size;
 
     /* Receive packets */
-    nb_rx = rte_eth_rx_burst(g_port_id, 0, bufs, capture_count);
+    nb_rx = rte_eth_rx_burst(dc->port_id, queue, bufs, max_packets);
+    dc->nb_held[queue] = nb_rx;
 
     if (nb_rx == 0) {
         return 0; /* No packets received */
     }
 
-    /* Get current timestamp */
-    timestamp = (uint32_t)(rte_get_tsc_cycles() / rte_get_tsc_hz());
+    /* Receive time of the burst, for packets the NIC did not stamp */
+    tsc = rte_rdtsc();
+    if (unlikely(clock_sync_due(tsc_clock, tsc))) {
+        clock_sync_calibrate(tsc_clock);
+        if (dc->ts_offset >= 0)
+            clock_sync_calibrate(nic_clock);
+    }
+    burst_ns = clock_sync_ns(tsc_clock, tsc);
+    last_ns = dc->last_ns[queue];
 
-    /* Process received packets */
+    /* Process received packets; mbufs are kept until the burst is released */
     for (i = 0; i < nb_rx; i++) {
         struct rte_mbuf *mbuf = bufs[i];
-        
+        uint64_t ns = burst_ns;
+
+        if (dc->ts_offset >= 0 && (mbuf->ol_flags & dc->ts_flag))
+            ns = clock_sync_ns(nic_clock, *RTE_MBUF_DYNFIELD(mbuf, dc->ts_offset, rte_mbuf_timestamp_t *));
+        /* Calibration only slews, but a step of the system clock or a
+         * restart can map ticks to an earlier time */
+        if (unlikely(ns < last_ns))
+            ns = last_ns;
+        last_ns = ns;
+
         packets[i].data = rte_pktmbuf_mtod(mbuf, uint8_t*);
         packets[i].length = rte_pktmbuf_data_len(mbuf);
-        packets[i].port = g_port_id;
-        packets[i].timestamp = timestamp;
+        packets[i].port = dc->port_id;
+        packets[i].timestamp = (uint32_t)(ns / 1000000000ULL);
+        packets[i].rx_flags = dc->rx_offloads ? mbuf_rx_flags(mbuf, dc->rx_offloads) : 0;
+        packets[i].rss_hash = mbuf->hash.rss;
+        if (timestamps)
+            timestamps[i] = ns;
     }
+    dc->last_ns[queue] = last_ns;
 
-    /* Free mbufs after copying data */
-    for (i = 0; i < nb_rx; i++) {
-        rte_pktmbuf_free(bufs[i]);
+    return nb_rx;
+}
+
+static void dpdk_backend_release(struct capture_ctx *ctx, int queue)
+{
+    struct dpdk_ctx *dc = ctx->priv;
+
+    if (dc->nb_held[queue] > 0) {
+        rte_pktmbuf_free_bulk(dc->held[queue], dc->nb_held[queue]);
+        dc->nb_held[queue] = 0;
     }
+}
 
-    return nb_rx;
+static int dpdk_backend_stats(struct capture_ctx *ctx, struct capture_stats *stats)
+{
+    struct dpdk_ctx *dc = ctx->priv;
+    struct rte_eth_stats eth_stats;
+    uint64_t obj_size;
+    unsigned in_use;
+    int q;
+
+    if (rte_eth_stats_get(dc->port_id, &eth_stats) == 0) {
+        stats->rx_packets = eth_stats.ipackets;
+        stats->rx_bytes = eth_stats.ibytes;
+        stats->rx_dropped = eth_stats.imissed + eth_stats.rx_nombuf;
+        stats->rx_errors = eth_stats.ierrors;
+        stats->rx_missed = eth_stats.imissed;
+        stats->rx_nombuf = eth_stats.rx_nombuf;
+    }
+
+    /* Each object carries a mempool header and trailer around the mbuf */
+    obj_size = dc->mbuf_pool->header_size + dc->mbuf_pool->elt_size +
+               dc->mbuf_pool->trailer_size;
+    in_use = rte_mempool_in_use_count(dc->mbuf_pool);
+
+    stats->buffer_bytes = obj_size * dc->mbuf_pool->populated_size;
+    stats->buffer_in_use = obj_size * in_use;
+    if (stats->buffer_in_use > dc->mempool_in_use_hwm)
+        dc->mempool_in_use_hwm = stats->buffer_in_use;
+    stats->buffer_in_use_hwm = dc->mempool_in_use_hwm;
+
+    /* Calibration of the clock that timestamps packets, worst queue first */
+    for (q = 0; q < ctx->nb_queues; q++) {
+        const struct clock_sync *cs = dc->ts_offset >= 0 ? &dc->nic_clock[q] : &dc->tsc_clock[q];
+
+        stats->clock_calibrations += cs->calibrations;
+        if (llabs(cs->last_error_ns) > llabs(stats->clock_error_ns))
+            stats->clock_error_ns = cs->last_error_ns;
+        if (cs->max_error_ns > stats->clock_error_max_ns)
+            stats->clock_error_max_ns = cs->max_error_ns;
+    }
+
+    return 0;
+}
+
+static int dpdk_backend_health(struct capture_ctx *ctx, struct capture_health *health)
+{
+    struct dpdk_ctx *dc = ctx->priv;
+    struct rte_eth_link link;
+
+    if (rte_eth_link_get_nowait(dc->port_id, &link) == 0) {
+        health->link_up = link.link_status == RTE_ETH_LINK_UP;
+        health->link_speed = link.link_status == RTE_ETH_LINK_UP ? link.link_speed : 0;
+        if (!dc->lsc_intr && dc->link_last >= 0 && dc->link_last != health->link_up)
+            dc->link_changes++;
+        dc->link_last = health->link_up;
+    }
+
+    health->link_changes = __atomic_load_n(&dc->link_changes, __ATOMIC_RELAXED);
+    health->reset_events = __atomic_load_n(&dc->reset_events, __ATOMIC_RELAXED);
+    health->reset_pending = __atomic_load_n(&dc->reset_pending, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+static int dpdk_backend_restart(struct capture_ctx *ctx, int queue)
+{
+    struct dpdk_ctx *dc = ctx->priv;
+    int ret;
+
+    /* A stalled queue alone, where the PMD can stop it */
+    if (queue >= 0 && !__atomic_load_n(&dc->reset_pending, __ATOMIC_ACQUIRE)) {
+        ret = rte_eth_dev_rx_queue_stop(dc->port_id, queue);
+        if (ret == 0) {
+            ret = rte_eth_dev_rx_queue_start(dc->port_id, queue);
+            if (ret == 0)
+                return 0;
+        }
+        if (ret != -ENOTSUP)
+            printf("WARNING: cannot restart RX queue %d of port %u: %s, restarting the port\n",
+                   queue, dc->port_id, strerror(-ret));
+    }
+
+    rte_eth_dev_stop(dc->port_id);
+
+    /* After a reset event the port must be reset, which also unconfigures it */
+    if (__atomic_exchange_n(&dc->reset_pending, 0, __ATOMIC_ACQ_REL)) {
+        ret = rte_eth_dev_reset(dc->port_id);
+        if (ret != 0) {
+            printf("Error: cannot reset port %u: %s\n", dc->port_id, strerror(-ret));
+            __atomic_store_n(&dc->reset_pending, 1, __ATOMIC_RELEASE);
+            return -1;
+        }
+    }
+
+    ret = port_init(dc->port_id, dc->mbuf_pool, ctx->nb_queues, &dc->rx_offloads,
+                    &dc->ts_offset, &dc->ts_flag, &dc->lsc_intr);
+    if (ret != 0) {
+        printf("Error: cannot restart port %u: %s\n", dc->port_id, strerror(ret < 0 ? -ret : ret));
+        return -1;
+    }
+
+    /* A reset may have restarted the NIC clock */
+    return clocks_init(dc, ctx->nb_queues, dc->clock);
+}
+
+static void dpdk_backend_close(struct capture_ctx *ctx)
+{
+    struct dpdk_ctx *dc = ctx->priv;
+
+    port_events_unregister(dc);
+
+    /* Stop the port */
+    if (rte_eth_dev_is_valid_port(dc->port_id)) {
+        rte_eth_dev_stop(dc->port_id);
+        rte_eth_dev_close(dc->port_id);
+    }
+
+    dpdk_ctx_free(dc);
+    eal_release();
+}
+
+const struct capture_backend capture_backend_dpdk = {
+    .name = "dpdk",
+    .priv_size = sizeof(struct dpdk_ctx),
+    .init = dpdk_backend_init,
+    .rx_burst = dpdk_backend_rx_burst,
+    .release = dpdk_backend_release,
+    .stats = dpdk_backend_stats,
+    .health = dpdk_backend_health,
+    .restart = dpdk_backend_restart,
+    .close = dpdk_backend_close,
+};
+
+void dpdk_set_mbuf_count(unsigned num_mbufs)
+{
+    g_num_mbufs = num_mbufs > 0 ? num_mbufs : NUM_MBUFS;
+}
+
+int dpdk_init(int port, const char *cores, int batch_size)
+{
+    struct capture_config config = {
+        .backend = CAPTURE_BACKEND_PCI,
+        .port = port,
+        .iface = NULL,
+        .queues = 1,
+        .cores = cores,
+        .batch_size = batch_size,
+    };
+
+    return dpdk_init_config(&config);
+}
+
+int dpdk_init_config(const struct capture_config *config)
+{
+    struct capture_config legacy;
+
+    if (config == NULL || config->cores == NULL)
+        return -1;
+
+    if (g_default_ctx != NULL) {
+        printf("Error: DPDK capture already initialized\n");
+        return -1;
+    }
+
+    if (config->backend != CAPTURE_BACKEND_PCI && config->backend != CAPTURE_BACKEND_AF_XDP &&
+        config->backend != CAPTURE_BACKEND_VDEV) {
+        printf("Error: unknown capture backend %d\n", config->backend);
+        return -1;
+    }
+
+    legacy = *config;
+    if (legacy.num_mbufs == 0)
+        legacy.num_mbufs = g_num_mbufs;
+
+    g_default_ctx = capture_open(&legacy);
+    return g_default_ctx ? 0 : -1;
+}
+
+int dpdk_capture_packets(struct packet *packets, int max_packets)
+{
+    return capture_rx_burst(g_default_ctx, -1, packets, NULL, max_packets);
+}
+
+int dpdk_capture_packets_queue(int queue, struct packet *packets, int max_packets)
+{
+    if (queue < 0) {
+        return -1;
+    }
+
+    return capture_rx_burst(g_default_ctx, queue, packets, NULL, max_packets);
+}
+
+int dpdk_get_nb_queues(void)
+{
+    return capture_get_nb_queues(g_default_ctx);
+}
+
+int dpdk_get_port_id(void)
+{
+    if (g_default_ctx == NULL) {
+        return -1;
+    }
+
+    return ((struct dpdk_ctx *)g_default_ctx->priv)->port_id;
 }
 
 int dpdk_get_stats(int port, uint64_t *rx_packets, uint64_t *tx_packets,
@@ -229,7 +786,7 @@ int dpdk_get_stats(int port, uint64_t *rx_packets, uint64_t *tx_packets,
     struct rte_eth_stats stats;
     int ret;
 
-    if (port != g_port_id) {
+    if (port != dpdk_get_port_id()) {
         return -1;
     }
 
@@ -246,18 +803,44 @@ int dpdk_get_stats(int port, uint64_t *rx_packets, uint64_t *tx_packets,
     return 0;
 }
 
+int dpdk_get_mem_stats(struct dpdk_mem_stats *stats)
+{
+    struct capture_stats cs;
+    struct rte_mempool *pool;
+
+    if (!stats || g_default_ctx == NULL) {
+        return -1;
+    }
+
+    if (capture_get_stats(g_default_ctx, &cs) != 0) {
+        return -1;
+    }
+
+    pool = ((struct dpdk_ctx *)g_default_ctx->priv)->mbuf_pool;
+    stats->mbuf_count = pool->populated_size;
+    stats->mbuf_in_use = rte_mempool_in_use_count(pool);
+    stats->mempool_bytes = cs.buffer_bytes;
+    stats->mempool_in_use = cs.buffer_in_use;
+    stats->mempool_in_use_hwm = cs.buffer_in_use_hwm;
+
+    return 0;
+}
+
+int dpdk_get_port_socket(int port)
+{
+    if (!rte_eth_dev_is_valid_port(port)) {
+        return -1;
+    }
+
+    return rte_eth_dev_socket_id(port);
+}
+
 void dpdk_cleanup(void)
 {
     printf("Cleaning up DPDK resources...\n");
-    
-    /* Stop the port */
-    if (rte_eth_dev_is_valid_port(g_port_id)) {
-        rte_eth_dev_stop(g_port_id);
-        rte_eth_dev_close(g_port_id);
-    }
 
-    /* Cleanup EAL */
-    rte_eal_cleanup();
-    
+    capture_close(g_default_ctx);
+    g_default_ctx = NULL;
+
     printf("DPDK cleanup completed\n");
 }
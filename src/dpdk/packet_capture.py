@@ -1,12 +1,27 @@
 """
-Python wrapper for DPDK packet capture library.
-Provides a clean Python interface to the DPDK C library.
+Python wrapper for the packet capture library.
+Provides a clean Python interface to the capture backends of the C library:
+DPDK ports and virtual devices, AF_XDP, pcap files and AF_PACKET.
 """
 
 import ctypes
 import os
 import logging
-from ctypes import Structure, c_uint8, c_uint16, c_uint32, c_void_p, POINTER
+from ctypes import Structure, c_uint8, c_uint16, c_uint32, c_uint64, c_void_p, POINTER
+
+import numpy as np
+
+from src.dpdk.burst import PACKED_PACKET, PacketBurst
+
+# Locations searched for the native library
+LIBRARY_PATHS = ["./libdpdk_capture.so", "/usr/local/lib/libdpdk_capture.so"]
+
+def find_library():
+    """Return the path of the native capture library, or None if not built."""
+    for lib_path in LIBRARY_PATHS:
+        if os.path.exists(lib_path):
+            return lib_path
+    return None
 
 # Packet structure matching C definition
 class Packet(Structure):
@@ -14,107 +29,345 @@ class Packet(Structure):
         ("data", POINTER(c_uint8)),
         ("length", c_uint16),
         ("port", c_uint8),
-        ("timestamp", c_uint32)
+        ("rx_flags", c_uint8),
+        ("timestamp", c_uint32),
+        ("rss_hash", c_uint32)
+    ]
+
+# Receive offload flags matching the PACKET_RX_* definitions
+PACKET_RX_PTYPE = 0x01
+PACKET_RX_IPV4 = 0x02
+PACKET_RX_RSS_HASH = 0x04
+PACKET_RX_IP_CKSUM_CHECKED = 0x08
+PACKET_RX_IP_CKSUM_BAD = 0x10
+PACKET_RX_L4_CKSUM_CHECKED = 0x20
+PACKET_RX_L4_CKSUM_BAD = 0x40
+
+# Capture configuration structure matching C definition
+class CaptureConfig(Structure):
+    _fields_ = [
+        ("backend", ctypes.c_int),
+        ("port", ctypes.c_int),
+        ("iface", ctypes.c_char_p),
+        ("queues", ctypes.c_int),
+        ("cores", ctypes.c_char_p),
+        ("batch_size", ctypes.c_int),
+        ("source", ctypes.c_char_p),
+        ("num_mbufs", ctypes.c_uint),
+        ("clock", ctypes.c_int)
     ]
 
-class DPDKPacketCapture:
-    def __init__(self, port=0, cores="0", batch_size=32):
+# Capture statistics structure matching C definition
+class CaptureStats(Structure):
+    _fields_ = [
+        ("rx_packets", c_uint64),
+        ("rx_bytes", c_uint64),
+        ("rx_dropped", c_uint64),
+        ("rx_errors", c_uint64),
+        ("rx_missed", c_uint64),
+        ("rx_nombuf", c_uint64),
+        ("buffer_bytes", c_uint64),
+        ("buffer_in_use", c_uint64),
+        ("buffer_in_use_hwm", c_uint64),
+        ("clock_calibrations", c_uint64),
+        ("clock_error_ns", ctypes.c_int64),
+        ("clock_error_max_ns", c_uint64)
+    ]
+
+# Largest number of RX queues, matching MAX_RX_QUEUES
+MAX_RX_QUEUES = 16
+
+# Link state structure matching C definition
+class CaptureHealth(Structure):
+    _fields_ = [
+        ("link_up", ctypes.c_int32),
+        ("link_speed", c_uint32),
+        ("link_changes", c_uint64),
+        ("reset_events", c_uint64),
+        ("reset_pending", ctypes.c_int32),
+        ("nb_queues", ctypes.c_int32),
+        ("idle_ms", c_uint64 * MAX_RX_QUEUES)
+    ]
+
+# Capture backends matching the CAPTURE_BACKEND_* definitions
+BACKENDS = {
+    'pci': 0,
+    'af_xdp': 1,
+    'vdev': 2,
+    'pcap': 3,
+    'af_packet': 4
+}
+
+# Backends that run on DPDK and need root for hugepages and device access
+DPDK_BACKENDS = ('pci', 'af_xdp', 'vdev')
+
+# Most packets the DPDK backends return per poll, MAX_PKT_BURST in dpdk_capture.h
+MAX_PKT_BURST = 32
+
+# Reference clocks of receive timestamps, matching the CAPTURE_CLOCK_* definitions
+CLOCKS = {
+    'realtime': 0,
+    'tai': 1
+}
+
+class PacketCapture:
+    def __init__(self, backend='pci', port=0, cores="0", batch_size=32, num_mbufs=0,
+                 iface=None, queues=1, source=None, clock='realtime'):
+        self.backend = backend
         self.port = port
         self.cores = cores
         self.batch_size = batch_size
+        self.num_mbufs = num_mbufs
+        self.iface = iface
+        self.queues = queues
+        self.source = source
+        self.clock = clock
         self.lib = None
+        self.ctx = None
+        self.packet_buffer = None
+        self.timestamps = None
         self.initialized = False
         self.logger = logging.getLogger(__name__)
         
     def initialize(self):
-        """Initialize DPDK library and configure packet capture."""
+        """Load the capture library and open the configured backend."""
         try:
-            # Load the DPDK capture library
-            lib_path = "./libdpdk_capture.so"
-            if not os.path.exists(lib_path):
-                lib_path = "/usr/local/lib/libdpdk_capture.so"
+            if self.backend not in BACKENDS:
+                self.logger.error(f"Unknown capture backend '{self.backend}' (expected one of {', '.join(BACKENDS)})")
+                return False
                 
-            if not os.path.exists(lib_path):
-                self.logger.error("DPDK capture library not found. Run 'make' to build it.")
+            # Load the capture library
+            lib_path = find_library()
+            if not lib_path:
+                self.logger.error("Capture library not found. Run 'make' to build it.")
                 return False
                 
             self.lib = ctypes.CDLL(lib_path)
             
             # Define function signatures
-            self.lib.dpdk_init.argtypes = [ctypes.c_int, ctypes.c_char_p, ctypes.c_int]
-            self.lib.dpdk_init.restype = ctypes.c_int
+            self.lib.capture_backend_available.argtypes = [ctypes.c_int]
+            self.lib.capture_backend_available.restype = ctypes.c_int
+            
+            self.lib.capture_open.argtypes = [POINTER(CaptureConfig)]
+            self.lib.capture_open.restype = c_void_p
+            
+            self.lib.capture_rx_burst.argtypes = [c_void_p, ctypes.c_int, POINTER(Packet), POINTER(c_uint64), ctypes.c_int]
+            self.lib.capture_rx_burst.restype = ctypes.c_int
+            
+            self.lib.capture_release.argtypes = [c_void_p, ctypes.c_int]
+            self.lib.capture_release.restype = None
+            
+            self.lib.capture_pack_burst.argtypes = [POINTER(Packet), POINTER(c_uint64), ctypes.c_int, c_void_p,
+                                                    c_void_p, c_uint64]
+            self.lib.capture_pack_burst.restype = ctypes.c_int64
             
-            self.lib.dpdk_capture_packets.argtypes = [POINTER(Packet), ctypes.c_int]
-            self.lib.dpdk_capture_packets.restype = ctypes.c_int
+            self.lib.capture_get_stats.argtypes = [c_void_p, POINTER(CaptureStats)]
+            self.lib.capture_get_stats.restype = ctypes.c_int
             
-            self.lib.dpdk_cleanup.argtypes = []
-            self.lib.dpdk_cleanup.restype = None
+            self.lib.capture_get_nb_queues.argtypes = [c_void_p]
+            self.lib.capture_get_nb_queues.restype = ctypes.c_int
             
-            # Initialize DPDK
-            cores_bytes = self.cores.encode('utf-8')
-            result = self.lib.dpdk_init(self.port, cores_bytes, self.batch_size)
+            self.lib.capture_get_numa_node.argtypes = [c_void_p]
+            self.lib.capture_get_numa_node.restype = ctypes.c_int
             
-            if result != 0:
-                self.logger.error(f"DPDK initialization failed with error code: {result}")
+            self.lib.capture_get_fd.argtypes = [c_void_p, ctypes.c_int]
+            self.lib.capture_get_fd.restype = ctypes.c_int
+            
+            self.lib.capture_get_health.argtypes = [c_void_p, POINTER(CaptureHealth)]
+            self.lib.capture_get_health.restype = ctypes.c_int
+            
+            self.lib.capture_restart.argtypes = [c_void_p, ctypes.c_int]
+            self.lib.capture_restart.restype = ctypes.c_int
+            
+            self.lib.capture_close.argtypes = [c_void_p]
+            self.lib.capture_close.restype = None
+            
+            if not self.lib.capture_backend_available(BACKENDS[self.backend]):
+                self.logger.error(f"Capture backend '{self.backend}' is not built into {lib_path}"
+                                  f"{' (DPDK not found at build time)' if self.backend in DPDK_BACKENDS else ''}")
                 return False
                 
+            # Open the capture context
+            config = CaptureConfig(
+                backend=BACKENDS[self.backend],
+                port=self.port,
+                iface=self.iface.encode('utf-8') if self.iface else None,
+                queues=self.queues,
+                cores=self.cores.encode('utf-8'),
+                batch_size=self.batch_size,
+                source=self.source.encode('utf-8') if self.source else None,
+                num_mbufs=self.num_mbufs,
+                clock=CLOCKS[self.clock]
+            )
+            self.ctx = self.lib.capture_open(ctypes.byref(config))
+            
+            if not self.ctx:
+                self.logger.error(f"Failed to open {self.backend} capture backend")
+                return False
+                
+            self.packet_buffer = (Packet * self.batch_size)()
+            self.timestamps = (c_uint64 * self.batch_size)()
             self.initialized = True
-            self.logger.info(f"DPDK initialized successfully on port {self.port}")
+            self.logger.info(f"Capture initialized on {self.describe()} with "
+                             f"{self.get_queue_count()} RX queue(s)")
             return True
             
         except Exception as e:
-            self.logger.error(f"Failed to initialize DPDK: {e}")
+            self.logger.error(f"Failed to initialize packet capture: {e}")
             return False
             
-    def capture_packets(self):
-        """Capture a batch of packets from the network interface."""
+    def describe(self):
+        """Describe the capture source for log messages."""
+        if self.backend == 'pci':
+            return f"DPDK port {self.port}"
+        if self.backend in ('af_xdp', 'af_packet'):
+            return f"interface {self.iface} ({self.backend})"
+        return f"{self.source} ({self.backend})"
+        
+    def capture_packets(self, max_packets=None, queue=None):
+        """Capture a batch of packets as a PacketBurst.
+        
+        Without a queue number all RX queues are polled in turn. Packet data
+        is copied into the burst and the buffers are returned to the backend
+        right away. Batches larger than a backend burst are gathered over
+        several polls, until a poll comes back short.
+        """
         if not self.initialized:
-            self.logger.error("DPDK not initialized")
-            return []
+            self.logger.error("Packet capture not initialized")
+            return PacketBurst()
             
         try:
-            # Allocate packet buffer
-            packet_buffer = (Packet * self.batch_size)()
-            
-            # Capture packets
-            num_packets = self.lib.dpdk_capture_packets(packet_buffer, self.batch_size)
-            
-            if num_packets < 0:
-                self.logger.error("Packet capture failed")
-                return []
-                
-            # Convert C packets to Python dictionaries
-            packets = []
-            for i in range(num_packets):
-                packet = packet_buffer[i]
-                
-                # Copy packet data
-                data = ctypes.string_at(packet.data, packet.length)
-                
-                packet_dict = {
-                    'data': data,
-                    'length': packet.length,
-                    'port': packet.port,
-                    'timestamp': packet.timestamp
-                }
-                
-                packets.append(packet_dict)
-                
-            return packets
+            # Capture up to the requested batch size
+            if max_packets is None or max_packets > self.batch_size:
+                max_packets = self.batch_size
+            queue = -1 if queue is None else queue
+            backend_burst = min(self.batch_size, MAX_PKT_BURST) if self.backend in DPDK_BACKENDS else self.batch_size
+            bursts = []
+            count = 0
+            while count < max_packets:
+                wanted = min(max_packets - count, backend_burst)
+                burst = self.rx_burst(queue, wanted)
+                if burst is None:
+                    break
+                bursts.append(burst)
+                count += len(burst)
+                if len(burst) < wanted:
+                    break
+            return PacketBurst.concat(bursts)
             
         except Exception as e:
             self.logger.error(f"Error capturing packets: {e}")
-            return []
+            return PacketBurst()
+            
+    def rx_burst(self, queue, max_packets):
+        """Poll one backend burst into a PacketBurst; None if the capture failed."""
+        num_packets = self.lib.capture_rx_burst(self.ctx, queue, self.packet_buffer,
+                                                self.timestamps, max_packets)
+        if num_packets < 0:
+            self.logger.error("Packet capture failed")
+            return None
+        if num_packets == 0:
+            return PacketBurst()
+            
+        # Copy the burst into one buffer in a single call, then return the
+        # packets; held AF_PACKET blocks would keep the ring's descriptor readable
+        try:
+            size = self.lib.capture_pack_burst(self.packet_buffer, self.timestamps, num_packets,
+                                               None, None, 0)
+            meta = np.empty(num_packets, dtype=PACKED_PACKET)
+            buffer = np.empty(size, dtype=np.uint8)
+            if self.lib.capture_pack_burst(self.packet_buffer, self.timestamps, num_packets,
+                                           meta.ctypes.data, buffer.ctypes.data, size) < 0:
+                raise RuntimeError("cannot pack burst")
+        finally:
+            self.lib.capture_release(self.ctx, queue)
+            
+        return PacketBurst(buffer, meta)
+        
+    def get_queue_count(self):
+        """Get the number of RX queues being polled."""
+        if not self.ctx:
+            return 0
+        return self.lib.capture_get_nb_queues(self.ctx)
+        
+    def get_fd(self, queue=0):
+        """Get a descriptor that polls readable when a queue has packets, or -1 if the backend must be busy-polled."""
+        if not self.initialized:
+            return -1
+        return self.lib.capture_get_fd(self.ctx, queue)
+        
+    def get_numa_node(self):
+        """Get the NUMA node packets are received on, or -1 if unknown."""
+        if not self.initialized:
+            return -1
+        return self.lib.capture_get_numa_node(self.ctx)
+        
+    def get_stats(self):
+        """Get receive counters and packet buffer usage of the backend."""
+        if not self.initialized:
+            return {}
+            
+        stats = CaptureStats()
+        if self.lib.capture_get_stats(self.ctx, ctypes.byref(stats)) != 0:
+            return {}
+            
+        return {name: getattr(stats, name) for name, _ in CaptureStats._fields_}
+        
+    def get_health(self):
+        """Get the link state and the seconds since each queue last returned packets.
+        
+        link_up is None where the backend has no link (pcap replay). Idle
+        times advance between calls, so call it from the polling thread.
+        """
+        if not self.initialized:
+            return {}
             
+        health = CaptureHealth()
+        if self.lib.capture_get_health(self.ctx, ctypes.byref(health)) != 0:
+            return {}
+            
+        return {
+            'link_up': None if health.link_up < 0 else bool(health.link_up),
+            'link_speed': health.link_speed,
+            'link_changes': health.link_changes,
+            'reset_events': health.reset_events,
+            'reset_pending': bool(health.reset_pending),
+            'idle': [health.idle_ms[q] / 1000.0 for q in range(health.nb_queues)]
+        }
+        
+    def restart(self, queue=None):
+        """Restart one RX queue, or the port if queue is None, releasing the last burst.
+        
+        Not thread safe with capture_packets(); returns False if the
+        backend cannot restart or the restart failed.
+        """
+        if not self.initialized:
+            return False
+        return self.lib.capture_restart(self.ctx, -1 if queue is None else queue) == 0
+        
+    def get_memory_stats(self):
+        """Get memory usage of the packet buffers (mbuf pools, rings or mapped file)."""
+        stats = self.get_stats()
+        return {name: stats[name] for name in ('buffer_bytes', 'buffer_in_use', 'buffer_in_use_hwm')
+                if name in stats}
+        
+    def get_drop_stats(self):
+        """Get packets lost before reaching the application, by drop reason."""
+        stats = self.get_stats()
+        if not stats:
+            return {}
+        return {'nic_missed': stats['rx_missed'], 'rx_nombuf': stats['rx_nombuf'], 'rx_errors': stats['rx_errors']}
+        
     def cleanup(self):
-        """Cleanup DPDK resources."""
-        if self.lib and self.initialized:
+        """Release buffers and close the capture backend."""
+        if self.lib and self.ctx:
             try:
-                self.lib.dpdk_cleanup()
+                self.lib.capture_close(self.ctx)
+                self.ctx = None
                 self.initialized = False
-                self.logger.info("DPDK cleanup completed")
+                self.logger.info("Capture cleanup completed")
             except Exception as e:
-                self.logger.error(f"Error during DPDK cleanup: {e}")
+                self.logger.error(f"Error during capture cleanup: {e}")
                 
     def __del__(self):
         """Destructor to ensure cleanup."""
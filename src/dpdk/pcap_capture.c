@@ -0,0 +1,170 @@
+/*
+ * Pcap File Capture Backend
+ * Replays a pcap file through the capture API as fast as it is polled;
+ * packets point into the memory-mapped file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture_backend.h"
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_GLOBAL_HDR_LEN 24
+#define PCAP_RECORD_HDR_LEN 16
+#define LINKTYPE_ETHERNET 1
+
+struct pcap_ctx {
+    const uint8_t *map;
+    size_t size;
+    size_t offset;          /* Next record header */
+    int swapped;            /* File written with the other byte order */
+    uint32_t ts_scale;      /* Nanoseconds per timestamp fraction unit */
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+static inline uint32_t read_u32(const struct pcap_ctx *pc, const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return pc->swapped ? __builtin_bswap32(v) : v;
+}
+
+static int pcap_init(struct capture_ctx *ctx, const struct capture_config *config)
+{
+    struct pcap_ctx *pc = ctx->priv;
+    struct stat st;
+    uint32_t magic;
+    int fd;
+
+    if (config->source == NULL || config->source[0] == '\0') {
+        printf("Error: pcap backend requires a file name\n");
+        return -1;
+    }
+
+    fd = open(config->source, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: cannot open %s: %s\n", config->source, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < PCAP_GLOBAL_HDR_LEN) {
+        printf("Error: %s: truncated pcap header\n", config->source);
+        close(fd);
+        return -1;
+    }
+
+    pc->size = st.st_size;
+    pc->map = mmap(NULL, pc->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pc->map == MAP_FAILED) {
+        pc->map = NULL;
+        printf("Error: cannot map %s: %s\n", config->source, strerror(errno));
+        return -1;
+    }
+    madvise((void *)pc->map, pc->size, MADV_SEQUENTIAL);
+
+    memcpy(&magic, pc->map, sizeof(magic));
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+        pc->swapped = 0;
+    } else if (__builtin_bswap32(magic) == PCAP_MAGIC_USEC ||
+               __builtin_bswap32(magic) == PCAP_MAGIC_NSEC) {
+        pc->swapped = 1;
+        magic = __builtin_bswap32(magic);
+    } else {
+        printf("Error: %s: not a pcap file (pcapng is not supported)\n", config->source);
+        munmap((void *)pc->map, pc->size);
+        return -1;
+    }
+    pc->ts_scale = magic == PCAP_MAGIC_USEC ? 1000 : 1;
+
+    if (read_u32(pc, pc->map + 20) != LINKTYPE_ETHERNET) {
+        printf("Error: %s: unsupported link type %u\n", config->source, read_u32(pc, pc->map + 20));
+        munmap((void *)pc->map, pc->size);
+        return -1;
+    }
+
+    /* A file is a single stream */
+    ctx->nb_queues = 1;
+    pc->offset = PCAP_GLOBAL_HDR_LEN;
+    return 0;
+}
+
+static int pcap_rx_burst(struct capture_ctx *ctx, int queue __attribute__((unused)),
+                         struct packet *packets, uint64_t *timestamps, int max_packets)
+{
+    struct pcap_ctx *pc = ctx->priv;
+    int nb_rx = 0;
+
+    while (nb_rx < max_packets && pc->offset + PCAP_RECORD_HDR_LEN <= pc->size) {
+        const uint8_t *hdr = pc->map + pc->offset;
+        uint32_t ts_sec = read_u32(pc, hdr);
+        uint32_t ts_frac = read_u32(pc, hdr + 4);
+        uint32_t incl_len = read_u32(pc, hdr + 8);
+
+        /* Stop at a truncated last record */
+        if (pc->offset + PCAP_RECORD_HDR_LEN + incl_len > pc->size)
+            break;
+
+        packets[nb_rx].data = (uint8_t *)hdr + PCAP_RECORD_HDR_LEN;
+        packets[nb_rx].length = incl_len > UINT16_MAX ? UINT16_MAX : incl_len;
+        packets[nb_rx].port = 0;
+        packets[nb_rx].rx_flags = 0;
+        packets[nb_rx].rss_hash = 0;
+        packets[nb_rx].timestamp = ts_sec;
+        if (timestamps)
+            timestamps[nb_rx] = (uint64_t)ts_sec * 1000000000ULL + (uint64_t)ts_frac * pc->ts_scale;
+
+        pc->offset += PCAP_RECORD_HDR_LEN + incl_len;
+        pc->packets++;
+        pc->bytes += incl_len;
+        nb_rx++;
+    }
+
+    return nb_rx;
+}
+
+static void pcap_release(struct capture_ctx *ctx __attribute__((unused)),
+                         int queue __attribute__((unused)))
+{
+    /* Packets stay mapped until the context is closed */
+}
+
+static int pcap_stats(struct capture_ctx *ctx, struct capture_stats *stats)
+{
+    struct pcap_ctx *pc = ctx->priv;
+
+    stats->rx_packets = pc->packets;
+    stats->rx_bytes = pc->bytes;
+    stats->buffer_bytes = pc->size;
+    return 0;
+}
+
+static void pcap_close(struct capture_ctx *ctx)
+{
+    struct pcap_ctx *pc = ctx->priv;
+
+    if (pc->map)
+        munmap((void *)pc->map, pc->size);
+    pc->map = NULL;
+}
+
+const struct capture_backend capture_backend_pcap = {
+    .name = "pcap",
+    .priv_size = sizeof(struct pcap_ctx),
+    .init = pcap_init,
+    .rx_burst = pcap_rx_burst,
+    .release = pcap_release,
+    .stats = pcap_stats,
+    .close = pcap_close,
+};
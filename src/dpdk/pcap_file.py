@@ -0,0 +1,100 @@
+"""
+Minimal pcap file reader and writer.
+Used to replay capture corpora through the feature pipeline without a NIC.
+"""
+
+import struct
+
+PCAP_MAGIC_USEC = 0xa1b2c3d4
+PCAP_MAGIC_NSEC = 0xa1b23c4d
+LINKTYPE_ETHERNET = 1
+
+class PcapReader:
+    def __init__(self, path):
+        self.path = path
+        self.file = None
+        self.endian = '<'
+        self.ts_scale = 1000
+        self.linktype = LINKTYPE_ETHERNET
+        
+    def open(self):
+        """Open the file and parse the global header."""
+        self.file = open(self.path, 'rb')
+        header = self.file.read(24)
+        if len(header) < 24:
+            raise ValueError(f"{self.path}: truncated pcap header")
+            
+        for endian in ('<', '>'):
+            magic = struct.unpack(endian + 'I', header[:4])[0]
+            if magic in (PCAP_MAGIC_USEC, PCAP_MAGIC_NSEC):
+                self.endian = endian
+                self.ts_scale = 1000 if magic == PCAP_MAGIC_USEC else 1
+                break
+        else:
+            raise ValueError(f"{self.path}: not a pcap file (pcapng is not supported)")
+            
+        self.linktype = struct.unpack(self.endian + 'I', header[20:24])[0]
+        if self.linktype != LINKTYPE_ETHERNET:
+            raise ValueError(f"{self.path}: unsupported link type {self.linktype}")
+        return self
+        
+    def __enter__(self):
+        return self.open()
+        
+    def __exit__(self, exc_type, exc, tb):
+        self.close()
+        
+    def __iter__(self):
+        """Yield (timestamp_ns, data, original_length) for each packet."""
+        record_header = struct.Struct(self.endian + 'IIII')
+        while True:
+            header = self.file.read(16)
+            if len(header) < 16:
+                return
+            ts_sec, ts_frac, incl_len, orig_len = record_header.unpack(header)
+            data = self.file.read(incl_len)
+            if len(data) < incl_len:
+                return
+            yield ts_sec * 1000000000 + ts_frac * self.ts_scale, data, orig_len
+            
+    def close(self):
+        """Close the file."""
+        if self.file:
+            self.file.close()
+            self.file = None
+
+class PcapWriter:
+    def __init__(self, path, snaplen=65535, nanosecond=True):
+        self.path = path
+        self.snaplen = snaplen
+        self.nanosecond = nanosecond
+        self.file = None
+        
+    def open(self):
+        """Create the file and write the global header."""
+        self.file = open(self.path, 'wb')
+        magic = PCAP_MAGIC_NSEC if self.nanosecond else PCAP_MAGIC_USEC
+        self.file.write(struct.pack('<IHHiIII', magic, 2, 4, 0, 0, self.snaplen, LINKTYPE_ETHERNET))
+        return self
+        
+    def __enter__(self):
+        return self.open()
+        
+    def __exit__(self, exc_type, exc, tb):
+        self.close()
+        
+    def write(self, timestamp_ns, data, orig_len=None):
+        """Append one packet."""
+        data = data[:self.snaplen]
+        if self.nanosecond:
+            ts_sec, ts_frac = divmod(timestamp_ns, 1000000000)
+        else:
+            ts_sec, ts_frac = divmod(timestamp_ns // 1000, 1000000)
+        self.file.write(struct.pack('<IIII', ts_sec, ts_frac, len(data), orig_len or len(data)))
+        self.file.write(data)
+        
+    def close(self):
+        """Close the file."""
+        if self.file:
+            self.file.close()
+            self.file = None
@@ -0,0 +1,115 @@
+"""
+IPv4, TCP and UDP checksum verification for the bad_checksum_packets feature.
+Capture backends with receive offloads report what the NIC or kernel already
+verified in the packet's rx_flags; everything else is checked here, with the
+same rules as checksum_bad() in the native flow engine.
+"""
+
+import struct
+
+import numpy as np
+
+# Receive offload flags, see PACKET_RX_* in dpdk_capture.h
+PACKET_RX_IP_CKSUM_CHECKED = 0x08
+PACKET_RX_IP_CKSUM_BAD = 0x10
+PACKET_RX_L4_CKSUM_CHECKED = 0x20
+PACKET_RX_L4_CKSUM_BAD = 0x40
+
+def ones_sum(data):
+    """Sum of the big-endian 16-bit words of data, odd length zero padded."""
+    if len(data) & 1:
+        data = data + b'\0'
+    return sum(struct.unpack(f'!{len(data) // 2}H', data))
+
+def packet_checksum_bad(data, rx_flags=0):
+    """Whether an Ethernet/IPv4 frame has a bad IPv4, TCP or UDP checksum.
+    
+    TCP and UDP checksums are only checked when the whole unfragmented
+    datagram was captured. A one's complement sum is valid when it folds to
+    0xFFFF, that is when it is a non-zero multiple of 0xFFFF.
+    """
+    ip = data[14:]
+    header_length = (ip[0] & 0xF) * 4
+    if not rx_flags & PACKET_RX_IP_CKSUM_CHECKED:
+        header_sum = ones_sum(ip[:header_length])
+        if header_length < 20 or header_sum == 0 or header_sum % 0xFFFF:
+            return True
+    elif rx_flags & PACKET_RX_IP_CKSUM_BAD:
+        return True
+        
+    protocol = ip[9]
+    if protocol not in (6, 17):
+        return False
+    if rx_flags & PACKET_RX_L4_CKSUM_CHECKED:
+        return bool(rx_flags & PACKET_RX_L4_CKSUM_BAD)
+        
+    total_length, fragment = struct.unpack_from('!H2xH', ip, 2)
+    if total_length > len(ip) or total_length < header_length or fragment & 0x3FFF:
+        return False
+    l4_length = total_length - header_length
+    if l4_length < (20 if protocol == 6 else 8):
+        return False
+    # A zero UDP checksum means the sender did not compute one
+    if protocol == 17 and ip[header_length + 6] == 0 and ip[header_length + 7] == 0:
+        return False
+    return (protocol + l4_length + ones_sum(ip[12:20]) + ones_sum(ip[header_length:total_length])) % 0xFFFF != 0
+
+def l4_word_sums(buffer, start, end):
+    """Little-endian 16-bit word sums of the ranges buffer[start:end], for even starts and ordered ranges of two bytes or more."""
+    halves = buffer[:len(buffer) & ~1].view('<u2')
+    bounds = np.empty(2 * len(start), dtype=np.int64)
+    bounds[0::2] = start >> 1
+    bounds[1::2] = np.minimum(end >> 1, len(halves) - 1)
+    # An IPv4 datagram has at most 32767 words, so the sums fit 32 bits
+    total = np.add.reduceat(halves, bounds, dtype=np.uint32)[0::2].astype(np.int64)
+    # reduceat indices stop short of the end; add the last word to a range reaching it
+    if end[-1] >> 1 == len(halves):
+        total[-1] += int(halves[-1])
+    odd = np.flatnonzero(end & 1)
+    total[odd] += buffer[end[odd] - 1]
+    return total
+
+def burst_checksum_bad(burst, headers, valid):
+    """packet_checksum_bad() of the packets of a PacketBurst in the valid mask.
+    
+    headers is the burst's header matrix, as PacketBurst.headers() gives it,
+    holding at least the Ethernet and IPv4 headers; the IPv4 header and
+    pseudo-header sums come from it. Only the TCP and UDP segments are summed
+    from the burst buffer, in one pass over little-endian 16-bit words. Since
+    2**16 is 1 modulo 0xFFFF, such a sum equals the big-endian word sum
+    times 2**8 modulo 0xFFFF.
+    """
+    flags = burst.rx_flags
+    ip_checked = (flags & PACKET_RX_IP_CKSUM_CHECKED) != 0
+    l4_checked = (flags & PACKET_RX_L4_CKSUM_CHECKED) != 0
+    words = np.ascontiguousarray(headers).view('>u2')
+    header_length = (headers[:, 14] & 0xF).astype(np.int64) * 4
+    # The IPv4 header starts at word 7; options are rare, so only their rows sum past 20 bytes
+    header_sum = words[:, 7:17].sum(axis=1, dtype=np.int64)
+    options = np.flatnonzero(valid & (header_length > 20))
+    if len(options):
+        extra = words[options, 17:37] * (np.arange(20) < (header_length[options, None] - 20) // 2)
+        header_sum[options] += extra.sum(axis=1, dtype=np.int64)
+    ip_bad = np.where(ip_checked, (flags & PACKET_RX_IP_CKSUM_BAD) != 0,
+                      (header_length < 20) | (header_sum == 0) | (header_sum % 0xFFFF != 0))
+    
+    protocol = headers[:, 23]
+    tcp_udp = (protocol == 6) | (protocol == 17)
+    l4_bad = l4_checked & ((flags & PACKET_RX_L4_CKSUM_BAD) != 0) & tcp_udp
+    total_length = words[:, 8].astype(np.int64)
+    l4_length = total_length - header_length
+    check = valid & tcp_udp & ~l4_checked & (total_length <= burst.lengths.astype(np.int64) - 14) & (l4_length >= 0)
+    check &= (words[:, 10] & 0x3FFF) == 0
+    check &= l4_length >= np.where(protocol == 6, 20, 8)
+    c = np.flatnonzero(check)
+    if len(c):
+        buffer = burst.buffer
+        l4 = burst.offsets[c].astype(np.int64) + 14 + header_length[c]
+        # A zero UDP checksum means the sender did not compute one
+        computed = (protocol[c] == 6) | ((buffer[l4 + 6] | buffer[l4 + 7]) != 0)
+        c, l4 = c[computed], l4[computed]
+    if len(c):
+        pseudo = protocol[c] + l4_length[c] + words[c, 13:17].sum(axis=1, dtype=np.int64)
+        l4_sum = l4_word_sums(burst.buffer, l4, l4 + l4_length[c])
+        l4_bad[c] = (pseudo + (l4_sum << 8)) % 0xFFFF != 0
+    return valid & (ip_bad | l4_bad)
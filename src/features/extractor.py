@@ -4,16 +4,24 @@ Extracts comprehensive flow features from captured packets.
 """
 
 import struct
+import sys
 import time
-import hashlib
 import logging
 from collections import defaultdict
 
+from src.features.checksum import packet_checksum_bad
+from src.features.flow_key import pack_key
+from src.features.plugins import FLOW_END_NONE, FLOW_END_SHUTDOWN
+
 class FeatureExtractor:
-    def __init__(self):
+    def __init__(self, clock=time.time):
         self.logger = logging.getLogger(__name__)
         self.flows = defaultdict(dict)
         self.flow_timeout = 600  # 10 minutes
+        self.clock = clock  # For packets without a capture timestamp
+        self.max_flows = 0  # New flows beyond this are dropped; 0 for no limit
+        self.table_full = 0  # Packets dropped because the flow table was full
+        self.tenant = 0  # Stamped in records, see TenantExtractor
         
     def parse_ethernet_header(self, data):
         """Parse Ethernet header from packet data."""
@@ -106,18 +114,13 @@ class FeatureExtractor:
         }
     
     def get_flow_key(self, src_ip, dst_ip, src_port, dst_port, protocol):
-        """Generate a unique flow key."""
-        # Normalize flow direction (smaller IP first)
-        if src_ip < dst_ip or (src_ip == dst_ip and src_port < dst_port):
-            key = f"{src_ip}:{src_port}-{dst_ip}:{dst_port}:{protocol}"
-        else:
-            key = f"{dst_ip}:{dst_port}-{src_ip}:{src_port}:{protocol}"
-        return hashlib.md5(key.encode()).hexdigest()[:16]
+        """Generate a unique flow key, the same for both directions."""
+        return pack_key(src_ip, dst_ip, src_port, dst_port, protocol)
     
     def update_flow_stats(self, flow_key, packet_info):
         """Update flow statistics with new packet."""
         flow = self.flows[flow_key]
-        current_time = time.time()
+        current_time = packet_info['time']
         
         # Initialize flow if new
         if 'start_time' not in flow:
@@ -130,6 +133,7 @@ class FeatureExtractor:
             flow['packet_count'] = 0
             flow['byte_count'] = 0
             flow['tcp_flags'] = 0
+            flow['bad_checksum_packets'] = 0
             flow['packet_lengths'] = []
             flow['inter_arrival_times'] = []
             flow['last_packet_time'] = current_time
@@ -149,6 +153,9 @@ class FeatureExtractor:
         # Update TCP flags if TCP packet
         if packet_info['protocol'] == 6 and 'tcp_flags' in packet_info:
             flow['tcp_flags'] |= packet_info['tcp_flags']
+            
+        if packet_info.get('bad_checksum'):
+            flow['bad_checksum_packets'] += 1
     
     def calculate_flow_features(self, flow):
         """Calculate comprehensive flow features."""
@@ -226,8 +233,13 @@ class FeatureExtractor:
         features['avg_packet_size'] = features['packet_length_mean']
         features['packet_length_variance'] = features['packet_length_std'] ** 2
         
+        # Packets with a bad IPv4, TCP or UDP checksum
+        features['bad_checksum_packets'] = flow['bad_checksum_packets']
+        features['end_reason'] = FLOW_END_NONE
+        features['tenant'] = self.tenant
+        
         # Timestamp
-        features['timestamp'] = int(time.time() * 1000000)  # Microseconds
+        features['timestamp'] = int(flow['last_packet_time'] * 1000000)  # Microseconds
         
         # Label (simplified - in real scenarios this would come from ML model or rules)
         features['label'] = 'BENIGN'
@@ -249,9 +261,55 @@ class FeatureExtractor:
         variance = sum((x - mean) ** 2 for x in values) / (len(values) - 1)
         return variance ** 0.5
     
-    def cleanup_old_flows(self):
+    def estimate_flow_size(self, flow):
+        """Estimate the memory footprint of a single flow entry in bytes."""
+        size = sys.getsizeof(flow)
+        for key, value in flow.items():
+            size += sys.getsizeof(value)
+            if isinstance(value, list):
+                size += sum(sys.getsizeof(v) for v in value)
+        return size
+        
+    def memory_usage(self, sample_size=256):
+        """Estimate the memory used by the flow table in bytes.
+        
+        Walking every flow is too slow for large tables, so the per-flow
+        size is averaged over a sample and extrapolated.
+        """
+        num_flows = len(self.flows)
+        size = sys.getsizeof(self.flows)
+        if num_flows == 0:
+            return size
+            
+        sampled = 0
+        sampled_bytes = 0
+        try:
+            for flow_key, flow in self.flows.items():
+                sampled_bytes += sys.getsizeof(flow_key) + self.estimate_flow_size(flow)
+                sampled += 1
+                if sampled >= sample_size:
+                    break
+        except RuntimeError:
+            # Flow table was resized by the capture loop while sampling
+            pass
+            
+        if sampled == 0:
+            return size
+        return size + int(sampled_bytes / sampled * num_flows)
+    
+    def flow_count(self):
+        """Get the number of active flows."""
+        return len(self.flows)
+        
+    def packet_time(self, packet):
+        """Capture time of a packet in seconds, from the backend's clock if it has one."""
+        timestamp_ns = packet.get('timestamp_ns')
+        return timestamp_ns / 1e9 if timestamp_ns else self.clock()
+        
+    def cleanup_old_flows(self, current_time=None):
         """Remove old flows to prevent memory leaks."""
-        current_time = time.time()
+        if current_time is None:
+            current_time = self.clock()
         expired_flows = []
         
         for flow_key, flow in self.flows.items():
@@ -264,12 +322,29 @@ class FeatureExtractor:
         if expired_flows:
             self.logger.debug(f"Cleaned up {len(expired_flows)} expired flows")
     
+    def flush_flows(self, end_reason=FLOW_END_SHUTDOWN):
+        """Final records of all active flows, as of their last packet; empties the flow table."""
+        records = []
+        for flow in self.flows.values():
+            features = self.calculate_flow_features(flow)
+            if features:
+                features['end_reason'] = end_reason
+                records.append(features)
+        self.flows.clear()
+        return records
+        
+    def extract_burst(self, burst):
+        """Extract features for a PacketBurst, one record per packet; None for skipped packets."""
+        return [self.extract_features(packet) for packet in burst.packets()]
+        
     def extract_features(self, packet):
         """Main function to extract features from a packet."""
         try:
+            current_time = self.packet_time(packet)
+            
             # Clean up old flows periodically
             if len(self.flows) > 1000:
-                self.cleanup_old_flows()
+                self.cleanup_old_flows(current_time)
                 
             packet_data = packet['data']
             packet_length = packet['length']
@@ -288,7 +363,9 @@ class FeatureExtractor:
                 'src_ip': ip['src_ip'],
                 'dst_ip': ip['dst_ip'],
                 'protocol': ip['protocol'],
-                'packet_length': packet_length
+                'packet_length': packet_length,
+                'time': current_time,
+                'bad_checksum': packet_checksum_bad(packet_data, packet.get('rx_flags', 0))
             }
             
             # Parse transport layer
@@ -317,6 +394,10 @@ class FeatureExtractor:
                 packet_info['protocol']
             )
             
+            if self.max_flows and flow_key not in self.flows and len(self.flows) >= self.max_flows:
+                self.table_full += 1
+                return None
+                
             self.update_flow_stats(flow_key, packet_info)
             
             # Extract features for this flow
@@ -0,0 +1,150 @@
+"""
+Canonical flow keys.
+Packed, direction-independent 5-tuple keys and their 64-bit hash, identical
+to src/dpdk/flow_key.h, so flow sampling and Kafka partitioning agree with
+the native flow engine.
+"""
+
+import functools
+import socket
+import struct
+
+import numpy as np
+
+MASK64 = (1 << 64) - 1
+
+PRIME64_1 = 0x9E3779B185EBCA87
+PRIME64_2 = 0xC2B2AE3D27D4EB4F
+PRIME64_3 = 0x165667B19E3779F9
+PRIME64_4 = 0x85EBCA77C2B2AE63
+PRIME64_5 = 0x27D4EB2F165667C5
+
+V4_MAPPED = b'\0' * 10 + b'\xff\xff'
+
+def pack_address(address):
+    """Address in network byte order, from packed bytes, a dotted or IPv6 string or an integer."""
+    if isinstance(address, bytes):
+        return address
+    if isinstance(address, int):
+        return address.to_bytes(4 if address < (1 << 32) else 16, 'big')
+    if ':' in address:
+        return socket.inet_pton(socket.AF_INET6, address)
+    return socket.inet_aton(address)
+
+def pack_key(src_ip, dst_ip, src_port, dst_port, protocol):
+    """Canonical key: the lower (address, port) endpoint first, then the protocol.
+
+    13 bytes for IPv4 and 37 for IPv6; both directions of a flow give the same key.
+    """
+    src, dst = pack_address(src_ip), pack_address(dst_ip)
+    if len(src) != len(dst):
+        # Mixed families compare as IPv4-mapped IPv6 addresses
+        src, dst = (V4_MAPPED + a if len(a) == 4 else a for a in (src, dst))
+    if (dst, dst_port) < (src, src_port):
+        src, dst, src_port, dst_port = dst, src, dst_port, src_port
+    return src + dst + struct.pack('>HHB', src_port, dst_port, protocol)
+
+def rotl(x, r):
+    return ((x << r) | (x >> (64 - r))) & MASK64
+
+def xxh_round(acc, lane):
+    acc = (acc + lane * PRIME64_2) & MASK64
+    return (rotl(acc, 31) * PRIME64_1) & MASK64
+
+def xxh64(data):
+    """XXH64 with seed 0, as flow_key_hash() computes it."""
+    length = len(data)
+    p = 0
+    if length >= 32:
+        v1 = (PRIME64_1 + PRIME64_2) & MASK64
+        v2 = PRIME64_2
+        v3 = 0
+        v4 = (-PRIME64_1) & MASK64
+        while p + 32 <= length:
+            l1, l2, l3, l4 = struct.unpack_from('<QQQQ', data, p)
+            v1, v2, v3, v4 = xxh_round(v1, l1), xxh_round(v2, l2), xxh_round(v3, l3), xxh_round(v4, l4)
+            p += 32
+        h = (rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18)) & MASK64
+        for v in (v1, v2, v3, v4):
+            h = ((h ^ xxh_round(0, v)) * PRIME64_1 + PRIME64_4) & MASK64
+    else:
+        h = PRIME64_5
+
+    h = (h + length) & MASK64
+    while p + 8 <= length:
+        h ^= xxh_round(0, struct.unpack_from('<Q', data, p)[0])
+        h = (rotl(h, 27) * PRIME64_1 + PRIME64_4) & MASK64
+        p += 8
+    if p + 4 <= length:
+        h ^= (struct.unpack_from('<I', data, p)[0] * PRIME64_1) & MASK64
+        h = (rotl(h, 23) * PRIME64_2 + PRIME64_3) & MASK64
+        p += 4
+    while p < length:
+        h ^= (data[p] * PRIME64_5) & MASK64
+        h = (rotl(h, 11) * PRIME64_1) & MASK64
+        p += 1
+
+    h ^= h >> 33
+    h = (h * PRIME64_2) & MASK64
+    h ^= h >> 29
+    h = (h * PRIME64_3) & MASK64
+    h ^= h >> 32
+    return h
+
+@functools.lru_cache(maxsize=65536)
+def key_hash(key):
+    """64-bit hash of a packed key."""
+    return xxh64(key)
+
+@functools.lru_cache(maxsize=65536)
+def flow_hash(src_ip, dst_ip, src_port, dst_port, protocol):
+    """64-bit hash of a flow, the same for both directions and in the native engine."""
+    return xxh64(pack_key(src_ip, dst_ip, src_port, dst_port, protocol))
+
+def record_hash(features):
+    """flow_hash() of a flow record."""
+    return flow_hash(features.get('src_ip'), features.get('dst_ip'), features.get('src_port') or 0,
+                     features.get('dst_port') or 0, features.get('protocol') or 0)
+
+def flow_keys(fields):
+    """Direction-independent flow keys of parsed packets, as two integer arrays.
+    
+    hi holds the lower and higher addresses, lo the matching ports and the
+    protocol: the canonical IPv4 key of pack_key() is
+    hi.to_bytes(8, 'big') + lo.to_bytes(5, 'big').
+    """
+    src, dst = fields['src_ip'].astype(np.uint64), fields['dst_ip'].astype(np.uint64)
+    sport, dport = fields['src_port'].astype(np.uint64), fields['dst_port'].astype(np.uint64)
+    forward = (src < dst) | ((src == dst) & (sport < dport))
+    hi = np.where(forward, (src << 32) | dst, (dst << 32) | src)
+    lo = np.where(forward, (sport << 24) | (dport << 8), (dport << 24) | (sport << 8)) | fields['protocol']
+    return hi, lo
+
+U64 = np.uint64
+
+def rotl64(x, r):
+    return (x << U64(r)) | (x >> U64(64 - r))
+
+def flow_hashes(hi, lo):
+    """XXH64 of the 13-byte keys given by flow_keys(), as key_hash() computes it one key at a time."""
+    hi, lo = np.asarray(hi, dtype=np.uint64), np.asarray(lo, dtype=np.uint64)
+    P1, P2, P3, P4, P5 = (U64(p) for p in (PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME64_5))
+    # Little-endian lanes of the big-endian key bytes: 8, then 4, then 1
+    lane = hi.byteswap()
+    word = (lo >> U64(8)).astype(np.uint32).byteswap().astype(np.uint64)
+    last = lo & U64(0xff)
+    
+    h = np.full(len(hi), P5 + U64(13), dtype=np.uint64)
+    h ^= rotl64(lane * P2, 31) * P1
+    h = rotl64(h, 27) * P1 + P4
+    h ^= word * P1
+    h = rotl64(h, 23) * P2 + P3
+    h ^= last * P5
+    h = rotl64(h, 11) * P1
+    
+    h ^= h >> U64(33)
+    h *= P2
+    h ^= h >> U64(29)
+    h *= P3
+    h ^= h >> U64(32)
+    return h
@@ -0,0 +1,353 @@
+"""
+Python wrapper for the native flow engine.
+Computes the same flow features as FeatureExtractor in C, a burst at a time.
+"""
+
+import ctypes
+import logging
+import time
+from ctypes import Structure, c_uint8, c_uint16, c_uint32, c_uint64, c_double, c_void_p, POINTER
+
+import numpy as np
+
+from src.dpdk.packet_capture import find_library
+from src.features.plugins import FLOW_END_SHUTDOWN
+from src.features.records import COLUMNS, FlowRecords, concat_records, derive_columns
+from src.features.tenants import MAX_TENANTS
+
+MAX_PKT_BURST = 32
+FLOW_JSON_MAX_RECORD = 2048
+
+# Flow record structure matching C definition; addresses are in network order
+FLOW_RECORD = np.dtype([
+    ('src_ip', '>u4'),
+    ('dst_ip', '>u4'),
+    ('src_port', '<u2'),
+    ('dst_port', '<u2'),
+    ('protocol', 'u1'),
+    ('tcp_flags', 'u1'),
+    ('valid', 'u1'),
+    ('end_reason', 'u1'),
+    ('total_fwd_packets', '<u8'),
+    ('total_length_fwd_packets', '<u8'),
+    ('packet_length_max', '<u4'),
+    ('packet_length_min', '<u4'),
+    ('flow_duration', '<f8'),
+    ('packet_length_mean', '<f8'),
+    ('packet_length_std', '<f8'),
+    ('packet_length_variance', '<f8'),
+    ('flow_bytes_per_second', '<f8'),
+    ('flow_packets_per_second', '<f8'),
+    ('flow_iat_mean', '<f8'),
+    ('flow_iat_std', '<f8'),
+    ('flow_iat_max', '<f8'),
+    ('flow_iat_min', '<f8'),
+    ('timestamp', '<u8'),
+    ('bad_checksum_packets', '<u8'),
+    ('tenant', '<u2'),
+], align=True)
+
+# Tenant classification table matching C definition, filled from a TenantMap
+class FlowTenantTable(Structure):
+    _fields_ = [
+        ("vlan", c_uint8 * 4096),
+        ("vni_page", c_uint16 * 4096),
+        ("nb_vni_pages", c_uint32),
+        ("vnis", c_void_p),
+        ("flow_timeout", c_double * MAX_TENANTS),
+        ("sample_rate", c_uint32 * MAX_TENANTS)
+    ]
+
+# Flow engine runtime configuration structure matching C definition
+class FlowEngineConfig(Structure):
+    _fields_ = [
+        ("flow_timeout", c_double),
+        ("sample_rate", c_uint32),
+        ("tenant", c_uint16),
+        ("tenants", POINTER(FlowTenantTable))
+    ]
+
+# Flow engine statistics structure matching C definition
+class FlowEngineStats(Structure):
+    _fields_ = [
+        ("packets", c_uint64),
+        ("parse_skipped", c_uint64),
+        ("flows_created", c_uint64),
+        ("flows_expired", c_uint64),
+        ("table_full", c_uint64),
+        ("active_flows", c_uint32),
+        ("max_flows", c_uint32),
+        ("memory_bytes", c_uint64),
+        ("sampled_out", c_uint64),
+        ("config_version", c_uint64),
+        ("bad_checksum", c_uint64),
+        ("rx_classified", c_uint64),
+        ("cksum_offloaded", c_uint64),
+        ("lookups_reused", c_uint64),
+        ("flows_flushed", c_uint64)
+    ]
+
+# Counters of one tenant's flow table matching C definition
+class FlowTenantStats(Structure):
+    _fields_ = [
+        ("packets", c_uint64),
+        ("parse_skipped", c_uint64),
+        ("records", c_uint64),
+        ("flows_created", c_uint64),
+        ("table_full", c_uint64),
+        ("active_flows", c_uint32),
+        ("max_flows", c_uint32)
+    ]
+
+def tenant_table(tenant_map):
+    """FlowTenantTable of a TenantMap; it points to the map's VNI pages, which the engine copies."""
+    table = FlowTenantTable()
+    ctypes.memmove(table.vlan, tenant_map.vlan.ctypes.data, tenant_map.vlan.nbytes)
+    ctypes.memmove(table.vni_page, tenant_map.vni_page.ctypes.data, tenant_map.vni_page.nbytes)
+    if tenant_map.match_vni:
+        table.nb_vni_pages = len(tenant_map.vni_tenants)
+        table.vnis = tenant_map.vni_tenants.ctypes.data
+    for index, tenant in enumerate(tenant_map.tenants):
+        table.flow_timeout[index] = tenant.flow_timeout or 0
+        table.sample_rate[index] = tenant.sample_rate or 0
+    return table
+
+class NativeFeatureExtractor:
+    def __init__(self, max_flows=0, flow_timeout=600.0, encode_json=False, tenant_map=None):
+        """encode_json also encodes each record as JSON in native code, for export.
+        
+        With a TenantMap, the engine classifies packets by VLAN ID or VNI as
+        it parses them and keeps a flow table per tenant; records carry the
+        tenant index.
+        """
+        self.logger = logging.getLogger(__name__)
+        self.max_flows = max_flows
+        self.flow_timeout = flow_timeout
+        self.encode_json = encode_json
+        self.map = tenant_map
+        self.tenants = tenant_map.tenants if tenant_map else []
+        self.lib = None
+        self.engine = None
+        self.records = None
+        self.json_buffer = None
+        self.json_ends = None
+        self.reserve(MAX_PKT_BURST)
+        
+    def initialize(self):
+        """Load the native library and create a flow engine."""
+        try:
+            lib_path = find_library()
+            if not lib_path:
+                self.logger.error("Native library not found. Run 'make' to build it.")
+                return False
+                
+            self.lib = ctypes.CDLL(lib_path)
+            
+            self.lib.flow_engine_create.argtypes = [c_uint32, c_double]
+            self.lib.flow_engine_create.restype = c_void_p
+            
+            self.lib.flow_engine_create_tenants.argtypes = [c_uint16, POINTER(c_uint32), c_double]
+            self.lib.flow_engine_create_tenants.restype = c_void_p
+            
+            self.lib.flow_engine_destroy.argtypes = [c_void_p]
+            self.lib.flow_engine_destroy.restype = None
+            
+            self.lib.flow_engine_process_packed.argtypes = [
+                c_void_p, c_void_p, c_void_p, ctypes.c_int, c_uint64, c_void_p]
+            self.lib.flow_engine_process_packed.restype = ctypes.c_int
+            
+            self.lib.flow_engine_flush.argtypes = [c_void_p, c_uint8, c_void_p, ctypes.c_int]
+            self.lib.flow_engine_flush.restype = ctypes.c_int
+            
+            self.lib.flow_engine_expire.argtypes = [c_void_p, c_uint64]
+            self.lib.flow_engine_expire.restype = ctypes.c_int
+            
+            self.lib.flow_engine_get_stats.argtypes = [c_void_p, POINTER(FlowEngineStats)]
+            self.lib.flow_engine_get_stats.restype = ctypes.c_int
+            
+            self.lib.flow_engine_get_tenant_stats.argtypes = [c_void_p, c_uint16, POINTER(FlowTenantStats)]
+            self.lib.flow_engine_get_tenant_stats.restype = ctypes.c_int
+            
+            self.lib.flow_engine_set_config.argtypes = [c_void_p, POINTER(FlowEngineConfig)]
+            self.lib.flow_engine_set_config.restype = ctypes.c_int
+            
+            self.lib.flow_engine_get_config.argtypes = [c_void_p, POINTER(FlowEngineConfig)]
+            self.lib.flow_engine_get_config.restype = ctypes.c_int
+            
+            self.lib.flow_json_encode_burst.argtypes = [
+                c_void_p, ctypes.c_int, c_void_p, ctypes.c_size_t, c_void_p]
+            self.lib.flow_json_encode_burst.restype = ctypes.c_int
+            
+            if self.map:
+                max_flows = [tenant.max_flows or self.max_flows for tenant in self.tenants]
+                self.engine = self.lib.flow_engine_create_tenants(
+                    len(max_flows), (c_uint32 * len(max_flows))(*max_flows), self.flow_timeout)
+            else:
+                self.engine = self.lib.flow_engine_create(self.max_flows, self.flow_timeout)
+            if not self.engine:
+                self.logger.error("Failed to create native flow engine")
+                return False
+                
+            if self.map:
+                config = self.get_config()
+                config.tenants = ctypes.pointer(tenant_table(self.map))
+                if self.lib.flow_engine_set_config(self.engine, ctypes.byref(config)) != 0:
+                    self.logger.error("Failed to set the native tenant table")
+                    return False
+                    
+            return True
+            
+        except Exception as e:
+            self.logger.error(f"Failed to initialize native flow engine: {e}")
+            return False
+            
+    def reserve(self, count):
+        """Grow the record and JSON buffers to hold count records."""
+        if self.records is not None and len(self.records) >= count:
+            return
+        self.records = np.zeros(count, dtype=FLOW_RECORD)
+        self.json_buffer = np.zeros(count * FLOW_JSON_MAX_RECORD, dtype=np.uint8)
+        self.json_ends = np.zeros(count, dtype=np.uint32)
+        
+    def extract_burst(self, burst):
+        """Extract features for a PacketBurst in one native call.
+        
+        The engine reads the packets from the burst's buffer at their offsets.
+        Returns FlowRecords of the packets that belong to a flow, in burst order.
+        """
+        count = len(burst)
+        if not count:
+            return FlowRecords.empty()
+        self.reserve(count)
+        meta = np.ascontiguousarray(burst.meta)
+        result = self.lib.flow_engine_process_packed(self.engine, burst.buffer.ctypes.data, meta.ctypes.data,
+                                                     count, time.time_ns(), self.records.ctypes.data)
+        if result < 0:
+            raise RuntimeError(f"Native flow engine failed with error code: {result}")
+        return self.to_records(self.records[:count])
+        
+    def to_records(self, records):
+        """FlowRecords of the valid entries of a FLOW_RECORD array, JSON-encoded in one native call."""
+        json = spans = None
+        if self.encode_json:
+            used = self.lib.flow_json_encode_burst(records.ctypes.data, len(records), self.json_buffer.ctypes.data,
+                                                   len(self.json_buffer), self.json_ends.ctypes.data)
+            if used < 0:
+                raise RuntimeError("Native JSON encoder buffer too small")
+            json = self.json_buffer[:used].tobytes()
+            ends = self.json_ends[:len(records)].astype(np.int64)
+        valid = records['valid'] != 0
+        if not valid.all():
+            records = records[valid]
+            if json is not None:
+                ends = ends[valid]
+        columns = {name: records[name].astype(dtype) for name, dtype in COLUMNS}
+        derive_columns(columns)
+        columns['packet_length_variance'] = records['packet_length_variance'].copy()
+        if json is not None:
+            # Each line starts where the previous valid one ended; spans leave out the newline
+            spans = np.empty((len(ends), 2), dtype=np.int64)
+            spans[:1, 0] = 0
+            spans[1:, 0] = ends[:-1]
+            spans[:, 1] = ends - 1
+        return FlowRecords(columns, int_zeros=False, json=json, spans=spans)
+        
+    def flush_flows(self, end_reason=FLOW_END_SHUTDOWN):
+        """Final records of all active flows, as of their last packet; empties the flow table.
+        
+        Flows the engine samples out are removed without a record.
+        """
+        batches = []
+        if not self.engine:
+            return FlowRecords.empty()
+        while True:
+            count = self.lib.flow_engine_flush(self.engine, end_reason, self.records.ctypes.data,
+                                               len(self.records))
+            if count < 0:
+                raise RuntimeError(f"Native flow engine failed with error code: {count}")
+            if count == 0:
+                return concat_records(batches)
+            batches.append(self.to_records(self.records[:count]))
+            
+    def get_stats(self):
+        """Get flow engine counters."""
+        if not self.engine:
+            return {}
+            
+        stats = FlowEngineStats()
+        if self.lib.flow_engine_get_stats(self.engine, ctypes.byref(stats)) != 0:
+            return {}
+            
+        return {name: getattr(stats, name) for name, _ in FlowEngineStats._fields_}
+        
+    def drop_stats(self):
+        """Packets not added to a flow, by drop reason."""
+        stats = self.get_stats()
+        if not stats:
+            return {}
+        return {'parse_failed': stats['parse_skipped'], 'flow_table_full': stats['table_full']}
+        
+    def tenant_stats(self, index):
+        """Counters of one tenant's flow table."""
+        stats = FlowTenantStats()
+        if not self.engine or self.lib.flow_engine_get_tenant_stats(self.engine, index, ctypes.byref(stats)) != 0:
+            return {}
+        return {name: getattr(stats, name) for name, _ in FlowTenantStats._fields_}
+        
+    def topics(self):
+        """Kafka topic of each tenant that has its own."""
+        return self.map.topics() if self.map else {}
+        
+    def collect(self):
+        """Per-tenant counters for the metrics exporter."""
+        metrics = {'count': len(self.tenants)}
+        for index, tenant in enumerate(self.tenants):
+            stats = self.tenant_stats(index)
+            metrics[f"{tenant.name}_packets"] = stats.get('packets', 0)
+            metrics[f"{tenant.name}_records"] = stats.get('records', 0)
+            metrics[f"{tenant.name}_flows"] = stats.get('active_flows', 0)
+            metrics[f"{tenant.name}_max_flows"] = stats.get('max_flows', 0)
+            metrics[f"{tenant.name}_flow_table_full"] = stats.get('table_full', 0)
+        return metrics
+        
+    def get_config(self):
+        """Get the runtime configuration as last set, as a FlowEngineConfig; None on error."""
+        config = FlowEngineConfig()
+        if self.lib.flow_engine_get_config(self.engine, ctypes.byref(config)) != 0:
+            return None
+        return config
+        
+    def set_config(self, flow_timeout=None, sample_rate=None, tenant=None):
+        """Replace the runtime configuration; safe while bursts are processed.
+        
+        Tenants' own flow timeouts and sampling rates still override these.
+        """
+        config = self.get_config()
+        if config is None:
+            return False
+        if flow_timeout is not None:
+            config.flow_timeout = flow_timeout
+            self.flow_timeout = flow_timeout
+        if sample_rate is not None:
+            config.sample_rate = sample_rate
+        if tenant is not None:
+            config.tenant = tenant
+        return self.lib.flow_engine_set_config(self.engine, ctypes.byref(config)) == 0
+        
+    def flow_count(self):
+        """Get the number of active flows."""
+        return self.get_stats().get('active_flows', 0)
+        
+    def memory_usage(self):
+        """Get bytes allocated for the native flow table."""
+        return self.get_stats().get('memory_bytes', 0)
+        
+    def cleanup(self):
+        """Destroy the flow engine."""
+        if self.lib and self.engine:
+            self.lib.flow_engine_destroy(self.engine)
+            self.engine = None
+            
+    def __del__(self):
+        """Destructor to ensure cleanup."""
+        self.cleanup()
@@ -0,0 +1,253 @@
+"""
+Columnar batches of flow records.
+The vectorised and native extractors return the records of a burst as
+FlowRecords, one array per feature, so that filtering, sampling and the
+plugins work on whole columns. Record dictionaries are only built when a
+batch is iterated, at the export sinks.
+"""
+
+import numpy as np
+
+# Feature columns computed per burst, in record order
+COLUMNS = [
+    ('src_ip', 'u4'),
+    ('dst_ip', 'u4'),
+    ('src_port', 'u2'),
+    ('dst_port', 'u2'),
+    ('protocol', 'u1'),
+    ('flow_duration', 'f8'),
+    ('total_fwd_packets', 'i8'),
+    ('total_length_fwd_packets', 'i8'),
+    ('packet_length_max', 'i8'),
+    ('packet_length_min', 'i8'),
+    ('packet_length_mean', 'f8'),
+    ('packet_length_std', 'f8'),
+    ('flow_bytes_per_second', 'f8'),
+    ('flow_packets_per_second', 'f8'),
+    ('flow_iat_mean', 'f8'),
+    ('flow_iat_std', 'f8'),
+    ('flow_iat_max', 'f8'),
+    ('flow_iat_min', 'f8'),
+    ('tcp_flags', 'u1'),
+    ('bad_checksum_packets', 'i8'),
+    ('end_reason', 'u1'),
+    ('tenant', 'u2'),
+    ('timestamp', 'i8'),
+]
+
+TCP_FLAG_COUNTS = ['fin_flag_count', 'syn_flag_count', 'rst_flag_count',
+                   'psh_flag_count', 'ack_flag_count', 'urg_flag_count']
+
+def make_record(src_ip, dst_ip, src_port, dst_port, protocol, flow_duration, total_fwd_packets,
+                total_bwd_packets, total_length_fwd_packets, total_length_bwd_packets,
+                packet_length_max, packet_length_min, packet_length_mean, packet_length_std,
+                flow_bytes_per_second, flow_packets_per_second, flow_iat_mean, flow_iat_std,
+                flow_iat_max, flow_iat_min, tcp_flags, fin_flag_count, syn_flag_count,
+                rst_flag_count, psh_flag_count, ack_flag_count, urg_flag_count, avg_packet_size,
+                packet_length_variance, bad_checksum_packets, end_reason, tenant, timestamp):
+    """Build one flow record; a dictionary display is the fastest way to build one."""
+    return {
+        'src_ip': src_ip,
+        'dst_ip': dst_ip,
+        'src_port': src_port,
+        'dst_port': dst_port,
+        'protocol': protocol,
+        'flow_duration': flow_duration,
+        'total_fwd_packets': total_fwd_packets,
+        'total_bwd_packets': total_bwd_packets,
+        'total_length_fwd_packets': total_length_fwd_packets,
+        'total_length_bwd_packets': total_length_bwd_packets,
+        'packet_length_max': packet_length_max,
+        'packet_length_min': packet_length_min,
+        'packet_length_mean': packet_length_mean,
+        'packet_length_std': packet_length_std,
+        'flow_bytes_per_second': flow_bytes_per_second,
+        'flow_packets_per_second': flow_packets_per_second,
+        'flow_iat_mean': flow_iat_mean,
+        'flow_iat_std': flow_iat_std,
+        'flow_iat_max': flow_iat_max,
+        'flow_iat_min': flow_iat_min,
+        'tcp_flags': tcp_flags,
+        'fin_flag_count': fin_flag_count,
+        'syn_flag_count': syn_flag_count,
+        'rst_flag_count': rst_flag_count,
+        'psh_flag_count': psh_flag_count,
+        'ack_flag_count': ack_flag_count,
+        'urg_flag_count': urg_flag_count,
+        'avg_packet_size': avg_packet_size,
+        'packet_length_variance': packet_length_variance,
+        'bad_checksum_packets': bad_checksum_packets,
+        'end_reason': end_reason,
+        'tenant': tenant,
+        'timestamp': timestamp,
+        'label': 'BENIGN',
+    }
+
+def ip_to_string(ip):
+    """Convert an IPv4 address held in an integer to dotted-quad format."""
+    return f"{ip >> 24}.{(ip >> 16) & 0xff}.{(ip >> 8) & 0xff}.{ip & 0xff}"
+
+def ip_strings(ips):
+    """Dotted-quad strings of an array of addresses, converting each distinct address once."""
+    values = ips.tolist()
+    strings = {ip: ip_to_string(ip) for ip in set(values)}
+    return [strings[ip] for ip in values]
+
+def derive_columns(columns):
+    """Add the columns derived from others: TCP flag counts, average size and variance."""
+    flags = columns['tcp_flags'].astype(np.int64)
+    for bit, name in enumerate(TCP_FLAG_COUNTS):
+        columns[name] = ((flags >> bit) & 1).astype(np.uint8)
+    columns['avg_packet_size'] = columns['packet_length_mean']
+    columns['packet_length_variance'] = columns['packet_length_std'] ** 2
+
+def build_records(columns, rows, int_zeros=True):
+    """Records of the given rows of feature columns, like FeatureExtractor's.
+    
+    With int_zeros, statistics without enough samples are integer 0, as in
+    FeatureExtractor; the native engine reports them as 0.0.
+    """
+    if not len(rows):
+        return []
+    count = columns['total_fwd_packets'][rows]
+    one_packet = np.flatnonzero(count < 2).tolist() if int_zeros else ()
+    one_iat = np.flatnonzero(count < 3).tolist() if int_zeros else ()
+    
+    def column(name, zero_at=()):
+        values = columns[name][rows].tolist()
+        for i in zero_at:
+            values[i] = 0
+        return values
+        
+    src_ip = columns['src_ip'][rows].tolist()
+    dst_ip = columns['dst_ip'][rows].tolist()
+    strings = {ip: ip_to_string(ip) for ip in set(src_ip) | set(dst_ip)}
+    zeros = [0] * len(rows)
+    built = map(make_record,
+                [strings[ip] for ip in src_ip],
+                [strings[ip] for ip in dst_ip],
+                column('src_port'),
+                column('dst_port'),
+                column('protocol'),
+                column('flow_duration'),
+                column('total_fwd_packets'),
+                zeros,
+                column('total_length_fwd_packets'),
+                zeros,
+                column('packet_length_max'),
+                column('packet_length_min'),
+                column('packet_length_mean'),
+                column('packet_length_std', one_packet),
+                column('flow_bytes_per_second'),
+                column('flow_packets_per_second'),
+                column('flow_iat_mean', one_packet),
+                column('flow_iat_std', one_iat),
+                column('flow_iat_max', one_packet),
+                column('flow_iat_min', one_packet),
+                column('tcp_flags'),
+                column('fin_flag_count'),
+                column('syn_flag_count'),
+                column('rst_flag_count'),
+                column('psh_flag_count'),
+                column('ack_flag_count'),
+                column('urg_flag_count'),
+                column('avg_packet_size'),
+                column('packet_length_variance', one_packet),
+                column('bad_checksum_packets'),
+                column('end_reason'),
+                column('tenant'),
+                column('timestamp'))
+    return list(built)
+
+class EncodedFeatures(dict):
+    """Feature dictionary that also carries its JSON encoding from the native encoder.
+    
+    json holds the bytes json.dumps() would produce for the dictionary; code
+    that changes the features must build a plain dictionary instead.
+    """
+    
+    __slots__ = ('json',)
+    
+    def __reduce__(self):
+        return (encoded_features, (dict(self), self.json))
+
+def encoded_features(features, encoded):
+    """Rebuild EncodedFeatures when unpickled."""
+    record = EncodedFeatures(features)
+    record.json = encoded
+    return record
+
+class FlowRecords:
+    """Flow records of a burst, one array per feature.
+    
+    columns maps the names of COLUMNS and of the columns added by
+    derive_columns() to arrays with one entry per record; addresses are
+    integers. json, if set, holds the records' JSON encodings back to back,
+    record i at json[spans[i, 0]:spans[i, 1]]. Iterating yields record
+    dictionaries, EncodedFeatures when the JSON is known.
+    """
+    
+    __slots__ = ('columns', 'int_zeros', 'json', 'spans')
+    
+    def __init__(self, columns, int_zeros=True, json=None, spans=None):
+        self.columns = columns
+        self.int_zeros = int_zeros
+        self.json = json
+        self.spans = spans
+        
+    @classmethod
+    def empty(cls):
+        columns = {name: np.zeros(0, dtype=dtype) for name, dtype in COLUMNS}
+        derive_columns(columns)
+        return cls(columns)
+        
+    def __len__(self):
+        return len(self.columns['src_ip'])
+        
+    def __iter__(self):
+        return iter(self.records())
+        
+    def __getitem__(self, i):
+        if isinstance(i, slice):
+            return self.select(i)
+        return self.select([i]).records()[0]
+        
+    def records(self):
+        """The records as dictionaries."""
+        records = build_records(self.columns, np.arange(len(self)), self.int_zeros)
+        if self.json is None:
+            return records
+        encoded = []
+        for features, (start, end) in zip(records, self.spans.tolist()):
+            record = EncodedFeatures(features)
+            record.json = self.json[start:end]
+            encoded.append(record)
+        return encoded
+        
+    def select(self, rows):
+        """The records at the given indices or mask."""
+        spans = None if self.spans is None else self.spans[rows]
+        return FlowRecords({name: values[rows] for name, values in self.columns.items()},
+                           self.int_zeros, self.json, spans)
+
+def concat_records(batches):
+    """Join batches of records, columnar if they all are."""
+    batches = [batch for batch in batches if len(batch)]
+    if not all(isinstance(batch, FlowRecords) for batch in batches):
+        return [features for batch in batches for features in batch]
+    if not batches:
+        return FlowRecords.empty()
+    if len(batches) == 1:
+        return batches[0]
+        
+    columns = {name: np.concatenate([batch.columns[name] for batch in batches]) for name in batches[0].columns}
+    json = spans = None
+    if all(batch.json is not None for batch in batches):
+        json = b''.join(batch.json for batch in batches)
+        shifted = []
+        base = 0
+        for batch in batches:
+            shifted.append(batch.spans + base)
+            base += len(batch.json)
+        spans = np.concatenate(shifted)
+    return FlowRecords(columns, batches[0].int_zeros, json, spans)
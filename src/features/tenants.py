@@ -0,0 +1,285 @@
+"""
+Tenant isolation for links shared by several tenants.
+Packets are classified by VLAN ID or VXLAN VNI before parsing, through
+lookup tables indexed by the tag, and each tenant's flows are kept apart.
+The native engine classifies in its parser and holds a flow table per
+tenant; with the other engines the burst is classified as a whole and each
+tenant's packets go to a flow extractor of its own. Tenants therefore have
+separate flow tables, flow limits, sampling rates and Kafka topics, and a
+tenant that fills its table only loses its own new flows.
+"""
+
+import re
+from dataclasses import dataclass, field
+
+import numpy as np
+
+from src.features.records import FlowRecords, concat_records
+
+# Tag protocol identifiers of 802.1Q and 802.1ad (QinQ) tags
+VLAN_TPIDS = (0x8100, 0x88a8)
+ETHERTYPE_IPV4 = 0x0800
+VXLAN_PORT = 4789
+VXLAN_FLAG_VNI = 0x08
+
+# Receive offload flags, see PACKET_RX_* in dpdk_capture.h; the packet type
+# describes the outer frame, so it is cleared when tags are stripped
+PACKET_RX_PTYPE = 0x01
+PACKET_RX_IPV4 = 0x02
+
+# Header bytes classification reads: two tags, Ethernet, the longest IPv4
+# header, and the UDP and VXLAN headers
+CLASSIFY_BYTES = 8 + 14 + 60 + 16
+
+# Tenant 0 takes the packets no tenant claims
+DEFAULT_TENANT = 'default'
+MAX_TENANTS = 256
+
+# Two-level VNI table: 4096 pages of 4096 tenant indexes, allocated on use,
+# as struct flow_tenant_table lays it out
+VNI_PAGE_BITS = 12
+VNI_PAGE_SIZE = 1 << VNI_PAGE_BITS
+
+TENANT_NAME = re.compile(r'^[a-z][a-z0-9_]*$')
+
+@dataclass(frozen=True)
+class Tenant:
+    """A tenant and its limits; None settings follow the runtime configuration."""
+    name: str
+    vlans: frozenset = field(default_factory=frozenset)
+    vnis: frozenset = field(default_factory=frozenset)
+    max_flows: int = 0
+    sample_rate: int = None
+    flow_timeout: float = None
+    kafka_topic: str = None
+    export_rate: float = None
+
+def parse_ids(values, limit):
+    """Parse '100,200-299' into a set of IDs below limit."""
+    ids = set()
+    for value in values.split(','):
+        if not value:
+            continue
+        first, _, last = value.partition('-')
+        first = int(first)
+        last = int(last) if last else first
+        if not 0 <= first <= last < limit:
+            raise ValueError(f"ID range '{value}' outside 0-{limit - 1}")
+        ids.update(range(first, last + 1))
+    return frozenset(ids)
+
+def parse_tenant(spec):
+    """Parse 'name:vlan=100,200-299 vni=5001 max_flows=N sample_rate=N flow_timeout=S topic=T export_rate=N'."""
+    name, _, terms = spec.partition(':')
+    name = name.strip()
+    if not TENANT_NAME.match(name) or name == DEFAULT_TENANT:
+        raise ValueError(f"Invalid tenant name '{name}' (lower case letters, digits and _, not '{DEFAULT_TENANT}')")
+    settings = {}
+    for term in terms.split():
+        if '=' not in term:
+            raise ValueError(f"Invalid tenant term '{term}' (expected name=value)")
+        key, value = term.split('=', 1)
+        if key == 'vlan':
+            settings['vlans'] = parse_ids(value, 1 << 12)
+        elif key == 'vni':
+            settings['vnis'] = parse_ids(value, 1 << 24)
+        elif key == 'max_flows':
+            settings['max_flows'] = int(value)
+        elif key == 'sample_rate':
+            settings['sample_rate'] = int(value)
+            if settings['sample_rate'] < 1:
+                raise ValueError("sample_rate must be at least 1")
+        elif key == 'flow_timeout':
+            settings['flow_timeout'] = float(value)
+            if settings['flow_timeout'] <= 0:
+                raise ValueError("flow_timeout must be positive")
+        elif key == 'topic':
+            settings['kafka_topic'] = value
+        elif key == 'export_rate':
+            settings['export_rate'] = float(value)
+            if settings['export_rate'] <= 0:
+                raise ValueError("export_rate must be positive")
+        else:
+            raise ValueError(f"Unknown tenant term '{key}' "
+                             "(expected vlan, vni, max_flows, sample_rate, flow_timeout, topic or export_rate)")
+    if not settings.get('vlans') and not settings.get('vnis'):
+        raise ValueError(f"Tenant '{name}' needs a vlan or vni term")
+    return Tenant(name, **settings)
+
+def be16(headers, column):
+    """Big-endian 16-bit field at a column, or at one column per row, of a header matrix."""
+    if np.ndim(column):
+        rows = np.arange(len(headers))
+        return (headers[rows, column].astype(np.int64) << 8) | headers[rows, column + 1]
+    return (headers[:, column].astype(np.int64) << 8) | headers[:, column + 1]
+
+class TenantMap:
+    def __init__(self, tenants):
+        """Lookup tables from VLAN ID and VNI to tenant index; index 0 is the default tenant.
+        
+        vni_page maps the top bits of a VNI to a page of vni_tenants; page
+        0 is all zero and stands for the pages no tenant uses.
+        """
+        self.tenants = [Tenant(DEFAULT_TENANT)] + list(tenants)
+        if len(self.tenants) > MAX_TENANTS:
+            raise ValueError(f"At most {MAX_TENANTS - 1} tenants are supported")
+        self.vlan = np.zeros(1 << 12, dtype=np.uint8)
+        self.vni_page = np.zeros(1 << (24 - VNI_PAGE_BITS), dtype=np.uint16)
+        pages = [np.zeros(VNI_PAGE_SIZE, dtype=np.uint8)]
+        
+        names = set()
+        for index, tenant in enumerate(self.tenants):
+            if tenant.name in names:
+                raise ValueError(f"Duplicate tenant '{tenant.name}'")
+            names.add(tenant.name)
+            for vlan in tenant.vlans:
+                if self.vlan[vlan]:
+                    raise ValueError(f"VLAN {vlan} is assigned to two tenants")
+                self.vlan[vlan] = index
+            for vni in tenant.vnis:
+                if not self.vni_page[vni >> VNI_PAGE_BITS]:
+                    self.vni_page[vni >> VNI_PAGE_BITS] = len(pages)
+                    pages.append(np.zeros(VNI_PAGE_SIZE, dtype=np.uint8))
+                page = pages[self.vni_page[vni >> VNI_PAGE_BITS]]
+                if page[vni & (VNI_PAGE_SIZE - 1)]:
+                    raise ValueError(f"VNI {vni} is assigned to two tenants")
+                page[vni & (VNI_PAGE_SIZE - 1)] = index
+        self.vni_tenants = np.stack(pages)
+        self.match_vni = len(pages) > 1
+        
+    def classify(self, headers, lengths):
+        """Tenant index of each frame of a header matrix and the offset of the frame its flows are parsed from.
+        
+        headers holds at least CLASSIFY_BYTES of each frame, zero padded,
+        and lengths the frame lengths. VLAN tags are skipped by moving the
+        start of the frame past them, so the parsers find the inner
+        EtherType where an untagged frame has it; the MAC addresses they
+        then see are not used. VXLAN packets of a tenant's VNI are parsed
+        from their inner frame.
+        """
+        tenants = np.zeros(len(headers), dtype=np.intp)
+        offsets = np.zeros(len(headers), dtype=np.int64)
+        if not len(headers):
+            return tenants, offsets
+        ethertype = be16(headers, 12)
+        tagged = np.isin(ethertype, VLAN_TPIDS) & (lengths >= 18)
+        if tagged.any():
+            # The outer tag identifies the tenant; a QinQ inner tag is skipped too
+            tenants[tagged] = self.vlan[be16(headers, 14)[tagged] & 0xFFF]
+            inner = be16(headers, 16)
+            qinq = tagged & np.isin(inner, VLAN_TPIDS) & (lengths >= 22)
+            offsets[tagged] = 4
+            offsets[qinq] = 8
+            ethertype = np.where(qinq, be16(headers, 20), np.where(tagged, inner, ethertype))
+            
+        if self.match_vni:
+            ip = offsets + 14
+            rows = np.flatnonzero((ethertype == ETHERTYPE_IPV4) & (lengths >= ip + 20) &
+                                  (headers[np.arange(len(headers)), ip + 9] == 17))
+            candidates = headers[rows]
+            ip = ip[rows]
+            udp = ip + (candidates[np.arange(len(rows)), ip] & 0xF).astype(np.int64) * 4
+            vxlan = (((be16(candidates, ip + 6) & 0x3FFF) == 0) & (lengths[rows] >= udp + 30) &
+                     (be16(candidates, udp + 2) == VXLAN_PORT) &
+                     ((candidates[np.arange(len(rows)), udp + 8] & VXLAN_FLAG_VNI) != 0))
+            vni = (candidates[np.arange(len(rows)), udp + 12].astype(np.int64) << 16) | be16(candidates, udp + 13)
+            vni_tenants = self.vni_tenants[self.vni_page[vni >> VNI_PAGE_BITS], vni & (VNI_PAGE_SIZE - 1)]
+            claimed = np.flatnonzero(vxlan & (vni_tenants != 0))
+            tenants[rows[claimed]] = vni_tenants[claimed]
+            offsets[rows[claimed]] = udp[claimed] + 16
+        return tenants, offsets
+        
+    def topics(self):
+        """Kafka topic of each tenant that has its own."""
+        return {index: tenant.kafka_topic for index, tenant in enumerate(self.tenants) if tenant.kafka_topic}
+
+class TenantExtractor:
+    def __init__(self, tenant_map, create):
+        """Extract features with one Python or NumPy extractor per tenant, made by create(tenant, index).
+        
+        Offers the extractor interface of the engine it wraps. Records carry
+        the tenant index in their tenant field. The native engine classifies
+        tenants itself, see NativeFeatureExtractor.
+        """
+        self.map = tenant_map
+        self.tenants = tenant_map.tenants
+        self.extractors = [create(tenant, index) for index, tenant in enumerate(self.tenants)]
+        self.packets = [0] * len(self.tenants)
+        self.records = [0] * len(self.tenants)
+        self.parse_failed = [0] * len(self.tenants)
+        self._flow_timeout = 600
+        
+    @property
+    def flow_timeout(self):
+        return self._flow_timeout
+        
+    @flow_timeout.setter
+    def flow_timeout(self, value):
+        """The runtime flow timeout, for tenants without one of their own."""
+        self._flow_timeout = value
+        for tenant, extractor in zip(self.tenants, self.extractors):
+            extractor.flow_timeout = tenant.flow_timeout or value
+            
+    def sample_rates(self, sample_rate):
+        """Flow sampling rate of each tenant, given the runtime one."""
+        return [tenant.sample_rate or sample_rate for tenant in self.tenants]
+        
+    def topics(self):
+        return self.map.topics()
+        
+    def extract_burst(self, burst):
+        """Extract features for a PacketBurst, each tenant's packets with its extractor.
+        
+        The burst is classified as a whole from its header matrix; each
+        tenant's packets are a burst sharing its buffer, at the offsets of
+        the frames their flows are parsed from.
+        """
+        tenants, offsets = self.map.classify(burst.headers(CLASSIFY_BYTES), burst.lengths.astype(np.int64))
+        batches = []
+        for index in np.unique(tenants).tolist():
+            rows = np.flatnonzero(tenants == index)
+            skip = offsets[rows]
+            group = burst.select(rows, skip)
+            # Offload results describe the outer frame; checksum verdicts
+            # only still hold for the same IP packet behind VLAN tags
+            if skip.any():
+                flags = group.meta['rx_flags']
+                group.meta['rx_flags'] = np.where(skip == 0, flags, np.where(
+                    skip <= 8, flags & (0xFF & ~(PACKET_RX_PTYPE | PACKET_RX_IPV4)), 0))
+                
+            extractor = self.extractors[index]
+            table_full = extractor.table_full
+            records = extractor.extract_burst(group)
+            if not isinstance(records, FlowRecords):
+                records = [record for record in records if record is not None]
+            self.packets[index] += len(group)
+            self.records[index] += len(records)
+            self.parse_failed[index] += len(group) - len(records) - (extractor.table_full - table_full)
+            batches.append(records)
+        return concat_records(batches)
+        
+    def flush_flows(self, *args):
+        """Final records of all tenants' active flows."""
+        return concat_records([extractor.flush_flows(*args) for extractor in self.extractors])
+        
+    def flow_count(self):
+        return sum(extractor.flow_count() for extractor in self.extractors)
+        
+    def memory_usage(self):
+        return sum(extractor.memory_usage() for extractor in self.extractors)
+        
+    def drop_stats(self):
+        """Packets not added to a flow over all tenants, by drop reason."""
+        return {'parse_failed': sum(self.parse_failed),
+                'flow_table_full': sum(extractor.table_full for extractor in self.extractors)}
+        
+    def collect(self):
+        """Per-tenant counters for the metrics exporter."""
+        metrics = {'count': len(self.tenants)}
+        for index, (tenant, extractor) in enumerate(zip(self.tenants, self.extractors)):
+            metrics[f"{tenant.name}_packets"] = self.packets[index]
+            metrics[f"{tenant.name}_records"] = self.records[index]
+            metrics[f"{tenant.name}_flows"] = extractor.flow_count()
+            metrics[f"{tenant.name}_max_flows"] = tenant.max_flows
+            metrics[f"{tenant.name}_flow_table_full"] = extractor.table_full
+        return metrics
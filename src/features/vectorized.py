@@ -0,0 +1,498 @@
+"""
+Vectorised NumPy implementation of the flow feature extractor.
+Produces the same per-packet flow records as FeatureExtractor, but parses
+headers, keys flows and updates flow statistics for a whole burst at once
+with grouped array operations. Used when the native engine is not built.
+"""
+
+import logging
+import sys
+import time
+from itertools import compress, repeat
+
+import numpy as np
+
+from src.features.checksum import burst_checksum_bad
+from src.features.flow_key import flow_keys
+from src.features.plugins import FLOW_END_SHUTDOWN
+from src.features.records import COLUMNS, FlowRecords, derive_columns
+
+# Bytes of each packet copied for header parsing: Ethernet, IPv4 with options, TCP
+HEADER_BYTES = 96
+
+# Default burst size with the vectorised extractor, whose cost is mostly per burst
+VECTOR_BURST = 4096
+
+# FeatureExtractor expires idle flows only while it holds more flows than this
+CLEANUP_THRESHOLD = 1000
+
+INITIAL_CAPACITY = 1024
+
+# Per-flow state arrays, indexed by flow slot; separate arrays keep per-packet gathers contiguous
+FLOW_STATE = [
+    ('start_time', 'f8'),
+    ('last_time', 'f8'),
+    ('src_ip', 'u4'),
+    ('dst_ip', 'u4'),
+    ('src_port', 'u2'),
+    ('dst_port', 'u2'),
+    ('protocol', 'u1'),
+    ('tcp_flags', 'u1'),
+    ('count', 'i8'),
+    ('bad_checksum', 'i8'),
+    ('bytes', 'i8'),
+    ('len_max', 'i8'),
+    ('len_min', 'i8'),
+    ('len_shift', 'i8'),        # First packet length; sums below are of (length - shift)
+    ('len_sum', 'i8'),
+    ('len_sum_sq', 'i8'),
+    ('iat_max', 'f8'),
+    ('iat_min', 'f8'),
+    ('iat_shift', 'f8'),        # First inter-arrival time
+    ('iat_sum', 'f8'),
+    ('iat_sum_sq', 'f8'),
+]
+
+# Largest run grid segmented_scan() builds, in elements per scanned element
+GRID_LIMIT = 4
+
+def run_grid(rank, run):
+    """Grid for segmented_scan() holding run j in column j, or None if it would be too sparse.
+    
+    Returns the flat cell of each element and the grid shape.
+    """
+    shape = (int(rank.max()) + 1, int(run[-1]) + 1)
+    if shape[0] * shape[1] > GRID_LIMIT * len(rank):
+        return None
+    return rank * shape[1] + run, shape
+
+def segmented_scan(values, rank, op, grid=None):
+    """Inclusive scan of op over runs of equal group.
+    
+    rank[i] is the position of element i in its run. With a run_grid(),
+    the runs are accumulated down the grid's columns in one pass; otherwise
+    element i combines with element i-step, in log2(run length) passes,
+    while the run reaches back that far.
+    """
+    if grid is not None:
+        cells, shape = grid
+        columns = np.zeros(shape, dtype=values.dtype)
+        columns.reshape(-1)[cells] = values
+        op.accumulate(columns, axis=0, out=columns)
+        return columns.reshape(-1)[cells]
+    values = values.copy()
+    step = 1
+    top = rank.max() if len(rank) else 0
+    while step <= top:
+        np.copyto(values[step:], op(values[step:], values[:-step]), where=rank[step:] >= step)
+        step *= 2
+    return values
+
+def segmented_sum(values, group_start):
+    """Inclusive sums of integers over runs of equal group; group_start[i] is where i's run starts."""
+    total = np.cumsum(values)
+    return total - total[group_start] + values[group_start]
+
+# Bound on packet lengths, separating runs in segmented_extreme()
+LENGTH_BOUND = 1 << 17
+
+def segmented_extreme(values, run, op):
+    """Inclusive running np.maximum or np.minimum of packet lengths over runs.
+    
+    run numbers the runs in increasing order; offsetting each run by a
+    multiple of LENGTH_BOUND keeps earlier runs from reaching later ones.
+    """
+    if op is np.maximum:
+        return np.maximum.accumulate(values + run * LENGTH_BOUND) - run * LENGTH_BOUND
+    return np.minimum.accumulate(values - run * LENGTH_BOUND) + run * LENGTH_BOUND
+
+def parse_headers(headers, caplen):
+    """Parse Ethernet/IPv4/TCP/UDP fields of a burst.
+    
+    headers is an (n, HEADER_BYTES) uint8 array with the start of each
+    packet, zero padded, and caplen the captured length of each packet.
+    Returns a dictionary of field arrays and the mask of IPv4 packets, with
+    the same validity rules as FeatureExtractor.
+    """
+    # Multi-byte fields are read through big-endian views of the header bytes
+    h = np.ascontiguousarray(headers)
+    ethertype = h[:, 12:14].view('>u2')[:, 0]
+    ip_len = caplen - 14
+    version = h[:, 14] >> 4
+    header_length = (h[:, 14] & 0xf).astype(np.int64) * 4
+    valid = (caplen >= 14) & (ethertype == 0x0800) & (ip_len >= 20) & (version == 4) & (ip_len >= header_length)
+    
+    protocol = h[:, 23]
+    src_ip = h[:, 26:30].view('>u4')[:, 0].astype(np.uint32)
+    dst_ip = h[:, 30:34].view('>u4')[:, 0].astype(np.uint32)
+    
+    # Transport header, gathered from wherever the IP options put it
+    l4 = np.minimum(14 + header_length, HEADER_BYTES - 20)
+    transport = h[:, 34:54].copy()
+    options = np.flatnonzero(l4 != 34)
+    if len(options):
+        transport[options] = h[options[:, None], l4[options, None] + np.arange(20)]
+    l4_len = ip_len - header_length
+    ports = transport[:, :4].view('>u2').astype(np.uint16)
+    src_port = ports[:, 0]
+    dst_port = ports[:, 1]
+    flags = transport[:, 13]
+    
+    is_tcp = protocol == 6
+    tcp_ok = is_tcp & (l4_len >= 20) & (l4_len >= (transport[:, 12] >> 4).astype(np.int64) * 4)
+    udp_ok = (protocol == 17) & (l4_len >= 8)
+    has_ports = tcp_ok | udp_ok
+    
+    return {
+        'src_ip': src_ip,
+        'dst_ip': dst_ip,
+        'src_port': np.where(has_ports, src_port, 0),
+        'dst_port': np.where(has_ports, dst_port, 0),
+        'protocol': protocol,
+        'tcp_flags': np.where(tcp_ok, flags, 0),
+    }, valid
+
+class VectorFeatureExtractor:
+    def __init__(self, clock=time.time):
+        self.logger = logging.getLogger(__name__)
+        self.flow_timeout = 600  # 10 minutes
+        self.clock = clock  # Read once per burst, for packets without a capture timestamp
+        self.index = {}  # Flow key, the 16 bytes of flow_keys() (hi, lo) -> slot
+        self.keys = [None] * INITIAL_CAPACITY
+        self.free = list(range(INITIAL_CAPACITY - 1, -1, -1))
+        self.state = {name: np.zeros(INITIAL_CAPACITY, dtype=dtype) for name, dtype in FLOW_STATE}
+        self.active = np.zeros(INITIAL_CAPACITY, dtype=bool)
+        self.oldest = -np.inf  # Lower bound of last_time over active flows
+        self.max_flows = 0  # New flows beyond this are dropped; 0 for no limit
+        self.table_full = 0  # Packets dropped because the flow table was full
+        self.parse_failed = 0  # Packets that were not IPv4
+        self.tenant = 0  # Stamped in records, see TenantExtractor
+        
+    def grow(self):
+        """Double the flow table."""
+        capacity = len(self.active)
+        self.state = {name: np.concatenate([values, np.zeros(capacity, dtype=values.dtype)])
+                      for name, values in self.state.items()}
+        self.active = np.concatenate([self.active, np.zeros(capacity, dtype=bool)])
+        self.keys.extend([None] * capacity)
+        self.free.extend(range(2 * capacity - 1, capacity - 1, -1))
+        
+    def flow_count(self):
+        """Get the number of active flows."""
+        return len(self.index)
+        
+    def memory_usage(self):
+        """Get bytes used by the flow table."""
+        return (sum(values.nbytes for values in self.state.values()) + self.active.nbytes + sys.getsizeof(self.index) +
+                sys.getsizeof(self.keys) + sys.getsizeof(self.free) +
+                len(self.index) * 150)
+        
+    def cleanup_old_flows(self, current_time):
+        """Remove flows idle for longer than the flow timeout."""
+        slots = np.flatnonzero(self.active & (current_time - self.state['last_time'] > self.flow_timeout))
+        for slot in slots.tolist():
+            del self.index[self.keys[slot]]
+            self.keys[slot] = None
+            self.free.append(slot)
+        self.active[slots] = False
+        for values in self.state.values():
+            values[slots] = 0
+        self.oldest = -np.inf
+        if len(slots):
+            self.logger.debug(f"Cleaned up {len(slots)} expired flows")
+            
+    def oldest_time(self):
+        """Last packet time of the longest idle flow."""
+        if not self.index:
+            return np.inf
+        self.oldest = self.state['last_time'][self.active].min()
+        return self.oldest
+        
+    def next_cleanup(self, keys, valid, times, start, end, after=None):
+        """First packet in [start, end), from after on, at which FeatureExtractor would expire flows.
+        
+        Flows are only expired while more than CLEANUP_THRESHOLD flows are
+        held, and only once a flow has been idle for the flow timeout.
+        Returns end if no flow can expire in the range.
+        """
+        if len(self.index) + (end - start) <= CLEANUP_THRESHOLD:
+            return end
+        if times[start:end].max() - self.oldest <= self.flow_timeout:
+            return end
+        late = np.flatnonzero(times[start:end] - self.oldest_time() > self.flow_timeout)
+        if not len(late):
+            return end
+        first_late = max(start + int(late[0]), start if after is None else after)
+        
+        # Count flows as FeatureExtractor would see them before each packet
+        flows = len(self.index)
+        seen = set()
+        for i in range(start, end):
+            if i >= first_late and flows > CLEANUP_THRESHOLD:
+                return i
+            if valid[i]:
+                key = keys[i]
+                if key not in self.index and key not in seen and not 0 < self.max_flows <= flows:
+                    seen.add(key)
+                    flows += 1
+        return end
+        
+    def extract_columns(self, headers, caplen, lengths, times, burst=None):
+        """Extract features for a burst given as arrays, in columnar form.
+        
+        headers holds the first HEADER_BYTES of each packet (zero padded),
+        caplen the captured and lengths the reported packet lengths, and
+        times the packet times in seconds. burst, if given, is the
+        PacketBurst the arrays were built from, whose checksums are verified.
+        Returns the mask of IPv4 packets and a dictionary of per-packet
+        feature arrays; addresses are integers.
+        """
+        n = len(caplen)
+        columns = {name: np.zeros(n, dtype=dtype) for name, dtype in COLUMNS}
+        if n == 0:
+            return np.zeros(0, dtype=bool), columns
+            
+        fields, valid = parse_headers(headers, caplen)
+        if burst is not None:
+            fields['bad_checksum'] = burst_checksum_bad(burst, headers, valid)
+        else:
+            fields['bad_checksum'] = np.zeros(n, dtype=bool)
+            
+        # Bytes keys hash faster than tuples of integers
+        hi, lo = flow_keys(fields)
+        keys = np.column_stack((hi, lo)).view('V16')[:, 0].tolist()
+        
+        start = 0
+        while start < n:
+            end = self.next_cleanup(keys, valid, times, start, n)
+            if end == start:
+                self.cleanup_old_flows(times[start])
+                end = self.next_cleanup(keys, valid, times, start, n, after=start + 1)
+            self.update_range(fields, valid, keys, lengths, times, start, end, columns)
+            start = end
+            
+        derive_columns(columns)
+        return valid, columns
+        
+    def flush_flows(self, end_reason=FLOW_END_SHUTDOWN):
+        """Final records of all active flows, as of their last packet; empties the flow table."""
+        slots = np.flatnonzero(self.active)
+        state = {name: values[slots] for name, values in self.state.items()}
+        columns = {name: np.zeros(len(slots), dtype=dtype) for name, dtype in COLUMNS}
+        count = state['count']
+        iat_count = count - 1
+        duration = np.maximum(state['last_time'] - state['start_time'], 0.000001)
+        with np.errstate(invalid='ignore', divide='ignore'):
+            len_var = (state['len_sum_sq'] - state['len_sum'].astype(np.float64) ** 2 / count) / (count - 1)
+            iat_var = (state['iat_sum_sq'] - state['iat_sum'] ** 2 / iat_count) / (iat_count - 1)
+            iat_mean = (state['iat_sum'] + state['iat_shift'] * iat_count) / iat_count
+            
+        for name in ('src_ip', 'dst_ip', 'src_port', 'dst_port', 'protocol'):
+            columns[name] = state[name]
+        columns['flow_duration'] = duration
+        columns['total_fwd_packets'] = count
+        columns['total_length_fwd_packets'] = state['bytes']
+        columns['packet_length_max'] = state['len_max']
+        columns['packet_length_min'] = state['len_min']
+        columns['packet_length_mean'] = (state['len_sum'] + state['len_shift'] * count) / count
+        columns['packet_length_std'] = np.where(count > 1, np.sqrt(np.maximum(len_var, 0.0)), 0.0)
+        columns['flow_bytes_per_second'] = state['bytes'] / duration
+        columns['flow_packets_per_second'] = count / duration
+        columns['flow_iat_mean'] = np.where(count > 1, iat_mean, 0.0)
+        columns['flow_iat_std'] = np.where(count > 2, np.sqrt(np.maximum(iat_var, 0.0)), 0.0)
+        columns['flow_iat_max'] = np.where(count > 1, state['iat_max'], 0.0)
+        columns['flow_iat_min'] = np.where(count > 1, state['iat_min'], 0.0)
+        columns['tcp_flags'] = np.where(state['protocol'] == 6, state['tcp_flags'], 0)
+        columns['bad_checksum_packets'] = state['bad_checksum']
+        columns['end_reason'][:] = end_reason
+        columns['tenant'][:] = self.tenant
+        columns['timestamp'] = (state['last_time'] * 1000000).astype(np.int64)
+        derive_columns(columns)
+        records = FlowRecords(columns)
+        
+        self.index.clear()
+        self.keys = [None] * len(self.active)
+        self.free = list(range(len(self.active) - 1, -1, -1))
+        for values in self.state.values():
+            values[:] = 0
+        self.active[:] = False
+        self.oldest = -np.inf
+        return records
+        
+    def assign_slots(self, keys, packets):
+        """Look up the flow slot of each packet, creating flows in packet order.
+        
+        keys[j] is the flow key of packets[j]. Packets of new flows that do
+        not fit under max_flows get slot -1. Returns the slots, and the slots
+        of the new flows with the index of their first packet.
+        """
+        index = self.index
+        get = index.get
+        slots = np.fromiter(map(get, keys, repeat(-1)), dtype=np.int64, count=len(keys))
+        missing = np.flatnonzero(slots < 0)
+        if not len(missing):
+            return slots, None
+            
+        # New flows in order of their first packet, as many as fit under max_flows
+        missing_keys = [keys[j] for j in missing.tolist()]
+        new_keys = list(dict.fromkeys(missing_keys))
+        if self.max_flows:
+            del new_keys[max(self.max_flows - len(index), 0):]
+        first = dict(zip(reversed(missing_keys), packets[missing][::-1].tolist()))
+        while len(self.free) < len(new_keys):
+            self.grow()
+        new_slots = self.free[len(self.free) - len(new_keys):][::-1]
+        del self.free[len(self.free) - len(new_keys):]
+        index.update(zip(new_keys, new_slots))
+        for slot, key in zip(new_slots, new_keys):
+            self.keys[slot] = key
+        slots[missing] = list(map(get, missing_keys, repeat(-1)))
+        return slots, (np.array(new_slots, dtype=np.int64), np.array([first[key] for key in new_keys], dtype=np.int64))
+        
+    def update_range(self, fields, valid, keys, lengths, times, start, end, columns):
+        """Update flows with packets [start, end), in which no flow expires, and fill their columns."""
+        packets = np.flatnonzero(valid[start:end]) + start
+        if not len(packets):
+            return
+        range_keys = keys[start:end]
+        if len(packets) < end - start:
+            range_keys = list(compress(range_keys, valid[start:end].tolist()))
+        slots, created = self.assign_slots(range_keys, packets)
+        if self.max_flows and (slots < 0).any():
+            full = slots < 0
+            valid[packets[full]] = False
+            self.table_full += int(full.sum())
+            packets = packets[~full]
+            slots = slots[~full]
+            if not len(packets):
+                return
+        state = self.state
+        self.oldest = min(self.oldest, times[packets].min())
+        
+        # New flows take their addresses from their first packet
+        if created is not None:
+            new_slots, first = created
+            state['start_time'][new_slots] = times[first]
+            state['last_time'][new_slots] = times[first]
+            for name in ('src_ip', 'dst_ip', 'src_port', 'dst_port', 'protocol'):
+                state[name][new_slots] = fields[name][first]
+            state['len_shift'][new_slots] = lengths[first]
+            state['len_max'][new_slots] = -1
+            state['len_min'][new_slots] = np.iinfo(np.int64).max
+            state['iat_max'][new_slots] = -np.inf
+            state['iat_min'][new_slots] = np.inf
+            self.active[new_slots] = True
+            
+        # Group packets by flow, keeping packet order within each flow
+        # A stable sort of 16-bit keys is a radix sort
+        order = np.argsort(slots.astype(np.uint16) if len(self.active) <= 1 << 16 else slots, kind='stable')
+        g = slots[order]
+        p = packets[order]
+        m = len(g)
+        same = np.zeros(m, dtype=bool)
+        same[1:] = g[1:] == g[:-1]
+        first_in_group = ~same
+        group_start = np.maximum.accumulate(np.where(first_in_group, np.arange(m), 0))
+        rank = np.arange(m) - group_start
+        run = np.cumsum(first_in_group) - 1
+        grid = run_grid(rank, run)
+        
+        t = times[p]
+        length = lengths[p].astype(np.int64)
+        count = state['count'][g] + rank + 1
+        byte_count = state['bytes'][g] + segmented_sum(length, group_start)
+        
+        # Packet lengths, as sums of deviations from the first length
+        d = length - state['len_shift'][g]
+        len_sum = state['len_sum'][g] + segmented_sum(d, group_start)
+        len_sum_sq = state['len_sum_sq'][g] + segmented_sum(d * d, group_start)
+        len_max = np.maximum(state['len_max'][g], segmented_extreme(length, run, np.maximum))
+        len_min = np.minimum(state['len_min'][g], segmented_extreme(length, run, np.minimum))
+        
+        # Inter-arrival times; a flow's first packet has none, and gets 0 since a new flow's last time is its start
+        prev = state['last_time'][g]
+        np.copyto(prev[1:], t[:-1], where=same[1:])
+        iat = t - prev
+        has_iat = count > 1
+        iat_count = count - 1
+        
+        # The first inter-arrival time of each flow sets its shift
+        iat_shift = state['iat_shift'][g].copy()
+        shift_from = np.maximum.accumulate(np.where(iat_count == 1, np.arange(m), -1))
+        from_burst = shift_from >= group_start
+        iat_shift[from_burst] = iat[shift_from[from_burst]]
+        e = iat - iat_shift
+        iat_sum = state['iat_sum'][g] + segmented_scan(e, rank, np.add, grid)
+        iat_sum_sq = state['iat_sum_sq'][g] + segmented_scan(e * e, rank, np.add, grid)
+        iat_max = np.maximum(state['iat_max'][g], segmented_scan(np.where(has_iat, iat, -np.inf), rank, np.maximum, grid))
+        iat_min = np.minimum(state['iat_min'][g], segmented_scan(np.where(has_iat, iat, np.inf), rank, np.minimum, grid))
+        tcp_flags = state['tcp_flags'][g] | segmented_scan(fields['tcp_flags'][p], rank, np.bitwise_or, grid)
+        bad_checksum = state['bad_checksum'][g] + segmented_sum(fields['bad_checksum'][p].astype(np.int64), group_start)
+        
+        # Store the state after each flow's last packet in the range
+        last = np.ones(m, dtype=bool)
+        last[:-1] = ~same[1:]
+        ls = g[last]
+        state['last_time'][ls] = t[last]
+        state['count'][ls] = count[last]
+        state['bytes'][ls] = byte_count[last]
+        state['len_sum'][ls] = len_sum[last]
+        state['len_sum_sq'][ls] = len_sum_sq[last]
+        state['len_max'][ls] = len_max[last]
+        state['len_min'][ls] = len_min[last]
+        state['iat_shift'][ls] = iat_shift[last]
+        state['iat_sum'][ls] = iat_sum[last]
+        state['iat_sum_sq'][ls] = iat_sum_sq[last]
+        state['iat_max'][ls] = iat_max[last]
+        state['iat_min'][ls] = iat_min[last]
+        state['tcp_flags'][ls] = tcp_flags[last]
+        state['bad_checksum'][ls] = bad_checksum[last]
+        
+        # Features, with the statistics computed over shifted values; the shifted sums of flows
+        # without enough packets for a statistic are 0, so clamping the divisors gives it 0
+        duration = np.maximum(t - state['start_time'][g], 0.000001)
+        iat_divisor = np.maximum(iat_count, 1)
+        len_var = (len_sum_sq - len_sum.astype(np.float64) ** 2 / count) / np.maximum(count - 1, 1)
+        iat_var = (iat_sum_sq - iat_sum ** 2 / iat_divisor) / np.maximum(iat_count - 1, 1)
+        
+        for name in ('src_ip', 'dst_ip', 'src_port', 'dst_port', 'protocol'):
+            columns[name][p] = state[name][g]
+        columns['flow_duration'][p] = duration
+        columns['total_fwd_packets'][p] = count
+        columns['total_length_fwd_packets'][p] = byte_count
+        columns['packet_length_max'][p] = len_max
+        columns['packet_length_min'][p] = len_min
+        columns['packet_length_mean'][p] = (len_sum + state['len_shift'][g] * count) / count
+        columns['packet_length_std'][p] = np.sqrt(np.maximum(len_var, 0.0))
+        columns['flow_bytes_per_second'][p] = byte_count / duration
+        columns['flow_packets_per_second'][p] = count / duration
+        columns['flow_iat_mean'][p] = (iat_sum + iat_shift * iat_count) / iat_divisor
+        columns['flow_iat_std'][p] = np.sqrt(np.maximum(iat_var, 0.0))
+        columns['flow_iat_max'][p] = np.where(has_iat, iat_max, 0.0)
+        columns['flow_iat_min'][p] = np.where(has_iat, iat_min, 0.0)
+        # parse_headers() gives non-TCP packets no flags
+        columns['tcp_flags'][p] = tcp_flags
+        columns['bad_checksum_packets'][p] = bad_checksum
+        columns['tenant'][p] = self.tenant
+        columns['timestamp'][p] = (t * 1000000).astype(np.int64)
+        
+    def extract_burst(self, burst):
+        """Extract features for a PacketBurst, as FlowRecords of its IPv4 packets in packet order."""
+        if not len(burst):
+            return FlowRecords.empty()
+        try:
+            lengths = burst.lengths.astype(np.int64)
+            table_full = self.table_full
+            valid, columns = self.extract_columns(burst.headers(HEADER_BYTES), lengths, lengths,
+                                                  burst.times(self.clock), burst)
+            added = int(np.count_nonzero(valid))
+            self.parse_failed += len(valid) - added - (self.table_full - table_full)
+            records = FlowRecords(columns)
+            return records if added == len(valid) else records.select(valid)
+        except Exception as e:
+            self.logger.error(f"Error extracting features: {e}")
+            return FlowRecords.empty()
+            
+    def drop_stats(self):
+        """Packets not added to a flow, by drop reason."""
+        return {'parse_failed': self.parse_failed, 'flow_table_full': self.table_full}
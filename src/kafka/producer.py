@@ -3,18 +3,56 @@ Kafka producer for streaming network flow features.
 Handles real-time data streaming to Apache Kafka.
 """
 
+import asyncio
 import json
 import logging
-import time
-from confluent_kafka import Producer, KafkaException
+import os
+import threading
+from confluent_kafka import Producer, KafkaError, KafkaException
+from src.features.flow_key import record_hash
+from src.metrics.drops import DropCounters, EXPORT_QUEUE_FULL, EXPORT_FAILED
+
+# Delivery report modes: only failures reach Python, or every message does
+DELIVERY_REPORT_MODES = ('errors', 'all')
+
+# Reports of messages removed from the producer queue by purge()
+PURGE_ERRORS = (KafkaError._PURGE_QUEUE, KafkaError._PURGE_INFLIGHT)
+
+# Seconds of the cleanup timeout kept for purging and spooling what is undelivered
+SPOOL_TIME = 0.5
 
 class KafkaProducer:
-    def __init__(self, config_file='config/kafka.properties'):
+    def __init__(self, config_file='config/kafka.properties', poll_interval=0.1, spool_file=None):
+        """spool_file, if given, keeps messages still undelivered at shutdown for the next start."""
         self.logger = logging.getLogger(__name__)
         self.producer = None
         self.topic = 'network-flows'
+        self.tenant_topics = {}  # Topic of each tenant index exported apart
+        self.partitions = {}  # Partition count of each topic known at startup
         self.config_file = config_file
-        self.message_count = 0
+        self.poll_interval = poll_interval
+        self.delivery_reports = 'errors'
+        self.queue_capacity = 100000
+        
+        # Delivery accounting; produced is only written by the exporting
+        # thread and the report counters only by the poll thread
+        self.produced = 0
+        self.produced_bytes = 0
+        self.failed = 0
+        self.reported = 0
+        self.logged = 0
+        self.drops = DropCounters()  # Records never produced, counted by the exporting thread
+        self.stats = {}  # Latest librdkafka statistics
+        
+        # Messages purged at shutdown, written to the spool and produced again at the next start
+        self.spool_file = spool_file
+        self.purged = []
+        self.spooled = 0
+        self.replayed = 0
+        
+        self.poll_thread = None
+        self.stopping = threading.Event()
+        self.thread_init = None
         
     def load_config(self):
         """Load Kafka configuration from file."""
@@ -26,7 +64,8 @@ class KafkaProducer:
             'compression.type': 'snappy',
             'acks': 1,
             'retries': 3,
-            'retry.backoff.ms': 100
+            'retry.backoff.ms': 100,
+            'statistics.interval.ms': 1000
         }
         
         try:
@@ -43,16 +82,41 @@ class KafkaProducer:
             
         return config
         
-    def initialize(self):
-        """Initialize Kafka producer."""
+    def initialize(self, thread_init=None):
+        """Initialize Kafka producer and start its poll thread.
+        
+        thread_init, if given, is called first in the poll thread.
+        """
         try:
             config = self.load_config()
+            self.queue_capacity = int(config.get('queue.buffering.max.messages', self.queue_capacity))
+            
+            # Our own setting, not librdkafka's
+            mode = config.pop('delivery.reports', self.delivery_reports)
+            if mode not in DELIVERY_REPORT_MODES:
+                raise ValueError(f"delivery.reports must be one of {', '.join(DELIVERY_REPORT_MODES)}")
+            self.delivery_reports = mode
+            
+            # One producer-wide report callback instead of one per message; in
+            # 'errors' mode librdkafka drops successful reports before Python
+            config['on_delivery'] = self.on_delivery
+            config['delivery.report.only.error'] = mode == 'errors'
+            config['stats_cb'] = self.on_stats
+            config['error_cb'] = self.on_error
             self.producer = Producer(config)
             
             # Test connection by getting metadata
             metadata = self.producer.list_topics(timeout=5)
             self.logger.info(f"Connected to Kafka cluster with {len(metadata.brokers)} brokers")
+            self.partitions = {name: len(topic.partitions)
+                               for name, topic in getattr(metadata, 'topics', {}).items() if topic.partitions}
             
+            self.thread_init = thread_init
+            self.stopping.clear()
+            self.poll_thread = threading.Thread(target=self.poll_loop, name='kafka-poll', daemon=True)
+            self.poll_thread.start()
+            
+            self.replay_spool()
             return True
             
         except KafkaException as e:
@@ -62,48 +126,99 @@ class KafkaProducer:
             self.logger.error(f"Failed to initialize Kafka producer: {e}")
             return False
             
-    def delivery_callback(self, err, msg):
-        """Callback for message delivery confirmation."""
-        if err:
+    def poll_loop(self):
+        """Serve delivery reports, statistics and errors off the export path."""
+        if self.thread_init:
+            self.thread_init()
+        while not self.stopping.is_set():
+            try:
+                self.producer.poll(self.poll_interval)
+            except Exception as e:
+                self.logger.error(f"Kafka poll failed: {e}")
+                self.stopping.wait(self.poll_interval)
+                continue
+                
+            delivered = self.delivered()
+            if delivered // 1000 > self.logged // 1000:
+                self.logger.info(f"Delivered {delivered} messages to Kafka")
+            self.logged = delivered
+            
+    def on_delivery(self, err, msg):
+        """Producer-wide delivery report; only failures arrive in 'errors' mode."""
+        if err and err.code() in PURGE_ERRORS:
+            # Kept for the spool rather than failed
+            self.purged.append(msg)
+        elif err:
+            self.failed += 1
             self.logger.error(f"Message delivery failed: {err}")
         else:
-            self.message_count += 1
-            if self.message_count % 1000 == 0:
-                self.logger.info(f"Delivered {self.message_count} messages to Kafka")
-                
-    def send_features(self, features):
-        """Send network flow features to Kafka."""
-        if not self.producer:
+            self.reported += 1
+            
+    def on_stats(self, stats_json):
+        """Keep the latest librdkafka statistics."""
+        try:
+            self.stats = json.loads(stats_json)
+        except ValueError as e:
+            self.logger.error(f"Invalid Kafka statistics: {e}")
+            
+    def on_error(self, err):
+        """Client-level errors, such as all brokers being down."""
+        self.logger.error(f"Kafka error: {err}")
+        
+    def in_flight(self):
+        """Messages queued, in flight or with reports not yet served."""
+        return len(self.producer) if self.producer is not None else 0
+        
+    def delivered(self):
+        """Messages acknowledged by the brokers."""
+        if self.delivery_reports == 'all':
+            return self.reported
+        return max(self.produced - self.failed - self.spooled - self.in_flight(), 0)
+        
+    def send_features(self, features, on_delivery=None):
+        """Send network flow features to Kafka; on_delivery(err, msg) is called from the poll thread.
+        
+        In 'errors' mode on_delivery only sees failed messages.
+        """
+        if self.producer is None:
             self.logger.error("Kafka producer not initialized")
             return False
             
         try:
-            # Convert features to JSON
-            message = json.dumps(features, default=str)
-            
-            # Create message key from flow information
-            key = f"{features.get('src_ip', '')}:{features.get('src_port', '')}-{features.get('dst_ip', '')}:{features.get('dst_port', '')}"
+            # Convert features to JSON, unless the native engine already did
+            message = getattr(features, 'json', None) or json.dumps(features, default=str)
             
-            # Send message
-            self.producer.produce(
-                topic=self.topic,
-                key=key,
-                value=message,
-                callback=self.delivery_callback
-            )
+            # Key and partition by the flow hash, so both directions of a flow
+            # land on the same partition; topics created after startup fall
+            # back to the client's partitioner on the same key
+            flow = record_hash(features)
+            key = f"{flow:016x}"
+            topic = self.tenant_topics.get(features.get('tenant'), self.topic) if self.tenant_topics else self.topic
+            partitions = self.partitions.get(topic)
+            extra = {'partition': flow % partitions} if partitions else {}
+            if on_delivery is not None:
+                extra['on_delivery'] = on_delivery
+                
+            # Send message; reports are served by the poll thread
+            self.producer.produce(topic=topic, key=key, value=message, **extra)
             
-            # Trigger delivery callbacks
-            self.producer.poll(0)
+            self.produced += 1
+            self.produced_bytes += len(message) + len(key)
             
             return True
             
+        except BufferError:
+            self.drops.counts[EXPORT_QUEUE_FULL] += 1
+            self.logger.error("Kafka producer queue is full")
+            return False
         except Exception as e:
+            self.drops.counts[EXPORT_FAILED] += 1
             self.logger.error(f"Error sending message to Kafka: {e}")
             return False
             
-    def send_batch(self, features_list):
+    def send_batch(self, features_list, flush=True):
         """Send a batch of features to Kafka."""
-        if not self.producer:
+        if self.producer is None:
             self.logger.error("Kafka producer not initialized")
             return 0
             
@@ -113,35 +228,151 @@ class KafkaProducer:
                 sent_count += 1
                 
         # Flush to ensure delivery
-        self.producer.flush(timeout=1.0)
-        
+        if flush:
+            self.producer.flush(timeout=1.0)
+            
         return sent_count
         
+    async def send_batch_async(self, features_list, check_interval=0.005):
+        """Send a batch and wait until it has left the producer queue, without blocking the event loop.
+        
+        Returns the number of delivered and failed messages. Completion is
+        tracked with counters: the batch is done once the producer has
+        completed as many messages as had been produced by the end of the
+        batch. Failures are counted per message, which only costs a Python
+        call for messages that fail in 'errors' mode.
+        """
+        if self.producer is None:
+            self.logger.error("Kafka producer not initialized")
+            return {'delivered': 0, 'failed': len(features_list)}
+            
+        report = {'delivered': 0, 'failed': 0}
+        reported = [0]
+        
+        def on_delivery(err, msg):
+            # A message's own callback replaces the producer-wide one
+            self.on_delivery(err, msg)
+            reported[0] += 1
+            if err:
+                report['failed'] += 1
+                
+        sent = 0
+        for features in features_list:
+            if self.send_features(features, on_delivery):
+                sent += 1
+            else:
+                report['failed'] += 1
+                
+        end = self.produced
+        while sent and self.producer is not None and reported[0] < sent:
+            if self.produced - self.in_flight() >= end and self.delivery_reports == 'errors':
+                break
+            await asyncio.sleep(check_interval)
+            
+        report['delivered'] = len(features_list) - report['failed']
+        return report
+        
+    def queue_occupancy(self):
+        """Get the fraction of the local producer queue in use."""
+        return self.in_flight() / self.queue_capacity
+        
+    def memory_usage(self):
+        """Get bytes held in the producer queue awaiting delivery."""
+        if self.stats:
+            return self.stats.get('msg_size', 0)
+        if not self.produced:
+            return 0
+        return self.in_flight() * self.produced_bytes // self.produced
+        
+    def drop_stats(self):
+        """Records lost on the way to Kafka, by drop reason."""
+        stats = self.drops.to_dict()
+        stats['delivery_failed'] = self.failed
+        return stats
+        
     def get_statistics(self):
-        """Get producer statistics."""
-        if not self.producer:
+        """Get producer statistics, from our counters and the latest librdkafka statistics."""
+        if self.producer is None:
             return {}
             
+        stats = self.stats
+        return {
+            'messages_produced': self.produced,
+            'messages_sent': self.delivered(),
+            'messages_failed': self.failed,
+            'messages_in_flight': self.in_flight(),
+            'messages_spooled': self.spooled,
+            'messages_replayed': self.replayed,
+            'bytes_produced': self.produced_bytes,
+            'txmsgs': stats.get('txmsgs', 0),
+            'txmsg_bytes': stats.get('txmsg_bytes', 0),
+            'tx_errors': sum(broker.get('txerrs', 0) for broker in stats.get('brokers', {}).values()),
+            'queue_bytes': stats.get('msg_size', 0),
+            'brokers': len(stats.get('brokers', {}))
+        }
+        
+    def replay_spool(self):
+        """Produce the messages spooled at the last shutdown again."""
+        if not self.spool_file or not os.path.exists(self.spool_file):
+            return
         try:
-            stats = json.loads(self.producer.stats())
-            return {
-                'messages_sent': self.message_count,
-                'txmsgs': stats.get('txmsgs', 0),
-                'txmsg_bytes': stats.get('txmsg_bytes', 0),
-                'brokers': len(stats.get('brokers', {}))
-            }
-        except Exception as e:
-            self.logger.error(f"Error getting statistics: {e}")
-            return {'messages_sent': self.message_count}
+            with open(self.spool_file) as f:
+                messages = [json.loads(line) for line in f if line.strip()]
+            for message in messages:
+                key = message['key']
+                partitions = self.partitions.get(message['topic'])
+                extra = {'partition': int(key, 16) % partitions} if partitions and key else {}
+                self.producer.produce(topic=message['topic'], key=key, value=message['value'], **extra)
+                self.produced += 1
+                self.produced_bytes += len(message['value']) + len(key or '')
+                self.replayed += 1
+            # Undelivered again at the next shutdown, they are spooled again
+            os.unlink(self.spool_file)
+            self.logger.info(f"Replayed {len(messages)} messages spooled at the last shutdown")
+        except (OSError, ValueError, KeyError, BufferError) as e:
+            self.logger.error(f"Cannot replay Kafka spool {self.spool_file}: {e}")
+            
+    def write_spool(self, messages):
+        """Append purged messages to the spool file; returns False if they could not be kept."""
+        try:
+            with open(self.spool_file, 'a') as f:
+                for msg in messages:
+                    key = msg.key()
+                    f.write(json.dumps({'topic': msg.topic(), 'key': key.decode() if key else None,
+                                        'value': msg.value().decode()}) + '\n')
+                f.flush()
+                os.fsync(f.fileno())
+            return True
+        except OSError as e:
+            self.logger.error(f"Cannot write Kafka spool {self.spool_file}: {e}")
+            return False
             
-    def cleanup(self):
-        """Cleanup Kafka producer resources."""
-        if self.producer:
+    def cleanup(self, timeout=10.0):
+        """Deliver pending messages for up to timeout seconds, then spool or drop the rest."""
+        if self.producer is not None:
             try:
-                # Wait for any pending messages to be delivered
-                self.producer.flush(timeout=10.0)
-                self.logger.info(f"Kafka producer cleaned up. Total messages sent: {self.message_count}")
+                # Stop polling; flush() serves the remaining reports here
+                self.stopping.set()
+                if self.poll_thread:
+                    self.poll_thread.join(timeout=1.0)
+                remaining = self.producer.flush(max(timeout - SPOOL_TIME, 0.0))
+                if remaining:
+                    # Take what the brokers did not acknowledge in time out of
+                    # the queue; in-flight messages may still arrive, so the
+                    # spool can duplicate them
+                    self.purged = []
+                    self.producer.purge(in_queue=True, in_flight=True, blocking=False)
+                    self.producer.poll(0)
+                    if self.spool_file and self.write_spool(self.purged):
+                        self.spooled += len(self.purged)
+                        self.logger.warning(f"Spooled {len(self.purged)} undelivered messages to {self.spool_file}")
+                    else:
+                        self.failed += len(self.purged)
+                        self.logger.error(f"Dropped {len(self.purged)} messages not delivered before the deadline")
+                self.logger.info(f"Kafka producer cleaned up. Total messages sent: {self.delivered()}, "
+                                 f"failed: {self.failed}, spooled: {self.spooled}")
             except Exception as e:
                 self.logger.error(f"Error during Kafka cleanup: {e}")
             finally:
                 self.producer = None
+                self.poll_thread = None
@@ -0,0 +1,98 @@
+"""
+Drop-reason accounting for the capture pipeline.
+Every stage that can lose a packet or a record counts it under a fixed
+reason, in a counter set owned by the thread or process doing the work, so
+counting is a list increment with no locking. The accountant sums them with
+the drop counters kept by the NIC, the kernel and the native flow engine.
+"""
+
+import logging
+from collections import defaultdict
+
+# Drop reasons, in pipeline order
+REASONS = (
+    'nic_missed',             # NIC or kernel ring full (imissed, tp_drops)
+    'rx_nombuf',              # No free mbuf to receive into
+    'rx_errors',              # Frames the NIC received with errors
+    'worker_ring_full',       # Burst not handed to a worker process
+    'parse_failed',           # Not an IPv4 packet, or truncated headers
+    'flow_table_full',        # New flow with no room in the flow table
+    'export_queue_full',      # Kafka producer queue full
+    'export_failed',          # Kafka produce() rejected the record
+    'delivery_failed',        # Kafka reported the message undelivered
+    'packet_store_full',      # Packet store writer behind
+    'flow_archive_full',      # Flow archive writer behind
+    'collector_unavailable'   # Collector unreachable or its queue full
+)
+
+# Indexes into DropCounters.counts
+(NIC_MISSED, RX_NOMBUF, RX_ERRORS, WORKER_RING_FULL, PARSE_FAILED, FLOW_TABLE_FULL, EXPORT_QUEUE_FULL,
+ EXPORT_FAILED, DELIVERY_FAILED, PACKET_STORE_FULL, FLOW_ARCHIVE_FULL, COLLECTOR_UNAVAILABLE) = range(len(REASONS))
+
+class DropCounters:
+    """Drop counters of one thread or process.
+
+    Only the owning thread increments them, e.g.
+    drops.counts[PARSE_FAILED] += skipped, so no lock is needed; readers
+    may see a value one increment old.
+    """
+
+    __slots__ = ('counts',)
+
+    def __init__(self):
+        self.counts = [0] * len(REASONS)
+
+    def __getitem__(self, reason):
+        return self.counts[reason]
+
+    def to_dict(self):
+        """Counts of the reasons that occurred."""
+        return {reason: count for reason, count in zip(REASONS, self.counts) if count}
+
+class DropAccountant:
+    def __init__(self):
+        self.logger = logging.getLogger(__name__)
+        self.sources = {}
+
+    def register(self, name, source):
+        """Register a DropCounters, or a callable returning {reason: count} for counters kept elsewhere."""
+        if callable(source):
+            self.sources[name] = source
+        else:
+            self.sources[name] = source.to_dict
+
+    def unregister(self, name):
+        self.sources.pop(name, None)
+
+    def snapshot(self):
+        """Drops per reason, overall and per source."""
+        totals = dict.fromkeys(REASONS, 0)
+        by_source = defaultdict(dict)
+        for name, source in list(self.sources.items()):
+            try:
+                counts = source() or {}
+            except Exception as e:
+                self.logger.error(f"Error reading drop counters of {name}: {e}")
+                continue
+            for reason, count in counts.items():
+                if reason not in totals:
+                    raise ValueError(f"Unknown drop reason from {name}: {reason}")
+                totals[reason] += int(count)
+                by_source[name][reason] = int(count)
+        return {'total': sum(totals.values()), 'reasons': totals, 'sources': dict(by_source)}
+
+    def collect(self):
+        """Flatten a snapshot for the metrics exporter."""
+        snapshot = self.snapshot()
+        metrics = {'total': snapshot['total']}
+        metrics.update(snapshot['reasons'])
+        for name, counts in snapshot['sources'].items():
+            for reason, count in counts.items():
+                metrics[f"{name}_{reason}"] = count
+        return metrics
+
+    def format_summary(self):
+        """Format a one-line summary for logging."""
+        snapshot = self.snapshot()
+        parts = [f"{reason}={count}" for reason, count in snapshot['reasons'].items() if count]
+        return f"Drops: total={snapshot['total']}" + (f" [{', '.join(parts)}]" if parts else '')
@@ -0,0 +1,103 @@
+"""
+Metrics exporter for pipeline statistics.
+Collects values from registered sources and serves them in Prometheus text format.
+"""
+
+import logging
+import threading
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+class MetricsExporter:
+    def __init__(self, port=None, prefix='dpdk_capture'):
+        self.logger = logging.getLogger(__name__)
+        self.port = port
+        self.prefix = prefix
+        self.sources = {}
+        self.server = None
+        self.thread = None
+        self.lock = threading.Lock()
+        
+    def register(self, name, collector):
+        """Register a source; collector() returns a dict of metric name to number."""
+        with self.lock:
+            self.sources[name] = collector
+            
+    def unregister(self, name):
+        """Remove a previously registered source."""
+        with self.lock:
+            self.sources.pop(name, None)
+            
+    def collect(self):
+        """Collect current values from all sources as a flat dictionary."""
+        with self.lock:
+            sources = list(self.sources.items())
+            
+        metrics = {}
+        for name, collector in sources:
+            try:
+                values = collector() or {}
+            except Exception as e:
+                self.logger.error(f"Error collecting metrics from {name}: {e}")
+                continue
+                
+            for key, value in values.items():
+                if isinstance(value, bool):
+                    value = int(value)
+                if isinstance(value, (int, float)):
+                    metrics[f"{self.prefix}_{name}_{key}"] = value
+                    
+        return metrics
+        
+    def render_prometheus(self):
+        """Render collected metrics in Prometheus text exposition format."""
+        lines = []
+        for name, value in sorted(self.collect().items()):
+            lines.append(f"{name} {value}")
+        return '\n'.join(lines) + '\n'
+        
+    def start(self, thread_init=None):
+        """Start serving metrics over HTTP if a port is configured.
+        
+        thread_init, if given, is called first in the server thread.
+        """
+        if not self.port:
+            return True
+            
+        exporter = self
+        
+        class Handler(BaseHTTPRequestHandler):
+            def do_GET(self):
+                if self.path not in ('/', '/metrics'):
+                    self.send_error(404)
+                    return
+                body = exporter.render_prometheus().encode('utf-8')
+                self.send_response(200)
+                self.send_header('Content-Type', 'text/plain; version=0.0.4')
+                self.send_header('Content-Length', str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+                
+            def log_message(self, format, *args):
+                pass
+                
+        try:
+            self.server = HTTPServer(('', self.port), Handler)
+            def serve():
+                if thread_init:
+                    thread_init()
+                self.server.serve_forever()
+                
+            self.thread = threading.Thread(target=serve, name='metrics-exporter', daemon=True)
+            self.thread.start()
+            self.logger.info(f"Serving metrics on port {self.port}")
+            return True
+        except Exception as e:
+            self.logger.error(f"Failed to start metrics exporter: {e}")
+            return False
+            
+    def stop(self):
+        """Stop the HTTP server."""
+        if self.server:
+            self.server.shutdown()
+            self.server.server_close()
+            self.server = None
@@ -0,0 +1,100 @@
+"""
+Memory footprint accounting for the capture pipeline.
+Aggregates byte counts reported by each component into fixed categories.
+"""
+
+import logging
+from collections import defaultdict
+
+# Accounting categories
+CATEGORIES = (
+    'mempools',       # DPDK mbuf pools and capture rings
+    'flow_table',     # Per-flow state
+    'arenas',         # Native allocator arenas
+    'sketches',       # Approximate counting structures
+    'export_queues',  # Records awaiting delivery to Kafka
+    'spool'           # On-disk spool buffers held in memory
+)
+
+class MemoryAccountant:
+    def __init__(self):
+        self.logger = logging.getLogger(__name__)
+        self.providers = defaultdict(dict)
+        self.flow_counters = {}
+        self.high_water = dict.fromkeys(CATEGORIES, 0)
+        self.total_high_water = 0
+        
+    def register(self, category, name, provider):
+        """Register a provider; provider() returns the bytes it currently holds."""
+        if category not in CATEGORIES:
+            raise ValueError(f"Unknown memory category: {category}")
+        self.providers[category][name] = provider
+        
+    def register_flow_counter(self, name, counter):
+        """Register a callable returning the number of active flows it holds."""
+        self.flow_counters[name] = counter
+        
+    def unregister(self, name):
+        """Remove all providers registered under a name."""
+        for providers in self.providers.values():
+            providers.pop(name, None)
+        self.flow_counters.pop(name, None)
+        
+    def snapshot(self):
+        """Take a snapshot of memory usage by category."""
+        categories = dict.fromkeys(CATEGORIES, 0)
+        for category, providers in self.providers.items():
+            for name, provider in providers.items():
+                try:
+                    categories[category] += int(provider() or 0)
+                except Exception as e:
+                    self.logger.error(f"Error reading memory usage of {name}: {e}")
+                    
+        for category, used in categories.items():
+            self.high_water[category] = max(self.high_water[category], used)
+            
+        total = sum(categories.values())
+        self.total_high_water = max(self.total_high_water, total)
+        
+        flows = 0
+        for name, counter in self.flow_counters.items():
+            try:
+                flows += int(counter() or 0)
+            except Exception as e:
+                self.logger.error(f"Error reading flow count of {name}: {e}")
+                
+        return {
+            'total_bytes': total,
+            'total_high_water_bytes': self.total_high_water,
+            'categories': categories,
+            'high_water': dict(self.high_water),
+            'active_flows': flows,
+            'bytes_per_flow': categories['flow_table'] / flows if flows else 0,
+            'total_bytes_per_flow': total / flows if flows else 0
+        }
+        
+    def collect(self):
+        """Flatten a snapshot for the metrics exporter."""
+        snapshot = self.snapshot()
+        metrics = {
+            'total_bytes': snapshot['total_bytes'],
+            'total_high_water_bytes': snapshot['total_high_water_bytes'],
+            'active_flows': snapshot['active_flows'],
+            'bytes_per_flow': snapshot['bytes_per_flow'],
+            'total_bytes_per_flow': snapshot['total_bytes_per_flow']
+        }
+        for category in CATEGORIES:
+            metrics[f"{category}_bytes"] = snapshot['categories'][category]
+            metrics[f"{category}_high_water_bytes"] = snapshot['high_water'][category]
+        return metrics
+        
+    def format_summary(self):
+        """Format a one-line summary for logging."""
+        snapshot = self.snapshot()
+        parts = [f"{category}={used / 1048576:.1f}MiB"
+                 for category, used in snapshot['categories'].items() if used]
+        return (f"Memory: total={snapshot['total_bytes'] / 1048576:.1f}MiB "
+                f"(peak {snapshot['total_high_water_bytes'] / 1048576:.1f}MiB), "
+                f"{snapshot['active_flows']} flows, "
+                f"{snapshot['bytes_per_flow']:.0f} B/flow"
+                + (f" [{', '.join(parts)}]" if parts else ''))
@@ -0,0 +1,178 @@
+"""
+Asyncio integration for the capture pipeline.
+Capture queues are drained from the event loop when their descriptors become
+readable, and finished records are announced through an eventfd so other
+async services can wait on them without extra threads or polling sleeps.
+"""
+
+import asyncio
+import collections
+import logging
+import os
+
+# Bursts read from one queue per readiness callback, to keep the loop responsive
+BURSTS_PER_WAKEUP = 16
+
+class AsyncCapturePipeline:
+    def __init__(self, capture, process, burst_size=32, max_pending=65536, max_backoff=0.001):
+        """Drain capture into records on the running event loop.
+        
+        process turns a PacketBurst into feature records. Backends without
+        a readiness descriptor (DPDK, pcap replay) are polled from loop timers
+        that back off up to max_backoff seconds while idle.
+        """
+        self.logger = logging.getLogger(__name__)
+        self.capture = capture
+        self.process = process
+        self.burst_size = burst_size
+        self.max_pending = max_pending
+        self.max_backoff = max_backoff
+        self.loop = None
+        self.records = collections.deque()
+        self.ready = asyncio.Event()
+        self.event_fd = os.eventfd(0, os.EFD_NONBLOCK | os.EFD_CLOEXEC)
+        self.readers = []
+        self.timer = None
+        self.backoff = 0.0
+        self.paused = False
+        self.running = False
+        self.wakeups = 0
+        self.packets = 0
+        
+    def fileno(self):
+        """Descriptor that polls readable while records are waiting."""
+        return self.event_fd
+        
+    def start(self):
+        """Register the capture queues with the running event loop."""
+        self.loop = asyncio.get_running_loop()
+        self.running = True
+        for queue in range(self.capture.get_queue_count()):
+            fd = self.capture.get_fd(queue)
+            if fd >= 0:
+                self.readers.append((fd, queue))
+        if self.readers:
+            self.logger.info(f"Waiting on {len(self.readers)} capture descriptor(s)")
+        else:
+            self.logger.info("Capture backend has no readiness descriptor, polling from loop timers")
+        self.resume()
+        
+    def pause(self):
+        """Stop reading capture while the consumer is behind; packets wait in the backend's ring."""
+        self.paused = True
+        for fd, _ in self.readers:
+            self.loop.remove_reader(fd)
+        if self.timer:
+            self.timer.cancel()
+            self.timer = None
+            
+    def resume(self):
+        """Start reading capture again."""
+        self.paused = False
+        if self.readers:
+            for fd, queue in self.readers:
+                self.loop.add_reader(fd, self.on_readable, queue)
+        else:
+            self.timer = self.loop.call_soon(self.on_timer)
+            
+    def restart_capture(self, queue=None):
+        """Restart a capture queue (None for the port) between callbacks; the restart may replace its descriptor."""
+        was_paused = self.paused
+        if self.loop:
+            self.pause()
+        ok = self.capture.restart(queue)
+        self.readers = []
+        for q in range(self.capture.get_queue_count()):
+            fd = self.capture.get_fd(q)
+            if fd >= 0:
+                self.readers.append((fd, q))
+        if self.running and not was_paused:
+            self.resume()
+        return ok
+        
+    def drain(self, queue):
+        """Read bursts from one queue (None for all) until it is empty; returns the packet count."""
+        captured = 0
+        for _ in range(BURSTS_PER_WAKEUP):
+            packets = self.capture.capture_packets(self.burst_size, queue=queue)
+            if not packets:
+                break
+            captured += len(packets)
+            records = self.process(packets)
+            if records:
+                self.publish(records)
+            if len(packets) < self.burst_size or self.paused:
+                break
+        self.packets += captured
+        return captured
+        
+    def on_readable(self, queue):
+        """Reader callback: a queue's descriptor became readable."""
+        self.wakeups += 1
+        self.drain(queue)
+        
+    def on_timer(self):
+        """Timer callback for backends without a readiness descriptor."""
+        self.timer = None
+        if not self.running or self.paused:
+            return
+        if self.drain(None):
+            self.backoff = 0.0
+            self.timer = self.loop.call_soon(self.on_timer)
+        else:
+            self.backoff = min(max(self.backoff * 2, 0.00001), self.max_backoff)
+            self.timer = self.loop.call_later(self.backoff, self.on_timer)
+            
+    def publish(self, records):
+        """Queue records for consumers and signal the eventfd."""
+        if not self.records:
+            os.eventfd_write(self.event_fd, 1)
+        self.records.extend(records)
+        self.ready.set()
+        if len(self.records) >= self.max_pending and not self.paused:
+            self.pause()
+            
+    def get_batch_nowait(self, max_records=256):
+        """Take up to max_records waiting records."""
+        count = min(max_records, len(self.records))
+        batch = [self.records.popleft() for _ in range(count)]
+        if not self.records:
+            self.ready.clear()
+            try:
+                os.eventfd_read(self.event_fd)
+            except BlockingIOError:
+                pass
+        if self.paused and self.running and len(self.records) < self.max_pending // 2:
+            self.resume()
+        return batch
+        
+    async def get_batch(self, max_records=256, timeout=None):
+        """Wait for records and take up to max_records; empty on timeout or stop."""
+        if not self.records and self.running:
+            try:
+                await asyncio.wait_for(self.ready.wait(), timeout)
+            except asyncio.TimeoutError:
+                return []
+        return self.get_batch_nowait(max_records)
+        
+    def collect(self):
+        """Loop counters for the metrics exporter."""
+        return {'wakeups': self.wakeups, 'packets': self.packets,
+                'pending_records': len(self.records), 'paused': int(self.paused)}
+        
+    def stop(self):
+        """Unregister from the loop and wake any waiting consumer."""
+        if not self.running:
+            return
+        self.running = False
+        if self.loop:
+            self.pause()
+        self.readers = []
+        self.ready.set()
+        
+    def close(self):
+        """Stop and release the eventfd."""
+        self.stop()
+        if self.event_fd >= 0:
+            os.close(self.event_fd)
+            self.event_fd = -1
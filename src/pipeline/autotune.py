@@ -0,0 +1,160 @@
+"""
+Load-aware auto-tuning of the capture loop.
+Adjusts RX burst size, idle poll backoff and export batch size from observed
+empty-poll ratio, RX queue occupancy and per-stage latency.
+"""
+
+import logging
+import time
+
+class AutoTuner:
+    def __init__(self, max_burst=32, min_burst=4, max_backoff_us=1000,
+                 min_export_batch=1, max_export_batch=256, export_latency_us=10000,
+                 interval=0.5, enabled=True):
+        self.logger = logging.getLogger(__name__)
+        self.enabled = enabled
+        self.min_burst = max(1, min(min_burst, max_burst))
+        self.max_burst = max_burst
+        self.max_backoff = max_backoff_us / 1e6
+        self.min_export_batch = max(1, min_export_batch)
+        self.max_export_batch = max(self.min_export_batch, max_export_batch)
+        self.export_latency = export_latency_us / 1e6
+        self.interval = interval
+        
+        # Current decisions; static values when tuning is disabled
+        self.burst_size = max_burst
+        self.backoff_ceiling = self.max_backoff
+        self.export_batch = self.min_export_batch
+        self.backoff = 0.0
+        
+        self.adjustments = 0
+        self.reset_window()
+        self.window_start = time.perf_counter()
+        self.last_window = self.window_metrics(1.0)
+        
+    def reset_window(self):
+        """Reset counters of the current observation window."""
+        self.polls = 0
+        self.empty_polls = 0
+        self.full_polls = 0
+        self.packets = 0
+        self.stage_time = {'capture': 0.0, 'process': 0.0, 'export': 0.0}
+        self.export_occupancy = 0.0
+        
+    def record_poll(self, received, requested, capture_time):
+        """Record the outcome of one RX poll."""
+        self.polls += 1
+        self.packets += received
+        self.stage_time['capture'] += capture_time
+        if received == 0:
+            self.empty_polls += 1
+        elif received >= requested:
+            # A full burst means packets are waiting in the RX queue
+            self.full_polls += 1
+            
+    def record_stage(self, stage, elapsed):
+        """Record time spent in a pipeline stage."""
+        self.stage_time[stage] = self.stage_time.get(stage, 0.0) + elapsed
+        
+    def record_export_occupancy(self, occupancy):
+        """Record export queue occupancy as a fraction of its capacity."""
+        self.export_occupancy = max(self.export_occupancy, occupancy)
+        
+    def idle_backoff(self):
+        """Return how long to sleep after an empty poll.
+        
+        Backoff doubles on consecutive empty polls up to the current ceiling,
+        so a busy link is polled continuously and an idle one costs no CPU.
+        """
+        if not self.enabled:
+            return 0.001
+        if self.backoff_ceiling <= 0:
+            return 0.0
+        self.backoff = min(max(self.backoff * 2, 0.000001), self.backoff_ceiling)
+        return self.backoff
+        
+    def reset_backoff(self):
+        """Reset backoff after a poll that returned packets."""
+        self.backoff = 0.0
+        
+    def window_metrics(self, elapsed):
+        """Summarize the current window."""
+        polls = max(self.polls, 1)
+        packets = max(self.packets, 1)
+        return {
+            'empty_poll_ratio': self.empty_polls / polls,
+            'full_burst_ratio': self.full_polls / polls,
+            'packet_rate': self.packets / elapsed,
+            'capture_ns_per_packet': self.stage_time['capture'] / packets * 1e9,
+            'process_ns_per_packet': self.stage_time['process'] / packets * 1e9,
+            'export_ns_per_packet': self.stage_time['export'] / packets * 1e9,
+            'export_occupancy': self.export_occupancy
+        }
+        
+    def maybe_adjust(self):
+        """Re-evaluate the tuning decisions once per interval."""
+        now = time.perf_counter()
+        elapsed = now - self.window_start
+        if elapsed < self.interval:
+            return False
+            
+        window = self.window_metrics(elapsed)
+        self.last_window = window
+        self.reset_window()
+        self.window_start = now
+        
+        if not self.enabled:
+            return False
+            
+        burst = self.burst_size
+        ceiling = self.backoff_ceiling
+        export_batch = self.export_batch
+        
+        # Burst size: grow while the RX queue has a backlog, shrink when idle
+        if window['full_burst_ratio'] > 0.5:
+            burst = min(burst * 2, self.max_burst)
+        elif window['full_burst_ratio'] < 0.1 and window['empty_poll_ratio'] > 0.5:
+            burst = max(burst // 2, self.min_burst)
+            
+        # Poll strategy: busy-poll under load, allow sleeping when mostly idle
+        if window['empty_poll_ratio'] < 0.5 or window['full_burst_ratio'] > 0.1:
+            ceiling = 0.0
+        elif window['empty_poll_ratio'] > 0.9:
+            ceiling = self.max_backoff
+        else:
+            ceiling = self.max_backoff / 10
+            
+        # Export batch: what arrives within the latency budget, larger if the
+        # export queue backs up so per-batch costs are amortized
+        export_batch = int(window['packet_rate'] * self.export_latency)
+        if window['export_occupancy'] > 0.5:
+            export_batch = max(export_batch, self.export_batch * 2)
+        export_batch = min(max(export_batch, self.min_export_batch), self.max_export_batch)
+        
+        if (burst, ceiling, export_batch) == (self.burst_size, self.backoff_ceiling, self.export_batch):
+            return False
+            
+        self.logger.debug(
+            f"Auto-tune: burst {self.burst_size}->{burst}, "
+            f"backoff ceiling {self.backoff_ceiling * 1e6:.0f}->{ceiling * 1e6:.0f}us, "
+            f"export batch {self.export_batch}->{export_batch} "
+            f"(empty {window['empty_poll_ratio']:.2f}, full {window['full_burst_ratio']:.2f}, "
+            f"{window['packet_rate']:.0f} pps)")
+        
+        self.burst_size = burst
+        self.backoff_ceiling = ceiling
+        self.export_batch = export_batch
+        self.adjustments += 1
+        return True
+        
+    def collect(self):
+        """Current decisions and observations for the metrics exporter."""
+        metrics = {
+            'enabled': self.enabled,
+            'burst_size': self.burst_size,
+            'backoff_ceiling_us': self.backoff_ceiling * 1e6,
+            'export_batch': self.export_batch,
+            'adjustments': self.adjustments
+        }
+        metrics.update(self.last_window)
+        return metrics
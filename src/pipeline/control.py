@@ -0,0 +1,110 @@
+"""
+Local control channel over a Unix socket.
+Line-based commands to query statistics and change the runtime configuration:
+    
+    ping                        -> OK pong
+    stats                       -> JSON object of all metrics
+    config                      -> JSON object of the runtime configuration
+    set <name> <value>          -> OK version <n>
+    apply {"name": value, ...}  -> OK version <n> (all changes or none)
+    help                        -> list of commands
+"""
+
+import json
+import logging
+import os
+import socketserver
+import threading
+
+HELP_TEXT = ("commands: ping | stats | config | set <name> <value> | "
+             "apply <json object> | help; "
+             "settings: flow_timeout, sample_rate, kafka_topic, filter")
+
+class ControlServer:
+    def __init__(self, path, config_store, metrics=None, thread_init=None):
+        self.logger = logging.getLogger(__name__)
+        self.path = path
+        self.config_store = config_store
+        self.metrics = metrics
+        self.thread_init = thread_init
+        self.server = None
+        self.thread = None
+        
+    def handle_command(self, line):
+        """Execute one command line and return the response line."""
+        parts = line.strip().split(None, 1)
+        if not parts:
+            return None
+        command = parts[0].lower()
+        argument = parts[1] if len(parts) > 1 else ''
+        
+        try:
+            if command == 'ping':
+                return 'OK pong'
+            if command == 'help':
+                return f"OK {HELP_TEXT}"
+            if command == 'stats':
+                return json.dumps(self.metrics.collect() if self.metrics else {}, sort_keys=True)
+            if command == 'config':
+                return json.dumps(self.config_store.current.to_dict(), sort_keys=True)
+            if command == 'set':
+                name, _, value = argument.partition(' ')
+                if not name or not value:
+                    return 'ERR usage: set <name> <value>'
+                config = self.config_store.update({name: value})
+                return f"OK version {config.version}"
+            if command == 'apply':
+                changes = json.loads(argument)
+                if not isinstance(changes, dict) or not changes:
+                    return 'ERR usage: apply {"name": value, ...}'
+                config = self.config_store.update(changes)
+                return f"OK version {config.version}"
+            return f"ERR unknown command '{command}'"
+        except (ValueError, TypeError) as e:
+            return f"ERR {e}"
+            
+    def start(self):
+        """Create the socket and serve commands in a background thread."""
+        control = self
+        
+        class Handler(socketserver.StreamRequestHandler):
+            def handle(self):
+                for raw in self.rfile:
+                    response = control.handle_command(raw.decode('utf-8', 'replace'))
+                    if response is None:
+                        continue
+                    self.wfile.write(response.encode('utf-8') + b'\n')
+                    self.wfile.flush()
+                    
+        class Server(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+            daemon_threads = True
+            
+        try:
+            if os.path.exists(self.path):
+                os.unlink(self.path)
+            self.server = Server(self.path, Handler)
+            os.chmod(self.path, 0o600)
+            
+            def serve():
+                if self.thread_init:
+                    self.thread_init()
+                self.server.serve_forever()
+                
+            self.thread = threading.Thread(target=serve, name='control-socket', daemon=True)
+            self.thread.start()
+            self.logger.info(f"Control socket listening on {self.path}")
+            return True
+        except Exception as e:
+            self.logger.error(f"Failed to start control socket: {e}")
+            return False
+            
+    def stop(self):
+        """Stop serving and remove the socket."""
+        if self.server:
+            self.server.shutdown()
+            self.server.server_close()
+            self.server = None
+            try:
+                os.unlink(self.path)
+            except OSError:
+                pass
@@ -0,0 +1,130 @@
+"""
+Link-state monitoring and automatic recovery of the capture port.
+Link changes and driver reset requests are logged and counted; a port that
+stops receiving while its link is up, or one RX queue that stops while the
+others receive, is restarted in place with exponential backoff, so a wedged
+NIC or driver recovers without restarting the pipeline.
+"""
+
+import logging
+import time
+
+PORT = 'port'
+
+class LinkMonitor:
+    def __init__(self, capture, stall_timeout=10.0, interval=1.0, max_backoff=64, clock=time.monotonic):
+        """Watch capture's link and queues from the polling thread.
+        
+        A port or queue idle for stall_timeout seconds is restarted; each
+        restart that does not bring packets back doubles its timeout, up to
+        max_backoff times stall_timeout. stall_timeout 0 only watches the link.
+        """
+        self.logger = logging.getLogger(__name__)
+        self.capture = capture
+        self.stall_timeout = stall_timeout
+        self.interval = interval
+        self.max_timeout = stall_timeout * max_backoff
+        self.clock = clock
+        # Replaced when another component owns the capture's queues (asyncio)
+        self.restart = capture.restart
+        
+        self.last_check = 0.0
+        self.health = {}
+        self.link_up = None
+        self.timeouts = {}
+        self.restarted = {}
+        
+        self.stalls = 0
+        self.port_restarts = 0
+        self.queue_restarts = 0
+        self.restart_failures = 0
+        
+    def check(self, now=None):
+        """Check link state and receive activity, restarting what stalled; cheap between intervals."""
+        now = self.clock() if now is None else now
+        if now - self.last_check < self.interval:
+            return
+        self.last_check = now
+        
+        health = self.capture.get_health()
+        if not health:
+            return
+        self.health = health
+        self.check_link(health['link_up'])
+        
+        if health['reset_pending']:
+            self.try_restart(PORT, now, "Driver requested a port reset, restarting the port")
+            return
+        if self.stall_timeout <= 0 or health['link_up'] is not True or not health['idle']:
+            return
+            
+        idle = health['idle']
+        self.recovered(PORT, min(idle), now)
+        if min(idle) >= self.timeout(PORT):
+            if self.try_restart(PORT, now, f"No packets for {min(idle):.1f}s with the link up, restarting the port"):
+                self.stalls += 1
+            return
+            
+        # One queue stalled while the others receive
+        if len(idle) < 2 or min(idle) >= self.stall_timeout:
+            return
+        for queue, queue_idle in enumerate(idle):
+            self.recovered(queue, queue_idle, now)
+            if queue_idle >= self.timeout(queue) and self.try_restart(
+                    queue, now, f"RX queue {queue} idle for {queue_idle:.1f}s while others receive, restarting it"):
+                self.stalls += 1
+                
+    def check_link(self, link_up):
+        """Log link state changes."""
+        if link_up == self.link_up:
+            return
+        if link_up is False:
+            self.logger.warning("Capture link is down")
+        elif link_up and self.link_up is not None:
+            self.logger.info(f"Capture link is up ({self.health['link_speed']} Mbps)")
+        self.link_up = link_up
+        
+    def timeout(self, key):
+        return self.timeouts.get(key, self.stall_timeout)
+        
+    def recovered(self, key, idle, now):
+        """Reset the backoff of a port or queue that received since its last restart."""
+        restarted = self.restarted.get(key)
+        if restarted is not None and idle < now - restarted - self.interval / 2:
+            self.logger.info(f"{'Port' if key == PORT else f'RX queue {key}'} receiving again after restart")
+            del self.restarted[key]
+            self.timeouts.pop(key, None)
+            
+    def try_restart(self, key, now, reason):
+        """Restart the port or a queue unless its backoff has not expired; returns whether it tried."""
+        restarted = self.restarted.get(key)
+        if restarted is not None and now - restarted < self.timeout(key):
+            return False
+        self.logger.warning(reason)
+        ok = self.restart(None if key == PORT else key)
+        if ok:
+            if key == PORT:
+                self.port_restarts += 1
+            else:
+                self.queue_restarts += 1
+        else:
+            self.restart_failures += 1
+            self.logger.error(f"Restart of {'the port' if key == PORT else f'RX queue {key}'} failed")
+        # Until packets come back, wait twice as long before the next restart
+        self.timeouts[key] = min(self.timeout(key) * 2, self.max_timeout)
+        self.restarted[key] = now
+        return True
+        
+    def collect(self):
+        """Link state and recovery counters for the metrics exporter."""
+        link_up = self.health.get('link_up')
+        return {
+            'up': -1 if link_up is None else int(link_up),
+            'speed_mbps': self.health.get('link_speed', 0),
+            'changes': self.health.get('link_changes', 0),
+            'reset_events': self.health.get('reset_events', 0),
+            'stalls': self.stalls,
+            'port_restarts': self.port_restarts,
+            'queue_restarts': self.queue_restarts,
+            'restart_failures': self.restart_failures
+        }
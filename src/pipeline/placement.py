@@ -0,0 +1,223 @@
+"""
+CPU isolation and thread placement for pipeline threads.
+Pins every thread the library and pipeline create to configured CPUs, keeps
+them off the RX lcores and checks that the RX lcores are isolated.
+"""
+
+import ctypes
+import ctypes.util
+import glob
+import logging
+import os
+import threading
+
+# Thread roles recognized by their kernel thread name (comm)
+THREAD_NAME_ROLES = (
+    ('rdk:', 'kafka'),           # librdkafka main, broker and background threads
+    ('eal-intr', 'eal'),         # DPDK interrupt thread
+    ('rte_mp', 'eal'),           # DPDK multi-process channel
+    ('dpdk-', 'eal'),            # DPDK control threads (telemetry, ...)
+    ('telemetry', 'eal')
+)
+
+# Roles that may be configured; unconfigured roles use the housekeeping CPUs
+ROLES = ('rx', 'kafka', 'eal', 'metrics', 'control', 'writer', 'worker', 'housekeeping')
+
+def parse_cpu_list(spec):
+    """Parse a CPU list such as '0-3,8' into a set of CPU ids."""
+    cpus = set()
+    for part in spec.split(','):
+        part = part.strip()
+        if not part:
+            continue
+        if '-' in part:
+            first, last = part.split('-', 1)
+            cpus.update(range(int(first), int(last) + 1))
+        else:
+            cpus.add(int(part))
+    return cpus
+
+def format_cpu_list(cpus):
+    """Format a set of CPU ids as a compact CPU list."""
+    ranges = []
+    for cpu in sorted(cpus):
+        if ranges and cpu == ranges[-1][1] + 1:
+            ranges[-1][1] = cpu
+        else:
+            ranges.append([cpu, cpu])
+    return ','.join(str(a) if a == b else f"{a}-{b}" for a, b in ranges)
+
+def parse_placement(spec):
+    """Parse 'role=cpus;role=cpus' into a dictionary of role to CPU set."""
+    placement = {}
+    if not spec:
+        return placement
+    for entry in spec.split(';'):
+        entry = entry.strip()
+        if not entry:
+            continue
+        role, cpus = entry.split('=', 1)
+        role = role.strip()
+        if role not in ROLES:
+            raise ValueError(f"Unknown thread role '{role}' (expected one of {', '.join(ROLES)})")
+        placement[role] = parse_cpu_list(cpus)
+    return placement
+
+def cpu_numa_node(cpu):
+    """Return the NUMA node of a CPU, or -1 if unknown."""
+    nodes = glob.glob(f"/sys/devices/system/cpu/cpu{cpu}/node*")
+    if not nodes:
+        return -1
+    return int(os.path.basename(nodes[0])[4:])
+
+class ThreadPlacement:
+    def __init__(self, rx_cores="0", placement=None, housekeeping=None):
+        self.logger = logging.getLogger(__name__)
+        self.rx_cpus = parse_cpu_list(rx_cores)
+        self.placement = dict(placement or {})
+        self.housekeeping = set(housekeeping) if housekeeping else None
+        self.numa_node = -1
+        self.placed = {}
+        self.lock = threading.Lock()
+        
+    def snapshot(self):
+        """Record the CPUs available to the process.
+        
+        Must run before DPDK initialization, which pins the calling thread
+        to the main lcore; threads created later inherit that affinity.
+        """
+        if self.housekeeping is None:
+            allowed = os.sched_getaffinity(0)
+            self.housekeeping = (allowed - self.rx_cpus) or allowed
+            
+        self.placement.setdefault('rx', self.rx_cpus)
+        for role in ROLES:
+            self.placement.setdefault(role, self.housekeeping)
+            
+    def cpus_for(self, role):
+        """Get the CPU set configured for a role."""
+        return self.placement.get(role) or self.housekeeping or os.sched_getaffinity(0)
+        
+    def pin_thread(self, tid, role):
+        """Pin a thread (0 for the calling thread) to the CPUs of a role."""
+        cpus = self.cpus_for(role)
+        try:
+            os.sched_setaffinity(tid, cpus)
+            with self.lock:
+                self.placed[tid or threading.get_native_id()] = role
+            return True
+        except OSError as e:
+            self.logger.warning(f"Cannot pin thread {tid} ({role}) to CPUs {format_cpu_list(cpus)}: {e}")
+            return False
+            
+    def register_current_thread(self, role):
+        """Record the calling thread's role without changing its affinity."""
+        with self.lock:
+            self.placed[threading.get_native_id()] = role
+            
+    def pin_current_thread(self, role):
+        """Pin the calling thread; call at the start of every pipeline thread."""
+        return self.pin_thread(0, role)
+        
+    def apply(self):
+        """Pin threads created by libraries, recognized by their kernel name.
+        
+        Called after initialization and periodically, since librdkafka starts
+        broker threads lazily.
+        """
+        pinned = 0
+        for task in glob.glob('/proc/self/task/*'):
+            tid = int(os.path.basename(task))
+            with self.lock:
+                if tid in self.placed:
+                    continue
+            try:
+                with open(os.path.join(task, 'comm')) as f:
+                    name = f.read().strip()
+            except OSError:
+                continue
+                
+            for prefix, role in THREAD_NAME_ROLES:
+                if name.startswith(prefix):
+                    if self.pin_thread(tid, role):
+                        self.logger.debug(f"Pinned thread {name} ({tid}) to {role} CPUs "
+                                          f"{format_cpu_list(self.cpus_for(role))}")
+                        pinned += 1
+                    break
+        return pinned
+        
+    def set_numa_node(self, node):
+        """Prefer memory from the NUMA node of the capture port."""
+        self.numa_node = node
+        if node < 0:
+            return False
+            
+        lib_path = ctypes.util.find_library('numa')
+        if not lib_path:
+            self.logger.warning("libnuma not found, memory is not bound to the port's NUMA node")
+            return False
+            
+        try:
+            libnuma = ctypes.CDLL(lib_path)
+            if libnuma.numa_available() < 0:
+                return False
+            libnuma.numa_set_preferred(node)
+            self.logger.info(f"Preferring memory from NUMA node {node}")
+            return True
+        except (OSError, AttributeError) as e:
+            self.logger.warning(f"Cannot set preferred NUMA node: {e}")
+            return False
+            
+    def check(self):
+        """Warn about configurations that let other work disturb the RX lcores."""
+        warnings = []
+        
+        isolated = set()
+        try:
+            with open('/sys/devices/system/cpu/isolated') as f:
+                isolated = parse_cpu_list(f.read().strip())
+        except OSError:
+            pass
+            
+        nohz_full = set()
+        try:
+            with open('/sys/devices/system/cpu/nohz_full') as f:
+                spec = f.read().strip()
+                if spec and spec != '(null)':
+                    nohz_full = parse_cpu_list(spec)
+        except OSError:
+            pass
+            
+        not_isolated = self.rx_cpus - isolated
+        if not_isolated:
+            warnings.append(f"RX cores {format_cpu_list(not_isolated)} are not isolated "
+                            f"(add isolcpus={format_cpu_list(self.rx_cpus)} to the kernel command line)")
+        not_nohz = self.rx_cpus - nohz_full
+        if isolated and not_nohz:
+            warnings.append(f"RX cores {format_cpu_list(not_nohz)} are not in nohz_full")
+            
+        sharing = [role for role in ROLES if role != 'rx' and self.cpus_for(role) & self.rx_cpus]
+        if sharing:
+            warnings.append(f"{', '.join(sharing)} threads may run on RX cores "
+                            f"{format_cpu_list(self.rx_cpus)} (set --housekeeping-cores or --placement)")
+            
+        if self.numa_node >= 0:
+            for role in ROLES:
+                remote = {cpu for cpu in self.cpus_for(role)
+                          if cpu_numa_node(cpu) not in (-1, self.numa_node)}
+                if remote:
+                    warnings.append(f"{role} CPUs {format_cpu_list(remote)} are not on "
+                                    f"the port's NUMA node {self.numa_node}")
+                    
+        for warning in warnings:
+            self.logger.warning(warning)
+        return warnings
+        
+    def collect(self):
+        """Placement state for the metrics exporter."""
+        with self.lock:
+            roles = list(self.placed.values())
+        metrics = {'numa_node': self.numa_node, 'pinned_threads': len(roles)}
+        for role in ROLES:
+            metrics[f"{role}_threads"] = roles.count(role)
+        return metrics
@@ -0,0 +1,186 @@
+"""
+Token-bucket rate limiting of exported flow records.
+Records are cumulative snapshots of their flow, so a record over a flow's,
+its tenant's or the global rate is held back instead of dropped: a newer
+record of the same flow replaces it, and the latest one is exported once
+tokens are available again. Suppressed updates are thereby folded into the
+next record exported for the flow and no counts are lost. Final records of
+flows always pass.
+"""
+
+import time
+from collections import OrderedDict
+
+from src.features.flow_key import record_hash
+
+# Seconds between releases of held records while no new records arrive
+RELEASE_INTERVAL = 0.1
+
+# Seconds between sweeps of per-flow buckets that refilled completely
+SWEEP_INTERVAL = 1.0
+
+class TokenBucket:
+    __slots__ = ('rate', 'burst', 'tokens', 'updated')
+    
+    def __init__(self, rate, burst, now):
+        self.rate = rate
+        self.burst = burst
+        self.tokens = burst
+        self.updated = now
+        
+    def refill(self, now):
+        self.tokens = min(self.burst, self.tokens + (now - self.updated) * self.rate)
+        self.updated = now
+        return self.tokens
+
+class RecordLimiter:
+    def __init__(self, flow_rate=0.0, flow_burst=None, rate=0.0, burst=None, tenants=None, clock=time.monotonic):
+        """Limit exported records to flow_rate per second per flow and rate per second overall.
+        
+        Bursts default to one second of records, at least one. tenants lists
+        the Tenant of each tenant index; one with an export_rate gets a
+        bucket of its own besides the global one. A rate of 0 is unlimited.
+        """
+        self.clock = clock
+        now = clock()
+        self.flow_rate = flow_rate
+        self.flow_burst = flow_burst or max(flow_rate, 1.0)
+        self.bucket = TokenBucket(rate, burst or max(rate, 1.0), now) if rate else None
+        self.tenants = tenants or []
+        self.tenant_buckets = [TokenBucket(t.export_rate, max(t.export_rate, 1.0), now) if t.export_rate else None
+                               for t in self.tenants]
+        self.enabled = bool(flow_rate or rate or any(self.tenant_buckets))
+        
+        self.flows = {}  # (flow hash, tenant) -> TokenBucket of the flow, while not full
+        self.held = OrderedDict()  # (flow hash, tenant) -> latest held record, oldest first
+        self.last_release = now
+        self.last_sweep = now
+        
+        self.passed = 0
+        self.suppressed = 0
+        self.aggregated = 0
+        self.released = 0
+        self.tenant_suppressed = [0] * len(self.tenants)
+        
+    def limit(self, records):
+        """Records to export now out of records; the others are held. Also releases held records that are due."""
+        if not self.enabled:
+            return records
+        now = self.clock()
+        exported = [features for features in records if self.admit(features, now)]
+        exported.extend(self.release(now))
+        return exported
+        
+    def admit(self, features, now):
+        """Take tokens for a record, or hold it in place of the flow's previously held record."""
+        tenant = features.get('tenant', 0)
+        key = (record_hash(features), tenant)
+        if features.get('end_reason'):
+            # The final record of a flow supersedes its held one and always
+            # passes, running the shared buckets into debt if need be
+            if self.held.pop(key, None) is not None:
+                self.aggregated += 1
+            self.flows.pop(key, None)
+            self.take_shared(tenant, now, force=True)
+            self.passed += 1
+            return True
+            
+        flow = self.flow_bucket(key, now)
+        if (flow is None or flow.tokens >= 1) and self.take_shared(tenant, now):
+            if flow is not None:
+                flow.tokens -= 1
+            if self.held.pop(key, None) is not None:
+                self.aggregated += 1
+            self.passed += 1
+            return True
+            
+        if key in self.held:
+            self.aggregated += 1
+        self.held[key] = features
+        self.suppressed += 1
+        if tenant < len(self.tenant_suppressed):
+            self.tenant_suppressed[tenant] += 1
+        return False
+        
+    def flow_bucket(self, key, now):
+        """Refilled bucket of a flow; None without a per-flow limit."""
+        if not self.flow_rate:
+            return None
+        flow = self.flows.get(key)
+        if flow is None:
+            flow = self.flows[key] = TokenBucket(self.flow_rate, self.flow_burst, now)
+        else:
+            flow.refill(now)
+        return flow
+        
+    def take_shared(self, tenant, now, force=False):
+        """Take a token from the global bucket and the tenant's, if both have one or force is set."""
+        bucket = self.bucket
+        tenant_bucket = self.tenant_buckets[tenant] if tenant < len(self.tenant_buckets) else None
+        if not force and ((bucket is not None and bucket.refill(now) < 1) or
+                          (tenant_bucket is not None and tenant_bucket.refill(now) < 1)):
+            return False
+        if bucket is not None:
+            bucket.tokens -= 1
+        if tenant_bucket is not None:
+            tenant_bucket.tokens -= 1
+        return True
+        
+    def release(self, now=None):
+        """Held records whose flows have tokens again, oldest first; checked every RELEASE_INTERVAL."""
+        if not self.enabled:
+            return []
+        now = self.clock() if now is None else now
+        if now - self.last_release < RELEASE_INTERVAL:
+            return []
+        self.last_release = now
+        released = []
+        for key in list(self.held):
+            if self.bucket is not None and self.bucket.refill(now) < 1:
+                break
+            flow = self.flow_bucket(key, now)
+            if flow is not None and flow.tokens < 1:
+                continue
+            if not self.take_shared(key[1], now):
+                continue
+            if flow is not None:
+                flow.tokens -= 1
+            released.append(self.held.pop(key))
+        self.released += len(released)
+        
+        if now - self.last_sweep >= SWEEP_INTERVAL:
+            self.sweep(now)
+        return released
+        
+    def sweep(self, now):
+        """Forget flows whose buckets refilled completely; they start full again when seen."""
+        self.last_sweep = now
+        held = self.held
+        self.flows = {key: flow for key, flow in self.flows.items()
+                      if key in held or flow.refill(now) < flow.burst}
+        
+    def flush(self):
+        """All held records, regardless of tokens, at shutdown."""
+        released = list(self.held.values())
+        self.held.clear()
+        self.flows.clear()
+        self.released += len(released)
+        return released
+        
+    def memory_usage(self):
+        """Approximate bytes held by flow buckets and held records."""
+        return len(self.flows) * 200 + len(self.held) * 1000
+        
+    def collect(self):
+        """Rate limiting counters for the metrics exporter."""
+        metrics = {
+            'records': self.passed,
+            'suppressed': self.suppressed,
+            'aggregated': self.aggregated,
+            'released': self.released,
+            'held': len(self.held),
+            'flows': len(self.flows)
+        }
+        for tenant, suppressed in zip(self.tenants, self.tenant_suppressed):
+            metrics[f"{tenant.name}_suppressed"] = suppressed
+        return metrics
@@ -0,0 +1,205 @@
+"""
+Runtime configuration that can be changed without restarting.
+Configurations are immutable; updates build a new object and swap a single
+reference, so the data path reads a consistent snapshot once per burst
+without taking a lock.
+"""
+
+import ipaddress
+import logging
+import threading
+from dataclasses import dataclass, field, replace
+
+import numpy as np
+
+from src.features.flow_key import flow_hashes, flow_keys, record_hash
+from src.features.records import FlowRecords
+
+PROTOCOL_NAMES = {'icmp': 1, 'tcp': 6, 'udp': 17}
+
+class FlowFilter:
+    """Filter on flow records: 'proto=tcp,udp port=80,443 net=10.0.0.0/8'.
+    
+    All terms must match; a term matches if any of its values does, on
+    either the source or the destination side.
+    """
+    
+    def __init__(self, spec=''):
+        self.spec = (spec or '').strip()
+        self.protocols = None
+        self.ports = None
+        self.networks = None
+        
+        if self.spec in ('', 'none'):
+            self.spec = ''
+            return
+            
+        for term in self.spec.split():
+            if '=' not in term:
+                raise ValueError(f"Invalid filter term '{term}' (expected name=value[,value])")
+            name, values = term.split('=', 1)
+            values = [v for v in values.split(',') if v]
+            if name == 'proto':
+                self.protocols = {PROTOCOL_NAMES.get(v.lower()) or int(v) for v in values}
+            elif name == 'port':
+                self.ports = {int(v) for v in values}
+            elif name == 'net':
+                self.networks = [ipaddress.ip_network(v, strict=False) for v in values]
+            else:
+                raise ValueError(f"Unknown filter term '{name}' (expected proto, port or net)")
+                
+    def matches(self, features):
+        """Check whether a flow record passes the filter."""
+        if self.protocols is not None and features.get('protocol') not in self.protocols:
+            return False
+        if self.ports is not None and not ({features.get('src_port'), features.get('dst_port')} & self.ports):
+            return False
+        if self.networks is not None:
+            addresses = []
+            for key in ('src_ip', 'dst_ip'):
+                try:
+                    addresses.append(ipaddress.ip_address(features.get(key)))
+                except ValueError:
+                    pass
+            if not any(address in network for address in addresses for network in self.networks):
+                return False
+        return True
+        
+    def mask(self, records):
+        """matches() for each record of a FlowRecords batch."""
+        columns = records.columns
+        passed = np.ones(len(records), dtype=bool)
+        if self.protocols is not None:
+            passed &= np.isin(columns['protocol'], list(self.protocols))
+        if self.ports is not None:
+            ports = list(self.ports)
+            passed &= np.isin(columns['src_port'], ports) | np.isin(columns['dst_port'], ports)
+        if self.networks is not None:
+            inside = np.zeros(len(records), dtype=bool)
+            for network in self.networks:
+                if network.version != 4:
+                    continue
+                netmask = int(network.netmask)
+                address = int(network.network_address)
+                inside |= ((columns['src_ip'] & netmask) == address) | ((columns['dst_ip'] & netmask) == address)
+            passed &= inside
+        return passed
+        
+    def __bool__(self):
+        return bool(self.spec)
+        
+    def __str__(self):
+        return self.spec or 'none'
+
+def flow_sampled(features, sample_rate):
+    """Keep or drop all records of a flow, independent of direction."""
+    if sample_rate <= 1:
+        return True
+    # Same rule as the native engine, so both keep the same flows
+    return record_hash(features) % sample_rate == 0
+
+def select_features(records, config, sample_rate):
+    """Drop empty records and those rejected by the filter or flow sampling.
+    
+    sample_rate is one rate, or a list of rates indexed by the records' tenant.
+    """
+    if isinstance(records, FlowRecords):
+        return select_batch(records, config, sample_rate)
+    tenant_rates = sample_rate if isinstance(sample_rate, list) else None
+    selected = []
+    for features in records:
+        if not features:
+            continue
+        if config.filter and not config.filter.matches(features):
+            continue
+        if tenant_rates:
+            sample_rate = tenant_rates[features['tenant']]
+        if not flow_sampled(features, sample_rate):
+            continue
+        selected.append(features)
+    return selected
+
+def select_batch(records, config, sample_rate):
+    """select_features() of a FlowRecords batch, over whole columns."""
+    selected = config.filter.mask(records) if config.filter else np.ones(len(records), dtype=bool)
+    rates = np.asarray(sample_rate, dtype=np.uint64)
+    if rates.ndim:
+        rates = rates[records.columns['tenant']]
+    elif sample_rate <= 1:
+        rates = None
+    if rates is not None:
+        selected &= flow_hashes(*flow_keys(records.columns)) % np.maximum(rates, 1) == 0
+    return records if selected.all() else records.select(selected)
+
+@dataclass(frozen=True)
+class RuntimeConfig:
+    flow_timeout: float = 600.0
+    sample_rate: int = 1
+    kafka_topic: str = 'network-flows'
+    filter: FlowFilter = field(default_factory=FlowFilter)
+    version: int = 0
+    
+    def to_dict(self):
+        """Describe the configuration for the control channel."""
+        return {
+            'flow_timeout': self.flow_timeout,
+            'sample_rate': self.sample_rate,
+            'kafka_topic': self.kafka_topic,
+            'filter': str(self.filter),
+            'version': self.version
+        }
+
+def parse_value(name, value):
+    """Convert a textual value from the control channel to the field type."""
+    if name == 'flow_timeout':
+        value = float(value)
+        if value <= 0:
+            raise ValueError("flow_timeout must be positive")
+    elif name == 'sample_rate':
+        value = int(value)
+        if value < 1:
+            raise ValueError("sample_rate must be at least 1")
+    elif name == 'kafka_topic':
+        value = str(value).strip()
+        if not value:
+            raise ValueError("kafka_topic must not be empty")
+    elif name == 'filter':
+        value = value if isinstance(value, FlowFilter) else FlowFilter(str(value))
+    else:
+        raise ValueError(f"Unknown setting '{name}'")
+    return value
+
+class ConfigStore:
+    def __init__(self, initial=None):
+        self.logger = logging.getLogger(__name__)
+        self.current = initial or RuntimeConfig()
+        self.lock = threading.Lock()
+        self.listeners = []
+        
+    def add_listener(self, listener):
+        """Call listener(config) after each change, from the updating thread.
+        
+        Listeners are called in version order, one change at a time, and
+        must not update the store themselves.
+        """
+        self.listeners.append(listener)
+        
+    def update(self, changes):
+        """Validate and apply a set of changes atomically; returns the new config."""
+        values = {name: parse_value(name, value) for name, value in changes.items()}
+        
+        # Writers are serialized, listeners included, so that concurrent
+        # updates reach them in version order; readers never take the lock
+        with self.lock:
+            config = replace(self.current, version=self.current.version + 1, **values)
+            self.current = config
+            
+            for listener in self.listeners:
+                try:
+                    listener(config)
+                except Exception as e:
+                    self.logger.error(f"Error applying configuration: {e}")
+                    
+        self.logger.info(f"Configuration version {config.version} applied: "
+                         + ', '.join(f"{name}={values[name]}" for name in values))
+        return config
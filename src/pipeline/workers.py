@@ -0,0 +1,407 @@
+"""
+Multi-process worker pool for Python-side packet processing.
+Each RX queue feeds a dedicated worker process through a shared-memory ring.
+RSS keeps every flow on one queue, so each worker owns complete flows and
+Python processing scales with cores instead of the GIL. Results return over
+a second ring per worker and are merged into the exporter by the RX process.
+"""
+
+import logging
+import multiprocessing
+import os
+import pickle
+import queue
+import signal
+import struct
+import time
+from multiprocessing import shared_memory
+
+from src.dpdk.burst import PacketBurst
+from src.features.records import concat_records
+from src.features.tenants import TenantExtractor, TenantMap
+from src.pipeline.runtime_config import select_features
+
+# Ring layout: producer and consumer counters on separate cache lines
+HEAD_OFFSET = 0
+TAIL_OFFSET = 64
+DROPPED_OFFSET = 128
+SIZE_OFFSET = 136
+RING_HEADER_SIZE = 192
+COUNTER = struct.Struct('Q')
+RECORD_HEADER = struct.Struct('I')
+WRAP_MARKER = 0xffffffff
+
+# Per-worker counters shared with the RX process
+WORKER_COUNTERS = ('bursts', 'packets', 'records', 'flows', 'flow_bytes', 'busy_ns', 'parse_failed',
+                   'flow_table_full')
+
+DEFAULT_RING_SIZE = 8 * 1024 * 1024
+
+# Bursts between checks for configuration changes while busy
+CONTROL_INTERVAL = 64
+
+# Final records per ring message when flushing flows at shutdown
+FLUSH_BATCH = 1024
+
+class ShmRing:
+    """Single-producer single-consumer ring of variable-size messages in shared memory.
+    
+    Messages are written before the head counter is published, so on
+    x86-64 (TSO) the consumer never sees a partial message. Aligned 8-byte
+    counter stores are atomic.
+    """
+    
+    def __init__(self, size=DEFAULT_RING_SIZE, name=None):
+        if name is None:
+            self.size = size & ~7
+            self.shm = shared_memory.SharedMemory(create=True, size=RING_HEADER_SIZE + self.size)
+            self.shm.buf[:RING_HEADER_SIZE] = bytes(RING_HEADER_SIZE)
+            COUNTER.pack_into(self.shm.buf, SIZE_OFFSET, self.size)
+            self.owner = True
+        else:
+            self.shm = shared_memory.SharedMemory(name=name)
+            self.size = COUNTER.unpack_from(self.shm.buf, SIZE_OFFSET)[0]
+            self.owner = False
+        self.name = self.shm.name
+        self.buf = self.shm.buf
+        
+    def _load(self, offset):
+        return COUNTER.unpack_from(self.buf, offset)[0]
+        
+    def _store(self, offset, value):
+        COUNTER.pack_into(self.buf, offset, value)
+        
+    def put(self, payload):
+        """Append a message; returns False, counting a drop, if the ring is full."""
+        need = (RECORD_HEADER.size + len(payload) + 7) & ~7
+        head = self._load(HEAD_OFFSET)
+        tail = self._load(TAIL_OFFSET)
+        pos = head % self.size
+        
+        # Messages are contiguous; skip the end of the buffer if it is too short
+        pad = self.size - pos if pos + need > self.size else 0
+        if need > self.size or head + pad + need - tail > self.size:
+            self._store(DROPPED_OFFSET, self._load(DROPPED_OFFSET) + 1)
+            return False
+            
+        if pad:
+            RECORD_HEADER.pack_into(self.buf, RING_HEADER_SIZE + pos, WRAP_MARKER)
+            head += pad
+            pos = 0
+            
+        start = RING_HEADER_SIZE + pos
+        RECORD_HEADER.pack_into(self.buf, start, len(payload))
+        self.buf[start + RECORD_HEADER.size:start + RECORD_HEADER.size + len(payload)] = payload
+        self._store(HEAD_OFFSET, head + need)
+        return True
+        
+    def get(self):
+        """Remove and return the oldest message, or None if the ring is empty."""
+        tail = self._load(TAIL_OFFSET)
+        while tail < self._load(HEAD_OFFSET):
+            pos = tail % self.size
+            start = RING_HEADER_SIZE + pos
+            length = RECORD_HEADER.unpack_from(self.buf, start)[0]
+            if length == WRAP_MARKER:
+                tail += self.size - pos
+                continue
+                
+            payload = bytes(self.buf[start + RECORD_HEADER.size:start + RECORD_HEADER.size + length])
+            self._store(TAIL_OFFSET, tail + ((RECORD_HEADER.size + length + 7) & ~7))
+            return payload
+        return None
+        
+    def used(self):
+        """Bytes currently queued."""
+        return self._load(HEAD_OFFSET) - self._load(TAIL_OFFSET)
+        
+    def dropped(self):
+        """Messages rejected because the ring was full."""
+        return self._load(DROPPED_OFFSET)
+        
+    def memory_usage(self):
+        """Bytes of shared memory held by the ring."""
+        return RING_HEADER_SIZE + self.size
+        
+    def close(self):
+        """Detach from the ring; the creator also removes it."""
+        self.buf = None
+        self.shm.close()
+        if self.owner:
+            try:
+                self.shm.unlink()
+            except FileNotFoundError:
+                pass
+
+def put_features(out_ring, features):
+    """Return records to the RX process."""
+    while features and not out_ring.put(pickle.dumps(features, protocol=pickle.HIGHEST_PROTOCOL)):
+        # The RX process is behind on merging; wait rather than lose records
+        time.sleep(0.0005)
+
+def create_extractor(engine, flow_timeout, encode_json=False, tenants=None, max_flows=0, tenant=0):
+    """Feature extractor of an engine, isolating tenants if given; native ones need initialize().
+    
+    The native engine classifies tenants itself; the others get an extractor per tenant.
+    """
+    if engine == 'native':
+        from src.features.native import NativeFeatureExtractor
+        return NativeFeatureExtractor(max_flows=max_flows, flow_timeout=flow_timeout, encode_json=encode_json,
+                                      tenant_map=TenantMap(tenants) if tenants else None)
+    if tenants:
+        return TenantExtractor(TenantMap(tenants), lambda spec, index: create_extractor(
+            engine, spec.flow_timeout or flow_timeout, encode_json, max_flows=spec.max_flows, tenant=index))
+    if engine == 'numpy':
+        from src.features.vectorized import VectorFeatureExtractor
+        extractor = VectorFeatureExtractor()
+    else:
+        from src.features.extractor import FeatureExtractor
+        extractor = FeatureExtractor()
+    extractor.max_flows = max_flows
+    extractor.flow_timeout = flow_timeout
+    extractor.tenant = tenant
+    return extractor
+
+def export_sample_rate(engine, extractor, config):
+    """Flow sampling rate for select_features, per tenant when the extractor has tenants."""
+    if engine == 'native':
+        # The native engines sample flows themselves
+        return 1
+    if isinstance(extractor, TenantExtractor):
+        return extractor.sample_rates(config.sample_rate)
+    return config.sample_rate
+
+def worker_main(index, in_name, out_name, control, counters, cpus, engine, encode_json, config, tenants,
+                log_level):
+    """Entry point of a worker process: extract, filter and sample one queue's packets."""
+    logging.basicConfig(level=log_level, format=f'%(asctime)s - worker{index} - %(levelname)s - %(message)s')
+    logger = logging.getLogger(__name__)
+    
+    # Ctrl-C reaches the whole process group; the RX process decides when to stop
+    signal.signal(signal.SIGINT, signal.SIG_IGN)
+    
+    if cpus:
+        try:
+            os.sched_setaffinity(0, cpus)
+        except OSError as e:
+            logger.warning(f"Cannot pin worker to CPUs {sorted(cpus)}: {e}")
+            
+    extractor = create_extractor(engine, config.flow_timeout, encode_json, tenants)
+    if engine == 'native':
+        if not extractor.initialize():
+            logger.error("Failed to initialize native flow engine")
+            return
+        extractor.set_config(config.flow_timeout, config.sample_rate)
+        
+    in_ring = ShmRing(name=in_name)
+    out_ring = ShmRing(name=out_name)
+    base = index * len(WORKER_COUNTERS)
+    idle = 0
+    stopping = False
+    
+    try:
+        while True:
+            payload = in_ring.get()
+            if payload is None and stopping:
+                # Export the flows still active as final records
+                features = select_features(extractor.flush_flows(), config,
+                                           export_sample_rate(engine, extractor, config))
+                for offset in range(0, len(features), FLUSH_BATCH):
+                    put_features(out_ring, features[offset:offset + FLUSH_BATCH])
+                counters[base + 2] += len(features)
+                counters[base + 3] = 0
+                break
+                
+            # Configuration changes and shutdown arrive between bursts
+            if payload is None or counters[base] % CONTROL_INTERVAL == 0:
+                try:
+                    if payload is None:
+                        message = control.get(timeout=min(0.0001 * (1 << idle), 0.01))
+                    else:
+                        message = control.get_nowait()
+                except queue.Empty:
+                    message = False
+                    idle = min(idle + 1, 7)
+                if message is None:
+                    # Finish the bursts already queued before exiting
+                    stopping = True
+                elif message:
+                    config = message
+                    extractor.flow_timeout = config.flow_timeout
+                    if engine == 'native':
+                        extractor.set_config(config.flow_timeout, config.sample_rate)
+                if payload is None:
+                    continue
+                    
+            idle = 0
+            start = time.perf_counter_ns()
+            burst = PacketBurst.decode(payload)
+            features = extractor.extract_burst(burst)
+            if engine != 'python' or tenants:
+                # None also stands for flows sampled out or tables full; take drops from the counters
+                drops = extractor.drop_stats()
+                counters[base + 6] = drops.get('parse_failed', 0)
+                counters[base + 7] = drops.get('flow_table_full', 0)
+            else:
+                counters[base + 6] += features.count(None)
+            features = select_features(features, config, export_sample_rate(engine, extractor, config))
+            put_features(out_ring, features)
+            
+            counters[base] += 1
+            counters[base + 1] += len(burst)
+            counters[base + 2] += len(features)
+            counters[base + 3] = extractor.flow_count()
+            counters[base + 5] += time.perf_counter_ns() - start
+            if counters[base] % 1024 == 1:
+                counters[base + 4] = extractor.memory_usage()
+                
+    finally:
+        if engine == 'native':
+            extractor.cleanup()
+        in_ring.close()
+        out_ring.close()
+
+class WorkerPool:
+    def __init__(self, workers, ring_size=DEFAULT_RING_SIZE, engine='python', cpus=None, encode_json=False,
+                 tenants=None):
+        self.logger = logging.getLogger(__name__)
+        self.workers = workers
+        self.ring_size = ring_size
+        self.engine = engine
+        self.encode_json = encode_json
+        self.tenants = tenants or []
+        self.cpus = cpus
+        self.context = multiprocessing.get_context('spawn')
+        self.in_rings = []
+        self.out_rings = []
+        self.controls = []
+        self.processes = []
+        self.counters = None
+        self.submitted = [0] * workers
+        self.merged = 0
+        
+    def start(self, config):
+        """Create the rings and start one worker per queue."""
+        try:
+            self.counters = self.context.Array('Q', self.workers * len(WORKER_COUNTERS), lock=False)
+            log_level = logging.getLogger().getEffectiveLevel()
+            for index in range(self.workers):
+                in_ring = ShmRing(self.ring_size)
+                out_ring = ShmRing(self.ring_size)
+                control = self.context.Queue()
+                process = self.context.Process(
+                    target=worker_main, name=f"worker{index}", daemon=True,
+                    args=(index, in_ring.name, out_ring.name, control, self.counters,
+                          self.cpus, self.engine, self.encode_json, config, self.tenants, log_level))
+                process.start()
+                self.in_rings.append(in_ring)
+                self.out_rings.append(out_ring)
+                self.controls.append(control)
+                self.processes.append(process)
+                
+            self.logger.info(f"Started {self.workers} worker processes ({self.engine} engine)")
+            return True
+            
+        except Exception as e:
+            self.logger.error(f"Failed to start worker pool: {e}")
+            self.stop()
+            return False
+            
+    def submit(self, index, burst):
+        """Hand a PacketBurst from queue index to its worker; returns False if the ring is full."""
+        if not burst:
+            return True
+        if self.in_rings[index].put(burst.encode()):
+            self.submitted[index] += len(burst)
+            return True
+        return False
+        
+    def collect(self, limit=64):
+        """Merge results from all workers, at most limit messages per worker."""
+        batches = []
+        for ring in self.out_rings:
+            for _ in range(limit):
+                payload = ring.get()
+                if payload is None:
+                    break
+                batches.append(pickle.loads(payload))
+        features = concat_records(batches)
+        self.merged += len(features)
+        return features
+        
+    def update_config(self, config):
+        """Send a new runtime configuration to every worker."""
+        for control in self.controls:
+            control.put(config)
+            
+    def alive(self):
+        """Check that all workers are running."""
+        return all(process.is_alive() for process in self.processes)
+        
+    def flow_count(self):
+        """Active flows over all workers."""
+        return self.total('flows')
+        
+    def flow_bytes(self):
+        """Flow table memory over all workers, as last reported."""
+        return self.total('flow_bytes')
+        
+    def total(self, counter):
+        """Sum one worker counter over all workers."""
+        if self.counters is None:
+            return 0
+        offset = WORKER_COUNTERS.index(counter)
+        return sum(self.counters[i * len(WORKER_COUNTERS) + offset] for i in range(self.workers))
+        
+    def memory_usage(self):
+        """Shared memory held by all rings."""
+        return sum(ring.memory_usage() for ring in self.in_rings + self.out_rings)
+        
+    def collect_metrics(self):
+        """Pool counters for the metrics exporter."""
+        metrics = {'workers': self.workers, 'alive': sum(p.is_alive() for p in self.processes),
+                   'merged_records': self.merged}
+        for index in range(len(self.in_rings)):
+            metrics[f"{index}_submitted_packets"] = self.submitted[index]
+            metrics[f"{index}_ring_dropped"] = self.in_rings[index].dropped()
+            metrics[f"{index}_ring_used_bytes"] = self.in_rings[index].used()
+            for offset, name in enumerate(WORKER_COUNTERS):
+                metrics[f"{index}_{name}"] = self.counters[index * len(WORKER_COUNTERS) + offset]
+        return metrics
+        
+    def drop_stats(self):
+        """Packets the workers could not add to a flow, by drop reason."""
+        if self.counters is None:
+            return {}
+        return {'parse_failed': self.total('parse_failed'), 'flow_table_full': self.total('flow_table_full')}
+        
+    def stop(self, timeout=5.0):
+        """Let workers finish queued bursts and flush their flows, then stop them and remove the rings.
+        
+        Returns the results merged while the workers drained, final records of
+        all active flows included. Workers still running after timeout seconds
+        are terminated and their flows lost.
+        """
+        batches = []
+        deadline = time.time() + timeout
+        for control in self.controls:
+            control.put(None)
+        while any(p.is_alive() for p in self.processes) and time.time() < deadline:
+            batches.append(self.collect())
+            time.sleep(0.001)
+        batches.append(self.collect(limit=1 << 30))
+        features = concat_records(batches)
+        
+        for process in self.processes:
+            if process.is_alive():
+                self.logger.warning(f"Worker {process.name} did not stop, terminating")
+                process.terminate()
+            process.join(1.0)
+            
+        for ring in self.in_rings + self.out_rings:
+            ring.close()
+        self.in_rings = []
+        self.out_rings = []
+        self.controls = []
+        self.processes = []
+        return features
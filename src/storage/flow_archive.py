@@ -0,0 +1,500 @@
+"""
+Columnar flow archive.
+Exported flow records are kept locally in hourly files of compressed column
+blocks. Each column is encoded for its data (delta for timestamps, frame of
+reference for counters and addresses, dictionaries for ports and labels,
+byte shuffling for floats) and then compressed. A per-file index holds each
+block's time range, a Bloom filter of its addresses and per-column min/max,
+so a query only decodes the blocks, and the columns, that it needs.
+"""
+
+import glob
+import json
+import logging
+import os
+import queue
+import socket
+import struct
+import threading
+import time
+import zlib
+from collections import namedtuple
+
+import numpy as np
+
+from src.features.plugins import FLOW_RECORD_FIELDS
+
+FILE_PREFIX = 'flows-'
+DEFAULT_BLOCK_RECORDS = 65536
+DEFAULT_BLOCK_SECONDS = 60.0
+DEFAULT_RETENTION_DAYS = 7
+DEFAULT_QUEUE_BATCHES = 1024
+COMPRESSION_LEVEL = 3
+
+FILE_MAGIC = b'FLCA'
+INDEX_MAGIC = b'FLCX'
+ARCHIVE_VERSION = 1
+FILE_HEADER = struct.Struct('<4sI')
+# offset, length, records, first and last timestamp (us), metadata and Bloom filter lengths
+INDEX_ENTRY = struct.Struct('<QIIqqII')
+
+# Bloom filter over the addresses of a block
+BLOOM_BITS_PER_ADDRESS = 10
+BLOOM_HASHES = 7
+BLOOM_MIN_BITS = 512
+BLOOM_MULTIPLIERS = (np.uint64(0x9E3779B97F4A7C15), np.uint64(0xC2B2AE3D27D4EB4F))
+
+ADDRESS_COLUMNS = ('src_ip', 'dst_ip')
+DICTIONARY_COLUMNS = ('src_port', 'dst_port', 'protocol', 'label')
+DELTA_COLUMNS = ('timestamp',)
+
+BlockIndex = namedtuple('BlockIndex', 'offset length records first_us last_us bloom meta')
+
+def column_encoding(name, dtype):
+    """Encoding used for a record column."""
+    if name in DELTA_COLUMNS:
+        return 'delta'
+    if name in DICTIONARY_COLUMNS:
+        return 'dict'
+    if dtype.startswith('f'):
+        return 'shuffle'
+    return 'for'
+
+# Archived columns: (name, dtype, encoding); addresses are stored as integers
+ARCHIVE_COLUMNS = [(name, 'u4' if name in ADDRESS_COLUMNS else dtype, column_encoding(name, dtype))
+                   for name, dtype in FLOW_RECORD_FIELDS]
+COLUMN_DTYPES = {name: dtype for name, dtype, _ in ARCHIVE_COLUMNS}
+
+def smallest_unsigned(maximum):
+    """Narrowest unsigned dtype holding values up to maximum."""
+    for dtype in ('u1', 'u2', 'u4'):
+        if maximum <= np.iinfo(dtype).max:
+            return dtype
+    return 'u8'
+
+def encode_for(values):
+    """Frame of reference: offsets from the minimum, in the narrowest width."""
+    values = values.astype(np.int64)
+    base = int(values.min()) if len(values) else 0
+    offsets = (values - base).view(np.uint64)
+    width = smallest_unsigned(int(offsets.max()) if len(offsets) else 0)
+    return offsets.astype(width).tobytes(), {'base': base, 'width': width}
+
+def decode_for(data, params, dtype):
+    offsets = np.frombuffer(data, dtype=params['width']).astype(np.int64)
+    return (offsets + params['base']).astype(dtype)
+
+def encode_delta(values):
+    """Zigzag-coded differences between neighbours, frame-of-reference encoded."""
+    values = values.astype(np.int64)
+    deltas = np.diff(values, prepend=values[:1])
+    zigzag = (deltas << 1) ^ (deltas >> 63)
+    data, params = encode_for(zigzag)
+    params['first'] = int(values[0]) if len(values) else 0
+    return data, params
+
+def decode_delta(data, params, dtype):
+    zigzag = decode_for(data, params, np.int64).view(np.uint64)
+    deltas = (zigzag >> np.uint64(1)).astype(np.int64) ^ -(zigzag & np.uint64(1)).astype(np.int64)
+    deltas[:1] = params['first']
+    return np.cumsum(deltas).astype(dtype)
+
+def encode_dict(values):
+    """Distinct values, then each row as an index into them."""
+    distinct, indexes = np.unique(values, return_inverse=True)
+    width = smallest_unsigned(len(distinct))
+    return indexes.astype(width).tobytes(), {'values': distinct.tolist(), 'width': width}
+
+def decode_dict(data, params, dtype):
+    return np.array(params['values'], dtype=dtype)[np.frombuffer(data, dtype=params['width'])]
+
+def encode_shuffle(values):
+    """Bytes of equal significance grouped together, which compresses floats far better."""
+    values = np.ascontiguousarray(values)
+    return values.view(np.uint8).reshape(len(values), values.itemsize).T.tobytes(), {}
+
+def decode_shuffle(data, params, dtype):
+    itemsize = np.dtype(dtype).itemsize
+    shuffled = np.frombuffer(data, dtype=np.uint8).reshape(itemsize, -1)
+    return np.ascontiguousarray(shuffled.T).view(dtype).ravel()
+
+ENCODERS = {'for': encode_for, 'delta': encode_delta, 'dict': encode_dict, 'shuffle': encode_shuffle}
+DECODERS = {'for': decode_for, 'delta': decode_delta, 'dict': decode_dict, 'shuffle': decode_shuffle}
+
+def bloom_positions(addresses, bits):
+    """Bit positions of addresses in a Bloom filter of bits bits (a power of two), by double hashing."""
+    addresses = np.asarray(addresses, dtype=np.uint64)
+    h1 = (addresses * BLOOM_MULTIPLIERS[0]) >> np.uint64(32)
+    h2 = ((addresses * BLOOM_MULTIPLIERS[1]) >> np.uint64(32)) | np.uint64(1)
+    rounds = np.arange(BLOOM_HASHES, dtype=np.uint64)
+    return (h1[:, None] + rounds[None, :] * h2[:, None]) & np.uint64(bits - 1)
+
+def build_bloom(addresses):
+    """Bloom filter of a block's addresses, as bytes."""
+    distinct = np.unique(addresses)
+    bits = BLOOM_MIN_BITS
+    while bits < len(distinct) * BLOOM_BITS_PER_ADDRESS:
+        bits *= 2
+    filter_bits = np.zeros(bits, dtype=bool)
+    filter_bits[bloom_positions(distinct, bits).ravel()] = True
+    return np.packbits(filter_bits, bitorder='little').tobytes()
+
+def bloom_contains(bloom, address):
+    """Whether an address may be in a Bloom filter built by build_bloom()."""
+    filter_bits = np.frombuffer(bloom, dtype=np.uint8)
+    positions = bloom_positions([address], len(bloom) * 8).ravel()
+    return bool(np.all((filter_bits[positions >> np.uint64(3)] >> (positions & np.uint64(7)).astype(np.uint8)) & 1))
+
+def address_to_int(address):
+    return int.from_bytes(socket.inet_aton(address), 'big')
+
+def int_to_address(value):
+    return f"{value >> 24}.{(value >> 16) & 0xff}.{(value >> 8) & 0xff}.{value & 0xff}"
+
+def archive_files(directory):
+    """Data and index paths of the files in an archive, oldest first."""
+    files = []
+    for index_path in sorted(glob.glob(os.path.join(directory, f"{FILE_PREFIX}*.idx"))):
+        files.append((index_path[:-len('.idx')] + '.fca', index_path))
+    return files
+
+class FlowArchive:
+    def __init__(self, directory, block_records=DEFAULT_BLOCK_RECORDS, block_seconds=DEFAULT_BLOCK_SECONDS,
+                 retention_days=DEFAULT_RETENTION_DAYS, queue_batches=DEFAULT_QUEUE_BATCHES):
+        """Archive flow records to directory from a background thread.
+        
+        A block is written once it holds block_records records or its first
+        record is block_seconds old. Files are started hourly and deleted
+        after retention_days.
+        """
+        self.logger = logging.getLogger(__name__)
+        self.directory = directory
+        self.block_records = block_records
+        self.block_seconds = block_seconds
+        self.retention_seconds = retention_days * 86400
+        self.queue = queue.Queue(maxsize=queue_batches)
+        self.thread = None
+        self.thread_init = None
+        
+        self.file_hour = None
+        self.data_file = None
+        self.index_file = None
+        self.file_size = 0
+        
+        self.pending = []
+        self.pending_count = 0
+        self.block_opened = 0.0
+        self.addresses = {}  # Dotted address -> integer, for repeated hosts
+        
+        self.stats = {'records': 0, 'blocks': 0, 'files': 0, 'raw_bytes': 0, 'stored_bytes': 0,
+                      'dropped_records': 0, 'write_errors': 0, 'expired_files': 0}
+        
+    def open(self, thread_init=None):
+        """Create the archive directory and start the writer thread.
+        
+        thread_init, if given, is called first in the writer thread.
+        """
+        try:
+            os.makedirs(self.directory, exist_ok=True)
+            self.thread_init = thread_init
+            self.thread = threading.Thread(target=self.run, name='flow-archive', daemon=True)
+            self.thread.start()
+            self.logger.info(f"Archiving flow records to {self.directory}")
+            return True
+        except OSError as e:
+            self.logger.error(f"Failed to open flow archive {self.directory}: {e}")
+            return False
+            
+    def submit(self, records):
+        """Queue a batch of flow records for archiving; never blocks the export path."""
+        try:
+            self.queue.put_nowait(records)
+            return True
+        except queue.Full:
+            self.stats['dropped_records'] += len(records)
+            return False
+            
+    def run(self):
+        """Writer thread: encode queued records into blocks on size or age."""
+        if self.thread_init:
+            self.thread_init()
+        while True:
+            try:
+                records = self.queue.get(timeout=1.0)
+            except queue.Empty:
+                records = []
+            if records is None:
+                break
+            try:
+                if records:
+                    if not self.pending:
+                        self.block_opened = time.monotonic()
+                    self.pending.append(records)
+                    self.pending_count += len(records)
+                if self.pending_count >= self.block_records or (
+                        self.pending and time.monotonic() - self.block_opened >= self.block_seconds):
+                    self.flush_block()
+            except (OSError, KeyError, ValueError) as e:
+                self.stats['write_errors'] += 1
+                self.logger.error(f"Flow archive write failed: {e}")
+                self.pending = []
+                self.pending_count = 0
+                
+    def to_columns(self, records):
+        """Convert flow record dictionaries to archive column arrays."""
+        columns = {}
+        for name, dtype, _ in ARCHIVE_COLUMNS:
+            if name in ADDRESS_COLUMNS:
+                addresses = self.addresses
+                if len(addresses) > 1000000:
+                    addresses.clear()
+                values = []
+                for record in records:
+                    address = record[name]
+                    value = addresses.get(address)
+                    if value is None:
+                        value = addresses[address] = address_to_int(address)
+                    values.append(value)
+                columns[name] = np.array(values, dtype=dtype)
+            else:
+                columns[name] = np.array([record[name] for record in records], dtype=dtype)
+        return columns
+        
+    def encode_block(self, columns):
+        """Encode and compress the columns of a block; returns the data and its metadata."""
+        chunks = []
+        meta = {}
+        offset = 0
+        for name, dtype, encoding in ARCHIVE_COLUMNS:
+            values = columns[name]
+            data, params = ENCODERS[encoding](values)
+            data = zlib.compress(data, COMPRESSION_LEVEL)
+            entry = {'offset': offset, 'length': len(data), 'encoding': encoding, 'params': params}
+            if encoding != 'shuffle' and dtype[0] in 'iu':
+                entry['min'], entry['max'] = int(values.min()), int(values.max())
+            meta[name] = entry
+            chunks.append(data)
+            offset += len(data)
+            self.stats['raw_bytes'] += values.nbytes
+        return b''.join(chunks), meta
+        
+    def flush_block(self):
+        """Write the pending records as one block and index it."""
+        if not self.pending:
+            return
+        records = [record for batch in self.pending for record in batch]
+        self.pending = []
+        self.pending_count = 0
+        
+        for start in range(0, len(records), self.block_records):
+            chunk = records[start:start + self.block_records]
+            columns = self.to_columns(chunk)
+            data, meta = self.encode_block(columns)
+            bloom = build_bloom(np.concatenate([columns[name] for name in ADDRESS_COLUMNS]))
+            meta_bytes = json.dumps(meta, separators=(',', ':')).encode()
+            
+            self.rotate()
+            offset = self.file_size
+            self.data_file.write(data)
+            self.data_file.flush()
+            self.file_size += len(data)
+            
+            timestamps = columns['timestamp']
+            self.index_file.write(INDEX_ENTRY.pack(offset, len(data), len(chunk), int(timestamps.min()),
+                                                   int(timestamps.max()), len(meta_bytes), len(bloom)))
+            self.index_file.write(bloom)
+            self.index_file.write(meta_bytes)
+            self.index_file.flush()
+            
+            self.stats['records'] += len(chunk)
+            self.stats['blocks'] += 1
+            self.stats['stored_bytes'] += len(data) + INDEX_ENTRY.size + len(bloom) + len(meta_bytes)
+            
+    def rotate(self):
+        """Start a new file at the top of each hour and expire old ones."""
+        hour = time.strftime('%Y%m%d-%H')
+        if self.data_file is not None and hour == self.file_hour:
+            return
+        self.close_file()
+        self.expire()
+        
+        base = os.path.join(self.directory, f"{FILE_PREFIX}{hour}")
+        new = not os.path.exists(base + '.fca')
+        self.data_file = open(base + '.fca', 'ab')
+        self.index_file = open(base + '.idx', 'ab')
+        if new:
+            self.data_file.write(FILE_HEADER.pack(FILE_MAGIC, ARCHIVE_VERSION))
+            self.index_file.write(FILE_HEADER.pack(INDEX_MAGIC, ARCHIVE_VERSION))
+        self.file_size = self.data_file.tell()
+        self.file_hour = hour
+        self.stats['files'] += 1
+        
+    def expire(self):
+        """Delete files last written more than the retention period ago."""
+        cutoff = time.time() - self.retention_seconds
+        for data_path, index_path in archive_files(self.directory):
+            try:
+                if os.path.getmtime(index_path) < cutoff:
+                    for path in (data_path, index_path):
+                        if os.path.exists(path):
+                            os.remove(path)
+                    self.stats['expired_files'] += 1
+            except OSError as e:
+                self.logger.warning(f"Failed to expire {data_path}: {e}")
+                
+    def close_file(self):
+        """Close the files being written."""
+        for f in (self.data_file, self.index_file):
+            if f:
+                f.close()
+        self.data_file = self.index_file = None
+        
+    def memory_usage(self):
+        """Approximate bytes of records waiting for their block to be written."""
+        return self.pending_count * 1024
+        
+    def drop_stats(self):
+        """Records not archived because the writer fell behind."""
+        return {'flow_archive_full': self.stats['dropped_records']}
+        
+    def collect(self):
+        """Archive counters for the metrics exporter."""
+        metrics = dict(self.stats)
+        metrics['queued_batches'] = self.queue.qsize()
+        metrics['pending_records'] = self.pending_count
+        return metrics
+        
+    def close(self):
+        """Write everything queued, then close the archive."""
+        if self.thread:
+            self.queue.put(None)
+            self.thread.join()
+            self.thread = None
+        try:
+            self.flush_block()
+        except (OSError, KeyError, ValueError) as e:
+            self.logger.error(f"Flow archive write failed: {e}")
+        self.close_file()
+        self.logger.info(f"Flow archive closed: {self.stats['records']} records in {self.stats['blocks']} blocks, "
+                         f"{self.stats['stored_bytes']} of {self.stats['raw_bytes']} bytes, "
+                         f"{self.stats['dropped_records']} dropped")
+
+class FlowArchiveReader:
+    def __init__(self, directory):
+        self.logger = logging.getLogger(__name__)
+        self.directory = directory
+        self.stats = {'files': 0, 'blocks': 0, 'blocks_read': 0, 'bytes_read': 0, 'records_scanned': 0,
+                      'records': 0}
+        
+    def read_index(self, path, start_us=None, end_us=None, address=None):
+        """Index entries of one file that may hold matching records.
+        
+        Blocks outside [start_us, end_us], or whose Bloom filter rules out
+        address, are skipped without parsing their metadata.
+        """
+        blocks = []
+        with open(path, 'rb') as f:
+            header = f.read(FILE_HEADER.size)
+            if len(header) < FILE_HEADER.size:
+                return blocks
+            magic, version = FILE_HEADER.unpack(header)
+            if magic != INDEX_MAGIC or version != ARCHIVE_VERSION:
+                raise ValueError(f"{path}: not a flow archive index")
+                
+            while True:
+                entry = f.read(INDEX_ENTRY.size)
+                if len(entry) < INDEX_ENTRY.size:
+                    break
+                offset, length, records, first_us, last_us, meta_len, bloom_len = INDEX_ENTRY.unpack(entry)
+                self.stats['blocks'] += 1
+                if (start_us is not None and last_us < start_us) or (end_us is not None and first_us > end_us):
+                    f.seek(bloom_len + meta_len, os.SEEK_CUR)
+                    continue
+                bloom = f.read(bloom_len)
+                if address is not None and not bloom_contains(bloom, address):
+                    f.seek(meta_len, os.SEEK_CUR)
+                    continue
+                meta = f.read(meta_len)
+                if len(meta) < meta_len:
+                    break  # Entry cut short by a crash
+                blocks.append(BlockIndex(offset, length, records, first_us, last_us, bloom, json.loads(meta)))
+        return blocks
+        
+    def query(self, host=None, port=None, protocol=None, start_us=None, end_us=None):
+        """Yield the archived flow records matching every given condition.
+        
+        host matches either address and port either port. Predicates are
+        evaluated on whole decoded columns, and the remaining columns are
+        only decoded for blocks with matches.
+        """
+        address = address_to_int(host) if host else None
+        for data_path, index_path in archive_files(self.directory):
+            self.stats['files'] += 1
+            blocks = self.read_index(index_path, start_us, end_us, address)
+            if not blocks:
+                continue
+                
+            with open(data_path, 'rb') as f:
+                for block in blocks:
+                    if not self.may_match(block.meta, address, port, protocol):
+                        continue
+                    self.stats['blocks_read'] += 1
+                    self.stats['records_scanned'] += block.records
+                    yield from self.scan_block(f, block, address, port, protocol, start_us, end_us)
+                    
+    def may_match(self, meta, address, port, protocol):
+        """Whether the min/max statistics of a block allow a match."""
+        def in_range(name, value):
+            return meta[name]['min'] <= value <= meta[name]['max']
+            
+        if address is not None and not (in_range('src_ip', address) or in_range('dst_ip', address)):
+            return False
+        if port is not None and not (in_range('src_port', port) or in_range('dst_port', port)):
+            return False
+        if protocol is not None and not in_range('protocol', protocol):
+            return False
+        return True
+        
+    def scan_block(self, f, block, address, port, protocol, start_us, end_us):
+        """Matching records of one block; each column is read only when first needed."""
+        decoded = {}
+        
+        def column(name):
+            if name not in decoded:
+                entry = block.meta.get(name)
+                if entry is None:
+                    # Column added after the block was written
+                    decoded[name] = np.zeros(block.records, dtype=COLUMN_DTYPES[name])
+                    return decoded[name]
+                f.seek(block.offset + entry['offset'])
+                data = f.read(entry['length'])
+                self.stats['bytes_read'] += len(data)
+                decoded[name] = DECODERS[entry['encoding']](zlib.decompress(data), entry['params'],
+                                                            COLUMN_DTYPES[name])
+            return decoded[name]
+            
+        match = np.ones(len(column('timestamp')), dtype=bool)
+        if start_us is not None:
+            match &= column('timestamp') >= start_us
+        if end_us is not None:
+            match &= column('timestamp') <= end_us
+        if address is not None:
+            match &= (column('src_ip') == address) | (column('dst_ip') == address)
+        if port is not None:
+            match &= (column('src_port') == port) | (column('dst_port') == port)
+        if protocol is not None:
+            match &= column('protocol') == protocol
+            
+        rows = np.flatnonzero(match)
+        if not len(rows):
+            return
+        values = {}
+        for name, _, _ in ARCHIVE_COLUMNS:
+            selected = column(name)[rows].tolist()
+            if name in ADDRESS_COLUMNS:
+                selected = [int_to_address(value) for value in selected]
+            values[name] = selected
+        names = list(values)
+        for row in zip(*values.values()):
+            self.stats['records'] += 1
+            yield dict(zip(names, row))
@@ -0,0 +1,333 @@
+"""
+Indexed packet store.
+Packets are appended in blocks to size-rotated pcap segments. Each segment
+has an index with one entry per block: its location, time range and the
+sorted hashes of the flows it holds, so a query for one flow reads only the
+blocks that can contain its packets.
+"""
+
+import glob
+import logging
+import os
+import queue
+import struct
+import threading
+import time
+from collections import namedtuple
+
+import numpy as np
+
+from src.dpdk.pcap_file import PCAP_MAGIC_NSEC, LINKTYPE_ETHERNET
+from src.dpdk.burst import PacketBurst
+from src.features.flow_key import flow_keys, key_hash, pack_key
+from src.features.vectorized import HEADER_BYTES, parse_headers
+
+SEGMENT_PREFIX = 'packets-'
+DEFAULT_BLOCK_BYTES = 4 << 20
+DEFAULT_SEGMENT_BYTES = 1 << 30
+DEFAULT_BLOCK_SECONDS = 1.0
+DEFAULT_QUEUE_BURSTS = 4096
+
+PCAP_HEADER = struct.pack('<IHHiIII', PCAP_MAGIC_NSEC, 2, 4, 0, 0, 65535, LINKTYPE_ETHERNET)
+RECORD_HEADER = struct.Struct('<IIII')
+RECORD_HEADER_DTYPE = np.dtype([('sec', '<u4'), ('nsec', '<u4'), ('caplen', '<u4'), ('len', '<u4')])
+
+# Index file: header, then per block an entry followed by its sorted flow hashes
+INDEX_MAGIC = b'PKIX'
+INDEX_VERSION = 1
+INDEX_HEADER = struct.Struct('<4sI')
+INDEX_ENTRY = struct.Struct('<QIIqqI')  # offset, length, packets, first_ns, last_ns, flows
+
+BlockIndex = namedtuple('BlockIndex', 'offset length packets first_ns last_ns hashes')
+
+def segment_paths(directory, number):
+    """Data and index paths of a segment."""
+    base = os.path.join(directory, f"{SEGMENT_PREFIX}{number:06d}")
+    return base + '.pcap', base + '.idx'
+
+def segment_numbers(directory):
+    """Numbers of the segments in a store, oldest first."""
+    numbers = []
+    for path in glob.glob(os.path.join(directory, f"{SEGMENT_PREFIX}*.idx")):
+        name = os.path.basename(path)[len(SEGMENT_PREFIX):-len('.idx')]
+        if name.isdigit():
+            numbers.append(int(name))
+    return sorted(numbers)
+
+def block_flow_keys(burst):
+    """Canonical keys (hi, lo) of the IPv4 packets in a PacketBurst."""
+    fields, valid = parse_headers(burst.headers(HEADER_BYTES), burst.lengths.astype(np.int64))
+    hi, lo = flow_keys(fields)
+    return hi, lo, valid
+
+class PacketStore:
+    def __init__(self, directory, block_bytes=DEFAULT_BLOCK_BYTES, segment_bytes=DEFAULT_SEGMENT_BYTES,
+                 block_seconds=DEFAULT_BLOCK_SECONDS, queue_bursts=DEFAULT_QUEUE_BURSTS):
+        """Write captured packets to directory from a background thread.
+        
+        A block is closed once it holds block_bytes or its first packet is
+        block_seconds old, and a segment once it holds segment_bytes.
+        """
+        self.logger = logging.getLogger(__name__)
+        self.directory = directory
+        self.block_bytes = block_bytes
+        self.segment_bytes = segment_bytes
+        self.block_seconds = block_seconds
+        self.queue = queue.Queue(maxsize=queue_bursts)
+        self.thread = None
+        self.thread_init = None
+        
+        self.segment = None
+        self.segment_number = 0
+        self.data_file = None
+        self.index_file = None
+        self.segment_size = 0
+        
+        # Block being built
+        self.chunks = []
+        self.block_size = 0
+        self.block_packets = 0
+        self.block_keys = set()
+        self.block_first_ns = None
+        self.block_last_ns = None
+        self.block_opened = 0.0
+        
+        self.stats = {'packets': 0, 'bytes': 0, 'blocks': 0, 'segments': 0,
+                      'dropped_packets': 0, 'write_errors': 0}
+        
+    def open(self, thread_init=None):
+        """Create the store directory and start the writer thread.
+        
+        thread_init, if given, is called first in the writer thread.
+        """
+        try:
+            os.makedirs(self.directory, exist_ok=True)
+            numbers = segment_numbers(self.directory)
+            self.segment_number = numbers[-1] if numbers else 0
+            self.thread_init = thread_init
+            self.thread = threading.Thread(target=self.run, name='packet-store', daemon=True)
+            self.thread.start()
+            self.logger.info(f"Writing packets to {self.directory}")
+            return True
+        except OSError as e:
+            self.logger.error(f"Failed to open packet store {self.directory}: {e}")
+            return False
+            
+    def submit(self, burst):
+        """Queue a PacketBurst for writing; never blocks the capture loop."""
+        try:
+            self.queue.put_nowait(burst)
+            return True
+        except queue.Full:
+            self.stats['dropped_packets'] += len(burst)
+            return False
+            
+    def run(self):
+        """Writer thread: write queued bursts, closing blocks on size or age."""
+        if self.thread_init:
+            self.thread_init()
+        while True:
+            try:
+                burst = self.queue.get(timeout=self.block_seconds / 2)
+            except queue.Empty:
+                burst = PacketBurst()
+            if burst is None:
+                break
+            try:
+                if burst:
+                    self.write_burst(burst)
+                if self.chunks and time.monotonic() - self.block_opened >= self.block_seconds:
+                    self.flush_block()
+            except OSError as e:
+                self.stats['write_errors'] += 1
+                self.logger.error(f"Packet store write failed: {e}")
+                
+    def write_burst(self, burst):
+        """Append a PacketBurst to the current block."""
+        hi, lo, valid = block_flow_keys(burst)
+        self.block_keys.update(zip(hi[valid].tolist(), lo[valid].tolist()))
+        
+        meta = burst.meta
+        timestamps = meta['timestamp_ns'].astype(np.int64)
+        timestamps[timestamps == 0] = time.time_ns()
+        lengths = meta['length'].astype(np.int64)
+        headers = np.empty(len(burst), dtype=RECORD_HEADER_DTYPE)
+        headers['sec'], headers['nsec'] = np.divmod(timestamps, 1000000000)
+        headers['caplen'] = lengths
+        headers['len'] = lengths
+        
+        # Each record header followed by its packet, gathered from the burst buffer
+        sizes = RECORD_HEADER.size + lengths
+        starts = np.cumsum(sizes) - sizes
+        size = int(sizes.sum())
+        records = np.empty(size, dtype=np.uint8)
+        records[starts[:, None] + np.arange(RECORD_HEADER.size)] = headers.view(np.uint8).reshape(len(burst), -1)
+        within = np.arange(int(lengths.sum())) - np.repeat(np.cumsum(lengths) - lengths, lengths)
+        records[np.repeat(starts + RECORD_HEADER.size, lengths) + within] = burst.buffer[
+            np.repeat(meta['offset'].astype(np.int64), lengths) + within]
+        self.chunks.append(records)
+        first, last = int(timestamps.min()), int(timestamps.max())
+        
+        if not self.block_packets:
+            self.block_opened = time.monotonic()
+            self.block_first_ns, self.block_last_ns = first, last
+        else:
+            self.block_first_ns = min(self.block_first_ns, first)
+            self.block_last_ns = max(self.block_last_ns, last)
+        self.block_packets += len(burst)
+        self.block_size += size
+        self.stats['packets'] += len(burst)
+        self.stats['bytes'] += size
+        
+        if self.block_size >= self.block_bytes:
+            self.flush_block()
+            
+    def flush_block(self):
+        """Write the current block and its index entry."""
+        if not self.block_packets:
+            return
+        if self.data_file is None or self.segment_size + self.block_size > self.segment_bytes:
+            self.open_segment()
+            
+        offset = self.segment_size
+        self.data_file.write(b''.join(self.chunks))
+        self.data_file.flush()
+        self.segment_size += self.block_size
+        
+        hashes = np.array(sorted(key_hash(hi.to_bytes(8, 'big') + lo.to_bytes(5, 'big'))
+                                 for hi, lo in self.block_keys), dtype='<u8')
+        self.index_file.write(INDEX_ENTRY.pack(offset, self.block_size, self.block_packets,
+                                               self.block_first_ns, self.block_last_ns, len(hashes)))
+        self.index_file.write(hashes.tobytes())
+        self.index_file.flush()
+        
+        self.stats['blocks'] += 1
+        self.chunks = []
+        self.block_size = 0
+        self.block_packets = 0
+        self.block_keys = set()
+        
+    def open_segment(self):
+        """Start a new segment, closing the current one."""
+        self.close_segment()
+        self.segment_number += 1
+        data_path, index_path = segment_paths(self.directory, self.segment_number)
+        self.data_file = open(data_path, 'wb')
+        self.data_file.write(PCAP_HEADER)
+        self.index_file = open(index_path, 'wb')
+        self.index_file.write(INDEX_HEADER.pack(INDEX_MAGIC, INDEX_VERSION))
+        self.segment_size = len(PCAP_HEADER)
+        self.stats['segments'] += 1
+        
+    def close_segment(self):
+        """Close the files of the current segment."""
+        for f in (self.data_file, self.index_file):
+            if f:
+                f.close()
+        self.data_file = self.index_file = None
+        
+    def memory_usage(self):
+        """Bytes of the block being built; queued bursts are counted by the capture buffers."""
+        return self.block_size
+        
+    def drop_stats(self):
+        """Packets not stored because the writer fell behind."""
+        return {'packet_store_full': self.stats['dropped_packets']}
+        
+    def collect(self):
+        """Store counters for the metrics exporter."""
+        metrics = dict(self.stats)
+        metrics['queued_bursts'] = self.queue.qsize()
+        return metrics
+        
+    def close(self):
+        """Write everything queued, then close the store."""
+        if self.thread:
+            self.queue.put(None)
+            self.thread.join()
+            self.thread = None
+        try:
+            self.flush_block()
+        except OSError as e:
+            self.logger.error(f"Packet store write failed: {e}")
+        self.close_segment()
+        self.logger.info(f"Packet store closed: {self.stats['packets']} packets in "
+                         f"{self.stats['blocks']} blocks, {self.stats['dropped_packets']} dropped")
+
+class PacketStoreReader:
+    def __init__(self, directory):
+        self.logger = logging.getLogger(__name__)
+        self.directory = directory
+        self.stats = {'segments': 0, 'blocks': 0, 'blocks_read': 0, 'bytes_read': 0, 'packets': 0}
+        
+    def read_index(self, path, start_ns=None, end_ns=None):
+        """Entries of one segment index overlapping [start_ns, end_ns]; skipped blocks' hashes are not loaded."""
+        blocks = []
+        with open(path, 'rb') as f:
+            header = f.read(INDEX_HEADER.size)
+            if len(header) < INDEX_HEADER.size:
+                return blocks
+            magic, version = INDEX_HEADER.unpack(header)
+            if magic != INDEX_MAGIC or version != INDEX_VERSION:
+                raise ValueError(f"{path}: not a packet store index")
+                
+            while True:
+                entry = f.read(INDEX_ENTRY.size)
+                if len(entry) < INDEX_ENTRY.size:
+                    break
+                offset, length, packets, first_ns, last_ns, flows = INDEX_ENTRY.unpack(entry)
+                self.stats['blocks'] += 1
+                if (start_ns is not None and last_ns < start_ns) or (end_ns is not None and first_ns > end_ns):
+                    f.seek(flows * 8, os.SEEK_CUR)
+                    continue
+                data = f.read(flows * 8)
+                if len(data) < flows * 8:
+                    break  # Entry cut short by a crash
+                blocks.append(BlockIndex(offset, length, packets, first_ns, last_ns,
+                                         np.frombuffer(data, dtype='<u8')))
+        return blocks
+        
+    def read_block(self, f, block):
+        """Packets of one block as (timestamp_ns, data, orig_len) tuples."""
+        f.seek(block.offset)
+        data = f.read(block.length)
+        self.stats['blocks_read'] += 1
+        self.stats['bytes_read'] += len(data)
+        
+        packets = []
+        pos = 0
+        while pos + RECORD_HEADER.size <= len(data):
+            sec, nsec, incl_len, orig_len = RECORD_HEADER.unpack_from(data, pos)
+            pos += RECORD_HEADER.size
+            packets.append((sec * 1000000000 + nsec, data[pos:pos + incl_len], orig_len))
+            pos += incl_len
+        return packets
+        
+    def query(self, src_ip, dst_ip, src_port=0, dst_port=0, protocol=6, start_ns=None, end_ns=None):
+        """Yield (timestamp_ns, data, orig_len) for every stored packet of a flow, in either direction."""
+        key = pack_key(src_ip, dst_ip, src_port, dst_port, protocol)
+        if len(key) != 13:
+            raise ValueError("the packet store indexes IPv4 flows only")
+        flow = np.uint64(key_hash(key))
+        target_hi, target_lo = int.from_bytes(key[:8], 'big'), int.from_bytes(key[8:], 'big')
+        
+        for number in segment_numbers(self.directory):
+            data_path, index_path = segment_paths(self.directory, number)
+            self.stats['segments'] += 1
+            blocks = [block for block in self.read_index(index_path, start_ns, end_ns)
+                      if len(block.hashes) and block.hashes[min(np.searchsorted(block.hashes, flow),
+                                                                len(block.hashes) - 1)] == flow]
+            if not blocks:
+                continue
+                
+            with open(data_path, 'rb') as f:
+                for block in blocks:
+                    packets = self.read_block(f, block)
+                    hi, lo, valid = block_flow_keys(PacketBurst.from_packets(
+                        [{'data': data, 'length': len(data)} for _, data, _ in packets]))
+                    match = valid & (hi == target_hi) & (lo == target_lo)
+                    for i in np.flatnonzero(match).tolist():
+                        timestamp = packets[i][0]
+                        if (start_ns is None or timestamp >= start_ns) and (end_ns is None or timestamp <= end_ns):
+                            self.stats['packets'] += 1
+                            yield packets[i]
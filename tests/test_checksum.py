@@ -0,0 +1,104 @@
+"""
+Checksum verification tests: the burst verifier against the per-packet one,
+and the offload flags that let it skip packets.
+"""
+
+import random
+import struct
+import unittest
+
+import numpy as np
+
+from src.dpdk.burst import PacketBurst
+from src.features.checksum import (PACKET_RX_IP_CKSUM_BAD, PACKET_RX_IP_CKSUM_CHECKED, PACKET_RX_L4_CKSUM_BAD,
+                                   PACKET_RX_L4_CKSUM_CHECKED, burst_checksum_bad, ones_sum, packet_checksum_bad)
+from src.features.vectorized import HEADER_BYTES, parse_headers
+
+def checksum(data):
+    total = ones_sum(data)
+    while total > 0xFFFF:
+        total = (total & 0xFFFF) + (total >> 16)
+    return ~total & 0xFFFF
+
+def frame(protocol=6, payload=b'', options=b'', fragment=0, udp_checksum=True, padding=b''):
+    """Ethernet/IPv4 frame with correct IPv4 and TCP or UDP checksums."""
+    header_length = 20 + len(options)
+    if protocol == 6:
+        l4 = struct.pack('!HHIIBBHHH', 1234, 80, 1, 0, 5 << 4, 0x18, 1024, 0, 0) + payload
+    else:
+        l4 = struct.pack('!HHHH', 1234, 53, 8 + len(payload), 0) + payload
+    src, dst = bytes([10, 0, 0, 1]), bytes([10, 0, 0, 2])
+    pseudo = src + dst + struct.pack('!BBH', 0, protocol, len(l4))
+    l4_sum = checksum(pseudo + l4)
+    if protocol == 17 and not udp_checksum:
+        l4_sum = 0
+    elif protocol == 17 and l4_sum == 0:
+        l4_sum = 0xFFFF
+    offset = 16 if protocol == 6 else 6
+    l4 = l4[:offset] + struct.pack('!H', l4_sum) + l4[offset + 2:]
+    ip = struct.pack('!BBHHHBBH4s4s', 0x40 | header_length // 4, 0, header_length + len(l4), 0, fragment, 64,
+                     protocol, 0, src, dst) + options
+    ip = ip[:10] + struct.pack('!H', checksum(ip)) + ip[12:]
+    return b'\x02' * 6 + b'\x04' * 6 + b'\x08\x00' + ip + l4 + padding
+
+def corrupt(data, position):
+    return data[:position] + bytes([data[position] ^ 0x01]) + data[position + 1:]
+
+def verify(frames, flags=None):
+    flags = flags or [0] * len(frames)
+    burst = PacketBurst.from_packets([{'data': data, 'length': len(data), 'rx_flags': rx_flags}
+                                      for data, rx_flags in zip(frames, flags)])
+    headers = burst.headers(HEADER_BYTES)
+    _, valid = parse_headers(headers, burst.lengths.astype(np.int64))
+    return burst_checksum_bad(burst, headers, valid).tolist()
+
+class BurstChecksumTest(unittest.TestCase):
+    def test_good_and_bad(self):
+        good = [frame(6), frame(6, b'odd'), frame(17, b'abcd'), frame(17, b'x' * 701), frame(6, b'y' * 1400)]
+        self.assertEqual(verify(good), [False] * len(good))
+        bad = [corrupt(data, 36) for data in good] + [corrupt(frame(6), 24)]
+        self.assertEqual(verify(bad), [True] * len(bad))
+        
+    def test_rules(self):
+        frames = [
+            frame(17, b'data', udp_checksum=False),             # UDP without a checksum
+            corrupt(frame(6, b'a' * 40), 70)[:60],              # Truncated: IPv4 header only
+            corrupt(frame(6, b'b' * 40, fragment=0x2000), 70),  # First fragment
+            frame(6, b'c' * 9, padding=b'\xff' * 7),            # Ethernet padding past the datagram
+            frame(6, b'd' * 16, options=b'\x01\x01\x01\x00'),   # IPv4 options
+            corrupt(frame(17, b'e' * 16, options=b'\x01' * 40), 30),
+        ]
+        self.assertEqual(verify(frames), [False, False, False, False, False, True])
+        
+    def test_offload_flags(self):
+        bad_l4 = corrupt(frame(6, b'payload'), 60)
+        bad_ip = corrupt(frame(6, b'payload'), 24)
+        frames = [bad_l4, bad_l4, frame(6), bad_ip, frame(6)]
+        flags = [PACKET_RX_IP_CKSUM_CHECKED | PACKET_RX_L4_CKSUM_CHECKED,
+                 0,
+                 PACKET_RX_IP_CKSUM_CHECKED | PACKET_RX_L4_CKSUM_CHECKED | PACKET_RX_L4_CKSUM_BAD,
+                 PACKET_RX_IP_CKSUM_CHECKED,
+                 PACKET_RX_IP_CKSUM_CHECKED | PACKET_RX_IP_CKSUM_BAD]
+        self.assertEqual(verify(frames, flags), [False, True, True, False, True])
+        
+    def test_matches_packet_checksum_bad(self):
+        rng = random.Random(7)
+        frames = []
+        flags = []
+        for _ in range(500):
+            data = frame(rng.choice((6, 17)), bytes(rng.randrange(256) for _ in range(rng.randrange(64))),
+                         options=b'\x01' * 4 * rng.randrange(3), udp_checksum=rng.random() < 0.9)
+            if rng.random() < 0.5:
+                data = corrupt(data, rng.randrange(14, len(data)))
+            if rng.random() < 0.1:
+                data = data[:rng.randrange(14, len(data))]
+            frames.append(data)
+            flags.append(rng.choice((0, 0, 0, PACKET_RX_IP_CKSUM_CHECKED, PACKET_RX_L4_CKSUM_CHECKED)))
+        burst = PacketBurst.from_packets([{'data': data, 'length': len(data)} for data in frames])
+        _, valid = parse_headers(burst.headers(HEADER_BYTES), burst.lengths.astype(np.int64))
+        expected = [bool(ok) and packet_checksum_bad(data, rx_flags)
+                    for data, rx_flags, ok in zip(frames, flags, valid.tolist())]
+        self.assertEqual(verify(frames, flags), expected)
+
+if __name__ == '__main__':
+    unittest.main()
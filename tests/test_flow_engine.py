@@ -0,0 +1,132 @@
+"""
+Native flow engine tests: packed bursts in one call, flow expiry against
+the reference extractor, and runtime configuration swaps while another
+thread is processing bursts.
+"""
+
+import json
+import random
+import struct
+import threading
+import unittest
+
+from src.dpdk.burst import PacketBurst
+from src.features.extractor import FeatureExtractor
+from src.features.native import MAX_PKT_BURST, NativeFeatureExtractor
+
+def udp_frame(src_port):
+    ip = struct.pack('!BBHHHBBH4s4s', 0x45, 0, 28, 0, 0, 64, 17, 0, bytes([10, 0, 0, 1]), bytes([10, 0, 0, 2]))
+    return b'\x02' * 6 + b'\x04' * 6 + b'\x08\x00' + ip + struct.pack('!HHHH', src_port, 53, 8, 0)
+
+def burst_of(frames, ts=1000000000):
+    return PacketBurst.from_packets([{'data': data, 'length': len(data), 'timestamp_ns': ts} for data in frames])
+
+class PackedBurstTest(unittest.TestCase):
+    def setUp(self):
+        self.extractor = NativeFeatureExtractor(encode_json=True)
+        if not self.extractor.initialize():
+            self.skipTest("native library not built, run 'make'")
+            
+    def tearDown(self):
+        self.extractor.cleanup()
+        
+    def test_burst_larger_than_max_pkt_burst(self):
+        """Records of the IPv4 packets of a burst, in order, with their JSON lines."""
+        frames = [udp_frame(1024 + i) for i in range(3 * MAX_PKT_BURST + 5)]
+        frames[40] = b'\x02' * 6 + b'\x04' * 6 + b'\x08\x06' + bytes(28)  # ARP
+        records = self.extractor.extract_burst(burst_of(frames))
+        ports = [1024 + i for i in range(len(frames)) if i != 40]
+        self.assertEqual(records.columns['src_port'].tolist(), ports)
+        self.assertEqual(records.columns['src_ip'].tolist(), [0x0a000001] * len(ports))
+        for record in records:
+            self.assertEqual(json.loads(record.json), record)
+            
+        flushed = self.extractor.flush_flows()
+        self.assertEqual(sorted(flushed.columns['src_port'].tolist()), ports)
+        self.assertEqual(self.extractor.flow_count(), 0)
+        
+    def test_empty_burst(self):
+        self.assertEqual(len(self.extractor.extract_burst(PacketBurst())), 0)
+
+class ExpiryTest(unittest.TestCase):
+    def setUp(self):
+        self.extractor = NativeFeatureExtractor(flow_timeout=10.0)
+        if not self.extractor.initialize():
+            self.skipTest("native library not built, run 'make'")
+            
+    def tearDown(self):
+        self.extractor.cleanup()
+        
+    def check_against_reference(self, packets):
+        reference = FeatureExtractor()
+        reference.flow_timeout = 10.0
+        expected = [(r['src_port'], r['total_fwd_packets'], round(r['flow_duration'], 6))
+                    for r in map(reference.extract_features, packets)]
+        
+        columns = self.extractor.extract_burst(PacketBurst.from_packets(packets)).columns
+        self.assertEqual(list(zip(columns['src_port'].tolist(), columns['total_fwd_packets'].tolist(),
+                                  columns['flow_duration'].round(6).tolist())), expected)
+        self.assertEqual(self.extractor.flow_count(), len(reference.flows))
+        return expected
+        
+    def test_expiry_matches_reference(self):
+        """Flows expire at the same packet as in FeatureExtractor, also in the middle of a burst."""
+        packets = [{'data': udp_frame(1024 + i), 'length': 42, 'timestamp_ns': 1000000000 + i * 10000000}
+                   for i in range(1200)]
+        packets += [{'data': udp_frame(1024 + i), 'length': 42, 'timestamp_ns': 14000000000 + i * 5000000}
+                    for i in range(0, 1200, 3)]
+        expected = self.check_against_reference(packets)
+        # Both the flows expired while the table filled and those expired late in the burst restarted
+        self.assertIn(1, [packets for _, packets, _ in expected[1200:]])
+        self.assertIn(2, [packets for _, packets, _ in expected[1200:]])
+        
+    def test_expiry_out_of_order(self):
+        """Timestamps that go back a little still expire flows in the reference's order."""
+        rng = random.Random(5)
+        packets = [{'data': udp_frame(1024 + rng.randrange(1500)), 'length': 42,
+                    'timestamp_ns': 1000000000 + i * 5000000 + rng.randrange(-200000000, 200000000)}
+                   for i in range(6000)]
+        self.check_against_reference(packets)
+
+class ConfigSwapTest(unittest.TestCase):
+    def setUp(self):
+        self.extractor = NativeFeatureExtractor()
+        if not self.extractor.initialize():
+            self.skipTest("native library not built, run 'make'")
+            
+    def tearDown(self):
+        self.extractor.cleanup()
+        
+    def test_swap_during_bursts(self):
+        """Configuration changes from the control thread while the RX thread is inside extract_burst."""
+        burst = burst_of([udp_frame(1024 + i) for i in range(MAX_PKT_BURST)])
+        stop = threading.Event()
+        tenants = set()
+        
+        def rx():
+            while not stop.is_set():
+                burst.meta['timestamp_ns'] += 1000
+                records = self.extractor.extract_burst(burst)
+                tenants.update(records.columns['tenant'].tolist())
+                
+        thread = threading.Thread(target=rx)
+        thread.start()
+        try:
+            for i in range(2000):
+                self.assertTrue(self.extractor.set_config(flow_timeout=60.0 + i % 2, tenant=i % 3))
+        finally:
+            stop.set()
+            thread.join()
+            
+        stats = self.extractor.get_stats()
+        self.assertEqual(stats['config_version'], 2000)
+        self.assertLessEqual(tenants, {0, 1, 2})
+        
+    def test_get_config_returns_last_set(self):
+        self.assertTrue(self.extractor.set_config(flow_timeout=30.0, sample_rate=4, tenant=2))
+        self.assertTrue(self.extractor.set_config(sample_rate=8))
+        config = self.extractor.get_config()
+        self.assertEqual((config.flow_timeout, config.sample_rate, config.tenant), (30.0, 8, 2))
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,92 @@
+"""
+Record rate limiting tests: records over a limit are held, a newer record
+of the same flow replaces the held one, and held records are released as
+tokens refill.
+"""
+
+import unittest
+
+from src.features.tenants import TenantMap, parse_tenant
+from src.pipeline.ratelimit import RELEASE_INTERVAL, RecordLimiter
+
+class Clock:
+    def __init__(self):
+        self.now = 100.0
+        
+    def __call__(self):
+        return self.now
+
+def record(port, packets, tenant=0, end_reason=0):
+    return {'src_ip': '10.0.0.1', 'dst_ip': '10.0.0.2', 'src_port': port, 'dst_port': 80, 'protocol': 6,
+            'total_fwd_packets': packets, 'tenant': tenant, 'end_reason': end_reason}
+
+def packets(records):
+    return [(features['src_port'], features['total_fwd_packets']) for features in records]
+
+class RecordLimiterTest(unittest.TestCase):
+    def setUp(self):
+        self.clock = Clock()
+        
+    def test_disabled_passes_everything(self):
+        limiter = RecordLimiter(clock=self.clock)
+        records = [record(1, n) for n in range(10)]
+        self.assertIs(limiter.limit(records), records)
+        self.assertEqual(limiter.release(), [])
+        
+    def test_hold_aggregate_release(self):
+        """Updates over the flow rate fold into the latest record, which goes out once tokens refill."""
+        limiter = RecordLimiter(flow_rate=1.0, flow_burst=1, clock=self.clock)
+        self.assertEqual(packets(limiter.limit([record(1, 1), record(2, 1)])), [(1, 1), (2, 1)])
+        self.assertEqual(limiter.limit([record(1, 2), record(1, 3), record(2, 2)]), [])
+        self.assertEqual(limiter.limit([record(1, 4)]), [])
+        self.assertEqual((limiter.passed, limiter.suppressed, limiter.aggregated), (2, 4, 2))
+        self.assertEqual(len(limiter.held), 2)
+        
+        # Not due before RELEASE_INTERVAL, nor before a token refills
+        self.clock.now += RELEASE_INTERVAL / 2
+        self.assertEqual(limiter.release(), [])
+        self.clock.now += RELEASE_INTERVAL
+        self.assertEqual(limiter.release(), [])
+        self.clock.now += 1.0
+        self.assertEqual(packets(limiter.release()), [(1, 4), (2, 2)])
+        self.assertEqual(limiter.released, 2)
+        self.assertEqual(limiter.held, {})
+        
+    def test_passing_record_supersedes_held(self):
+        limiter = RecordLimiter(flow_rate=1.0, flow_burst=1, clock=self.clock)
+        limiter.limit([record(1, 1), record(1, 2)])
+        self.clock.now += 1.0
+        self.assertEqual(packets(limiter.limit([record(1, 3)])), [(1, 3)])
+        self.assertEqual(limiter.held, {})
+        self.assertEqual(limiter.aggregated, 1)
+        
+    def test_final_record_always_passes(self):
+        limiter = RecordLimiter(flow_rate=1.0, flow_burst=1, rate=1.0, burst=1, clock=self.clock)
+        limiter.limit([record(1, 1), record(1, 2)])
+        self.assertEqual(packets(limiter.limit([record(1, 3, end_reason=1), record(2, 1, end_reason=1)])),
+                         [(1, 3), (2, 1)])
+        self.assertEqual(limiter.held, {})
+        # The global bucket ran into debt for them
+        self.clock.now += 1.5
+        self.assertEqual(limiter.limit([record(3, 1)]), [])
+        
+    def test_global_and_tenant_rates(self):
+        tenants = TenantMap([parse_tenant('noisy:vlan=2 export_rate=2')]).tenants
+        limiter = RecordLimiter(rate=10.0, tenants=tenants, clock=self.clock)
+        exported = limiter.limit([record(port, 1, tenant=1) for port in range(5)] +
+                                 [record(port, 1) for port in range(5)])
+        self.assertEqual(packets(exported), [(0, 1), (1, 1)] + [(port, 1) for port in range(5)])
+        self.assertEqual(limiter.collect()['noisy_suppressed'], 3)
+        
+        exported = limiter.limit([record(port, 1) for port in range(10, 20)])
+        self.assertEqual(len(exported), 3)
+        self.assertEqual(limiter.collect()['held'], 10)
+        
+    def test_flush(self):
+        limiter = RecordLimiter(flow_rate=1.0, flow_burst=1, clock=self.clock)
+        limiter.limit([record(1, 1), record(1, 2), record(2, 1), record(2, 2)])
+        self.assertEqual(packets(limiter.flush()), [(1, 2), (2, 2)])
+        self.assertEqual((limiter.held, limiter.flows), ({}, {}))
+
+if __name__ == '__main__':
+    unittest.main()
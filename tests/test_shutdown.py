@@ -0,0 +1,74 @@
+"""
+Shutdown drain tests: every engine exports a final record per active flow
+when flushed, and worker processes finish their rings and flush their flows
+before they exit.
+"""
+
+import struct
+import unittest
+
+from src.dpdk.burst import PacketBurst
+from src.features.plugins import FLOW_END_NONE, FLOW_END_SHUTDOWN
+from src.pipeline.runtime_config import RuntimeConfig
+from src.pipeline.workers import WorkerPool, create_extractor
+
+FLOWS = 40
+
+def udp_frame(src_port):
+    ip = struct.pack('!BBHHHBBH4s4s', 0x45, 0, 36, 0, 0, 64, 17, 0, bytes([10, 0, 0, 1]), bytes([10, 0, 0, 2]))
+    return b'\x02' * 6 + b'\x04' * 6 + b'\x08\x00' + ip + struct.pack('!HHHH', src_port, 53, 16, 0) + b'x' * 8
+
+def bursts(count=3):
+    """count bursts each carrying one packet of every flow; flow i is source port 1000 + i."""
+    return [PacketBurst.from_packets([{'data': udp_frame(1000 + flow), 'length': 50,
+                                       'timestamp_ns': 1000000000 + (n * FLOWS + flow) * 1000}
+                                      for flow in range(FLOWS)]) for n in range(count)]
+
+def final_packets(records):
+    """Packets counted by each flow's final record, by source port."""
+    return {features['src_port']: features['total_fwd_packets'] for features in records
+            if features['end_reason'] == FLOW_END_SHUTDOWN}
+
+class FlushFlowsTest(unittest.TestCase):
+    def check_engine(self, engine):
+        extractor = create_extractor(engine, 600.0)
+        if engine == 'native' and not extractor.initialize():
+            self.skipTest("native library not built, run 'make'")
+        try:
+            for burst in bursts():
+                extractor.extract_burst(burst)
+            self.assertEqual(extractor.flow_count(), FLOWS)
+            
+            records = list(extractor.flush_flows())
+            self.assertEqual(len(records), FLOWS)
+            self.assertEqual(final_packets(records), {1000 + flow: 3 for flow in range(FLOWS)})
+            self.assertEqual(extractor.flow_count(), 0)
+            self.assertEqual(len(extractor.flush_flows()), 0)
+        finally:
+            if engine == 'native':
+                extractor.cleanup()
+                
+    def test_python(self):
+        self.check_engine('python')
+        
+    def test_numpy(self):
+        self.check_engine('numpy')
+        
+    def test_native(self):
+        self.check_engine('native')
+
+class WorkerDrainTest(unittest.TestCase):
+    def test_stop_drains_rings_and_flushes(self):
+        """Bursts still queued when the pool stops are processed, then every flow gets its final record."""
+        pool = WorkerPool(1, ring_size=1 << 20, engine='numpy')
+        self.assertTrue(pool.start(RuntimeConfig(flow_timeout=600.0)))
+        for burst in bursts():
+            self.assertTrue(pool.submit(0, burst))
+            
+        records = list(pool.stop(timeout=30.0))
+        self.assertEqual(sum(features['end_reason'] == FLOW_END_NONE for features in records), 3 * FLOWS)
+        self.assertEqual(final_packets(records), {1000 + flow: 3 for flow in range(FLOWS)})
+        self.assertEqual(pool.processes, [])
+
+if __name__ == '__main__':
+    unittest.main()
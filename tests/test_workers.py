@@ -0,0 +1,79 @@
+"""
+Shared-memory ring tests: messages wrapping around the end of the buffer,
+and drops when the ring is full.
+"""
+
+import random
+import unittest
+
+from src.pipeline.workers import RECORD_HEADER, ShmRing
+
+def message_size(payload):
+    return (RECORD_HEADER.size + len(payload) + 7) & ~7
+
+class ShmRingTest(unittest.TestCase):
+    def setUp(self):
+        self.ring = ShmRing(1024)
+        self.consumer = ShmRing(name=self.ring.name)
+        
+    def tearDown(self):
+        self.consumer.close()
+        self.ring.close()
+        
+    def test_wraparound(self):
+        """Messages of every size cross the end of the buffer intact and in order."""
+        rng = random.Random(3)
+        pending = []
+        sent = rejected = 0
+        for _ in range(2000):
+            if pending and (rng.random() < 0.5 or len(pending) > 6):
+                self.assertEqual(self.consumer.get(), pending.pop(0))
+                continue
+            payload = bytes(rng.randrange(256) for _ in range(rng.randrange(1, 300)))
+            if self.ring.put(payload):
+                pending.append(payload)
+                sent += message_size(payload)
+            else:
+                rejected += 1
+        for payload in pending:
+            self.assertEqual(self.consumer.get(), payload)
+        self.assertIsNone(self.consumer.get())
+        self.assertEqual(self.ring.used(), 0)
+        self.assertEqual(self.ring.dropped(), rejected)
+        self.assertGreater(sent, 50 * self.ring.size)
+        
+    def test_wrap_skips_short_end(self):
+        """A message that does not fit before the end starts over at the front."""
+        first = b'a' * 500
+        self.assertTrue(self.ring.put(first))
+        self.assertTrue(self.ring.put(b'b' * 400))
+        self.assertEqual(self.consumer.get(), first)
+        # 112 bytes remain before the end: too short, so the message wraps
+        self.assertTrue(self.ring.put(b'c' * 200))
+        self.assertEqual(self.ring.used(), message_size(b'b' * 400) + 1024 - 912 + message_size(b'c' * 200))
+        self.assertEqual(self.consumer.get(), b'b' * 400)
+        self.assertEqual(self.consumer.get(), b'c' * 200)
+        self.assertEqual(self.ring.used(), 0)
+        
+    def test_full_ring_drops(self):
+        payload = b'x' * 120
+        accepted = 0
+        while self.ring.put(payload):
+            accepted += 1
+        self.assertEqual(accepted, 1024 // message_size(payload))
+        self.assertFalse(self.ring.put(b'y'))
+        self.assertEqual(self.consumer.dropped(), 2)
+        
+        # Room freed by the consumer is reused; the drops stay counted
+        self.assertEqual(self.consumer.get(), payload)
+        self.assertTrue(self.ring.put(payload))
+        self.assertEqual(self.ring.dropped(), 2)
+        
+    def test_oversized_message_dropped(self):
+        self.assertFalse(self.ring.put(b'z' * 1024))
+        self.assertEqual(self.ring.dropped(), 1)
+        self.assertTrue(self.ring.put(b'z' * (1024 - RECORD_HEADER.size)))
+        self.assertEqual(self.consumer.get(), b'z' * (1024 - RECORD_HEADER.size))
+
+if __name__ == '__main__':
+    unittest.main()